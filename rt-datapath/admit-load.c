@@ -0,0 +1,309 @@
+/*
+ * Load generator for admitd.
+ *
+ * Every thread opens its own connection and sends batches of admit and
+ * estimate requests for random queries, releasing the oldest of its
+ * admitted ones as it goes so that the daemon holds a steady number of
+ * reservations. Reports decisions/s and the batch round trip.
+ */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admit.h"
+#include "hist.h"
+#include "rng.h"
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long long decisions, accepted, rejected, soft, errors;
+	unsigned long long never;	/* rejects no deadline would save */
+	double asked, earliest, best_effort;	/* sums over the rest, secs */
+	struct hist rtt;	/* usecs per batch */
+};
+
+static const char *path = ADMIT_SOCKET;
+static long long num_decisions = 1000000;
+static int batch = 64, num_tables = 2, max_held = 1024;
+static long long max_blocks = 10000;
+static double max_deadline = 300, estimates, soft;
+static uint64_t seed;
+static int num_threads = 1;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void random_query(struct admit_req *req, struct rng *rng)
+{
+	int r = rng_range(rng, 10);
+
+	req->op = rng_double(rng) < estimates ? ADMIT_OP_ESTIMATE : ADMIT_OP_ADMIT;
+	/* mostly let the daemon pick, some scans and an occasional join */
+	req->kind = r < 7 ? ADMIT_AUTO : r < 9 ? ADMIT_SCAN : ADMIT_JOIN;
+	req->table = rng_range(rng, num_tables);
+	req->build_table = rng_range(rng, num_tables);
+	req->blocks = 1 + rng_range(rng, max_blocks);
+	req->deadline_ms = 1 + rng_range(rng, max_deadline * 1000);
+	if (rng_double(rng) < soft)
+		req->flags = ADMIT_F_SOFT;
+}
+
+static void *run(void *arg)
+{
+	struct worker *w = arg;
+	size_t len = sizeof(struct admit_hdr) + batch * sizeof(struct admit_req);
+	size_t rlen = sizeof(struct admit_hdr) + batch * sizeof(struct admit_resp);
+	struct admit_hdr *h = malloc(len), *rh = malloc(rlen);
+	struct admit_req *req = (struct admit_req *)(h + 1);
+	struct admit_resp *resp = (struct admit_resp *)(rh + 1);
+	uint64_t *held = malloc(max_held * sizeof(*held));
+	long long todo = num_decisions / num_threads;
+	/* unique across the clients of one daemon */
+	uint64_t next_id = (uint64_t)getpid() << 40 | (uint64_t)w->id << 32;
+	int head = 0, num_held = 0, admits, fd, i, n;
+	struct rng rng;
+	double start;
+	ssize_t got;
+
+	if (!h || !rh || !held) {
+		perror("malloc");
+		exit(1);
+	}
+
+	fd = connect_to(path);
+	if (fd < 0)
+		exit(1);
+	rng_seed(&rng, seed + w->id);
+	hist_init(&w->rtt);
+
+	h->magic = ADMIT_MAGIC;
+	h->version = ADMIT_VERSION;
+
+	while (todo > 0) {
+		memset(req, 0, batch * sizeof(*req));
+		for (n = 0, admits = 0; n < batch; n++) {
+			/*
+			 * keep at most max_held, counting the admits in flight:
+			 * the oldest goes first
+			 */
+			if (num_held + admits >= max_held) {
+				if (!num_held)
+					break;
+				req[n].op = ADMIT_OP_RELEASE;
+				req[n].id = held[head];
+				head = (head + 1) % max_held;
+				num_held--;
+				continue;
+			}
+			if (!todo)
+				break;
+			admits++;
+			random_query(&req[n], &rng);
+			req[n].id = next_id++;
+			todo--;
+		}
+		h->count = n;
+
+		start = now_sec();
+		if (send(fd, h, sizeof(*h) + n * sizeof(*req), 0) < 0) {
+			perror("send");
+			exit(1);
+		}
+		got = recv(fd, rh, rlen, 0);
+		if (got != (ssize_t)(sizeof(*rh) + n * sizeof(*resp)) ||
+				rh->magic != ADMIT_MAGIC || rh->count != n) {
+			fprintf(stderr, "bad reply from admitd\n");
+			exit(1);
+		}
+		hist_add(&w->rtt, (now_sec() - start) * 1e6);
+
+		for (i = 0; i < n; i++) {
+			if (req[i].op == ADMIT_OP_RELEASE)
+				continue;	/* may have expired by now */
+			w->decisions++;
+			switch (resp[i].status) {
+			case ADMIT_ACCEPT:
+				w->accepted++;
+				if (req[i].op == ADMIT_OP_ADMIT) {
+					held[(head + num_held) % max_held] = req[i].id;
+					num_held++;
+				}
+				break;
+			case ADMIT_SOFT:
+			case ADMIT_REJECT:
+				if (resp[i].status == ADMIT_SOFT)
+					w->soft++;
+				else
+					w->rejected++;
+				if (!resp[i].earliest_ms) {
+					w->never++;
+					break;
+				}
+				w->asked += req[i].deadline_ms / 1000.0;
+				w->earliest += resp[i].earliest_ms / 1000.0;
+				w->best_effort += resp[i].latency;
+				break;
+			default:
+				w->errors++;
+			}
+		}
+	}
+
+	close(fd);
+	free(h);
+	free(rh);
+	free(held);
+	return NULL;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: [-u <socket>] [-n <decisions>] [-B <batch>] [-j <threads>]\n"
+			"       [-T <tables>] [-b <max index blocks>] [-D <max deadline secs>]\n"
+			"       [-e <estimate fraction>] [-s <soft fraction>]\n"
+			"       [-h <max held per thread>] [-S <seed>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned long long decisions = 0, accepted = 0, rejected = 0, soft_n = 0;
+	unsigned long long errors = 0, never = 0, told;
+	double asked = 0, earliest = 0, best_effort = 0;
+	struct hist rtt;
+	double start, secs;
+	int i;
+	char c;
+
+	while ((c = getopt(argc, argv, "u:n:B:j:T:b:D:e:s:h:S:")) != -1) {
+		switch (c) {
+		case 'u':
+			path = optarg;
+			break;
+		case 'n':
+			num_decisions = atoll(optarg);
+			break;
+		case 'B':
+			batch = atoi(optarg);
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'T':
+			num_tables = atoi(optarg);
+			break;
+		case 'b':
+			max_blocks = atoll(optarg);
+			break;
+		case 'D':
+			max_deadline = atof(optarg);
+			break;
+		case 'e':
+			estimates = atof(optarg);
+			break;
+		case 's':
+			soft = atof(optarg);
+			break;
+		case 'h':
+			max_held = atoi(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (batch < 1 || batch > ADMIT_MAX_BATCH || num_threads < 1 ||
+			num_tables < 1 || num_tables > ADMIT_MAX_TABLES ||
+			max_blocks < 1 || max_deadline <= 0 || max_held < 1 ||
+			num_decisions < num_threads) {
+		usage();
+		exit(1);
+	}
+
+	workers = calloc(num_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	start = now_sec();
+	for (i = 0; i < num_threads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, run, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	hist_init(&rtt);
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		decisions += workers[i].decisions;
+		accepted += workers[i].accepted;
+		rejected += workers[i].rejected;
+		soft_n += workers[i].soft;
+		never += workers[i].never;
+		asked += workers[i].asked;
+		earliest += workers[i].earliest;
+		best_effort += workers[i].best_effort;
+		errors += workers[i].errors;
+		hist_merge(&rtt, &workers[i].rtt);
+	}
+	secs = now_sec() - start;
+
+	printf("%llu decisions in %.2f s: %.0f decisions/s; "
+			"accept %.1f%%, reject %.1f%%, soft %.1f%%, error %.1f%%\n",
+			decisions, secs, decisions / secs,
+			100.0 * accepted / decisions, 100.0 * rejected / decisions,
+			100.0 * soft_n / decisions, 100.0 * errors / decisions);
+	told = rejected + soft_n - never;
+	if (told)
+		printf("rejects: asked %.2f s, guaranteed from %.2f s, "
+				"best-effort %.2f s (avg); %llu with no deadline\n",
+				asked / told, earliest / told, best_effort / told, never);
+	printf("batch of %d rtt us: avg %.1f p50 %llu p99 %llu max %llu\n",
+			batch, hist_mean(&rtt),
+			(unsigned long long)hist_pct(&rtt, 0.5),
+			(unsigned long long)hist_pct(&rtt, 0.99), rtt.max);
+
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ * Reservation state and admission test of the admission service (admit.h).
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "admit.h"
+
+static double iops_S(const struct admit *a, int n)
+{
+	return 1.0 / pmodel_t_S(a->pm, 1, n);
+}
+
+static double iops_idx(const struct admit *a, int n, int scanning)
+{
+	return 1.0 / (scanning ? pmodel_t_Is(a->pm, 1, n) : pmodel_t_I(a->pm, 1, n));
+}
+
+int admit_init(struct admit *a, const struct pmodel *pm, int num_tables,
+		long long table_blocks, double headroom, int capacity)
+{
+	int i, size;
+
+	memset(a, 0, sizeof(*a));
+	a->pm = pm;
+	a->num_tables = num_tables;
+	a->table_blocks = table_blocks;
+	a->headroom = headroom;
+	a->capacity = capacity;
+
+	for (size = 1; size < 2 * capacity; size <<= 1)
+		;
+	a->hash_mask = size - 1;
+
+	a->resv = malloc(capacity * sizeof(*a->resv));
+	a->hash = malloc(size * sizeof(*a->hash));
+	a->heap = malloc(capacity * sizeof(*a->heap));
+	a->prev = malloc(2 * capacity * sizeof(*a->prev));
+	a->next = malloc(2 * capacity * sizeof(*a->next));
+	if (!a->resv || !a->hash || !a->heap || !a->prev || !a->next) {
+		admit_free(a);
+		return -1;
+	}
+
+	memset(a->hash, 0xff, size * sizeof(*a->hash));
+	for (i = 0; i < capacity; i++) {
+		a->resv[i].hnext = i + 1 < capacity ? i + 1 : -1;
+		a->resv[i].heap_pos = -1;
+	}
+	a->free = 0;
+
+	for (i = 0; i < ADMIT_MAX_TABLES; i++)
+		a->tables[i].head = -1;
+	a->index.head = -1;
+
+	return 0;
+}
+
+void admit_free(struct admit *a)
+{
+	free(a->resv);
+	free(a->hash);
+	free(a->heap);
+	free(a->prev);
+	free(a->next);
+	memset(a, 0, sizeof(*a));
+}
+
+static unsigned hash_id(const struct admit *a, uint64_t id)
+{
+	return (id * 0x9e3779b97f4a7c15ULL) >> 32 & a->hash_mask;
+}
+
+static int lookup(const struct admit *a, uint64_t id)
+{
+	int i = a->hash[hash_id(a, id)];
+
+	while (i >= 0 && a->resv[i].id != id)
+		i = a->resv[i].hnext;
+	return i;
+}
+
+/*
+ * Expiry heap
+ */
+static int earlier(const struct admit *a, int i, int j)
+{
+	return a->resv[a->heap[i]].expires < a->resv[a->heap[j]].expires;
+}
+
+static void heap_swap(struct admit *a, int i, int j)
+{
+	int t = a->heap[i];
+
+	a->heap[i] = a->heap[j];
+	a->heap[j] = t;
+	a->resv[a->heap[i]].heap_pos = i;
+	a->resv[a->heap[j]].heap_pos = j;
+}
+
+static void sift(struct admit *a, int i)
+{
+	int c;
+
+	while (i > 0 && earlier(a, i, (i - 1) / 2)) {
+		heap_swap(a, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	while ((c = 2 * i + 1) < a->num_heap) {
+		if (c + 1 < a->num_heap && earlier(a, c + 1, c))
+			c++;
+		if (!earlier(a, c, i))
+			break;
+		heap_swap(a, i, c);
+		i = c;
+	}
+}
+
+static void heap_remove(struct admit *a, int slot)
+{
+	int i = a->resv[slot].heap_pos;
+
+	a->num_heap--;
+	if (i != a->num_heap) {
+		heap_swap(a, i, a->num_heap);
+		sift(a, i);
+	}
+	a->resv[slot].heap_pos = -1;
+}
+
+/*
+ * Lists of reservations
+ */
+static struct admit_list *list_of(struct admit *a, int slot, int link)
+{
+	struct admit_resv *r = &a->resv[slot];
+
+	if (r->kind == ADMIT_INDEX)
+		return &a->index;
+	return &a->tables[link ? r->build_table : r->table];
+}
+
+static int links(const struct admit_resv *r)
+{
+	return r->kind == ADMIT_JOIN && r->build_table != r->table ? 2 : 1;
+}
+
+/* the tables' B_T add up to sum_B; keep it in step with a list's max */
+static void set_max(struct admit *a, struct admit_list *l, double max)
+{
+	if (l != &a->index)
+		a->sum_B += max - l->max;
+	l->max = max;
+}
+
+static void list_add(struct admit *a, int slot, int link)
+{
+	struct admit_list *l = list_of(a, slot, link);
+	int node = 2 * slot + link;
+	double rate = a->resv[slot].rate;
+
+	a->prev[node] = -1;
+	a->next[node] = l->head;
+	if (l->head >= 0)
+		a->prev[l->head] = node;
+	l->head = node;
+	if (!l->n++ && l != &a->index)
+		a->scanned++;
+	if (rate > l->max)
+		set_max(a, l, rate);
+}
+
+static void list_del(struct admit *a, int slot, int link)
+{
+	struct admit_list *l = list_of(a, slot, link);
+	int node = 2 * slot + link, i;
+	double max = 0;
+
+	if (a->prev[node] >= 0)
+		a->next[a->prev[node]] = a->next[node];
+	else
+		l->head = a->next[node];
+	if (a->next[node] >= 0)
+		a->prev[a->next[node]] = a->prev[node];
+	if (!--l->n && l != &a->index)
+		a->scanned--;
+
+	/* the largest reservation went: find the next */
+	if (a->resv[slot].rate >= l->max) {
+		for (i = l->head; i >= 0; i = a->next[i])
+			if (a->resv[i / 2].rate > max)
+				max = a->resv[i / 2].rate;
+		set_max(a, l, max);
+	}
+
+	/* no rounding left over once nothing is scanned */
+	if (!a->scanned)
+		a->sum_B = 0;
+}
+
+static void release(struct admit *a, int slot)
+{
+	struct admit_resv *r = &a->resv[slot];
+	int *link = &a->hash[hash_id(a, r->id)];
+	int i;
+
+	for (i = 0; i < links(r); i++)
+		list_del(a, slot, i);
+	heap_remove(a, slot);
+
+	while (*link != slot)
+		link = &a->resv[*link].hnext;
+	*link = r->hnext;
+	r->hnext = a->free;
+	a->free = slot;
+}
+
+void admit_expire(struct admit *a, double now)
+{
+	while (a->num_heap && a->resv[a->heap[0]].expires <= now) {
+		release(a, a->heap[0]);
+		a->expired++;
+	}
+}
+
+/*
+ * The reservation test for a query of one kind, and its predicted
+ * latency at the operating point it leaves. Returns 1 if it fits.
+ */
+static int fits(struct admit *a, const struct admit_req *req, int kind,
+		double L, double *rate, double *latency)
+{
+	double cap = 1 - a->headroom, sum = a->sum_B, worst = a->index.max, B;
+	int n = a->index.n, m = a->scanned, t[2], k, i;
+
+	if (kind == ADMIT_INDEX) {
+		*rate = req->blocks / L;
+		n++;
+		if (*rate > worst)
+			worst = *rate;
+		*latency = req->blocks / iops_idx(a, n, m > 0);
+	} else {
+		t[0] = req->table;
+		t[1] = req->build_table;
+		k = kind == ADMIT_JOIN && t[1] != t[0] ? 2 : 1;
+		*rate = (kind == ADMIT_JOIN ? 2 : 1) * a->table_blocks / L;
+		for (i = 0; i < k; i++) {
+			B = a->tables[t[i]].max;
+			if (*rate > B)
+				sum += *rate - B;
+			m += !a->tables[t[i]].n;
+		}
+		/* a pass over each table, sharing the device with the others */
+		*latency = (kind == ADMIT_JOIN ? 2 : 1) * a->table_blocks * m /
+			iops_S(a, n);
+	}
+
+	if (sum > cap * iops_S(a, n))
+		return 0;
+	return !n || worst <= cap * iops_idx(a, n, m > 0);
+}
+
+/* as dpsim: where the query would finish fastest at the current point */
+static int cheaper_kind(struct admit *a, const struct admit_req *req)
+{
+	int n = a->index.n, m = a->scanned + !a->tables[req->table].n;
+	double t_scan = a->table_blocks * m / iops_S(a, n);
+	double t_idx = req->blocks / iops_idx(a, n + 1, a->scanned > 0);
+
+	return t_idx < t_scan ? ADMIT_INDEX : ADMIT_SCAN;
+}
+
+/*
+ * The earliest deadline, in ms, at which a query of this kind passes the
+ * reservation test now, or 0 if none does. The test only gets easier as
+ * the deadline grows, so double it until it passes and bisect back down
+ * to the millisecond: some 60 tests at most.
+ */
+static uint32_t earliest(struct admit *a, const struct admit_req *req, int kind)
+{
+	double lo = req->deadline_ms / 1000.0, hi = lo, mid, rate, latency;
+
+	while (!fits(a, req, kind, hi, &rate, &latency)) {
+		if (hi >= ADMIT_MAX_DEADLINE)
+			return 0;
+		lo = hi;
+		hi = fmin(2 * hi, ADMIT_MAX_DEADLINE);
+	}
+	while (hi - lo > 0.001) {
+		mid = (lo + hi) / 2;
+		if (fits(a, req, kind, mid, &rate, &latency))
+			hi = mid;
+		else
+			lo = mid;
+	}
+	return ceil(hi * 1000);
+}
+
+/*
+ * Expected latency without a reservation. The reserved scans keep their
+ * B_T; what the device has left over at the new operating point is shared
+ * evenly among the scanned tables, and a scan of an already scanned table
+ * rides along with it. An index scan is one more stream of the model.
+ */
+static double best_effort(struct admit *a, const struct admit_req *req,
+		int kind)
+{
+	int n = a->index.n, m = a->scanned, t[2], k, i;
+	double spare, rate, latency = 0;
+
+	if (kind == ADMIT_INDEX)
+		return req->blocks / iops_idx(a, n + 1, m > 0);
+
+	t[0] = req->table;
+	t[1] = req->build_table;
+	k = kind == ADMIT_JOIN ? 2 : 1;
+	m += !a->tables[t[0]].n + (k == 2 && t[1] != t[0] && !a->tables[t[1]].n);
+
+	spare = iops_S(a, n) - a->sum_B;
+	if (spare < 0)
+		spare = 0;
+	for (i = 0; i < k; i++) {
+		rate = a->tables[t[i]].max + spare / m;
+		if (rate <= 0)
+			return PMODEL_INF;
+		latency += a->table_blocks / rate;
+	}
+	return latency;
+}
+
+static int reserve(struct admit *a, const struct admit_req *req, int kind,
+		double rate, double expires)
+{
+	struct admit_resv *r;
+	unsigned h;
+	int slot = a->free, i;
+
+	if (slot < 0)
+		return -1;
+	r = &a->resv[slot];
+	a->free = r->hnext;
+
+	r->id = req->id;
+	r->rate = rate;
+	r->expires = expires;
+	r->kind = kind;
+	r->table = req->table;
+	r->build_table = req->build_table;
+
+	h = hash_id(a, r->id);
+	r->hnext = a->hash[h];
+	a->hash[h] = slot;
+
+	for (i = 0; i < links(r); i++)
+		list_add(a, slot, i);
+
+	r->heap_pos = a->num_heap;
+	a->heap[a->num_heap++] = slot;
+	sift(a, r->heap_pos);
+	return 0;
+}
+
+static int valid(const struct admit *a, const struct admit_req *req)
+{
+	if (req->op == ADMIT_OP_RELEASE)
+		return 1;
+	if (req->op != ADMIT_OP_ADMIT && req->op != ADMIT_OP_ESTIMATE)
+		return 0;
+	if (req->kind > ADMIT_JOIN || !req->deadline_ms ||
+			req->table >= a->num_tables ||
+			(req->kind == ADMIT_JOIN && req->build_table >= a->num_tables))
+		return 0;
+	return req->blocks || req->kind == ADMIT_SCAN || req->kind == ADMIT_JOIN;
+}
+
+void admit_handle(struct admit *a, const struct admit_req *req,
+		struct admit_resp *resp, double now)
+{
+	double L = req->deadline_ms / 1000.0, rate, latency = 0;
+	int kind = req->kind, ok, slot, other, full = 0;
+	uint32_t ms;
+
+	memset(resp, 0, sizeof(*resp));
+	resp->id = req->id;
+
+	if (!valid(a, req))
+		goto error;
+
+	if (req->op == ADMIT_OP_RELEASE) {
+		slot = lookup(a, req->id);
+		if (slot < 0)
+			goto error;
+		resp->kind = a->resv[slot].kind;
+		release(a, slot);
+		a->released++;
+		return;
+	}
+
+	/* ids are unique among the held reservations */
+	if (req->op == ADMIT_OP_ADMIT && lookup(a, req->id) >= 0)
+		goto error;
+
+	a->decisions++;
+	if (kind == ADMIT_AUTO) {
+		kind = cheaper_kind(a, req);
+		ok = fits(a, req, kind, L, &rate, &latency);
+		if (!ok) {
+			kind = kind == ADMIT_SCAN ? ADMIT_INDEX : ADMIT_SCAN;
+			ok = fits(a, req, kind, L, &rate, &latency);
+		}
+	} else
+		ok = fits(a, req, kind, L, &rate, &latency);
+
+	if (ok && req->op == ADMIT_OP_ADMIT &&
+			reserve(a, req, kind, rate, now + L)) {
+		/* out of reservation slots */
+		ok = 0;
+		full = 1;
+	}
+
+	if (ok) {
+		resp->status = ADMIT_ACCEPT;
+		resp->kind = kind;
+		resp->latency = latency;
+		a->accepted++;
+		return;
+	}
+
+	/*
+	 * What it could have instead: for AUTO, the kind with the earlier.
+	 * With no slots left no deadline would do.
+	 */
+	if (!full)
+		resp->earliest_ms = earliest(a, req, kind);
+	if (req->kind == ADMIT_AUTO && !full) {
+		other = kind == ADMIT_SCAN ? ADMIT_INDEX : ADMIT_SCAN;
+		ms = earliest(a, req, other);
+		if (ms && (!resp->earliest_ms || ms < resp->earliest_ms)) {
+			resp->earliest_ms = ms;
+			kind = other;
+		}
+	}
+	resp->kind = kind;
+	resp->latency = best_effort(a, req, kind);
+
+	if (req->flags & ADMIT_F_SOFT) {
+		resp->status = ADMIT_SOFT;
+		a->soft++;
+	} else {
+		resp->status = ADMIT_REJECT;
+		a->rejected++;
+	}
+	return;
+
+error:
+	resp->status = ADMIT_ERROR;
+	a->errors++;
+}
@@ -0,0 +1,150 @@
+#ifndef ADMIT_H
+#define ADMIT_H
+
+#include <stdint.h>
+
+#include "pmodel.h"
+
+/*
+ * Admission control service (admitd).
+ *
+ * The daemon owns the performance model and the reservations of every
+ * admitted query, and decides on new ones with the reservation test of
+ * dpsim's "reserve" policy: every scanned table needs B_T = max |T|/L of
+ * the queries attached to it, every index scan |Q|/L, and together they
+ * must fit the model's operating point. Reservations end when released
+ * or when their deadline passes.
+ *
+ * A rejected query is not left with a bare no: the reply says the earliest
+ * deadline it could be guaranteed and the latency to expect best-effort,
+ * and with ADMIT_F_SOFT it is taken on those terms (no reservation).
+ *
+ * Protocol: SOCK_SEQPACKET on a Unix socket, one message per batch. A
+ * request message is an admit_hdr followed by count admit_reqs; the reply
+ * is an admit_hdr followed by one admit_resp per request, in order.
+ * Fields are in host byte order; the socket is local.
+ */
+#define ADMIT_MAGIC (0x54444d41)	/* "ADMT" */
+#define ADMIT_VERSION 2
+#define ADMIT_MAX_BATCH 1024
+#define ADMIT_SOCKET "/tmp/admitd.sock"
+#define ADMIT_MAX_DEADLINE (UINT32_MAX / 1000.0)	/* seconds */
+
+/* ops */
+#define ADMIT_OP_ADMIT 1
+#define ADMIT_OP_RELEASE 2
+#define ADMIT_OP_ESTIMATE 3	/* decide, but reserve nothing */
+
+/* kinds of query, and how an admitted one is served */
+#define ADMIT_AUTO 0		/* by whichever of scan and index fits */
+#define ADMIT_SCAN 1
+#define ADMIT_INDEX 2
+#define ADMIT_JOIN 3		/* scans of table and build_table */
+
+/* status */
+#define ADMIT_ACCEPT 0
+#define ADMIT_REJECT 1
+#define ADMIT_ERROR 2		/* malformed, or release of an unknown id */
+#define ADMIT_SOFT 3		/* rejected, taken best-effort (ADMIT_F_SOFT) */
+
+/* request flags */
+#define ADMIT_F_SOFT 1		/* if rejected, run best-effort instead */
+
+struct admit_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+};
+
+struct admit_req {
+	uint64_t id;		/* chosen by the client, unique while held */
+	uint64_t blocks;	/* read by an index scan */
+	uint32_t deadline_ms;	/* from now */
+	uint8_t op;
+	uint8_t kind;
+	uint16_t table;
+	uint16_t build_table;	/* joins */
+	uint8_t flags;
+	uint8_t pad[5];
+};
+
+/*
+ * An accepted query's latency is the one predicted at the operating point
+ * it leaves. A rejected (or soft) one is told the latency it can expect
+ * best-effort, in the bandwidth the reservations leave over, and the
+ * earliest deadline it would be guaranteed right now: none (0) when the
+ * daemon is out of reservation slots, whatever the deadline.
+ */
+struct admit_resp {
+	uint64_t id;
+	double latency;		/* seconds */
+	uint8_t status;
+	uint8_t kind;		/* how it is, or would best be, served */
+	uint16_t pad;
+	uint32_t earliest_ms;	/* rejects: 0 if no deadline would do */
+};
+
+/*
+ * Reservation state
+ */
+#define ADMIT_MAX_TABLES 64
+
+struct admit_resv {
+	uint64_t id;
+	double rate;		/* blocks/s reserved */
+	double expires;
+	int kind;		/* ADMIT_SCAN, ADMIT_INDEX or ADMIT_JOIN */
+	int table, build_table;
+	int hnext;		/* hash chain, or free list */
+	int heap_pos;		/* in the expiry heap, -1 when free */
+};
+
+/*
+ * A table's scans, or the index scans. A reservation is on one list, or
+ * on two for a join; member node 2 * slot + link stands for it on list
+ * 'link'.
+ */
+struct admit_list {
+	int head;		/* member node, -1 for none */
+	int n;
+	double max;		/* largest rate */
+};
+
+struct admit {
+	const struct pmodel *pm;
+	int num_tables;
+	long long table_blocks;
+	double headroom;
+
+	struct admit_resv *resv;
+	int capacity;
+	int free;
+	int *hash;
+	int hash_mask;
+	int *prev, *next;	/* by member node */
+
+	struct admit_list tables[ADMIT_MAX_TABLES];
+	struct admit_list index;
+	double sum_B;		/* sum of the tables' B_T */
+	int scanned;		/* tables with a reservation */
+
+	/* slots by expiry time */
+	int *heap;
+	int num_heap;
+
+	unsigned long long decisions, accepted, rejected, soft, released,
+		expired, errors;
+};
+
+int admit_init(struct admit *a, const struct pmodel *pm, int num_tables,
+		long long table_blocks, double headroom, int capacity);
+void admit_free(struct admit *a);
+
+/* end the reservations whose deadlines have passed by now (seconds) */
+void admit_expire(struct admit *a, double now);
+
+/* answer one request at time now */
+void admit_handle(struct admit *a, const struct admit_req *req,
+		struct admit_resp *resp, double now);
+
+#endif
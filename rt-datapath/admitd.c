@@ -0,0 +1,264 @@
+/*
+ * Admission control daemon.
+ *
+ * Holds the performance model and the reservations of the admitted
+ * queries (admit.c) and answers batches of admit, release and estimate
+ * requests from any number of local clients over a Unix socket, in the
+ * binary protocol of admit.h. Single threaded: batches are handled one at
+ * a time as epoll reports them, so decisions see each other in order.
+ *
+ * SIGINT or SIGTERM stop it; the counters go to stderr.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admit.h"
+
+#define MAX_EVENTS 64
+#define MAX_MSG (sizeof(struct admit_hdr) + \
+		ADMIT_MAX_BATCH * sizeof(struct admit_req))
+#define MAX_REPLY (sizeof(struct admit_hdr) + \
+		ADMIT_MAX_BATCH * sizeof(struct admit_resp))
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+			listen(fd, 128)) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Answer one batch. Returns -1 when the client is to be dropped.
+ */
+static int serve(struct admit *a, int fd, char *msg, char *reply)
+{
+	struct admit_hdr *h = (struct admit_hdr *)msg, *rh = (struct admit_hdr *)reply;
+	struct admit_req *req = (struct admit_req *)(h + 1);
+	struct admit_resp *resp = (struct admit_resp *)(rh + 1);
+	ssize_t len, out;
+	double now;
+	int i;
+
+	len = recv(fd, msg, MAX_MSG, 0);
+	if (len <= 0)
+		return -1;
+
+	if ((size_t)len < sizeof(*h) || h->magic != ADMIT_MAGIC ||
+			h->version != ADMIT_VERSION || h->count > ADMIT_MAX_BATCH ||
+			(size_t)len != sizeof(*h) + h->count * sizeof(*req)) {
+		fprintf(stderr, "admitd: malformed batch, dropping client\n");
+		return -1;
+	}
+
+	now = now_sec();
+	admit_expire(a, now);
+	for (i = 0; i < h->count; i++)
+		admit_handle(a, &req[i], &resp[i], now);
+
+	rh->magic = ADMIT_MAGIC;
+	rh->version = ADMIT_VERSION;
+	rh->count = h->count;
+	out = sizeof(*rh) + h->count * sizeof(*resp);
+
+	/* a client that does not read its replies is dropped, not waited for */
+	if (send(fd, reply, out, MSG_DONTWAIT | MSG_NOSIGNAL) != out)
+		return -1;
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -p <pmodel.dat|model.pmf> [-d <device>] [-u <socket>]\n"
+			"       [-T <tables>] [-L <table blocks>] [-H <headroom>]\n"
+			"       [-n <max reservations>]\n"
+			"  -d picks a device of a binary model (pmconv)\n"
+			"  socket defaults to " ADMIT_SOCKET "\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct pmodel pm;
+	struct admit a;
+	const char *path = ADMIT_SOCKET;
+	char *pmodel = NULL, *device = NULL, *msg, *reply;
+	int num_tables = 2, capacity = 1 << 20;
+	long long table_blocks = 262144;
+	double headroom = 0, start, secs;
+	int lfd, efd, n, i, fd, clients = 0;
+	unsigned long long batches = 0;
+	char c;
+
+	while ((c = getopt(argc, argv, "p:d:u:T:L:H:n:")) != -1) {
+		switch (c) {
+		case 'p':
+			pmodel = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'u':
+			path = optarg;
+			break;
+		case 'T':
+			num_tables = atoi(optarg);
+			break;
+		case 'L':
+			table_blocks = atoll(optarg);
+			break;
+		case 'H':
+			headroom = atof(optarg);
+			break;
+		case 'n':
+			capacity = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (!pmodel) {
+		usage();
+		exit(1);
+	}
+
+	if (num_tables < 1 || num_tables > ADMIT_MAX_TABLES || table_blocks < 1 ||
+			headroom < 0 || headroom >= 1 || capacity < 1) {
+		fprintf(stderr, "option out of range\n");
+		exit(1);
+	}
+
+	if (device ? pmodel_map(&pm, pmodel, device) : pmodel_load(&pm, pmodel))
+		exit(1);
+	if (admit_init(&a, &pm, num_tables, table_blocks, headroom, capacity)) {
+		perror("malloc");
+		exit(1);
+	}
+
+	msg = malloc(MAX_MSG);
+	reply = malloc(MAX_REPLY);
+	if (!msg || !reply) {
+		perror("malloc");
+		exit(1);
+	}
+
+	lfd = listen_on(path);
+	if (lfd < 0)
+		exit(1);
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.fd = lfd;
+	if (efd < 0 || epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev)) {
+		perror("epoll");
+		exit(1);
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "admitd: listening on %s, %d tables of %lld blocks\n",
+			path, num_tables, table_blocks);
+	start = now_sec();
+
+	while (!stop) {
+		n = epoll_wait(efd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
+
+			if (fd == lfd) {
+				fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+				if (fd < 0)
+					continue;
+				ev.events = EPOLLIN;
+				ev.data.fd = fd;
+				if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev)) {
+					close(fd);
+					continue;
+				}
+				clients++;
+				continue;
+			}
+
+			if (serve(&a, fd, msg, reply)) {
+				epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+				close(fd);
+				clients--;
+				continue;
+			}
+			batches++;
+		}
+	}
+
+	secs = now_sec() - start;
+	fprintf(stderr, "admitd: %llu decisions in %llu batches (%.0f/s over %.1f s): "
+			"%llu accepted, %llu rejected, %llu soft; %llu released, "
+			"%llu expired, %llu errors; %d held\n", a.decisions, batches,
+			secs > 0 ? a.decisions / secs : 0, secs, a.accepted, a.rejected,
+			a.soft, a.released, a.expired, a.errors, a.num_heap);
+
+	close(lfd);
+	unlink(path);
+	admit_free(&a);
+	pmodel_free(&pm);
+	return 0;
+}
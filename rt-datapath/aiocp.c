@@ -14,241 +14,466 @@
  *   You should have received a copy of the GNU General Public License
  *   along with this program;  if not, write to the Free Software
  *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
- *
- * Module: .c
  */
 
 /*
  * Change History:
  *
- *
  * version of copy command using async i/o
  * From:	Stephen Hemminger <shemminger@osdl.org>
  * Modified by Daniel McNeil <daniel@osdl.org> for testing aio.
  *	- added -a alignment
- *	- added -b blksize option 
+ *	- added -b blksize option
  *	_ added -s size	option
  *	- added -f open_flag option
  *	- added -w (no write) option (reads from source only)
- *	- added -n (num aio) option 
+ *	- added -n (num aio) option
  *	- added -z (zero dest) opton (writes zeros to dest only)
  *	- added -D delay_ms option
  *  - 2/2004  Marty Ridgeway (mridge@us.ibm.com) Changes to adapt to LTP
+ *  - bulk loader for the warehouse nodes: pipelines, io engines,
+ *    copy_file_range and a bandwidth cap
+ */
+
+/*
+ * Bulk copy, for loading relations onto the warehouse nodes.
  *
- * Copy file by using a async I/O state machine.
- * 1. Start read request
- * 2. When read completes turn it into a write request
- * 3. When write completes decrement counter and free resources
+ *	aiocp [options] src dst
+ *	aiocp [options] src... dir
  *
+ * Each file is cut into -j pipelines of consecutive chunks, copied side by
+ * side so the source and destination disks both see enough I/O at once.
+ * How a pipeline moves its chunks depends on the engine:
  *
- * Usage: aiocp [-b blksize] -n [num_aio] [-w] [-z] [-s filesize] 
- *		[-f DIRECT|TRUNC|CREAT|SYNC|LARGEFILE] src dest
+ *  - cfr (default): a thread per pipeline calling copy_file_range(2), so
+ *    the data never comes up to user space, and file systems that can
+ *    share extents do no I/O at all. Where the files cannot take it
+ *    (across file systems on old kernels, some devices) the pipeline falls
+ *    back to pread/pwrite of the same chunks.
+ *
+ *  - any io engine (ioengine.h: aio, uring, uring:buffered): one thread
+ *    keeps -n chunks of every pipeline in flight. A chunk is read, then
+ *    written from the same buffer, then reads the pipeline's next chunk;
+ *    whatever became ready in a pass goes down in one submit.
+ *
+ * With -B the reads are held to a bandwidth cap shared by all pipelines
+ * and files, so a load can run next to queries. -w only reads.
  */
-
 #define _GNU_SOURCE
-//#define DEBUG 1
-
-#include <unistd.h>
-#include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/param.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
-
-#include <libaio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-#define AIO_BLKSIZE	(64*1024)
-#define AIO_MAXIO	32
+#include "ioengine.h"
 
-static int aio_blksize = AIO_BLKSIZE;
-static int aio_maxio = AIO_MAXIO;
+#define DEFAULT_ENGINE "cfr"
+#define DEFAULT_CHUNK (1 << 20)
+#define DEFAULT_DEPTH 4
+#define DEFAULT_PIPELINES 4
 
-static int busy = 0;		// # of I/O's in flight
-static int tocopy = 0;		// # of blocks left to copy
-static int srcfd;		// source fd
-static int dstfd = -1;		// destination file descriptor
-static const char *dstname = NULL;
-static const char *srcname = NULL;
-static int source_open_flag = O_RDONLY;	/* open flags on source file */
-static int dest_open_flag = O_WRONLY;	/* open flags on dest file */
-static int no_write;			/* do not write */
-static int zero;			/* write zero's only */
+/* O_DIRECT transfers are multiples of this */
+#define ALIGN 4096
 
-static int debug;
-static int count_io_q_waits;	/* how many time io_queue_wait called */
+#define MB (1024.0 * 1024.0)
 
-struct iocb **iocb_free;	/* array of pointers to iocb */
-int iocb_free_count;		/* current free count */
-int alignment = 512;		/* buffer alignment */
+/*
+ * Bandwidth cap: a token bucket holding one chunk, so reads run at most a
+ * chunk ahead of the rate, and time spent below it is not saved up for a
+ * burst later
+ */
+struct rate {
+	double bps;		/* 0: no cap */
+	double start;
+	double burst;
+	double granted;		/* bytes */
+	pthread_mutex_t lock;
+};
+
+static struct rate rate;
+
+static int chunk = DEFAULT_CHUNK;
+static int depth = DEFAULT_DEPTH;
+static int pipelines = DEFAULT_PIPELINES;
+static long long max_size = -1;
+static int no_write = 0;
+static int verbose = 0;
+
+static double now(void)
+{
+	struct timespec ts;
 
-struct timeval delay;		/* delay between i/o */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-int init_iocb(int n, int iosize)
+/*
+ * Seconds until 'bytes' more may be read, 0 if they may be now (and then
+ * they are counted)
+ */
+static double rate_wait(struct rate *r, double t, size_t bytes)
 {
-	void *buf;
-	int i;
+	double allowed, wait = 0;
 
-	if ((iocb_free = malloc(n * sizeof(struct iocb *))) == 0) {
-		return -1;
-	}
+	if (!r->bps)
+		return 0;
 
-	for (i = 0; i < n; i++) {
-		if (!(iocb_free[i] = (struct iocb *) malloc(sizeof(struct iocb))))
-			return -1;
-		if (posix_memalign(&buf, alignment, iosize))
-			return -1;
-		if (debug > 1) {
-			printf("buf allocated at 0x%p, align:%d\n",
-					buf, alignment);
-		}
-		if (zero) {
-			/*
-			 * We are writing zero's to dstfd
-			 */
-			memset(buf, 0, iosize);
-		}
-		io_prep_pread(iocb_free[i], -1, buf, iosize, 0);
-	}
-	iocb_free_count = i;
-	return 0;
+	pthread_mutex_lock(&r->lock);
+	allowed = r->bps * (t - r->start) + r->burst;
+	if (r->granted < allowed - r->burst)
+		r->granted = allowed - r->burst;
+	if (r->granted + bytes <= allowed)
+		r->granted += bytes;
+	else
+		wait = (r->granted + bytes - allowed) / r->bps;
+	pthread_mutex_unlock(&r->lock);
+
+	return wait;
 }
 
-struct iocb *alloc_iocb()
+static void sleep_for(double secs)
 {
-	if (!iocb_free_count)
-		return 0;
-	return iocb_free[--iocb_free_count];
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
 }
 
-void free_iocb(struct iocb *io)
+static long long chunks_of(long long size)
 {
-	iocb_free[iocb_free_count++] = io;
+	return (size + chunk - 1) / chunk;
+}
+
+/* the chunks of pipeline p are [first, end) of the file's */
+static void pipeline_range(long long size, int p, long long *first,
+		long long *end)
+{
+	*first = chunks_of(size) * p / pipelines;
+	*end = chunks_of(size) * (p + 1) / pipelines;
 }
 
 /*
- * io_wait_run() - wait for an io_event and then call the callback.
+ * copy_file_range, a thread per pipeline
  */
-int io_wait_run(io_context_t ctx, struct timespec *to)
+struct cfr_pipeline {
+	pthread_t thread;
+	int p;
+	int src, dst;
+	long long size;
+	int fell_back;		/* to pread/pwrite */
+};
+
+/* pread/pwrite the rest of a pipeline's range */
+static void rw_copy(struct cfr_pipeline *cp, loff_t off, loff_t end)
 {
-	struct io_event events[aio_maxio];
-	struct io_event *ep;
-	int ret, n;
-
-	/*
-	 * get up to aio_maxio events at a time.
-	 */
-	ret = n = io_getevents(ctx, 1, aio_maxio, events, to);
-
-	/*
-	 * Call the callback functions for each event.
-	 */
-	for (ep = events; n-- > 0; ep++) {
-		io_callback_t cb = (io_callback_t)ep->data;
-		struct iocb *iocb = (struct iocb *)ep->obj;
-
-		cb(ctx, iocb, ep->res, ep->res2);
+	char *buf = malloc(chunk);
+	ssize_t n, w;
+	double wait;
+
+	if (!buf) {
+		perror("malloc");
+		exit(1);
 	}
-	return ret;
+
+	while (off < end) {
+		n = end - off < chunk ? end - off : chunk;
+		while ((wait = rate_wait(&rate, now(), n)) > 0)
+			sleep_for(wait);
+		n = pread(cp->src, buf, n, off);
+		if (n <= 0) {
+			perror(n ? "pread" : "pread: file shrank");
+			exit(1);
+		}
+		w = no_write ? n : pwrite(cp->dst, buf, n, off);
+		if (w != n) {
+			perror("pwrite");
+			exit(1);
+		}
+		off += n;
+	}
+
+	free(buf);
 }
 
-/* Fatal error handler */
-static void io_error(const char *func, int rc)
+static void *cfr_run(void *arg)
 {
-	if (rc == -ENOSYS)
-		fprintf(stderr, "AIO not in this kernel\n");
-	else if (rc < 0)
-		fprintf(stderr, "%s: %s\n", func, strerror(-rc));
-	else
-		fprintf(stderr, "%s: error %d\n", func, rc);
+	struct cfr_pipeline *cp = arg;
+	long long first, last;
+	loff_t off, end, out;
+	double wait;
+	ssize_t n;
 
-	if (dstfd > 0)
-		close(dstfd);
-	if (dstname && dest_open_flag & O_CREAT)
-		unlink(dstname);
-	exit(1);
+	pipeline_range(cp->size, cp->p, &first, &last);
+	off = first * chunk;
+	end = last * chunk < cp->size ? last * chunk : cp->size;
+
+	if (no_write) {
+		rw_copy(cp, off, end);
+		return NULL;
+	}
+
+	while (off < end) {
+		n = end - off < chunk ? end - off : chunk;
+		while ((wait = rate_wait(&rate, now(), n)) > 0)
+			sleep_for(wait);
+
+		out = off;
+		n = copy_file_range(cp->src, &off, cp->dst, &out, n, 0);
+		if (n < 0 && (errno == EXDEV || errno == ENOSYS ||
+					errno == EOPNOTSUPP || errno == EINVAL)) {
+			cp->fell_back = 1;
+			rw_copy(cp, off, end);
+			return NULL;
+		}
+		if (n <= 0) {
+			perror(n ? "copy_file_range" : "copy_file_range: file shrank");
+			exit(1);
+		}
+	}
+
+	return NULL;
 }
 
-/*
- * Write complete callback.
- * Adjust counts and free resources
- */
-static void wr_done(io_context_t ctx, struct iocb *iocb, long res, long res2)
+static int cfr_copy(const char *src, const char *dst, long long *bytes,
+		int *fell_back)
 {
-	if (res2 != 0) {
-		io_error("aio write", res2);
+	struct cfr_pipeline cp[pipelines];
+	struct stat st;
+	int sfd, dfd = -1, p;
+
+	sfd = open(src, O_RDONLY);
+	if (sfd < 0 || fstat(sfd, &st)) {
+		perror(src);
+		return -1;
 	}
-	if (res != iocb->u.c.nbytes) {
-		fprintf(stderr, "write missed bytes expect %lu got %ld\n",
-			iocb->u.c.nbytes, res2);
-		exit(1);
+	if (!no_write) {
+		dfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (dfd < 0) {
+			perror(dst);
+			return -1;
+		}
 	}
-	--tocopy;
-	--busy;
-	free_iocb(iocb);
-	if (debug)
-		write(2, "w", 1);
+
+	*bytes = st.st_size;
+	if (max_size >= 0 && *bytes > max_size)
+		*bytes = max_size;
+
+	if (dfd >= 0 && ftruncate(dfd, *bytes)) {
+		perror(dst);
+		return -1;
+	}
+
+	for (p = 0; p < pipelines; p++) {
+		cp[p].p = p;
+		cp[p].src = sfd;
+		cp[p].dst = dfd;
+		cp[p].size = *bytes;
+		cp[p].fell_back = 0;
+		if (pthread_create(&cp[p].thread, NULL, cfr_run, &cp[p])) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+
+	*fell_back = 0;
+	for (p = 0; p < pipelines; p++) {
+		pthread_join(cp[p].thread, NULL);
+		*fell_back += cp[p].fell_back;
+	}
+
+	close(sfd);
+	if (dfd >= 0) {
+		if (fdatasync(dfd)) {
+			perror(dst);
+			return -1;
+		}
+		close(dfd);
+	}
+	return 0;
 }
 
 /*
- * Read complete callback.
- * Change read iocb into a write iocb and start it.
+ * An io engine: every pipeline keeps 'depth' chunks in flight
  */
-static void rd_done(io_context_t ctx, struct iocb *iocb, long res, long res2)
+struct slot {
+	struct io_req req;
+	int p;
+	size_t want;		/* bytes the read must return */
+};
+
+struct pipeline {
+	long long next, end;	/* chunks left to read */
+};
+
+static int engine_copy(struct io_engine *io, const char *src, const char *dst,
+		long long *bytes)
 {
-	/* library needs accessors to look at iocb? */
-	int iosize = iocb->u.c.nbytes;
-	char *buf = iocb->u.c.buf;
-	off_t offset = iocb->u.c.offset;
-
-	if (res2 != 0)
-		io_error("aio read", res2);
-	if (res != iosize) {
-		fprintf(stderr, "read missing bytes expect %lu got %ld\n",
-			iocb->u.c.nbytes, res);
-		exit(1);
+	int nslots = pipelines * depth;
+	struct slot *slots;
+	struct pipeline pl[pipelines];
+	struct io_req *ready[nslots], *done[nslots];
+	int sfd, dfd = -1;
+	int num_ready, inflight = 0, idle, i, n, p;
+	long long size, dsize, off;
+	struct slot *s;
+	double wait;
+	void *buf;
+
+	sfd = ioengine_open(io, src, O_RDONLY, &size);
+	if (sfd < 0)
+		return -1;
+	if (max_size >= 0 && size > max_size)
+		size = max_size;
+	*bytes = size;
+
+	if (!no_write) {
+		dfd = ioengine_open(io, dst, O_WRONLY | O_CREAT | O_TRUNC, &dsize);
+		if (dfd < 0 || ftruncate(dfd, size)) {
+			perror(dst);
+			return -1;
+		}
 	}
 
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < nslots; i++) {
+		if (posix_memalign(&buf, ALIGN, chunk)) {
+			perror("posix_memalign");
+			return -1;
+		}
+		slots[i].p = i % pipelines;
+		slots[i].req.buf = buf;
+		slots[i].req.data = &slots[i];
+	}
+	for (p = 0; p < pipelines; p++)
+		pipeline_range(size, p, &pl[p].next, &pl[p].end);
+
+	idle = nslots;
+	while (1) {
+		/* idle slots read the next chunk of their pipeline */
+		num_ready = 0;
+		wait = -1;
+		for (i = 0; i < nslots; i++) {
+			s = &slots[i];
+			if (s->req.len || pl[s->p].next == pl[s->p].end)
+				continue;
+			off = pl[s->p].next * chunk;
+			s->want = size - off < chunk ? size - off : chunk;
+			if ((wait = rate_wait(&rate, now(), s->want)) > 0)
+				break;
+			pl[s->p].next++;
+			io_req_prep(&s->req, IO_READ, sfd, s->req.buf,
+					(s->want + ALIGN - 1) / ALIGN * ALIGN, off);
+			ready[num_ready++] = &s->req;
+			idle--;
+		}
 
-	/* turn read into write */
-	if (no_write) {
-		--tocopy;
-		--busy;
-		free_iocb(iocb);
-	} else {
-		io_prep_pwrite(iocb, dstfd, buf, iosize, offset);
-		io_set_callback(iocb, wr_done);
-		if (1 != (res = io_submit(ctx, 1, &iocb)))
-			io_error("io_submit write", res);
+		if (!num_ready && !inflight && idle == nslots && wait <= 0)
+			break;
+
+		if (num_ready) {
+			if (ioengine_submit(io, ready, num_ready))
+				return -1;
+			inflight += num_ready;
+		}
+
+		/* wait for a completion, or until the cap lets a read go */
+		n = ioengine_getevents(io, inflight ? 1 : 0, nslots, done,
+				wait > 0 ? wait : -1);
+		if (n < 0)
+			return -1;
+
+		num_ready = 0;
+		for (i = 0; i < n; i++) {
+			s = done[i]->data;
+			inflight--;
+
+			if (s->req.op == IO_READ) {
+				if (s->req.res < (long)s->want) {
+					fprintf(stderr, "%s: read at %lld: %s\n", src,
+							s->req.offset, s->req.res < 0 ?
+							strerror(-s->req.res) : "short read");
+					return -1;
+				}
+				if (!no_write) {
+					/* writes past the end are cut off below */
+					io_req_prep(&s->req, IO_WRITE, dfd, s->req.buf,
+							s->req.len, s->req.offset);
+					ready[num_ready++] = &s->req;
+					continue;
+				}
+			} else if (s->req.res != (long)s->req.len) {
+				fprintf(stderr, "%s: write at %lld: %s\n", dst,
+						s->req.offset, s->req.res < 0 ?
+						strerror(-s->req.res) : "short write");
+				return -1;
+			}
+
+			s->req.len = 0;
+			idle++;
+		}
+
+		/* the writes of what was read go down together */
+		if (num_ready) {
+			if (ioengine_submit(io, ready, num_ready))
+				return -1;
+			inflight += num_ready;
+		}
 	}
-	if (debug)
-		write(2, "r", 1);
-	if (debug > 1)
-		printf("%d", iosize);
+
+	for (i = 0; i < nslots; i++)
+		free(slots[i].req.buf);
+	free(slots);
+
+	ioengine_close(io, sfd);
+	if (dfd >= 0) {
+		if (ftruncate(dfd, size) || fdatasync(dfd)) {
+			perror(dst);
+			return -1;
+		}
+		ioengine_close(io, dfd);
+	}
+	return 0;
 }
 
-void usage()
+static void usage(void)
 {
-	fprintf(stderr,
-		"Usage: aiocp [-a align] [-s size] [-b blksize] [-n num_io]"
-		" [-f open_flag] SOURCE DEST\n"
-		"This copies from SOURCE to DEST using AIO.\n\n"
-		"Usage: aiocp [options] -w SOURCE\n"
-		"This does sequential AIO reads (no writes).\n\n"
-		"Usage: aiocp [options] -z DEST\n"
-		"This does sequential AIO writes of zeros.\n");
-		
+	fprintf(stderr, "usage: aiocp [options] src dst | src... dir\n"
+			"       [-e <engine>]     cfr (copy_file_range, default) or an io\n"
+			"                         engine:");
+	ioengine_list();
+	fprintf(stderr, "       [-j <pipelines>]  per file (%d)\n"
+			"       [-b <chunk>]      bytes, k/m/g (%dk)\n"
+			"       [-n <depth>]      chunks in flight per pipeline, io engines (%d)\n"
+			"       [-B <MB/s>]       cap the read bandwidth, give or take a chunk\n"
+			"       [-s <size>]       copy at most this much of each file, k/m/g\n"
+			"       [-w]              read only\n"
+			"       [-v]              report every file\n",
+			DEFAULT_PIPELINES, DEFAULT_CHUNK / 1024, DEFAULT_DEPTH);
 	exit(1);
 }
 
 /*
  * Scale value by kilo, mega, or giga.
  */
-long long scale_by_kmg(long long value, char scale)
+static long long scale_by_kmg(const char *arg)
 {
-	switch (scale) {
+	char *end;
+	long long value = strtoll(arg, &end, 0);
+
+	switch (*end) {
 	case 'g':
 	case 'G':
 		value *= 1024;
@@ -268,224 +493,121 @@ long long scale_by_kmg(long long value, char scale)
 	return value;
 }
 
-int main(int argc, char *const *argv)
+int main(int argc, char **argv)
 {
+	const char *engine = DEFAULT_ENGINE;
+	struct io_engine *io = NULL;
+	char dst[PATH_MAX], *base;
+	long long bytes, total = 0;
+	double start, t, cap = 0;
 	struct stat st;
-	off_t length = 0, offset = 0;
-	io_context_t myctx;
-	int c;
-	extern char *optarg;
-	extern int optind, opterr, optopt;
-
-	while ((c = getopt(argc, argv, "a:b:df:n:s:wzD:")) != -1) {
-		char *endp;
+	int dst_dir, fell_back = 0, fb, i, ret;
+	char c;
 
+	while ((c = getopt(argc, argv, "e:j:b:n:B:s:wv")) != -1) {
 		switch (c) {
-		case 'a':	/* alignment of data buffer */
-			alignment = strtol(optarg, &endp, 0);
-			alignment = (long)scale_by_kmg((long long)alignment,
-							*endp);
+		case 'e':
+			engine = optarg;
 			break;
-		case 'f':	/* use these open flags */
-			if (strcmp(optarg, "LARGEFILE") == 0 ||
-			    strcmp(optarg, "O_LARGEFILE") == 0) {
-				source_open_flag |= O_LARGEFILE;
-				dest_open_flag |= O_LARGEFILE;
-			} else if (strcmp(optarg, "TRUNC") == 0 ||
-			           strcmp(optarg, "O_TRUNC") == 0) {
-				dest_open_flag |= O_TRUNC;
-			} else if (strcmp(optarg, "SYNC") == 0 ||
-				   strcmp(optarg, "O_SYNC") == 0) {
-				dest_open_flag |= O_SYNC;
-			} else if (strcmp(optarg, "DIRECT") == 0 ||
-				   strcmp(optarg, "O_DIRECT") == 0) {
-				source_open_flag |= O_DIRECT;
-				dest_open_flag |= O_DIRECT;
-			} else if (strncmp(optarg, "CREAT", 5) == 0 ||
-				   strncmp(optarg, "O_CREAT", 5) == 0) {
-				dest_open_flag |= O_CREAT;
-			}
+		case 'j':
+			pipelines = atoi(optarg);
 			break;
-		case 'd':
-			debug++;
+		case 'b':
+			chunk = scale_by_kmg(optarg);
 			break;
-		case 'D':
-			delay.tv_usec = atoi(optarg);
+		case 'n':
+			depth = atoi(optarg);
 			break;
-		case 'b':	/* block size */
-			aio_blksize = strtol(optarg, &endp, 0);
-			aio_blksize = (long)scale_by_kmg((long long)aio_blksize, *endp);
-			break;
-
-		case 'n':	/* num io */
-			aio_maxio = strtol(optarg, &endp, 0);
+		case 'B':
+			cap = atof(optarg);
 			break;
-		case 's':	/* size to transfer */
-			length = strtoll(optarg, &endp, 0);
-			length = scale_by_kmg(length, *endp);
+		case 's':
+			max_size = scale_by_kmg(optarg);
 			break;
-		case 'w':	/* no write */
+		case 'w':
 			no_write = 1;
 			break;
-		case 'z':	/* write zero's */
-			zero = 1;
+		case 'v':
+			verbose = 1;
 			break;
-
 		default:
 			usage();
 		}
 	}
-
 	argc -= optind;
 	argv += optind;
-	
-#ifndef DEBUG
-	if (argc < 1) {
+
+	if (argc < 1 + !no_write || pipelines < 1 || depth < 1 || cap < 0 ||
+			chunk < ALIGN || chunk % ALIGN) {
+		fprintf(stderr, "need files, and a chunk that is a multiple of %d\n",
+				ALIGN);
 		usage();
 	}
-#else
-    source_open_flag |= O_DIRECT;
-    dest_open_flag |= O_DIRECT;
-    aio_blksize = 1;
-    aio_maxio=1;
-    srcname = "junkdata";
-    dstname = "ff2";
-#endif
-	if (!zero) {
-#ifndef DEBUG
-	       	if ((srcfd = open(srcname = *argv, source_open_flag)) < 0) {
-#else
-                if ((srcfd = open(srcname, source_open_flag)) < 0) {
-#endif
-			perror(srcname);
-			exit(1);
-		}
-		argv++;
-		argc--;
-		length = 1073741824;
-#if 0
-		if (fstat(srcfd, &st) < 0) {
-			perror("fstat");
-			exit(1);
-		}
-		if (length == 0)
-			length = st.st_size;
-#endif
+
+	dst_dir = !no_write && !stat(argv[argc - 1], &st) && S_ISDIR(st.st_mode);
+	if (!no_write && argc > 2 && !dst_dir) {
+		fprintf(stderr, "%s: not a directory\n", argv[argc - 1]);
+		usage();
 	}
+	if (!no_write)
+		argc--;
 
-	if (!no_write) {
-		/*
-		 * We are either copying or writing zeros to dstname
-		 */
-#ifndef DEBUG
-		if (argc < 1) {
-			usage();
-		}
-		if ((dstfd = open(dstname = *argv, dest_open_flag, 0666)) < 0) {
-#else
-            if ((dstfd = open(dstname, dest_open_flag, 0666)) < 0) {
-#endif
-			perror(dstname);
+	if (strcmp(engine, "cfr")) {
+		io = ioengine_create(engine, pipelines * depth);
+		if (!io)
+			exit(1);
+		if (io->ops->nodata) {
+			fprintf(stderr, "%s: moves no data\n", io->ops->name);
 			exit(1);
 		}
-		if (zero) {
-			/*
-			 * get size of dest, if we are zeroing it.
-			 * TODO: handle devices.
-			 */
-			if (fstat(dstfd, &st) < 0) {
-				perror("fstat");
-				exit(1);
-			}
-			if (length == 0)
-				length = st.st_size;
-		}
-	}
-
-	/* initialize state machine */
-	memset(&myctx, 0, sizeof(myctx));
-	io_queue_init(aio_maxio, &myctx);
-	tocopy = howmany(length, aio_blksize);
-
-	if (init_iocb(aio_maxio, aio_blksize) < 0) {
-		fprintf(stderr, "Error allocating the i/o buffers\n");
-		exit(1);
 	}
 
-	while (tocopy > 0) {
-		int i, rc;
-		/* Submit as many reads as once as possible upto aio_maxio */
-		int n = MIN(MIN(aio_maxio - busy, aio_maxio),
-				howmany(length - offset, aio_blksize));
-		if (n > 0) {
-			struct iocb *ioq[n];
-
-			for (i = 0; i < n; i++) {
-				struct iocb *io = alloc_iocb();
-				int iosize = MIN(length - offset, aio_blksize);
-
-				if (zero) {
-					/*
-					 * We are writing zero's to dstfd
-					 */
-					io_prep_pwrite(io, dstfd, io->u.c.buf,
-							iosize, offset);
-					io_set_callback(io, wr_done);
-				} else {
-					io_prep_pread(io, srcfd, io->u.c.buf,
-							iosize, offset);
-					io_set_callback(io, rd_done);
-				}
-				ioq[i] = io;
-				offset += iosize;
-			}
-
-			rc = io_submit(myctx, n, ioq);
-			if (rc < 0)
-				io_error("io_submit", rc);
-
-			busy += n;
-			if (debug > 1)
-				printf("io_submit(%d) busy:%d\n", n, busy);
-			if (delay.tv_usec) {
-				struct timeval t = delay;
-				(void)select(0,0,0,0,&t);
-			}
-		}
-
-		/*
-		 * We have submitted all the i/o requests. Wait for at least one to complete
-		 * and call the callbacks.
-		 */
-		count_io_q_waits++;
-		rc = io_wait_run(myctx, 0);
-		if (rc < 0)
-			io_error("io_wait_run", rc);
-
-		if (debug > 1) {
-			printf("io_wait_run: rc == %d\n", rc);
-			printf("busy:%d aio_maxio:%d tocopy:%d\n",
-					busy, aio_maxio, tocopy);
-		}
+	rate.bps = cap * MB;
+	rate.burst = chunk;
+	pthread_mutex_init(&rate.lock, NULL);
+	rate.start = start = now();
+
+	for (i = 0; i < argc; i++) {
+		if (no_write)
+			dst[0] = '\0';
+		else if (dst_dir) {
+			base = strdup(argv[i]);
+			snprintf(dst, sizeof(dst), "%s/%s", argv[argc], basename(base));
+			free(base);
+		} else
+			snprintf(dst, sizeof(dst), "%s", argv[argc]);
+
+		t = now();
+		fb = 0;
+		ret = io ? engine_copy(io, argv[i], dst, &bytes) :
+			cfr_copy(argv[i], dst, &bytes, &fb);
+		if (ret)
+			exit(1);
+		t = now() - t;
+		total += bytes;
+		fell_back += fb;
+
+		if (verbose)
+			printf("%s%s%s: %.1f MB in %.2f s, %.1f MB/s%s\n", argv[i],
+					no_write ? "" : " -> ", dst, bytes / MB, t,
+					t > 0 ? bytes / MB / t : 0,
+					fb ? " (pread/pwrite)" : "");
 	}
 
-	if (srcfd != -1)
-		close(srcfd);
-	if (dstfd != -1)
-		close(dstfd);
-	exit(0);
+	t = now() - start;
+	printf("%d files, %.1f MB in %.2f s: %.1f MB/s (%s, %d pipelines",
+			argc, total / MB, t, t > 0 ? total / MB / t : 0,
+			io ? engine : "copy_file_range", pipelines);
+	if (io)
+		printf(" x %d deep", depth);
+	printf(", %d KB chunks", chunk / 1024);
+	if (cap)
+		printf(", capped at %.0f MB/s", cap);
+	if (fell_back)
+		printf(", %d pipelines fell back to pread/pwrite", fell_back);
+	printf(")\n");
+
+	if (io)
+		ioengine_destroy(io);
+	return 0;
 }
-
-/* 
- * Results look like:
- * [alanm@toolbox ~/MOT3]$ ../taio -d kernel-source-2.4.8-0.4g.ppc.rpm abc
- * rrrrrrrrrrrrrrrwwwrwrrwwrrwrwwrrwrwrwwrrwrwrrrrwwrwwwrrwrrrwwwwwwwwwwwwwwwww
- * rrrrrrrrrrrrrrwwwrrwrwrwrwrrwwwwwwwwwwwwwwrrrrrrrrrrrrrrrrrrwwwwrwrwwrwrwrwr
- * wrrrrrrrwwwwwwwwwwwwwrrrwrrrwrrwrwwwwwwwwwwrrrrwwrwrrrrrrrrrrrwwwwwwwwwwwrww
- * wwwrrrrrrrrwwrrrwwrwrwrwwwrrrrrrrwwwrrwwwrrwrwwwwwwwwrrrrrrrwwwrrrrrrrwwwwww
- * wwwwwwwrwrrrrrrrrwrrwrrwrrwrwrrrwrrrwrrrwrwwwwwwwwwwwwwwwwwwrrrwwwrrrrrrrrrr
- * rrwrrrrrrwrrwwwwwwwwwwwwwwwwrwwwrrwrwwrrrrrrrrrrrrrrrrrrrwwwwwwwwwwwwwwwwwww
- * rrrrrwrrwrwrwrrwrrrwwwwwwwwrrrrwrrrwrwwrwrrrwrrwrrrrwwwwwwwrwrwwwwrwwrrrwrrr
- * rrrwwwwwwwrrrrwwrrrrrrrrrrrrwrwrrrrwwwwwwwwwwwwwwrwrrrrwwwwrwrrrrwrwwwrrrwww
- * rwwrrrrrrrwrrrrrrrrrrrrwwwwrrrwwwrwrrwwwwwwwwwwwwwwwwwwwwwrrrrrrrwwwwwwwrw
- */
@@ -1,207 +1,1476 @@
+/*
+ * Asynchronous workload engine.
+ *
+ * Runs the same seq/idx stream mixes as workload.c, but from a single
+ * thread driving O_DIRECT reads through an I/O engine (ioengine.h): libaio
+ * or io_uring on real devices, or the simulated disk. Every stream is dispatched
+ * through a token bucket and a queue depth, which the reservation
+ * controller (ctrl.c) adjusts at run-time. Output format matches workload.c.
+ *
+ * All times come from the I/O engine, so under the simulator warmup and
+ * runtime are in virtual seconds.
+ *
+ * With -q the engine also consumes what it reads: every block of the
+ * query's table is run through the tuple scan kernels (tuple.c), and the
+ * tuple rate and CPU cycles per tuple are reported next to the I/O
+ * bandwidth, which shows whether scans are CPU or I/O bound.
+ *
+ * Sequential scans of columnar files (gen-data -C) read only the query's
+ * columns, a row group at a time, and with -z only the row groups whose
+ * zone maps do not rule the predicate out.
+ *
+ * With -I the index scans are real B+tree probes (gen-index, index.h),
+ * point lookups or key ranges: each walks from the root to a leaf and
+ * then reads the heap blocks of the rows found. Inner pages are cached
+ * once read. The blocks an index scan outputs are the leaf, heap and
+ * uncached inner pages it read, so perf models measured this way carry
+ * real index scan costs in their t_I and t_Is rows.
+ *
+ * -B gives the index scans a buffer cache, shared by all of them, in
+ * place of their own inner page caches: index and heap pages alike are
+ * looked up there first, and its 2Q policy (bcache.h) keeps the hot ones
+ * while the sequential scans bypass it.
+ *
+ * With -P sequential scans keep only as many reads in flight as their
+ * consumer and rate need given the read latency (prefetch.h), instead of
+ * their whole queue depth, and the buffers they hold are reported.
+ *
+ * -Q attaches many queries (variants of Q1 and Q2) to every scan and
+ * evaluates them together (share.c), to see how the per-tuple cost grows
+ * with the number of queries sharing a scan.
+ *
+ * -M replaces the token buckets with an mClock scheduler (mclock.h):
+ * every stream gets a reservation, a limit and a weight, and the engine
+ * keeps -D reads in flight, each going to the stream whose tags are due.
+ *
+ * -G adds a background class, a bulk load or scan of one file that only
+ * gets the disk time the reserved streams leave (slack.h): it backs off
+ * within a quantum of a reserved stream falling behind, and what it got
+ * and cost the reserved streams go to stderr.
+ *
+ * -J runs the Q3 hash join (join.c) instead: one pass over the sequential
+ * file holding Location rows builds, then one pass over those holding
+ * Object rows probes, while index scans run throughout. Warmup and runtime
+ * do not apply; each scan's output is its stage's blocks and duration, and
+ * the CPU time and memory of both stages go to stderr.
+ */
 #define _GNU_SOURCE
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/time.h>
-#include <sys/param.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <libaio.h>
+
+#include "engine.h"
+#include "offset.h"
+#include "block.h"
+#include "cycles.h"
+
+#define MSEC_PER_SEC (1000)
+
+#define JOIN_BITS (6)		/* 64 partitions */
+
+/* how long to block for completions before re-checking tokens */
+#define WAIT_SEC (0.001)
+
+#ifdef HAVE_LIBAIO
+#define DEFAULT_IOENGINE "aio"
+#else
+#define DEFAULT_IOENGINE "sim"
+#endif
+
+double engine_now(struct engine *e)
+{
+	return ioengine_now(e->io);
+}
 
 /*
- * aio_maxio: max number of outstanding IOs
- * aio_blksize: read size
+ * Pick the next block for a stream
  */
-static int aio_maxio;
-static int aio_blksize;
+static long long next_offset(struct stream *s)
+{
+	if (s->random_workload)
+		return offset_rnd(&s->rng, s->num_blocks, READ_SIZE);
+	return offset_seq(&s->next_block, s->num_blocks, READ_SIZE);
+}
 
-struct iocb_data {
-	struct iocb job;
-	struct timeval submitted;
-	void *buf;
-};
+static int init_reqs(struct engine *e)
+{
+	struct io_req *req;
+	int i, ret;
 
-static int aio_inflight = 0;
+	if (pool_init(&e->reqs, e->iodepth)) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < e->iodepth; i++) {
+		req = malloc(sizeof(*req));
+		if (!req) {
+			perror("malloc");
+			return -1;
+		}
+		ret = posix_memalign(&req->buf, e->alignment, READ_SIZE);
+		if (ret) {
+			fprintf(stderr, "posix_memalign: %s\n", strerror(ret));
+			return -1;
+		}
+		pool_put(&e->reqs, req);
+	}
 
-static struct iocb_data **iocb_free;
-static int iocb_free_count;
-static int alignment = 512;
+	return 0;
+}
 
 /*
- * Source we are reading from
+ * List the row groups a columnar scan reads
  */
-static int fd;
+static int init_groups(struct engine *e, struct stream *s)
+{
+	uint64_t g;
+
+	s->groups = malloc(s->col.groups * sizeof(*s->groups));
+	if (!s->groups) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (g = 0; g < s->col.groups; g++)
+		if (!e->zone_skip || column_zone_match(&s->col, e->query, g))
+			s->groups[s->num_groups++] = g;
+
+	return 0;
+}
+
+static int open_index(struct engine *e, struct stream *s)
+{
+	char name[MAX_NAME];
+	long long size;
+
+	index_name(name, sizeof(name), s->filename);
+	if (index_read_meta(name, &s->index)) {
+		fprintf(stderr, "%s: no index, see gen-index\n", name);
+		return -1;
+	}
+	if (s->index.file_id != s->file_id) {
+		fprintf(stderr, "%s: index of another file\n", name);
+		return -1;
+	}
+
+	s->index_fd = ioengine_open(e->io, name, O_RDONLY, &size);
+	if (s->index_fd < 0)
+		return -1;
+
+	s->inner = calloc(s->index.pages - s->index.leaves, sizeof(*s->inner));
+	s->probes = calloc(s->max_depth, sizeof(*s->probes));
+	if (!s->inner || !s->probes) {
+		perror("malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_stream(struct engine *e, struct stream *s)
+{
+	long long size;
+	int ret;
+
+	s->fd = ioengine_open(e->io, s->filename, O_RDONLY, &size);
+	if (s->fd < 0)
+		return -1;
+
+	s->num_blocks = size / READ_SIZE;
+
+	if (s->random_workload && e->index_range && open_index(e, s))
+		return -1;
+
+	ret = column_open(&s->col, s->filename);
+	if (ret < 0)
+		return -1;
+	if (ret) {
+		/* stay clear of the footer */
+		s->num_blocks = s->col.groups * s->col.columns;
+		if (!s->random_workload && e->query &&
+				e->query->format == s->col.format &&
+				init_groups(e, s))
+			return -1;
+	}
+
+	if (s->num_blocks < 1) {
+		fprintf(stderr, "%s: file too small\n", s->filename);
+		return -1;
+	}
+
+	return 0;
+}
 
 /*
- * setup iocb structs.
- *
- *  - n: max number of ios
+ * Sort the sequential scans into the join's build and probe stages
  */
-static int init_iocb(void)
+static int init_join(struct engine *e)
+{
+	int i, format, build = 0;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (s->random_workload)
+			continue;
+
+		format = tuple_file_format(s->filename);
+		if (format == TUPLE_LOCATION) {
+			/* l_lid repeats from one Location file to the next */
+			if (build++) {
+				fprintf(stderr, "%s: the join builds from one Location "
+						"file\n", s->filename);
+				return -1;
+			}
+			s->stage = 0;
+		} else if (format == TUPLE_OBJECT)
+			s->stage = 1;
+		else {
+			fprintf(stderr, "%s: neither Location nor Object rows "
+					"(gen-data -f)\n", s->filename);
+			return -1;
+		}
+	}
+
+	if (join_init(e->join, JOIN_BITS)) {
+		perror("malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int init_engine(struct engine *e, const char *ioengine)
 {
 	int i;
 
-	/* allocate the pointers */
-	iocb_free = malloc(aio_maxio * sizeof(*iocb_free));
-	if (!iocb_free)
+	e->iodepth = 0;
+	for (i = 0; i < e->num_streams; i++) {
+		e->iodepth += e->streams[i].max_depth;
+		/* a columnar row group can take two reads even at depth 1 */
+		if (e->query && e->query->agg_col >= 0 &&
+				e->streams[i].max_depth < 2)
+			e->iodepth++;
+	}
+	if (e->slack)
+		e->iodepth += e->slack->max_depth;
+	if (!e->iodepth)
+		e->iodepth = 1;
+
+	e->io = ioengine_create(ioengine, e->iodepth);
+	if (!e->io)
 		return -1;
 
-	/* allocate iocb, buffer, etc... */
-	for (i = 0; i < aio_maxio; i++) {
+	if ((e->verify || e->query || e->join || e->share || e->index_range) &&
+			e->io->ops->nodata) {
+		fprintf(stderr, "the %s io engine reads no data to check or scan\n",
+				e->io->ops->name);
+		return -1;
+	}
 
-		iocb_free[i] = malloc(sizeof(**iocb_free));
-		if (!iocb_free[i])
+	for (i = 0; i < e->num_streams; i++)
+		if (open_stream(e, &e->streams[i]))
 			return -1;
 
-		if (posix_memalign(&iocb_free[i]->buf, alignment, aio_blksize)) {
-			fprintf(stderr, "posix_memalign: failed\n");
-			return -1;
+	if (e->join && init_join(e))
+		return -1;
+
+	if (e->slack && slack_init(e, e->slack))
+		return -1;
+
+	e->inflight = 0;
+	e->alignment = 512;
+
+	return init_reqs(e);
+}
+
+/*
+ * Add tokens accrued over dt. The bucket holds at most one queue's worth
+ * so an idle stream cannot burst past its rate.
+ */
+static void refill_tokens(struct engine *e, double dt)
+{
+	int i;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (!s->rate)
+			continue;
+		s->tokens += s->rate * dt;
+		if (s->tokens > s->depth)
+			s->tokens = s->depth;
+	}
+}
+
+/*
+ * Account for the buffers of sequential scans' reads in flight: as many
+ * as were after the last dispatch, which completions only bring down
+ */
+static void account_buffers(struct engine *e, double dt)
+{
+	int i;
+
+	if (!e->observing)
+		return;
+
+	for (i = 0; i < e->num_streams; i++)
+		if (!e->streams[i].random_workload)
+			prefetch_tick(&e->streams[i].pf, dt);
+}
+
+/*
+ * Reads a stream may have in flight, at least min: its queue depth, or
+ * with -P for sequential scans the prefetch window if that is smaller
+ */
+static int stream_depth(struct engine *e, struct stream *s, int min)
+{
+	int depth = s->depth;
+
+	if (e->prefetch && !s->random_workload &&
+			prefetch_update(&s->pf, s->rate, min, s->max_depth) < depth)
+		depth = s->pf.window;
+
+	return depth > min ? depth : min;
+}
+
+/*
+ * Queue the reads of whole row groups of a columnar stream. A group is
+ * read as a unit even when that takes the stream past its depth of 1.
+ */
+static int dispatch_groups(struct engine *e, struct stream *s,
+		struct io_req **ioq, int max)
+{
+	const struct tuple_query *q = e->query;
+	int cols[2] = { q->pred_col, q->agg_col };
+	int need = q->agg_col >= 0 ? 2 : 1;
+	int depth = stream_depth(e, s, need);
+	int n = 0, u, j;
+	uint64_t g;
+
+	if (!s->num_groups)
+		return 0;
+
+	while (s->inflight + need <= depth && n + need <= max &&
+			(!s->rate || s->tokens >= 1.0)) {
+		for (u = 0; s->units[u].pending; u++)
+			assert(u + 1 < MAX_DEPTH); /* sanity */
+
+		g = s->groups[s->next_group];
+		s->next_group = (s->next_group + 1) % s->num_groups;
+
+		for (j = 0; j < need; j++) {
+			struct io_req *req = pool_get(&e->reqs);
+			assert(req); /* sanity */
+
+			req->data = s;
+			io_req_prep(req, IO_READ, s->fd, req->buf, READ_SIZE,
+					column_block(&s->col, cols[j], g) * READ_SIZE);
+			s->units[u].req[j] = req;
+			ioq[n++] = req;
 		}
-		
-		printf("assigned: %p - %p\n", iocb_free[i], iocb_free[i]->buf);
+		s->units[u].pending = need;
+
+		s->inflight += need;
+		if (s->rate)
+			s->tokens -= need;
 	}
 
-	iocb_free_count = aio_maxio;
-	return 0;
+	return n;
 }
 
-static struct iocb_data *alloc_iocb(void)
+/* buffer cache key of a heap block or index page of a stream's file */
+static uint64_t cache_key(struct stream *s, int index, uint32_t page)
 {
-	if (!iocb_free_count)
-		return NULL;
-	return iocb_free[--iocb_free_count];
+	return (uint64_t)s->file_id << 33 | (uint64_t)index << 32 | page;
 }
 
-static void free_iocb(struct iocb_data *io)
+/*
+ * Take in a page a probe asked for: check the heap rows the leaf pointed
+ * to, or follow the index
+ */
+static void probe_page(struct engine *e, struct stream *s, struct probe *p,
+		const void *buf)
 {
-	iocb_free[iocb_free_count++] = io;
+	const struct index_meta *m = &s->index;
+	uint32_t block;
+	int32_t key;
+	int more;
+
+	if (!p->reading_index) {
+		/* every row of this block the leaf pointed to */
+		block = p->rids[p->next_rid] / INDEX_SLOTS;
+		for (; p->next_rid < p->num_rids &&
+				p->rids[p->next_rid] / INDEX_SLOTS == block;
+				p->next_rid++) {
+			key = index_row_key(m, buf, p->rids[p->next_rid] % INDEX_SLOTS);
+			if (key < p->lo || key >= p->hi) {
+				fprintf(stderr, "%s: block %u: row key %d outside [%d, %d), "
+						"stale index?\n", s->filename, block, key,
+						p->lo, p->hi);
+				exit(1);
+			}
+			if (e->observing)
+				s->rows_found++;
+		}
+	} else if (p->page > m->leaves) {
+		p->page = index_child(buf, p->lo);
+	} else {
+		p->num_rids = index_collect(buf, p->lo, p->hi, p->rids, &more);
+		p->next_rid = 0;
+		p->page = more && p->page < m->leaves ? p->page + 1 : 0;
+	}
 }
 
-static void read_done(io_context_t ctx, struct iocb *iocb, long res, long res2)
+/*
+ * Point a probe's read at what it needs next: heap blocks of rids already
+ * found, else the next index page. Pages in the cache are taken from
+ * there on the way. Returns 0 when the probe is complete.
+ */
+static int probe_next(struct engine *e, struct stream *s, struct probe *p)
 {
-	struct iocb_data *iocbd = (struct iocb_data *)iocb;
+	const struct index_meta *m = &s->index;
+	const void *page;
+	uint32_t block;
 
-	if (res2 != 0) {
-		fprintf(stderr, "read_done: %s\n", strerror(-res2));
-		exit(1);
+	while (1) {
+		if (p->next_rid < p->num_rids) {
+			block = p->rids[p->next_rid] / INDEX_SLOTS;
+			p->reading_index = 0;
+			if (e->cache &&
+					(page = bcache_get(e->cache, cache_key(s, 0, block)))) {
+				probe_page(e, s, p, page);
+				s->heap_hits++;
+				continue;
+			}
+			io_req_prep(p->req, IO_READ, s->fd, p->req->buf, READ_SIZE,
+					(long long)block * READ_SIZE);
+			return 1;
+		}
+
+		while (!e->cache && p->page > m->leaves &&
+				(page = s->inner[p->page - m->leaves - 1])) {
+			p->page = index_child(page, p->lo);
+			s->inner_hits++;
+		}
+		if (!p->page)
+			return 0;
+
+		p->reading_index = 1;
+		if (e->cache &&
+				(page = bcache_get(e->cache, cache_key(s, 1, p->page)))) {
+			if (p->page > m->leaves)
+				s->inner_hits++;
+			else
+				s->leaf_hits++;
+			probe_page(e, s, p, page);
+			continue;
+		}
+		io_req_prep(p->req, IO_READ, s->index_fd, p->req->buf, INDEX_PAGE,
+				(long long)p->page * INDEX_PAGE);
+		return 1;
 	}
+}
 
-	if (res != 4096) {
-		fprintf(stderr, "read_done: %ld/%d, %s\n", res, 4096, strerror(-res));
-		exit(1);
+/*
+ * Start probes on an index scan while depth and tokens allow, issuing at
+ * most max reads
+ */
+static int dispatch_probes(struct engine *e, struct stream *s,
+		struct io_req **ioq, int max)
+{
+	const struct index_meta *m = &s->index;
+	struct probe *p;
+	int n = 0, cached = 0;
+
+	while (s->inflight < s->depth && n < max &&
+			(!s->rate || s->tokens >= 1.0)) {
+		for (p = s->probes; p->req; p++)
+			;
+
+		p->lo = m->min_key + (int32_t)rng_range(&s->rng,
+				(uint64_t)m->max_key - m->min_key + 1);
+		p->hi = p->lo + e->index_range;
+		p->page = m->root;
+		p->num_rids = p->next_rid = 0;
+
+		p->req = pool_get(&e->reqs);
+		assert(p->req); /* sanity */
+		p->req->data = s;
+		if (!probe_next(e, s, p)) {
+			/* all of it was cached; do not spin on such probes */
+			assert(e->cache); /* else a probe reads at least a leaf */
+			pool_put(&e->reqs, p->req);
+			p->req = NULL;
+			if (e->observing)
+				s->probes_done++;
+			if (++cached >= s->max_depth)
+				break;
+			continue;
+		}
+		ioq[n++] = p->req;
+
+		s->inflight++;
+		if (s->rate)
+			s->tokens -= 1.0;
 	}
 
-	free_iocb(iocbd);
-	aio_inflight--;
+	return n;
 }
 
-static int io_wait_run(io_context_t ctx)
+/*
+ * A probe's read is in: follow the index or check the heap rows, then
+ * issue its next read or retire it.
+ */
+static void probe_done(struct engine *e, struct stream *s, struct probe *p)
 {
-	struct io_event events[aio_maxio];
-	struct io_event *ep;
-	int ret, i;
+	const struct index_meta *m = &s->index;
+	void *buf = p->req->buf;
 
-	ret = io_getevents(ctx, 1, aio_maxio, events, NULL);
-	if (ret < 1) {
-		fprintf(stderr, "io_getevents: %s\n", strerror(-ret));
+	if (!p->reading_index) {
+		s->heap_reads++;
+		if (e->cache)
+			bcache_put(e->cache, cache_key(s, 0, p->req->offset / READ_SIZE),
+					buf);
+	} else if (index_check_page(buf, p->page)) {
+		fprintf(stderr, "%s: bad index page %u\n", s->filename, p->page);
 		exit(1);
+	} else {
+		if (p->page > m->leaves)
+			s->inner_reads++;
+		else
+			s->leaf_reads++;
+
+		if (e->cache) {
+			bcache_put(e->cache, cache_key(s, 1, p->page), buf);
+		} else if (p->page > m->leaves) {
+			void *copy = malloc(INDEX_PAGE);
+
+			assert(copy);
+			memcpy(copy, buf, INDEX_PAGE);
+			s->inner[p->page - m->leaves - 1] = copy;
+		}
 	}
+	probe_page(e, s, p, buf);
 
-	//printf("io_wait_run: events=%d\n", ret);
-	for (i = 0; i < ret; i++) {
-		ep = events + i;
-		read_done(ctx, ep->obj, ep->res, ep->res2);
+	if (probe_next(e, s, p)) {
+		p->req->issued = engine_now(e);
+		if (ioengine_submit(e->io, &p->req, 1))
+			exit(1);
+		e->inflight++;
+		if (s->rate)
+			s->tokens -= 1.0;
+		if (e->mclock)
+			mclock_charge(e->mclock, s->id, 1, e->mclock->c[s->id].phase,
+					engine_now(e));
+		return;
 	}
 
+	if (e->observing)
+		s->probes_done++;
+	pool_put(&e->reqs, p->req);
+	p->req = NULL;
+	s->inflight--;
+}
+
+/*
+ * Queue the reads of a plain stream, at most max
+ */
+static int dispatch_blocks(struct engine *e, struct stream *s,
+		struct io_req **ioq, int max)
+{
+	int n = 0, depth;
+
+	/* join scans make one pass, in their stage */
+	if (s->stage >= 0 && s->stage != e->stage)
+		return 0;
+
+	depth = stream_depth(e, s, 1);
+	while (s->inflight < depth && n < max && (!s->rate || s->tokens >= 1.0) &&
+			(s->stage < 0 ||
+			 s->completed + s->inflight < s->num_blocks)) {
+		struct io_req *req = pool_get(&e->reqs);
+		assert(req); /* sanity */
+
+		req->data = s;
+		io_req_prep(req, IO_READ, s->fd, req->buf, READ_SIZE,
+				next_offset(s));
+		ioq[n++] = req;
+
+		s->inflight++;
+		if (s->rate)
+			s->tokens -= 1.0;
+	}
+
+	return n;
+}
+
+static int dispatch_stream(struct engine *e, struct stream *s,
+		struct io_req **ioq, int max)
+{
+	if (s->groups)
+		return dispatch_groups(e, s, ioq, max);
+	if (s->probes)
+		return dispatch_probes(e, s, ioq, max);
+	return dispatch_blocks(e, s, ioq, max);
+}
+
+/*
+ * Could the stream issue a read now, depth and stage permitting?
+ */
+static int stream_ready(struct engine *e, struct stream *s)
+{
+	int need;
+
+	if (s->groups) {
+		need = e->query->agg_col >= 0 ? 2 : 1;
+		return s->num_groups && s->inflight + need <= stream_depth(e, s, need);
+	}
+	if (s->probes)
+		return s->inflight < s->depth;
+	if (s->stage >= 0 && (s->stage != e->stage ||
+				s->completed + s->inflight >= s->num_blocks))
+		return 0;
+	return s->inflight < stream_depth(e, s, 1);
+}
+
+/*
+ * Keep the device busy with reads of the streams mclock picks, a dispatch
+ * unit (a read, row group or probe) at a time. A stream with no room goes
+ * out of the running until one of its reads completes.
+ */
+static int dispatch_mclock(struct engine *e, struct io_req **ioq)
+{
+	struct mclock *m = e->mclock;
+	double now = engine_now(e);
+	int n = 0, picks = 0, i, got, phase;
+
+	while (e->inflight + n < m->depth && picks < 4 * m->depth) {
+		i = mclock_pick(m, now, &phase);
+		if (i < 0)
+			break;
+		if (!stream_ready(e, &e->streams[i])) {
+			mclock_sleep(m, i);
+			continue;
+		}
+
+		got = dispatch_stream(e, &e->streams[i], ioq + n, 2);
+		/* a probe answered by the cache costs a pick, not a read */
+		mclock_charge(m, i, got ? got : 1, phase, now);
+		n += got;
+		picks++;
+	}
+
+	return n;
+}
+
+static void mclock_wake_all(struct engine *e)
+{
+	double now = engine_now(e);
+	int i;
+
+	for (i = 0; i < e->num_streams; i++)
+		mclock_wake(e->mclock, i, now);
+}
+
+/*
+ * Queue reads for every stream with both free depth and tokens, or for
+ * those mclock picks
+ */
+static int dispatch(struct engine *e)
+{
+	struct io_req *ioq[e->iodepth];
+	int i, n = 0;
+	double now;
+
+	if (e->mclock)
+		n = dispatch_mclock(e, ioq);
+	else
+		for (i = 0; i < e->num_streams; i++)
+			n += dispatch_stream(e, &e->streams[i], ioq + n,
+					e->iodepth - n);
+
+	/* the background goes last, into what the streams left */
+	if (e->slack)
+		n += slack_dispatch(e->slack, ioq + n, e->iodepth - n);
+
+	for (i = 0; i < e->num_streams; i++)
+		e->streams[i].pf.held = e->streams[i].inflight;
+
+	if (!n)
+		return 0;
+
+	now = engine_now(e);
+	for (i = 0; i < n; i++)
+		ioq[i]->issued = now;
+
+	if (ioengine_submit(e->io, ioq, n))
+		return -1;
+
+	e->inflight += n;
 	return 0;
 }
 
-static int run(void)
+/*
+ * One read of a row group is in; once they all are, run the query over
+ * the group and free its reads. Until then they count as in flight.
+ */
+static void group_done(struct engine *e, struct stream *s,
+		struct io_req *req)
 {
-	int ret, n, i;
-	io_context_t ctx;
+	struct col_unit *unit = s->units;
+	unsigned long long start;
+	struct tuple_agg warmup;
+	int j;
 
-	/*
-	 * Initialize libaio state machine
-	 */
-	memset(&ctx, 0, sizeof(ctx));
-	ret = io_queue_init(aio_maxio, &ctx);
-	if (ret) {
-		fprintf(stderr, "io_queue_init: %s\n", strerror(-ret));
-		exit(1);
+	while (unit->req[0] != req && unit->req[1] != req)
+		unit++;
+	if (--unit->pending)
+		return;
+
+	start = cycles();
+	column_scan(e->query, unit->req[0]->buf,
+			unit->req[1] ? unit->req[1]->buf : NULL,
+			e->observing ? &e->agg : &warmup);
+	if (e->observing)
+		e->scan_cycles += cycles() - start;
+
+	for (j = 0; j < 2 && unit->req[j]; j++) {
+		pool_put(&e->reqs, unit->req[j]);
+		s->inflight--;
 	}
+	memset(unit, 0, sizeof(*unit));
+}
+
+static void read_done(struct engine *e, struct io_req *req)
+{
+	struct stream *s = req->data;
+	struct probe *p = s->probes;
+	double issued = req->issued, start_consume;
+	int err;
+
+	if (p)
+		while (p->req != req)
+			p++;
 
-	/*
-	 * Setup iocb contexts
-	 */
-	if (init_iocb()) {
-		perror("init_iocb");
+	if (req->res != READ_SIZE) {
+		fprintf(stderr, "read missing bytes! %s\n", strerror(-req->res));
 		exit(1);
 	}
 
-	while (1) {
-		/* submit as many at once as we can */
-		n = MIN(aio_maxio - aio_inflight, aio_maxio);
-		//printf("min: n=%d, aio_inflight=%d\n", n, aio_inflight);
+	if (e->verify && !(p && p->reading_index)) {
+		err = block_check(req->buf, s->file_id, req->offset / READ_SIZE,
+				e->seed);
+		if (err) {
+			fprintf(stderr, "%s: block %lld: %s\n", s->filename,
+					req->offset / READ_SIZE, block_strerror(err));
+			exit(1);
+		}
+	}
 
-		if (n > 0) {
-			struct iocb *ioq[n];
-			struct timeval submitted;
+	start_consume = engine_now(e);
+	if (e->observing)
+		hist_add(&s->lat, (start_consume - issued) * 1e6);
+	if (e->slack && e->observing && s->reservation > 0)
+		slack_account(e->slack, issued, start_consume);
+	if (e->cache && !s->random_workload && e->observing)
+		bcache_bypass(e->cache);
 
-			assert(gettimeofday(&submitted, NULL) == 0);
+	if (s->stage >= 0) {
+		unsigned long long start = cycles();
 
-			for (i = 0; i < n; i++) {
-				struct iocb_data *io = alloc_iocb();
-				struct iocb *job = (struct iocb *)io;
-				assert(io); /* sanity check */
+		if (join_block(e->join, req->buf) < 0) {
+			fprintf(stderr, "join: out of memory\n");
+			exit(1);
+		}
+		e->join_cycles[s->stage] += cycles() - start;
+	}
 
-				//io->submitted = submitted;
-				printf("%p - %p\n", io, io->buf);
-				io_prep_pread(job, fd, io->buf, 4096, 0);
-				ioq[i] = job;
-			}
+	if (e->share) {
+		unsigned long long start = cycles();
 
-			ret = io_submit(ctx, n, ioq);
-			if (ret < 0) {
-				fprintf(stderr, "io_submit: %s\n", strerror(-ret));
-				exit(1);
+		share_scan(e->share, req->buf);
+		if (e->observing)
+			e->scan_cycles += cycles() - start;
+	}
+
+	if (e->query && !s->groups) {
+		unsigned long long start = cycles();
+		struct tuple_agg warmup;
+
+		/* always consume, but only count while observing */
+		tuple_scan(e->query, req->buf, e->observing ? &e->agg : &warmup);
+		if (e->observing)
+			e->scan_cycles += cycles() - start;
+	}
+
+	s->completed++;
+	if (e->observing)
+		s->blocks_read++;
+	if (s->stage >= 0 && s->completed == s->num_blocks)
+		s->finish = engine_now(e);
+
+	e->inflight--;
+	if (s->groups)
+		group_done(e, s, req);
+	else if (p)
+		probe_done(e, s, p);
+	else {
+		s->inflight--;
+		pool_put(&e->reqs, req);
+	}
+
+	if (!s->random_workload) {
+		double now = engine_now(e);
+
+		prefetch_done(&s->pf, issued, start_consume,
+				now - start_consume);
+	}
+
+	/* it may have room again */
+	if (e->mclock)
+		mclock_wake(e->mclock, s->id, engine_now(e));
+}
+
+static int io_wait_run(struct engine *e)
+{
+	struct io_req *done[e->iodepth];
+	int ret, i;
+
+	/* with nothing in flight this just lets WAIT_SEC pass */
+	ret = ioengine_getevents(e->io, e->inflight ? 1 : 0, e->iodepth, done,
+			WAIT_SEC);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ret; i++)
+		if (e->slack && done[i]->data == e->slack)
+			slack_done(e, e->slack, done[i]);
+		else
+			read_done(e, done[i]);
+
+	return 0;
+}
+
+static int run(struct engine *e, double warmup, double runtime)
+{
+	double now, last, begin;
+	int i;
+
+	begin = last = engine_now(e);
+	e->ctrl.last = begin;
+	if (e->mclock)
+		mclock_wake_all(e);
+
+	while (1) {
+		now = engine_now(e);
+		refill_tokens(e, now - last);
+		account_buffers(e, now - last);
+		last = now;
+
+		if (!e->observing && now - begin >= warmup) {
+			e->observing = 1;
+			for (i = 0; i < e->num_streams; i++) {
+				struct stream *s = &e->streams[i];
+
+				s->start = now;
+				s->blocks_read = 0;
+				s->inner_hits = s->inner_reads = 0;
+				s->leaf_reads = s->heap_reads = 0;
+				s->leaf_hits = s->heap_hits = 0;
+				hist_init(&s->lat);
+				s->pf.area = s->pf.secs = 0;
+				s->pf.peak = 0;
 			}
+			memset(&e->agg, 0, sizeof(e->agg));
+			e->scan_cycles = 0;
+			if (e->share)
+				share_reset(e->share);
+			if (e->cache)
+				bcache_reset(e->cache);
+			if (e->mclock)
+				mclock_reset(e->mclock, now);
+			if (e->slack)
+				slack_reset(e, e->slack, now);
+		}
+
+		if (now - begin >= warmup + runtime)
+			break;
+
+		if (e->mclock && e->observing)
+			mclock_tick(e->mclock, now);
+
+		ctrl_update(e, now);
+		if (e->slack)
+			slack_tick(e, e->slack, now);
+
+		if (dispatch(e))
+			return -1;
 
-			aio_inflight += n;
-			assert(aio_inflight <= aio_maxio);
-			//printf("io_submit: n=%d aio_inflight=%d\n", n, aio_inflight);
+		if (io_wait_run(e))
+			return -1;
+	}
+
+	for (i = 0; i < e->num_streams; i++)
+		e->streams[i].finish = now;
+	if (e->slack)
+		e->slack->finish = now;
+	e->observing = 0;
+
+	/* drain */
+	while (e->inflight)
+		if (io_wait_run(e))
+			return -1;
+
+	return 0;
+}
+
+static int stage_busy(struct engine *e)
+{
+	int i;
+
+	for (i = 0; i < e->num_streams; i++)
+		if (e->streams[i].stage == e->stage &&
+				e->streams[i].completed < e->streams[i].num_blocks)
+			return 1;
+	return 0;
+}
+
+/*
+ * Q3: one pass over the Location files to build, then one over the
+ * Object files to probe
+ */
+static int run_join(struct engine *e)
+{
+	unsigned long long start;
+	double now, last;
+	int i;
+
+	last = engine_now(e);
+	e->ctrl.last = last;
+	e->observing = 1;
+	for (i = 0; i < e->num_streams; i++)
+		e->streams[i].start = last;
+	if (e->mclock)
+		mclock_reset(e->mclock, last);
+
+	for (e->stage = 0; e->stage < 2; e->stage++) {
+		for (i = 0; i < e->num_streams; i++)
+			if (e->streams[i].stage == e->stage)
+				e->streams[i].start = engine_now(e);
+		if (e->mclock)
+			mclock_wake_all(e);
+
+		while (stage_busy(e)) {
+			now = engine_now(e);
+			refill_tokens(e, now - last);
+			account_buffers(e, now - last);
+			last = now;
+
+			ctrl_update(e, now);
+			if (e->mclock)
+				mclock_tick(e->mclock, now);
+
+			if (dispatch(e))
+				return -1;
+
+			if (io_wait_run(e))
+				return -1;
 		}
 
-		ret = io_wait_run(ctx);
-		if (ret < 0) {
-			fprintf(stderr, "io_wait_run: %s\n", strerror(-ret));
-			exit(1);
+		if (e->stage == 0) {
+			start = cycles();
+			if (join_build(e->join)) {
+				fprintf(stderr, "join: out of memory\n");
+				return -1;
+			}
+			e->table_cycles = cycles() - start;
+		}
+	}
+
+	start = cycles();
+	join_finish(e->join);
+	e->join_cycles[1] += cycles() - start;
+
+	now = engine_now(e);
+	for (i = 0; i < e->num_streams; i++)
+		if (e->streams[i].stage < 0)
+			e->streams[i].finish = now;
+	e->observing = 0;
+
+	/* drain the index scans */
+	while (e->inflight)
+		if (io_wait_run(e))
+			return -1;
+
+	return 0;
+}
+
+/*
+ * What the index probes cost
+ */
+static void report_index(struct engine *e)
+{
+	unsigned long long probes = 0, rows = 0, hits = 0, inner = 0, leaf = 0,
+		heap = 0;
+	double secs = 0, n;
+	int i;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (!s->probes)
+			continue;
+		probes += s->probes_done;
+		rows += s->rows_found;
+		hits += s->inner_hits;
+		inner += s->inner_reads;
+		leaf += s->leaf_reads;
+		heap += s->heap_reads;
+		if (s->finish - s->start > secs)
+			secs = s->finish - s->start;
+	}
+	if (!probes || secs <= 0)
+		return;
+
+	n = probes;
+	fprintf(stderr, "index (%s %d): %.0f probes/s, %.1f rows/probe, "
+			"blocks/probe: inner %.2f, leaf %.2f, heap %.1f; "
+			"inner cache hits %.1f%%\n",
+			e->index_range == 1 ? "point" : "range", e->index_range,
+			probes / secs, rows / n, inner / n, leaf / n, heap / n,
+			hits + inner ? 100.0 * hits / (hits + inner) : 0);
+}
+
+/*
+ * How well the buffer cache served the index scans
+ */
+static void report_cache(struct engine *e)
+{
+	struct bcache *c = e->cache;
+	unsigned long long hits[3] = { 0 }, reads[3] = { 0 };
+	const char *names[3] = { "inner", "leaf", "heap" };
+	int i;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		hits[0] += s->inner_hits;
+		hits[1] += s->leaf_hits;
+		hits[2] += s->heap_hits;
+		reads[0] += s->inner_reads;
+		reads[1] += s->leaf_reads;
+		reads[2] += s->heap_reads;
+	}
+
+	fprintf(stderr, "cache: %.1f MB 2Q (A1in %d, Am %d, A1out %d): %.1f%% hits, "
+			"%llu promoted, %llu evictions, %llu scan reads bypassed\n",
+			(double)c->pages * c->page_size / (1024 * 1024),
+			c->q[BCACHE_A1IN].n, c->q[BCACHE_AM].n, c->q[BCACHE_A1OUT].n,
+			c->hits + c->misses ? 100.0 * c->hits / (c->hits + c->misses) : 0,
+			c->ghost_hits, c->evictions, c->bypassed);
+	fprintf(stderr, "cache:");
+	for (i = 0; i < 3; i++)
+		fprintf(stderr, " %s %.1f%%", names[i], hits[i] + reads[i] ?
+				100.0 * hits[i] / (hits[i] + reads[i]) : 0);
+	fprintf(stderr, " hits\n");
+}
+
+/*
+ * Shared evaluation rate, and the results with -v
+ */
+static void report_share(struct engine *e, double hz)
+{
+	struct share *sh = e->share;
+	double secs = 0, cpt;
+	int i;
+
+	share_results(sh);
+
+	for (i = 0; i < e->num_streams; i++)
+		if (e->streams[i].finish - e->streams[i].start > secs)
+			secs = e->streams[i].finish - e->streams[i].start;
+	if (secs <= 0)
+		return;
+
+	cpt = sh->tuples ? e->scan_cycles / (double)sh->tuples : 0;
+	fprintf(stderr, "share (%s): %d queries in %d groups, %llu tuples, "
+			"%.0f tuples/s, %.2f cycles/tuple (cpu bound at %.0f tuples/s)\n",
+			share_impl(), sh->num_queries, sh->num_groups, sh->tuples,
+			sh->tuples / secs, cpt, cpt > 0 ? hz / cpt : 0);
+
+	if (!e->verbose)
+		return;
+	for (i = 0; i < sh->num_queries; i++) {
+		const struct tuple_query *q = sh->queries[i].q;
+		struct tuple_agg *r = &sh->queries[i].result;
+
+		fprintf(stderr, "share %d %s < %g: %llu of %llu matched, %s %.3f\n",
+				i, q->name, q->pred_lt, r->matched, r->tuples,
+				q->agg_col < 0 ? "count" : "avg",
+				q->agg_col < 0 ? (double)r->matched :
+				r->matched ? r->sum / r->matched : 0);
+	}
+}
+
+/*
+ * Stage durations, CPU time and memory of the join
+ */
+static void report_join(struct engine *e, double hz)
+{
+	static const char *names[] = { "build", "probe" };
+	struct join *j = e->join;
+	unsigned long long blocks[2] = { 0, 0 };
+	double start[2] = { 0, 0 }, finish[2] = { 0, 0 };
+	int files[2] = { 0, 0 }, i, k;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if ((k = s->stage) < 0)
+			continue;
+		if (!files[k] || s->start < start[k])
+			start[k] = s->start;
+		if (!files[k] || s->finish > finish[k])
+			finish[k] = s->finish;
+		blocks[k] += s->blocks_read;
+		files[k]++;
+	}
+
+	for (k = 0; k < 2; k++)
+		fprintf(stderr, "join Q3: %s %d files, %llu blocks, %llu rows in "
+				"%.1f ms (cpu %.1f ms%s)\n", names[k], files[k],
+				blocks[k], k ? j->probe_tuples : j->build_tuples,
+				(finish[k] - start[k]) * MSEC_PER_SEC,
+				e->join_cycles[k] / hz * MSEC_PER_SEC,
+				k ? "" : ", tables below");
+
+	fprintf(stderr, "join Q3: %llu build rows, tables built in %.2f ms; "
+			"%llu matches, avg o_temperature %.3f, avg l_elevation %.3f\n",
+			j->build_rows, e->table_cycles / hz * MSEC_PER_SEC,
+			j->matches, j->matches ? j->sum_probe / j->matches : 0,
+			j->matches ? j->sum_build / j->matches : 0);
+	fprintf(stderr, "join Q3: %d partitions, peak memory %.2f MB (partitions "
+			"%.2f, tables %.2f, probe batches %.2f)\n", j->parts,
+			join_memory(j) / 1e6, j->build_bytes / 1e6,
+			j->table_bytes / 1e6, j->batch_bytes / 1e6);
+}
+
+/*
+ * What the tuple consumer got through, against what the CPU could do
+ */
+static void report_scan(struct engine *e, double hz)
+{
+	struct tuple_agg *a = &e->agg;
+	double secs = 0, bytes = 0, cpt;
+	unsigned long long groups, listed;
+	int i;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		bytes += s->blocks_read * (double)READ_SIZE;
+		if (s->finish - s->start > secs)
+			secs = s->finish - s->start;
+	}
+	if (secs <= 0)
+		return;
+
+	cpt = a->tuples ? e->scan_cycles / (double)a->tuples : 0;
+
+	fprintf(stderr, "scan %s (%s): %llu tuples, %llu matched, %s %.3f\n",
+			e->query->name, tuple_impl(), a->tuples, a->matched,
+			e->query->agg_col < 0 ? "count" : "avg",
+			e->query->agg_col < 0 ? (double)a->matched :
+			a->matched ? a->sum / a->matched : 0);
+	fprintf(stderr, "scan %s: %.0f tuples/s, %.2f cycles/tuple (cpu bound at "
+			"%.0f tuples/s), io %.1f MB/s\n", e->query->name,
+			a->tuples / secs, cpt, cpt > 0 ? hz / cpt : 0,
+			bytes / secs / 1000000);
+
+	groups = listed = 0;
+	for (i = 0; i < e->num_streams; i++) {
+		groups += e->streams[i].groups ? e->streams[i].col.groups : 0;
+		listed += e->streams[i].num_groups;
+	}
+	if (groups)
+		fprintf(stderr, "scan %s: columnar, reading %llu of %llu row groups "
+				"(%.1f%%)%s\n", e->query->name, listed, groups,
+				100.0 * listed / groups,
+				e->zone_skip ? " past the zone maps" : "");
+}
+
+/*
+ * Buffers the sequential scans held against what they got through
+ */
+static void report_prefetch(struct engine *e)
+{
+	int i;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+		struct prefetch *p = &s->pf;
+		double secs = s->finish - s->start, avg;
+
+		if (s->random_workload || p->secs <= 0 || secs <= 0)
+			continue;
+
+		avg = p->area / p->secs;
+		fprintf(stderr, "prefetch: stream %d %.0f/%.0f blocks/s, in flight "
+				"avg %.1f peak %d (%.0f KB buffers), window %d, "
+				"latency %.0f us, consumer %.0f us/block\n", s->id,
+				s->blocks_read / secs, s->reservation, avg, p->peak,
+				avg * READ_SIZE / 1024, e->prefetch ? p->window : s->depth,
+				p->latency * 1e6, p->consume * 1e6);
+	}
+}
+
+/*
+ * What each stream got of the device and how, with -v, and how fairly the
+ * weight phase shared it: Jain's index over the streams' weight phase
+ * rates per unit of weight, among those it served, that is those neither
+ * short of their reservation (served by it alone) nor held at their limit
+ */
+static void report_mclock(struct engine *e)
+{
+	struct mclock *m = e->mclock;
+	double sum = 0, sum_sq = 0, x, rate, secs;
+	int i, shared = 0, limited = 0, reserved = 0, windows = 0, met = 0;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+		struct mclock_client *c = &m->c[i];
+
+		secs = s->finish - s->start;
+		if (secs <= 0)
+			continue;
+		rate = s->blocks_read / secs;
+
+		if (e->verbose)
+			fprintf(stderr, "mclock: stream %d r %.0f l %.0f w %.1f: %.0f blocks/s, "
+					"%.0f reserved + %.0f by weight, reservation met "
+					"in %d/%d windows\n", s->id, c->resv, c->limit,
+					c->weight, rate, c->blocks[MCLOCK_RESV] / secs,
+					c->blocks[MCLOCK_WEIGHT] / secs, c->windows_met,
+					c->windows);
+
+		if (c->resv > 0) {
+			reserved++;
+			windows += c->windows;
+			met += c->windows_met;
+		}
+		if (c->limit > 0 && rate >= 0.95 * c->limit) {
+			limited++;
+			continue;
 		}
+		if (rate < 0.95 * c->resv)
+			continue;
+		x = c->blocks[MCLOCK_WEIGHT] / secs / c->weight;
+		sum += x;
+		sum_sq += x * x;
+		shared++;
 	}
 
+	if (sum_sq > 0)
+		fprintf(stderr, "mclock: share fairness %.3f (Jain, %d streams by "
+				"weight), %d at their limit", sum * sum / (shared * sum_sq),
+				shared, limited);
+	else
+		fprintf(stderr, "mclock: nothing shared by weight, %d at their limit",
+				limited);
+	if (reserved)
+		fprintf(stderr, ", reservations met in %.1f%% of %.0f ms windows "
+				"(%d streams)", windows ? 100.0 * met / windows : 0,
+				m->window * MSEC_PER_SEC, reserved);
+	fprintf(stderr, "\n");
+}
+
+/*
+ * -M: comma separated <who>:<reservation>:<limit>:<weight>, who being seq,
+ * idx or a stream number; later ones override earlier ones
+ */
+static int parse_mclock(struct engine *e, char *spec)
+{
+	char *tok, *save, who[16];
+	double r, l, w;
+	int i, id;
+
+	for (tok = strtok_r(spec, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (sscanf(tok, "%15[^:]:%lf:%lf:%lf", who, &r, &l, &w) != 4 ||
+				r < 0 || l < 0 || w <= 0 || (l > 0 && r > l)) {
+			fprintf(stderr, "bad mclock spec %s\n", tok);
+			return -1;
+		}
+		id = -1;
+		if (strcmp(who, "seq") && strcmp(who, "idx")) {
+			id = atoi(who);
+			if (id < 0 || id >= e->num_streams) {
+				fprintf(stderr, "no stream %s\n", who);
+				return -1;
+			}
+		}
+		for (i = 0; i < e->num_streams; i++)
+			if (i == id || (id < 0 && e->streams[i].random_workload ==
+						!strcmp(who, "idx")))
+				mclock_set(e->mclock, i, r, l, w);
+	}
 	return 0;
 }
 
 static void usage(void)
 {
-	fprintf(stderr, "usage: -s <source> -m <aio_maxio>\n");
+	fprintf(stderr, "usage: -s <num seq scans> -x <num idx scans> -b <filename base>\n"
+			"       [-m <max queue depth>] [-r <seq reservation>] [-R <idx reservation>]\n"
+			"       [-c <ctrl period ms>] [-w <warmup s>] [-t <runtime s>] [-S <seed>]\n"
+			"       [-e <io engine>[:options]] [-V <data seed>] [-q <query> [-z] | -Q <n> | -J]\n"
+			"       [-I point|range:<keys> [-B <cache MB>]] [-P] [-L <latency log>]\n"
+			"       [-M <who>:<resv>:<limit>:<weight>,... [-D <reads>]]\n"
+			"       [-G r|w:<file>[,depth=<n>][,kb=<KB>][,q=<ms>][,late=<ms>]\n"
+			"           [,size=<MB>][,force]] [-v]\n"
+			"  reservations are in %d byte blocks/s; 0 is best effort\n"
+			"  -V checks every block against its gen-data stamp\n"
+			"  -q runs Q1, Q2 or Q3L over the blocks read (gen-data -f)\n"
+			"  -z skips row groups of columnar files (gen-data -C) the zone\n"
+			"     maps rule out for the query\n"
+			"  -I makes index scans probe the B+tree of their file (gen-index)\n"
+			"  -B gives them a shared buffer cache for index and heap pages\n"
+			"  -P sizes sequential scans' queues to their consumer and rate,\n"
+			"     for minimal buffer memory\n"
+			"  -L appends p50 and p99 read latency (us) of every scan to a log,\n"
+			"     laid out as the output\n"
+			"  -M schedules reads by mClock instead of token buckets: who is seq,\n"
+			"     idx or a stream number, reservation and limit are blocks/s\n"
+			"     (0 for none); -D reads in flight in all (default -m)\n"
+			"  -G reads or writes a file in the background, only in the slack\n"
+			"     the reserved streams leave: up to depth requests of kb KB\n"
+			"     (4, 64), backing off within a quantum of q ms (10) of a\n"
+			"     reservation falling behind; size is for new files (1024),\n"
+			"     force lets w: write over an existing one\n"
+			"  -Q evaluates n variants of Q1 and Q2 together over the blocks read\n"
+			"  -J runs the Q3 join, building from the Location seq file and\n"
+			"     probing with the Object ones\n"
+			"  io engines:", READ_SIZE);
+	ioengine_list();
 }
 
 int main(int argc, char **argv)
 {
+	struct engine e;
 	char c;
-	char *source = NULL;
+	int idx_scans = -1;
+	int seq_scans = -1;
+	char *filename_base = NULL;
+	char *ioengine = DEFAULT_IOENGINE;
+	int max_depth = 1;
+	double seq_reservation = 0, idx_reservation = 0;
+	double ctrl_period = 0.5;
+	double warmup = 10, runtime = 30;
+	unsigned long long seed = 0, start_cycles;
+	double start_wall, hz;
+	int num_shared = 0, i;
+	double cache_mb = 0;
+	char *latency_log = NULL, *mclock_spec = NULL;
+	int mclock_depth = 0;
+	FILE *out;
+
+	memset(&e, 0, sizeof(e));
 
-	while ((c = getopt(argc, argv, "s:m:")) != -1) {
+	while ((c = getopt(argc, argv, "s:x:b:m:r:R:c:w:t:S:e:V:q:zQ:JI:B:PL:M:D:G:v")) != -1) {
 		switch (c) {
+		case 'x':
+			idx_scans = atoi(optarg);
+			break;
 		case 's':
-			source = strdup(optarg);
+			seq_scans = atoi(optarg);
+			break;
+		case 'b':
+			filename_base = strdup(optarg);
 			break;
 		case 'm':
-			aio_maxio = atoi(optarg);
+			max_depth = atoi(optarg);
+			break;
+		case 'r':
+			seq_reservation = atof(optarg);
+			break;
+		case 'R':
+			idx_reservation = atof(optarg);
+			break;
+		case 'c':
+			ctrl_period = atof(optarg) / MSEC_PER_SEC;
+			break;
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		case 't':
+			runtime = atof(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			ioengine = strdup(optarg);
+			break;
+		case 'V':
+			e.verify = 1;
+			e.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			e.query = tuple_query_find(optarg);
+			if (!e.query) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'Q':
+			num_shared = atoi(optarg);
+			break;
+		case 'I':
+			if (!strcmp(optarg, "point"))
+				e.index_range = 1;
+			else if (!strncmp(optarg, "range:", 6))
+				e.index_range = atoi(optarg + 6);
+			if (e.index_range < 1) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'J':
+			e.join = calloc(1, sizeof(*e.join));
+			assert(e.join);
+			break;
+		case 'z':
+			e.zone_skip = 1;
+			break;
+		case 'P':
+			e.prefetch = 1;
+			break;
+		case 'B':
+			cache_mb = atof(optarg);
+			break;
+		case 'L':
+			latency_log = strdup(optarg);
+			break;
+		case 'M':
+			mclock_spec = strdup(optarg);
+			break;
+		case 'D':
+			mclock_depth = atoi(optarg);
+			break;
+		case 'G':
+			e.slack = calloc(1, sizeof(*e.slack));
+			assert(e.slack);
+			if (slack_parse(e.slack, optarg)) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'v':
+			e.verbose = 1;
 			break;
 		default:
 			usage();
@@ -209,28 +1478,142 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/*
-	 * Verify options
-	 */
-	if (!source) {
+	if (seq_scans < 0 || idx_scans < 0 || !filename_base ||
+			(e.zone_skip && !e.query) || (cache_mb > 0 && !e.index_range) ||
+			(!!e.query + !!e.join + (num_shared > 0)) > 1 ||
+			(mclock_spec && (seq_reservation > 0 || idx_reservation > 0)) ||
+			(mclock_depth && !mclock_spec) ||
+			(e.slack && (mclock_spec || e.join))) {
 		usage();
 		exit(1);
 	}
 
-	if (aio_maxio < 1 || aio_maxio > 100000) {
-		fprintf(stderr, "aio_maxio = %d is crazy!\n", aio_maxio);
-		usage();
+	if (max_depth < 1 || max_depth > MAX_DEPTH) {
+		fprintf(stderr, "max queue depth = %d is crazy!\n", max_depth);
 		exit(1);
 	}
 
-	/*
-	 * Open what we will be reading from
-	 */
-	fd = open(source, O_DIRECT|O_RDONLY);
-	if (fd < 0) {
-		perror("open");
+	e.num_streams = seq_scans + idx_scans;
+	if (e.num_streams > MAX_STREAMS) {
+		fprintf(stderr, "Too many streams! MAX_STREAMS=%d\n", MAX_STREAMS);
 		exit(1);
 	}
 
-	return run();
+	e.streams = calloc(e.num_streams ? e.num_streams : 1, sizeof(*e.streams));
+	assert(e.streams);
+
+	for (i = 0; i < e.num_streams; i++) {
+		struct stream *s = &e.streams[i];
+
+		s->id = i;
+		s->random_workload = i >= seq_scans;
+		if (s->random_workload) {
+			sprintf(s->filename, "%s.rnd.%d.dat", filename_base, i - seq_scans);
+			s->file_id = block_file_id(1, i - seq_scans);
+			s->reservation = idx_reservation;
+		} else {
+			sprintf(s->filename, "%s.seq.%d.dat", filename_base, i);
+			s->file_id = block_file_id(0, i);
+			s->reservation = seq_reservation;
+		}
+		rng_seed(&s->rng, seed + i);
+		s->stage = -1;
+		s->max_depth = max_depth;
+		s->depth = s->reservation > 0 ? 1 : max_depth;
+		s->rate = s->reservation;
+		prefetch_init(&s->pf, max_depth);
+	}
+
+	if (num_shared > 0) {
+		struct tuple_query *qs = calloc(num_shared, sizeof(*qs));
+
+		e.share = calloc(1, sizeof(*e.share));
+		assert(qs && e.share);
+		share_make_queries(qs, num_shared, seed);
+		if (share_init(e.share, qs, num_shared)) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+
+	if (cache_mb > 0) {
+		e.cache = calloc(1, sizeof(*e.cache));
+		if (!e.cache || bcache_init(e.cache,
+					cache_mb * 1024 * 1024 / READ_SIZE, READ_SIZE)) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+
+	if (mclock_spec) {
+		e.mclock = calloc(1, sizeof(*e.mclock));
+		if (!e.mclock || mclock_init(e.mclock, e.num_streams,
+					mclock_depth > 0 ? mclock_depth : max_depth)) {
+			perror("malloc");
+			exit(1);
+		}
+		if (parse_mclock(&e, mclock_spec))
+			exit(1);
+	}
+
+	ctrl_init(&e.ctrl, ctrl_period);
+	e.ctrl.enabled = seq_reservation > 0 || idx_reservation > 0;
+
+	if (init_engine(&e, ioengine))
+		exit(1);
+
+	start_cycles = cycles();
+	start_wall = cycles_wall();
+
+	if (e.join ? run_join(&e) : run(&e, warmup, runtime))
+		exit(1);
+
+	hz = (cycles() - start_cycles) / (cycles_wall() - start_wall);
+
+	/* output the data! */
+	printf("%d %d", seq_scans, idx_scans);
+	for (i = 0; i < e.num_streams; i++) {
+		struct stream *s = &e.streams[i];
+		/* to the nearest ms: a -t 20 run is 20000, not 19999 */
+		printf(" %llu %llu", s->blocks_read,
+				(unsigned long long)((s->finish - s->start) * MSEC_PER_SEC + 0.5));
+	}
+	printf("\n");
+
+	if (latency_log) {
+		out = fopen(latency_log, "a");
+		if (!out) {
+			perror(latency_log);
+			exit(1);
+		}
+		fprintf(out, "%d %d", seq_scans, idx_scans);
+		for (i = 0; i < e.num_streams; i++)
+			fprintf(out, " %llu %llu",
+					(unsigned long long)hist_pct(&e.streams[i].lat, 0.5),
+					(unsigned long long)hist_pct(&e.streams[i].lat, 0.99));
+		fprintf(out, "\n");
+		fclose(out);
+	}
+
+	if (e.ctrl.warnings)
+		fprintf(stderr, "ctrl: %lu reservation warnings\n", e.ctrl.warnings);
+
+	if (e.query)
+		report_scan(&e, hz);
+	if (e.index_range)
+		report_index(&e);
+	if (e.cache)
+		report_cache(&e);
+	if (e.share)
+		report_share(&e, hz);
+	if (e.join)
+		report_join(&e, hz);
+	if (e.prefetch || e.verbose)
+		report_prefetch(&e);
+	if (e.mclock)
+		report_mclock(&e);
+	if (e.slack)
+		slack_report(&e, e.slack);
+
+	return 0;
 }
@@ -0,0 +1,213 @@
+/*
+ * 2Q buffer cache (bcache.h).
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bcache.h"
+
+static unsigned hash_key(const struct bcache *c, uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - c->hash_bits);
+}
+
+int bcache_init(struct bcache *c, int pages, size_t page_size)
+{
+	int i, n;
+
+	memset(c, 0, sizeof(*c));
+	if (pages < 4)
+		pages = 4;
+	c->page_size = page_size;
+	c->pages = pages;
+	c->kin = pages / 4;
+	c->kout = pages / 2;
+
+	n = pages + c->kout;
+	for (c->hash_bits = 1; (1 << c->hash_bits) < 2 * n; c->hash_bits++)
+		;
+
+	c->data = malloc((size_t)pages * page_size);
+	c->free_bufs = malloc(pages * sizeof(*c->free_bufs));
+	c->entries = malloc(n * sizeof(*c->entries));
+	c->hash = malloc(sizeof(*c->hash) << c->hash_bits);
+	if (!c->data || !c->free_bufs || !c->entries || !c->hash) {
+		bcache_free(c);
+		return -1;
+	}
+
+	for (i = 0; i < pages; i++)
+		c->free_bufs[i] = pages - 1 - i;
+	c->num_free_bufs = pages;
+
+	for (i = 0; i < n; i++)
+		c->entries[i].hnext = i + 1 < n ? i + 1 : -1;
+	c->free_entries = 0;
+
+	memset(c->hash, 0xff, sizeof(*c->hash) << c->hash_bits);
+	for (i = 0; i < 3; i++)
+		c->q[i].head = c->q[i].tail = -1;
+
+	return 0;
+}
+
+void bcache_free(struct bcache *c)
+{
+	free(c->data);
+	free(c->free_bufs);
+	free(c->entries);
+	free(c->hash);
+	memset(c, 0, sizeof(*c));
+}
+
+static void queue_remove(struct bcache *c, int i)
+{
+	struct bcache_entry *x = &c->entries[i];
+	struct bcache_queue *q = &c->q[x->queue];
+
+	if (x->prev >= 0)
+		c->entries[x->prev].next = x->next;
+	else
+		q->head = x->next;
+	if (x->next >= 0)
+		c->entries[x->next].prev = x->prev;
+	else
+		q->tail = x->prev;
+	q->n--;
+}
+
+/* at the head, as the newest */
+static void queue_push(struct bcache *c, int i, int queue)
+{
+	struct bcache_entry *x = &c->entries[i];
+	struct bcache_queue *q = &c->q[queue];
+
+	x->queue = queue;
+	x->prev = -1;
+	x->next = q->head;
+	if (q->head >= 0)
+		c->entries[q->head].prev = i;
+	else
+		q->tail = i;
+	q->head = i;
+	q->n++;
+}
+
+static int lookup(const struct bcache *c, uint64_t key)
+{
+	int i = c->hash[hash_key(c, key)];
+
+	while (i >= 0 && c->entries[i].key != key)
+		i = c->entries[i].hnext;
+	return i;
+}
+
+static void hash_remove(struct bcache *c, int i)
+{
+	int *link = &c->hash[hash_key(c, c->entries[i].key)];
+
+	while (*link != i)
+		link = &c->entries[*link].hnext;
+	*link = c->entries[i].hnext;
+}
+
+/* forget an entry altogether */
+static void drop(struct bcache *c, int i)
+{
+	struct bcache_entry *x = &c->entries[i];
+
+	queue_remove(c, i);
+	hash_remove(c, i);
+	if (x->buf >= 0)
+		c->free_bufs[c->num_free_bufs++] = x->buf;
+	x->hnext = c->free_entries;
+	c->free_entries = i;
+}
+
+/*
+ * Free a page of data: from A1in when it is over its share, its key
+ * moving to A1out, else the least recently used page of Am
+ */
+static void reclaim(struct bcache *c)
+{
+	int i;
+
+	c->evictions++;
+
+	if (c->q[BCACHE_A1IN].n > c->kin || !c->q[BCACHE_AM].n) {
+		if (c->q[BCACHE_A1OUT].n >= c->kout)
+			drop(c, c->q[BCACHE_A1OUT].tail);
+
+		i = c->q[BCACHE_A1IN].tail;
+		queue_remove(c, i);
+		c->free_bufs[c->num_free_bufs++] = c->entries[i].buf;
+		c->entries[i].buf = -1;
+		queue_push(c, i, BCACHE_A1OUT);
+		return;
+	}
+
+	drop(c, c->q[BCACHE_AM].tail);
+}
+
+const void *bcache_get(struct bcache *c, uint64_t key)
+{
+	struct bcache_entry *x;
+	int i = lookup(c, key);
+
+	if (i < 0 || c->entries[i].buf < 0) {
+		c->misses++;
+		return NULL;
+	}
+
+	/* A1in is a FIFO: a page read twice in a row is not hot yet */
+	x = &c->entries[i];
+	if (x->queue == BCACHE_AM) {
+		queue_remove(c, i);
+		queue_push(c, i, BCACHE_AM);
+	}
+
+	c->hits++;
+	return c->data + (size_t)x->buf * c->page_size;
+}
+
+void bcache_put(struct bcache *c, uint64_t key, const void *data)
+{
+	struct bcache_entry *x;
+	int i = lookup(c, key), queue = BCACHE_A1IN;
+	unsigned h;
+
+	if (i >= 0) {
+		if (c->entries[i].buf >= 0)
+			return;		/* read twice while in flight */
+		/* remembered in A1out: hot */
+		c->ghost_hits++;
+		queue = BCACHE_AM;
+		drop(c, i);
+	}
+
+	if (!c->num_free_bufs)
+		reclaim(c);
+
+	/* a ghost always gives up its entry before a page takes one */
+	if (c->free_entries < 0)
+		drop(c, c->q[BCACHE_A1OUT].tail);
+
+	i = c->free_entries;
+	x = &c->entries[i];
+	c->free_entries = x->hnext;
+
+	x->key = key;
+	x->buf = c->free_bufs[--c->num_free_bufs];
+	memcpy(c->data + (size_t)x->buf * c->page_size, data, c->page_size);
+
+	h = hash_key(c, key);
+	x->hnext = c->hash[h];
+	c->hash[h] = i;
+	queue_push(c, i, queue);
+}
+
+void bcache_reset(struct bcache *c)
+{
+	c->hits = c->misses = c->ghost_hits = 0;
+	c->evictions = c->bypassed = 0;
+}
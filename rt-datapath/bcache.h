@@ -0,0 +1,80 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Buffer cache shared by the streams of the workload engine, with a 2Q
+ * replacement policy so scans cannot flush it.
+ *
+ * A page read for the first time goes to A1in, a FIFO of a quarter of
+ * the cache. Pages falling out of A1in lose their data but their keys are
+ * remembered in A1out, a ghost FIFO half the size of the cache; a page
+ * read again while its key is there is hot and goes to Am, an LRU of the
+ * rest. A one-time sweep over many pages thus only cycles through A1in,
+ * and the pages that keep being asked for stay in Am. Sequential scans
+ * bypass the cache altogether.
+ *
+ * Pages are identified by a 64-bit key chosen by the caller. The engine
+ * is single threaded, so lookups take no locks.
+ */
+struct bcache_entry {
+	uint64_t key;
+	int queue;		/* BCACHE_A1IN, BCACHE_A1OUT or BCACHE_AM */
+	int buf;		/* page of data, -1 for ghosts */
+	int prev, next;		/* in its queue */
+	int hnext;		/* hash chain */
+};
+
+struct bcache_queue {
+	int head, tail;		/* newest, oldest; -1 when empty */
+	int n;
+};
+
+#define BCACHE_A1IN 0
+#define BCACHE_A1OUT 1
+#define BCACHE_AM 2
+
+struct bcache {
+	size_t page_size;
+	int pages;		/* capacity */
+	int kin, kout;		/* A1in and A1out sizes */
+
+	char *data;
+	int *free_bufs;
+	int num_free_bufs;
+
+	struct bcache_entry *entries;	/* pages + kout of them */
+	int free_entries;	/* list through hnext */
+	int *hash;
+	unsigned hash_bits;
+
+	struct bcache_queue q[3];
+
+	/* counters */
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long ghost_hits;	/* misses promoted to Am */
+	unsigned long long evictions;
+	unsigned long long bypassed;	/* scan reads kept out */
+};
+
+int bcache_init(struct bcache *c, int pages, size_t page_size);
+void bcache_free(struct bcache *c);
+
+/* the page's data, or NULL on a miss */
+const void *bcache_get(struct bcache *c, uint64_t key);
+
+/* add a page read after a miss */
+void bcache_put(struct bcache *c, uint64_t key, const void *data);
+
+static inline void bcache_bypass(struct bcache *c)
+{
+	c->bypassed++;
+}
+
+/* zero the counters */
+void bcache_reset(struct bcache *c);
+
+#endif
@@ -0,0 +1,79 @@
+import sys
+import json
+from optparse import OptionParser
+
+#
+# Compare a bench run against a stored baseline.
+#
+# Every benchmark reports higher-is-better rates as a median and a median
+# absolute deviation (MAD) over its repetitions. A benchmark regresses when
+# it drops below the baseline by more than both:
+#
+#  - a relative threshold (-t), and
+#  - k (-k) combined standard deviations, estimated from the two MADs.
+#
+# Exits non-zero if any benchmark regressed, or if one in the baseline is
+# missing from the run (renamed, removed or crashed) unless -m allows it.
+#
+# The MADs only cover noise within a run. Between runs on one host the
+# turbo, cache and scheduling state moves the medians further, so the
+# relative threshold carries most of the weight. Baselines are per host;
+# comparing across machines measures the machines.
+#
+
+# MAD -> standard deviation for normally distributed noise
+MAD_TO_SIGMA = 1.4826
+
+def load(filename):
+	with open(filename) as f:
+		doc = json.load(f)
+	return dict((b['name'], b) for b in doc['benchmarks'])
+
+def noise(base, cur):
+	sb = base['mad'] * MAD_TO_SIGMA
+	sc = cur['mad'] * MAD_TO_SIGMA
+	return (sb * sb + sc * sc) ** 0.5
+
+def compare(baseline, current, rel, k, allow_missing):
+	regressions = 0
+	for name in sorted(current):
+		cur = current[name]
+		if name not in baseline:
+			print("%-24s %14.1f %-10s (new)" % (name, cur['median'], cur['unit']))
+			continue
+		base = baseline[name]
+		delta = cur['median'] - base['median']
+		limit = max(rel * base['median'], k * noise(base, cur))
+		if delta < -limit:
+			status = "REGRESSION"
+			regressions += 1
+		elif delta > limit:
+			status = "improved"
+		else:
+			status = "ok"
+		print("%-24s %14.1f %14.1f %+7.1f%%  %s" % (name, base['median'],
+			cur['median'], 100.0 * delta / base['median'], status))
+	for name in sorted(set(baseline) - set(current)):
+		print("%-24s missing from current run" % (name,))
+		if not allow_missing:
+			regressions += 1
+	return regressions
+
+if __name__ == '__main__':
+	parser = OptionParser(usage="%prog [options] baseline.json current.json")
+	parser.add_option("-t", dest="rel", type="float", default=0.25,
+			help="relative regression threshold (default 0.25)")
+	parser.add_option("-k", dest="k", type="float", default=3.0,
+			help="noise multiplier (default 3.0)")
+	parser.add_option("-m", dest="allow_missing", action="store_true",
+			default=False, help="only warn about baseline benchmarks "
+			"missing from the run")
+	opts, args = parser.parse_args()
+	if len(args) != 2:
+		parser.error("need a baseline and a current run")
+
+	regressions = compare(load(args[0]), load(args[1]), opts.rel, opts.k,
+			opts.allow_missing)
+	if regressions:
+		print("%d benchmark(s) regressed or missing" % (regressions,))
+		sys.exit(1)
@@ -0,0 +1,868 @@
+/*
+ * Benchmark regression suite.
+ *
+ * Runs fixed-seed micro-benchmarks of the pieces the drivers are built
+ * from (I/O engines, offset generators, allocators, goodness solvers) and
+ * writes the results as JSON. Each benchmark is repeated and reported as a
+ * median with its median absolute deviation, which bench-compare.py uses
+ * as the noise estimate when checking against a stored baseline.
+ *
+ * The I/O benchmarks run on a file in tmpfs by default. Pass -f to use
+ * another file or a loop/block device instead.
+ *
+ * Rates depend on the machine, so a baseline is only good for the host it
+ * was made on: regenerate it there (make bench-baseline) before checking
+ * against it. The JSON leaves out anything naming the host or the run.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#ifdef HAVE_LIBAIO
+#include <libaio.h>
+#endif
+
+#include "rng.h"
+#include "pool.h"
+#include "offset.h"
+#include "pmodel.h"
+#include "goodness.h"
+#include "admit.h"
+#include "ioengine.h"
+#include "block.h"
+#include "tuple.h"
+#include "column.h"
+#include "join.h"
+#include "share.h"
+
+#define READ_SIZE (4096)
+#define NSEC_PER_SEC (1000000000)
+#define MAX_REPS 100
+
+#define IO_OPS (16384)
+#define OFFSET_OPS (1 << 24)
+#define ALLOC_OPS (1 << 22)
+#define AIO_DEPTH 32
+#define VERIFY_BLOCKS 256
+#define VERIFY_PASSES 64
+#define TUPLE_BLOCKS 256
+#define TUPLE_PASSES 64
+#define ADMIT_OPS (1 << 18)
+#define ADMIT_HELD 1024
+
+struct bench_ctx {
+	uint64_t seed;
+	int rep;
+
+	/* I/O target */
+	char *target;
+	int fd;
+	int direct;
+	long long num_blocks;
+
+	/* goodness solvers */
+	struct pmodel *pm;
+};
+
+struct bench {
+	const char *name;
+	const char *unit;
+	double (*fn)(struct bench_ctx *ctx, void *arg);
+	void *arg;
+	int needs_pmodel;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec / (double)NSEC_PER_SEC;
+}
+
+/*
+ * Every repetition gets its own, but fixed, seed
+ */
+static void rep_seed(struct bench_ctx *ctx, struct rng *r)
+{
+	rng_seed(r, ctx->seed + ctx->rep);
+}
+
+/* keeps the compiler from discarding benchmark loops */
+static volatile long long sink;
+
+/*
+ * Offset generators
+ */
+static double bench_offset_libc(struct bench_ctx *ctx, void *arg)
+{
+	long long block, sum = 0;
+	double start;
+	int i;
+
+	srand(ctx->seed + ctx->rep);
+	start = now();
+	for (i = 0; i < OFFSET_OPS; i++) {
+		/* as in rnd.c */
+		block = ((double)(ctx->num_blocks - 1)) * (((double)rand()) / ((double)RAND_MAX));
+		sum += block * READ_SIZE;
+	}
+	sink = sum;
+	return OFFSET_OPS / (now() - start);
+}
+
+static double bench_offset_rnd(struct bench_ctx *ctx, void *arg)
+{
+	long long sum = 0;
+	struct rng r;
+	double start;
+	int i;
+
+	rep_seed(ctx, &r);
+	start = now();
+	for (i = 0; i < OFFSET_OPS; i++)
+		sum += offset_rnd(&r, ctx->num_blocks, READ_SIZE);
+	sink = sum;
+	return OFFSET_OPS / (now() - start);
+}
+
+static double bench_offset_seq(struct bench_ctx *ctx, void *arg)
+{
+	long long sum = 0, cursor = 0;
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < OFFSET_OPS; i++)
+		sum += offset_seq(&cursor, ctx->num_blocks, READ_SIZE);
+	sink = sum;
+	return OFFSET_OPS / (now() - start);
+}
+
+/*
+ * Allocators: the request free list the engine uses vs. malloc per IO
+ */
+static double bench_alloc_pool(struct bench_ctx *ctx, void *arg)
+{
+	void *objs[AIO_DEPTH], *bufs[AIO_DEPTH];
+	struct pool p;
+	double start;
+	int i, j;
+
+	assert(pool_init(&p, AIO_DEPTH) == 0);
+	for (i = 0; i < AIO_DEPTH; i++) {
+		assert(posix_memalign(&bufs[i], 512, READ_SIZE) == 0);
+		pool_put(&p, bufs[i]);
+	}
+
+	start = now();
+	for (i = 0; i < ALLOC_OPS; i += AIO_DEPTH) {
+		for (j = 0; j < AIO_DEPTH; j++)
+			objs[j] = pool_get(&p);
+		for (j = 0; j < AIO_DEPTH; j++)
+			pool_put(&p, objs[j]);
+	}
+	sink = (long long)objs[0];
+
+	for (i = 0; i < AIO_DEPTH; i++)
+		free(bufs[i]);
+	free(p.free);
+	return ALLOC_OPS / (now() - start);
+}
+
+static double bench_alloc_malloc(struct bench_ctx *ctx, void *arg)
+{
+	void *objs[AIO_DEPTH];
+	double start;
+	int i, j;
+
+	start = now();
+	for (i = 0; i < ALLOC_OPS; i += AIO_DEPTH) {
+		for (j = 0; j < AIO_DEPTH; j++)
+			assert(posix_memalign(&objs[j], 512, READ_SIZE) == 0);
+		for (j = 0; j < AIO_DEPTH; j++)
+			free(objs[j]);
+	}
+	return ALLOC_OPS / (now() - start);
+}
+
+/*
+ * I/O engines
+ */
+static double bench_io_psync(struct bench_ctx *ctx, void *arg)
+{
+	int random = arg != NULL;
+	long long cursor = 0, off;
+	struct rng r;
+	double start;
+	void *buf;
+	int i;
+
+	assert(posix_memalign(&buf, 512, READ_SIZE) == 0);
+	rep_seed(ctx, &r);
+
+	start = now();
+	for (i = 0; i < IO_OPS; i++) {
+		if (random)
+			off = offset_rnd(&r, ctx->num_blocks, READ_SIZE);
+		else
+			off = offset_seq(&cursor, ctx->num_blocks, READ_SIZE);
+		if (pread(ctx->fd, buf, READ_SIZE, off) != READ_SIZE) {
+			perror("pread");
+			exit(1);
+		}
+	}
+
+	free(buf);
+	return IO_OPS / (now() - start);
+}
+
+#ifdef HAVE_LIBAIO
+static double bench_io_libaio(struct bench_ctx *ctx, void *arg)
+{
+	struct iocb iocbs[AIO_DEPTH], *ioq[AIO_DEPTH];
+	struct io_event events[AIO_DEPTH];
+	void *bufs[AIO_DEPTH];
+	io_context_t aio;
+	int i, n, ret, submitted = 0, done = 0;
+	struct rng r;
+	double start;
+
+	memset(&aio, 0, sizeof(aio));
+	ret = io_queue_init(AIO_DEPTH, &aio);
+	if (ret) {
+		fprintf(stderr, "io_queue_init: %s\n", strerror(-ret));
+		exit(1);
+	}
+
+	for (i = 0; i < AIO_DEPTH; i++)
+		assert(posix_memalign(&bufs[i], 512, READ_SIZE) == 0);
+	rep_seed(ctx, &r);
+
+	start = now();
+
+	/* fill the queue, then resubmit each completion */
+	for (i = 0; i < AIO_DEPTH; i++) {
+		io_prep_pread(&iocbs[i], ctx->fd, bufs[i], READ_SIZE,
+				offset_rnd(&r, ctx->num_blocks, READ_SIZE));
+		ioq[i] = &iocbs[i];
+	}
+	ret = io_submit(aio, AIO_DEPTH, ioq);
+	assert(ret == AIO_DEPTH);
+	submitted = AIO_DEPTH;
+
+	while (done < IO_OPS) {
+		ret = io_getevents(aio, 1, AIO_DEPTH, events, NULL);
+		assert(ret > 0);
+		done += ret;
+
+		for (i = 0, n = 0; i < ret && submitted < IO_OPS; i++, n++) {
+			struct iocb *io = events[i].obj;
+
+			if (events[i].res != READ_SIZE) {
+				fprintf(stderr, "aio read: %ld\n", events[i].res);
+				exit(1);
+			}
+			io_prep_pread(io, ctx->fd, io->u.c.buf, READ_SIZE,
+					offset_rnd(&r, ctx->num_blocks, READ_SIZE));
+			ioq[n] = io;
+			submitted++;
+		}
+		if (n)
+			assert(io_submit(aio, n, ioq) == n);
+	}
+
+	start = now() - start;
+	io_destroy(aio);
+	for (i = 0; i < AIO_DEPTH; i++)
+		free(bufs[i]);
+	return IO_OPS / start;
+}
+#endif
+
+/*
+ * The same queue-depth 32 random reads through an I/O engine (ioengine.h),
+ * by wall clock: for the sim engine that is what the simulation costs
+ */
+static double bench_io_engine(struct bench_ctx *ctx, void *arg)
+{
+	struct io_req reqs[AIO_DEPTH], *ioq[AIO_DEPTH], *done[AIO_DEPTH];
+	char spec[64];
+	struct io_engine *io;
+	long long size;
+	int i, n, fd, submitted, reaped = 0;
+	struct rng r;
+	double start;
+
+	/* tmpfs takes no O_DIRECT */
+	snprintf(spec, sizeof(spec), "%s%s", (char *)arg,
+			!ctx->direct && !strcmp(arg, "uring") ? ":buffered" : "");
+	io = ioengine_create(spec, AIO_DEPTH);
+	if (!io)
+		exit(1);
+	fd = ioengine_open(io, ctx->target, O_RDONLY, &size);
+	if (fd < 0)
+		exit(1);
+
+	for (i = 0; i < AIO_DEPTH; i++)
+		assert(posix_memalign(&reqs[i].buf, 512, READ_SIZE) == 0);
+	rep_seed(ctx, &r);
+
+	start = now();
+
+	/* fill the queue, then resubmit each completion */
+	for (i = 0; i < AIO_DEPTH; i++) {
+		io_req_prep(&reqs[i], IO_READ, fd, reqs[i].buf, READ_SIZE,
+				offset_rnd(&r, ctx->num_blocks, READ_SIZE));
+		ioq[i] = &reqs[i];
+	}
+	assert(ioengine_submit(io, ioq, AIO_DEPTH) == 0);
+	submitted = AIO_DEPTH;
+
+	while (reaped < IO_OPS) {
+		n = ioengine_getevents(io, 1, AIO_DEPTH, done, -1);
+		assert(n > 0);
+		reaped += n;
+
+		for (i = 0; i < n; i++)
+			if (done[i]->res != READ_SIZE) {
+				fprintf(stderr, "%s read: %ld\n", spec, done[i]->res);
+				exit(1);
+			}
+		for (i = 0; i < n && submitted < IO_OPS; i++, submitted++)
+			io_req_prep(done[i], IO_READ, fd, done[i]->buf, READ_SIZE,
+					offset_rnd(&r, ctx->num_blocks, READ_SIZE));
+		if (i)
+			assert(ioengine_submit(io, done, i) == 0);
+	}
+
+	start = now() - start;
+	ioengine_close(io, fd);
+	ioengine_destroy(io);
+	for (i = 0; i < AIO_DEPTH; i++)
+		free(reqs[i].buf);
+	return IO_OPS / start;
+}
+
+/*
+ * Admission decisions (admit.c) as admitd makes them, on admit-load's mix
+ * of queries: the last ADMIT_HELD admitted are held and the oldest
+ * released, in virtual time a millisecond a decision
+ */
+static double bench_admit(struct bench_ctx *ctx, void *arg)
+{
+	uint64_t held[ADMIT_HELD];
+	struct admit_req req;
+	struct admit_resp resp;
+	struct admit a;
+	int i, k, head = 0, num_held = 0;
+	struct rng r;
+	double start, t = 0;
+
+	assert(admit_init(&a, ctx->pm, 2, 262144, 0, 2 * ADMIT_HELD) == 0);
+	rep_seed(ctx, &r);
+	memset(&req, 0, sizeof(req));
+
+	start = now();
+	for (i = 0; i < ADMIT_OPS; i++, t += 0.001) {
+		admit_expire(&a, t);
+		if (num_held == ADMIT_HELD) {
+			req.op = ADMIT_OP_RELEASE;
+			req.id = held[head];
+			head = (head + 1) % ADMIT_HELD;
+			num_held--;
+			admit_handle(&a, &req, &resp, t);
+			continue;
+		}
+
+		k = rng_range(&r, 10);
+		req.op = ADMIT_OP_ADMIT;
+		req.id = i;
+		req.kind = k < 7 ? ADMIT_AUTO : k < 9 ? ADMIT_SCAN : ADMIT_JOIN;
+		req.table = rng_range(&r, 2);
+		req.build_table = rng_range(&r, 2);
+		req.blocks = 1 + rng_range(&r, 10000);
+		req.deadline_ms = 1 + rng_range(&r, 300000);
+		admit_handle(&a, &req, &resp, t);
+		if (resp.status == ADMIT_ACCEPT) {
+			held[(head + num_held) % ADMIT_HELD] = req.id;
+			num_held++;
+		}
+	}
+	start = now() - start;
+	sink = a.accepted;
+
+	admit_free(&a);
+	return ADMIT_OPS / start;
+}
+
+/*
+ * Goodness solvers over random workloads, as in WorkloadGenerator.java
+ */
+#define WORKLOADS_PER_REP 16
+#define MAX_BLOCKS 262144
+#define MAX_DEADLINE 300
+
+static void random_workload(struct rng *r, struct query *q, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		q[i].blocks = 1 + rng_range(r, MAX_BLOCKS);
+		q[i].deadline = 1 + rng_range(r, MAX_DEADLINE);
+	}
+}
+
+static double bench_goodness(struct bench_ctx *ctx, double (*solver)(
+			const struct pmodel *, const struct query *, int,
+			unsigned char *), int n)
+{
+	struct query q[n];
+	unsigned char qi[n];
+	double start, elapsed = 0, g = 0;
+	struct rng r;
+	int i;
+
+	rep_seed(ctx, &r);
+	for (i = 0; i < WORKLOADS_PER_REP; i++) {
+		random_workload(&r, q, n);
+		start = now();
+		g += solver(ctx->pm, q, n, qi);
+		elapsed += now() - start;
+	}
+	sink = g;
+	return WORKLOADS_PER_REP / elapsed;
+}
+
+static double bench_goodness_exhaustive(struct bench_ctx *ctx, void *arg)
+{
+	return bench_goodness(ctx, goodness_exhaustive, (long)arg);
+}
+
+static double bench_goodness_solve(struct bench_ctx *ctx, void *arg)
+{
+	return bench_goodness(ctx, goodness_solve, (long)arg);
+}
+
+/*
+ * Block stamp checks, as done by the readers with -V
+ */
+static double bench_verify(struct bench_ctx *ctx, void *arg)
+{
+	char *buf;
+	double start;
+	long long bad = 0;
+	int i, j;
+
+	assert(posix_memalign((void **)&buf, BLOCK_SIZE,
+				VERIFY_BLOCKS * BLOCK_SIZE) == 0);
+	for (i = 0; i < VERIFY_BLOCKS; i++)
+		block_fill(buf + i * BLOCK_SIZE, 0, i, ctx->seed);
+
+	start = now();
+	for (j = 0; j < VERIFY_PASSES; j++)
+		for (i = 0; i < VERIFY_BLOCKS; i++)
+			bad += block_check(buf + i * BLOCK_SIZE, 0, i, ctx->seed);
+	sink = bad;
+	start = now() - start;
+
+	free(buf);
+	return VERIFY_PASSES * VERIFY_BLOCKS * (BLOCK_SIZE / 1048576.0) / start;
+}
+
+/*
+ * TUPLE_BLOCKS blocks for the tuple benches, the first nloc of them
+ * Location rows and the rest of format
+ */
+static char *tuple_blocks(struct bench_ctx *ctx, int format, int nloc)
+{
+	char *buf;
+	int i;
+
+	assert(posix_memalign((void **)&buf, BLOCK_SIZE,
+				TUPLE_BLOCKS * BLOCK_SIZE) == 0);
+	for (i = 0; i < TUPLE_BLOCKS; i++)
+		tuple_fill(buf + i * BLOCK_SIZE, i < nloc ? TUPLE_LOCATION : format,
+				0, i, ctx->seed);
+	return buf;
+}
+
+/*
+ * Tuple scan kernels over Object/Location blocks, in tuples/s
+ */
+static double bench_scan(struct bench_ctx *ctx, void *arg)
+{
+	const struct tuple_query *q = tuple_query_find(arg);
+	struct tuple_agg agg = { 0, 0, 0 };
+	char *buf = tuple_blocks(ctx, q->format, 0);
+	double start;
+	int i, j;
+
+	start = now();
+	for (j = 0; j < TUPLE_PASSES; j++)
+		for (i = 0; i < TUPLE_BLOCKS; i++)
+			tuple_scan(q, buf + i * BLOCK_SIZE, &agg);
+	start = now() - start;
+	sink = agg.matched;
+
+	free(buf);
+	return agg.tuples / start;
+}
+
+/*
+ * The same query over the row groups of a columnar file
+ */
+static double bench_scan_columns(struct bench_ctx *ctx, void *arg)
+{
+	const struct tuple_query *q = tuple_query_find(arg);
+	int groups = TUPLE_BLOCKS / tuple_columns(q->format);
+	struct column_zone zones[TUPLE_BLOCKS];
+	struct tuple_agg agg = { 0, 0, 0 };
+	double start;
+	char *buf;
+	int i, j;
+
+	assert(posix_memalign((void **)&buf, BLOCK_SIZE,
+				TUPLE_BLOCKS * BLOCK_SIZE) == 0);
+	for (i = 0; i < groups * tuple_columns(q->format); i++)
+		column_fill(buf + i * BLOCK_SIZE, q->format, 0, i, ctx->seed,
+				groups, zones);
+
+	start = now();
+	for (j = 0; j < TUPLE_PASSES; j++)
+		for (i = 0; i < groups; i++)
+			column_scan(q, buf + (q->pred_col * groups + i) * BLOCK_SIZE,
+					q->agg_col < 0 ? NULL :
+					buf + (q->agg_col * groups + i) * BLOCK_SIZE,
+					&agg);
+	start = now() - start;
+	sink = agg.matched;
+
+	free(buf);
+	return agg.tuples / start;
+}
+
+/*
+ * Q3 over a block of Location rows per 4 blocks of Object rows, build and
+ * probe included
+ */
+static double bench_join(struct bench_ctx *ctx, void *arg)
+{
+	int nloc = TUPLE_BLOCKS / 5;
+	char *buf = tuple_blocks(ctx, TUPLE_OBJECT, nloc);
+	struct join j;
+	double start;
+	int i, k;
+
+	start = now();
+	for (k = 0; k < TUPLE_PASSES; k++) {
+		assert(join_init(&j, 6) == 0);
+		for (i = 0; i < nloc; i++)
+			join_block(&j, buf + i * BLOCK_SIZE);
+		assert(join_build(&j) == 0);
+		for (; i < TUPLE_BLOCKS; i++)
+			join_block(&j, buf + i * BLOCK_SIZE);
+		join_finish(&j);
+		sink = j.matches;
+		join_free(&j);
+	}
+	start = now() - start;
+
+	free(buf);
+	return TUPLE_PASSES * (nloc * (double)LOCATION_ROWS +
+			(TUPLE_BLOCKS - nloc) * (double)OBJECT_ROWS) / start;
+}
+
+/*
+ * Scan rate with n Q1/Q2 variants attached, shared or one after another
+ */
+static double share_run(struct bench_ctx *ctx, int n, int shared)
+{
+	struct tuple_query qs[n];
+	struct tuple_agg agg[n];
+	unsigned long long tuples = 0;
+	struct share sh;
+	double start;
+	char *buf;
+	int i, j, k;
+
+	share_make_queries(qs, n, ctx->seed);
+	assert(share_init(&sh, qs, n) == 0);
+	memset(agg, 0, sizeof(agg));
+	buf = tuple_blocks(ctx, TUPLE_OBJECT, 0);
+
+	start = now();
+	for (j = 0; j < TUPLE_PASSES; j++)
+		for (i = 0; i < TUPLE_BLOCKS; i++) {
+			if (shared) {
+				tuples += share_scan(&sh, buf + i * BLOCK_SIZE);
+				continue;
+			}
+			for (k = 0; k < n; k++)
+				tuple_scan(&qs[k], buf + i * BLOCK_SIZE, &agg[k]);
+			tuples += OBJECT_ROWS;
+		}
+	share_results(&sh);
+	start = now() - start;
+	sink = sh.queries[0].result.matched + agg[0].matched;
+
+	share_free(&sh);
+	free(buf);
+	return tuples / start;
+}
+
+static double bench_share(struct bench_ctx *ctx, void *arg)
+{
+	return share_run(ctx, (long)arg, 1);
+}
+
+static double bench_share_naive(struct bench_ctx *ctx, void *arg)
+{
+	return share_run(ctx, (long)arg, 0);
+}
+
+static struct bench benches[] = {
+	{ "offset.libc_rand", "offsets/s", bench_offset_libc, NULL, 0 },
+	{ "offset.rnd", "offsets/s", bench_offset_rnd, NULL, 0 },
+	{ "offset.seq", "offsets/s", bench_offset_seq, NULL, 0 },
+	{ "alloc.pool", "allocs/s", bench_alloc_pool, NULL, 0 },
+	{ "alloc.malloc", "allocs/s", bench_alloc_malloc, NULL, 0 },
+	{ "io.psync.seq", "iops", bench_io_psync, NULL, 0 },
+	{ "io.psync.rnd", "iops", bench_io_psync, (void *)1, 0 },
+#ifdef HAVE_LIBAIO
+	{ "io.libaio.rnd.qd32", "iops", bench_io_libaio, NULL, 0 },
+#endif
+#ifdef HAVE_URING
+	{ "io.uring.rnd.qd32", "iops", bench_io_engine, "uring", 0 },
+#endif
+	{ "io.sim.rnd.qd32", "iops", bench_io_engine, "sim", 0 },
+	{ "verify.block", "MB/s", bench_verify, NULL, 0 },
+	{ "scan.q1", "tuples/s", bench_scan, "Q1", 0 },
+	{ "scan.q3l", "tuples/s", bench_scan, "Q3L", 0 },
+	{ "scan.q1.columnar", "tuples/s", bench_scan_columns, "Q1", 0 },
+	{ "join.q3", "tuples/s", bench_join, NULL, 0 },
+	{ "share.1", "tuples/s", bench_share, (void *)1, 0 },
+	{ "share.16", "tuples/s", bench_share, (void *)16, 0 },
+	{ "share.256", "tuples/s", bench_share, (void *)256, 0 },
+	{ "share.naive.16", "tuples/s", bench_share_naive, (void *)16, 0 },
+	{ "goodness.exhaustive.12", "solves/s", bench_goodness_exhaustive, (void *)12, 1 },
+	{ "goodness.solve.12", "solves/s", bench_goodness_solve, (void *)12, 1 },
+	{ "goodness.solve.256", "solves/s", bench_goodness_solve, (void *)256, 1 },
+	{ "admit.decide", "decisions/s", bench_admit, NULL, 1 },
+	{ NULL },
+};
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double median(double *vals, int n)
+{
+	qsort(vals, n, sizeof(*vals), double_cmp);
+	return n % 2 ? vals[n / 2] : (vals[n / 2 - 1] + vals[n / 2]) / 2;
+}
+
+/*
+ * Median absolute deviation: robust to the odd slow repetition
+ */
+static double mad(const double *vals, int n, double med)
+{
+	double dev[n];
+	int i;
+
+	for (i = 0; i < n; i++)
+		dev[i] = vals[i] > med ? vals[i] - med : med - vals[i];
+	return median(dev, n);
+}
+
+/*
+ * Create a tmpfs file of random data to read from
+ */
+static int make_target(struct bench_ctx *ctx, long long size)
+{
+	char path[] = "/dev/shm/rt-bench.XXXXXX";
+	struct rng r;
+	uint64_t buf[READ_SIZE / sizeof(uint64_t)];
+	long long i;
+	int fd, j;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	rng_seed(&r, ctx->seed);
+	for (i = 0; i < size / READ_SIZE; i++) {
+		for (j = 0; j < READ_SIZE / sizeof(uint64_t); j++)
+			buf[j] = rng_next(&r);
+		if (write(fd, buf, READ_SIZE) != READ_SIZE) {
+			perror(path);
+			close(fd);
+			unlink(path);
+			return -1;
+		}
+	}
+
+	close(fd);
+	ctx->target = strdup(path);
+	return 0;
+}
+
+/*
+ * Open the target, preferring O_DIRECT when the file system supports it
+ */
+static int open_target(struct bench_ctx *ctx)
+{
+	off_t size;
+
+	ctx->direct = 1;
+	ctx->fd = open(ctx->target, O_RDONLY|O_DIRECT);
+	if (ctx->fd < 0 && errno == EINVAL) {
+		ctx->direct = 0;
+		ctx->fd = open(ctx->target, O_RDONLY);
+	}
+	if (ctx->fd < 0) {
+		perror(ctx->target);
+		return -1;
+	}
+
+	/* works for regular files and block devices alike */
+	size = lseek(ctx->fd, 0, SEEK_END);
+	if (size < READ_SIZE) {
+		fprintf(stderr, "%s: too small\n", ctx->target);
+		return -1;
+	}
+	ctx->num_blocks = size / READ_SIZE;
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: [-f <file or device>] [-l <tmpfs file MB>] [-S <seed>]\n"
+			"       [-r <reps>] [-p <perf model>] [-o <output.json>] [-n <name filter>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx;
+	struct pmodel pm;
+	struct bench *b;
+	double vals[MAX_REPS], med;
+	char *pmodel_file = NULL, *output = NULL, *filter = NULL;
+	long long size_mb = 64;
+	int reps = 5, made_target = 0, first = 1;
+	FILE *out = stdout;
+	char c;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.seed = 42;
+	ctx.fd = -1;
+
+	while ((c = getopt(argc, argv, "f:l:S:r:p:o:n:")) != -1) {
+		switch (c) {
+		case 'f':
+			ctx.target = strdup(optarg);
+			break;
+		case 'l':
+			size_mb = atoll(optarg);
+			break;
+		case 'S':
+			ctx.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'p':
+			pmodel_file = strdup(optarg);
+			break;
+		case 'o':
+			output = strdup(optarg);
+			break;
+		case 'n':
+			filter = strdup(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (reps < 1 || reps > MAX_REPS) {
+		fprintf(stderr, "reps = %d is crazy!\n", reps);
+		exit(1);
+	}
+
+	if (size_mb < 1) {
+		usage();
+		exit(1);
+	}
+
+	if (!ctx.target) {
+		if (make_target(&ctx, size_mb << 20))
+			exit(1);
+		made_target = 1;
+	}
+
+	if (open_target(&ctx))
+		exit(1);
+
+	if (pmodel_file) {
+		if (pmodel_load(&pm, pmodel_file))
+			exit(1);
+		ctx.pm = &pm;
+	}
+
+	if (output) {
+		out = fopen(output, "w");
+		if (!out) {
+			perror(output);
+			exit(1);
+		}
+	}
+
+	fprintf(out, "{\n  \"seed\": %llu,\n  \"reps\": %d,\n  \"direct\": %d,\n"
+			"  \"benchmarks\": [", (unsigned long long)ctx.seed, reps,
+			ctx.direct);
+
+	for (b = benches; b->name; b++) {
+		if (filter && !strstr(b->name, filter))
+			continue;
+		if (b->needs_pmodel && !ctx.pm) {
+			fprintf(stderr, "%s: skipped, no perf model (-p)\n", b->name);
+			continue;
+		}
+
+		for (ctx.rep = 0; ctx.rep < reps; ctx.rep++)
+			vals[ctx.rep] = b->fn(&ctx, b->arg);
+
+		med = median(vals, reps);
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", "
+				"\"median\": %.3f, \"mad\": %.3f, \"min\": %.3f, \"max\": %.3f}",
+				first ? "" : ",", b->name, b->unit, med,
+				mad(vals, reps, med), vals[0], vals[reps - 1]);
+		fprintf(stderr, "%-24s %14.1f %s\n", b->name, med, b->unit);
+		first = 0;
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+
+	close(ctx.fd);
+	if (made_target)
+		unlink(ctx.target);
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rng.h"
+#include "crc32c.h"
+
+/*
+ * Layout of generated relation files (see gen-data.c). Every 4 KiB block
+ * starts with a header saying where it belongs, followed by a payload of
+ * pseudo-random words seeded from that header. Any block can therefore be
+ * regenerated and checked on its own, and no layer under the file system
+ * can compress or dedupe the data away.
+ *
+ * The header also carries a CRC32C of the payload, so readers can check a
+ * block (block_check()) at the cost of one checksum rather than by
+ * regenerating it.
+ */
+#define BLOCK_SIZE (4096)
+#define BLOCK_MAGIC (0x50445452)	/* "RTDP" */
+
+struct block_hdr {
+	uint32_t magic;
+	uint32_t file_id;
+	uint64_t block;		/* block number within the file */
+	uint64_t seed;
+	uint32_t crc;		/* CRC32C of the payload */
+	uint16_t format;	/* BLOCK_RANDOM or a table, see tuple.h */
+	uint16_t rows;		/* tuples in the payload */
+};
+
+#define BLOCK_RANDOM 0
+
+#define BLOCK_PAYLOAD (BLOCK_SIZE - sizeof(struct block_hdr))
+
+/* seq and rnd files are numbered separately, as in their names */
+static inline uint32_t block_file_id(int random, int idx)
+{
+	return (random ? 1u << 24 : 0) | (uint32_t)idx;
+}
+
+/*
+ * Write the header of a block and seed r for its payload. Once the
+ * payload is in place block_seal() adds the checksum.
+ */
+static inline void block_stamp(void *buf, uint32_t file_id, uint64_t block,
+		uint64_t seed, int format, int rows, struct rng *r)
+{
+	struct block_hdr *h = (struct block_hdr *)buf;
+
+	h->magic = BLOCK_MAGIC;
+	h->file_id = file_id;
+	h->block = block;
+	h->seed = seed;
+	h->crc = 0;
+	h->format = format;
+	h->rows = rows;
+
+	/* file ids fit in 24 bits and block numbers in 40 */
+	rng_seed(r, seed ^ ((uint64_t)file_id << 40) ^ block);
+}
+
+static inline void block_seal(void *buf)
+{
+	struct block_hdr *h = (struct block_hdr *)buf;
+
+	h->crc = crc32c(0, h + 1, BLOCK_PAYLOAD);
+}
+
+static inline void block_fill(void *buf, uint32_t file_id, uint64_t block,
+		uint64_t seed)
+{
+	uint64_t *p = (uint64_t *)((struct block_hdr *)buf + 1);
+	struct rng r;
+	size_t i;
+
+	block_stamp(buf, file_id, block, seed, BLOCK_RANDOM, 0, &r);
+	for (i = 0; i < BLOCK_PAYLOAD / sizeof(*p); i++)
+		p[i] = rng_next(&r);
+	block_seal(buf);
+}
+
+enum {
+	BLOCK_OK,
+	BLOCK_BAD_MAGIC,	/* not generated data, or zeroed */
+	BLOCK_BAD_FILE,		/* misdirected to another file */
+	BLOCK_BAD_BLOCK,	/* misdirected within the file */
+	BLOCK_BAD_SEED,		/* left over from another data set */
+	BLOCK_BAD_CRC,		/* torn or corrupted payload */
+};
+
+static inline const char *block_strerror(int err)
+{
+	static const char *msgs[] = { "ok", "bad magic", "wrong file",
+		"wrong block", "wrong seed", "payload checksum mismatch" };
+
+	return msgs[err];
+}
+
+/*
+ * Check a block read from (file_id, block) against its stamp
+ */
+static inline int block_check(const void *buf, uint32_t file_id,
+		uint64_t block, uint64_t seed)
+{
+	const struct block_hdr *h = (const struct block_hdr *)buf;
+
+	if (h->magic != BLOCK_MAGIC)
+		return BLOCK_BAD_MAGIC;
+	if (h->file_id != file_id)
+		return BLOCK_BAD_FILE;
+	if (h->block != block)
+		return BLOCK_BAD_BLOCK;
+	if (h->seed != seed)
+		return BLOCK_BAD_SEED;
+	if (h->crc != crc32c(0, h + 1, BLOCK_PAYLOAD))
+		return BLOCK_BAD_CRC;
+	return BLOCK_OK;
+}
+
+/*
+ * File id of a "$BASE.seq.N.dat" or "$BASE.rnd.N.dat" name, or -1
+ */
+static inline long long block_file_id_from_name(const char *filename)
+{
+	size_t len = strlen(filename);
+	const char *p = filename + len;
+	int idx, n;
+
+	if (len < 4 || strcmp(p - 4, ".dat"))
+		return -1;
+	for (p -= 4; p > filename && p[-1] != '.'; p--)
+		;
+	if (p - filename < 5 || sscanf(p, "%d.dat%n", &idx, &n) != 1 ||
+			p + n != filename + len)
+		return -1;
+	if (!strncmp(p - 5, ".seq.", 5))
+		return block_file_id(0, idx);
+	if (!strncmp(p - 5, ".rnd.", 5))
+		return block_file_id(1, idx);
+	return -1;
+}
+
+#endif
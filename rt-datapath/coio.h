@@ -0,0 +1,421 @@
+#ifndef COIO_H
+#define COIO_H
+
+/*
+ * C++20 coroutines over the I/O engine (ioengine.h).
+ *
+ * A stream is written as straight-line code,
+ *
+ *	coio::task<long> scan(coio::scheduler &s, int fd, long long off)
+ *	{
+ *		coio::buffer b = co_await s.read(fd, off, 4096);
+ *		...
+ *	}
+ *
+ * and co_await suspends it without a thread until the read is in. Tasks
+ * can co_await other tasks (scan, then probe, then aggregate) and the
+ * result is handed back directly, by symmetric transfer. Top-level tasks
+ * are spawn()ed on a scheduler, whose run() loop resumes whatever is ready,
+ * submits the reads queued meanwhile in one batch, and reaps completions.
+ *
+ * Per stream state is the coroutine frame alone, a few hundred bytes;
+ * frames come from size-class free lists, so starting and finishing
+ * streams does not touch malloc once warm. Read buffers are pooled by the
+ * scheduler and only held while a read is in flight or its buffer object
+ * lives, so thousands of streams can share a queue depth of a few dozen:
+ * a read finding the pool empty waits for the next buffer to be freed.
+ */
+#include <coroutine>
+#include <cstdlib>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "ioengine.h"
+
+namespace coio {
+
+/*
+ * Coroutine frames, by 64 byte size class
+ */
+class frame_pool {
+public:
+	static constexpr size_t granule = 64;
+	static constexpr size_t classes = 64;	/* frames up to 4 KB */
+
+	static void *alloc(size_t n)
+	{
+		frame_pool &p = get();
+		size_t c = (n + granule - 1) / granule;
+
+		p.live++;
+		p.bytes += c * granule;
+		if (p.bytes > p.peak_bytes)
+			p.peak_bytes = p.bytes;
+		if (c >= classes)
+			return ::operator new(n);
+		if (p.free[c]) {
+			void *f = p.free[c];
+
+			p.free[c] = *(void **)f;
+			return f;
+		}
+		return ::operator new(c * granule);
+	}
+
+	static void release(void *f, size_t n)
+	{
+		frame_pool &p = get();
+		size_t c = (n + granule - 1) / granule;
+
+		p.live--;
+		p.bytes -= c * granule;
+		if (c >= classes) {
+			::operator delete(f);
+			return;
+		}
+		*(void **)f = p.free[c];
+		p.free[c] = f;
+	}
+
+	static frame_pool &get()
+	{
+		static thread_local frame_pool p;
+		return p;
+	}
+
+	size_t live = 0;
+	size_t bytes = 0;
+	size_t peak_bytes = 0;
+
+private:
+	void *free[classes] = {};
+};
+
+class scheduler;
+
+/*
+ * A completed read: the request and its buffer, handed back to the
+ * scheduler's pool when this goes out of scope
+ */
+class buffer {
+public:
+	buffer() = default;
+	buffer(scheduler *s, io_req *req) : s_(s), req_(req) {}
+	buffer(buffer &&o) noexcept
+		: s_(std::exchange(o.s_, nullptr)), req_(std::exchange(o.req_, nullptr)) {}
+	buffer &operator=(buffer &&o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			s_ = std::exchange(o.s_, nullptr);
+			req_ = std::exchange(o.req_, nullptr);
+		}
+		return *this;
+	}
+	buffer(const buffer &) = delete;
+	buffer &operator=(const buffer &) = delete;
+	~buffer() { reset(); }
+
+	const void *data() const { return req_->buf; }
+	long res() const { return req_->res; }	/* bytes, or -errno */
+	long long offset() const { return req_->offset; }
+	bool ok() const { return req_ && req_->res == (long)req_->len; }
+
+	inline void reset();
+
+private:
+	scheduler *s_ = nullptr;
+	io_req *req_ = nullptr;
+};
+
+class scheduler {
+public:
+	/*
+	 * depth reads in flight at most, each into a buffer of up to
+	 * buf_size bytes aligned for O_DIRECT
+	 */
+	scheduler(io_engine *io, int depth, size_t buf_size)
+		: io_(io), buf_size_(buf_size)
+	{
+		for (int i = 0; i < depth; i++) {
+			io_req *req = new io_req();
+
+			if (posix_memalign(&req->buf, 4096, buf_size))
+				abort();
+			free_.push_back(req);
+		}
+		done_.resize(depth);
+	}
+
+	~scheduler()
+	{
+		for (io_req *req : free_) {
+			::free(req->buf);
+			delete req;
+		}
+	}
+
+	scheduler(const scheduler &) = delete;
+	scheduler &operator=(const scheduler &) = delete;
+
+	class read_op {
+	public:
+		read_op(scheduler &s, int fd, long long off, size_t len)
+			: s_(s), fd_(fd), off_(off), len_(len) {}
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			h_ = h;
+			if (s_.free_.empty()) {
+				s_.starved_.push_back(this);
+				return;
+			}
+			start(s_.take());
+		}
+
+		buffer await_resume() { return buffer(&s_, req_); }
+
+	private:
+		friend class scheduler;
+
+		void start(io_req *req)
+		{
+			req_ = req;
+			io_req_prep(req, IO_READ, fd_, req->buf, len_, off_);
+			req->data = h_.address();
+			s_.pending_.push_back(req);
+		}
+
+		scheduler &s_;
+		int fd_;
+		long long off_;
+		size_t len_;
+		std::coroutine_handle<> h_;
+		io_req *req_ = nullptr;
+	};
+
+	/* co_await s.read(fd, off, len) gives a buffer once the read is in */
+	read_op read(int fd, long long off, size_t len)
+	{
+		return read_op(*this, fd, off, len);
+	}
+
+	/* make a suspended coroutine runnable */
+	void wake(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+	template <typename Task>
+	void spawn(Task &&t)
+	{
+		live_++;
+		wake(t.detach(this));
+	}
+
+	/*
+	 * Run until every spawned task is done. Returns 0, or -1 when the
+	 * engine fails.
+	 */
+	int run()
+	{
+		while (live_) {
+			while (!ready_.empty()) {
+				std::coroutine_handle<> h = ready_.front();
+
+				ready_.pop_front();
+				h.resume();
+			}
+
+			if (!pending_.empty()) {
+				if (ioengine_submit(io_, pending_.data(), pending_.size()))
+					return -1;
+				inflight_ += pending_.size();
+				submits_++;
+				pending_.clear();
+			}
+
+			if (!inflight_) {
+				if (live_ && ready_.empty())
+					return -1;	/* nothing to wait for */
+				continue;
+			}
+
+			int n = ioengine_getevents(io_, 1, done_.size(), done_.data(), -1);
+			if (n < 0)
+				return -1;
+			inflight_ -= n;
+			reads_ += n;
+			for (int i = 0; i < n; i++)
+				wake(std::coroutine_handle<>::from_address(done_[i]->data));
+		}
+		return 0;
+	}
+
+	unsigned long long reads() const { return reads_; }
+	unsigned long long submits() const { return submits_; }
+	size_t buf_size() const { return buf_size_; }
+
+	/* called by finished top-level tasks */
+	void retire() { live_--; }
+
+	/* a buffer is given back: to a waiting read, else to the pool */
+	void release(io_req *req)
+	{
+		if (!starved_.empty()) {
+			read_op *op = starved_.front();
+
+			starved_.pop_front();
+			op->start(req);
+			return;
+		}
+		free_.push_back(req);
+	}
+
+private:
+	io_req *take()
+	{
+		io_req *req = free_.back();
+
+		free_.pop_back();
+		return req;
+	}
+
+	io_engine *io_;
+	size_t buf_size_;
+	std::vector<io_req *> free_;
+	std::deque<read_op *> starved_;
+	std::vector<io_req *> pending_;
+	std::vector<io_req *> done_;
+	std::deque<std::coroutine_handle<>> ready_;
+	size_t inflight_ = 0;
+	size_t live_ = 0;
+	unsigned long long reads_ = 0, submits_ = 0;
+};
+
+inline void buffer::reset()
+{
+	if (req_)
+		s_->release(req_);
+	s_ = nullptr;
+	req_ = nullptr;
+}
+
+template <typename T>
+class task;
+
+namespace detail {
+
+struct promise_base {
+	std::coroutine_handle<> continuation;
+	scheduler *owner = nullptr;	/* set for spawned tasks */
+
+	static void *operator new(size_t n) { return frame_pool::alloc(n); }
+	static void operator delete(void *f, size_t n) { frame_pool::release(f, n); }
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	/* resume whoever awaited us; a spawned task frees itself */
+	struct final_awaiter {
+		bool await_ready() const noexcept { return false; }
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			promise_base &p = h.promise();
+
+			if (p.continuation)
+				return p.continuation;
+			if (p.owner) {
+				p.owner->retire();
+				h.destroy();
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	final_awaiter final_suspend() noexcept { return {}; }
+
+	/* no exceptions on the I/O path */
+	void unhandled_exception() { abort(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+	T value{};
+
+	task<T> get_return_object();
+	void return_value(T v) { value = std::move(v); }
+};
+
+template <>
+struct promise<void> : promise_base {
+	task<void> get_return_object();
+	void return_void() {}
+};
+
+}
+
+/*
+ * A lazily started coroutine returning T: runs when awaited or spawned
+ */
+template <typename T = void>
+class task {
+public:
+	using promise_type = detail::promise<T>;
+	using handle = std::coroutine_handle<promise_type>;
+
+	explicit task(handle h) : h_(h) {}
+	task(task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+	task(const task &) = delete;
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+	{
+		h_.promise().continuation = caller;
+		return h_;
+	}
+
+	T await_resume()
+	{
+		if constexpr (!std::is_void_v<T>)
+			return std::move(h_.promise().value);
+	}
+
+	/* hand the frame to a scheduler, which frees it when done */
+	std::coroutine_handle<> detach(scheduler *s)
+	{
+		h_.promise().owner = s;
+		return std::exchange(h_, nullptr);
+	}
+
+private:
+	handle h_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object()
+{
+	return task<T>(task<T>::handle::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object()
+{
+	return task<void>(task<void>::handle::from_promise(*this));
+}
+
+}
+
+}
+
+#endif
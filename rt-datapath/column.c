@@ -0,0 +1,253 @@
+/*
+ * Columnar relation files: generation, footer and zone map reader.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "column.h"
+
+#define DATE_JITTER (8)		/* days rows arrive out of order */
+
+uint64_t column_groups(int format, long long blocks)
+{
+	int cols = tuple_columns(format);
+	uint64_t groups;
+
+	if (blocks < 1)
+		return 0;
+
+	/* the footer is small: shrink until it fits behind the segments */
+	for (groups = blocks / cols; groups; groups--)
+		if (groups * cols + column_footer_size(format, groups) / BLOCK_SIZE <=
+				(uint64_t)blocks)
+			break;
+	return groups;
+}
+
+size_t column_footer_size(int format, uint64_t groups)
+{
+	size_t len = groups * tuple_columns(format) * sizeof(struct column_zone) +
+		sizeof(struct column_trailer);
+
+	return (len + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+static void fill_object(uint32_t *v, int col, uint64_t row, uint64_t rows,
+		struct rng *r)
+{
+	float *f = (float *)v;
+	int i, d;
+
+	for (i = 0; i < COLUMN_ROWS; i++, row++) {
+		switch (col) {
+		case 0:
+			v[i] = row;
+			break;
+		case 1:
+			v[i] = rng_range(r, TUPLE_LOCATIONS);
+			break;
+		case 2:
+			d = row * TUPLE_DAYS / rows + rng_range(r, DATE_JITTER);
+			v[i] = d < TUPLE_DAYS ? d : TUPLE_DAYS - 1;
+			break;
+		case 3:
+			f[i] = -20 + 60 * rng_double(r);
+			break;
+		default:
+			f[i] = 100 * rng_double(r);
+			break;
+		}
+	}
+}
+
+static void fill_location(uint32_t *v, int col, uint64_t row, struct rng *r)
+{
+	float *f = (float *)v;
+	int i;
+
+	for (i = 0; i < COLUMN_ROWS; i++, row++) {
+		switch (col) {
+		case 0:
+			v[i] = row;
+			break;
+		case 1:
+			f[i] = -100 + 3100 * rng_double(r);
+			break;
+		case 2:
+			f[i] = -90 + 180 * rng_double(r);
+			break;
+		default:
+			f[i] = -180 + 360 * rng_double(r);
+			break;
+		}
+	}
+}
+
+/* all columns are 32 bits; ids and dates compare as ints, the rest as floats */
+static int column_is_float(int format, int col)
+{
+	if (format == TUPLE_OBJECT)
+		return col >= 3;
+	return col >= 1;
+}
+
+void column_fill(void *buf, int format, uint32_t file_id, uint64_t block,
+		uint64_t seed, uint64_t groups, struct column_zone *zones)
+{
+	uint32_t *v = (uint32_t *)((struct block_hdr *)buf + 1);
+	int col = block / groups;
+	uint64_t row = block % groups * COLUMN_ROWS;
+	struct column_zone *z = &zones[block];
+	struct rng r;
+	int i;
+
+	block_stamp(buf, file_id, block, seed, COLUMN_BLOCK(format, col),
+			COLUMN_ROWS, &r);
+	memset(v + COLUMN_ROWS, 0, BLOCK_PAYLOAD - COLUMN_ROWS * sizeof(*v));
+
+	if (format == TUPLE_OBJECT)
+		fill_object(v, col, row, groups * COLUMN_ROWS, &r);
+	else
+		fill_location(v, col, row, &r);
+
+	z->min.u = z->max.u = v[0];
+	for (i = 1; i < COLUMN_ROWS; i++) {
+		union column_value x = { .u = v[i] };
+
+		if (column_is_float(format, col)) {
+			if (x.f < z->min.f)
+				z->min = x;
+			if (x.f > z->max.f)
+				z->max = x;
+		} else {
+			if (x.i < z->min.i)
+				z->min = x;
+			if (x.i > z->max.i)
+				z->max = x;
+		}
+	}
+
+	block_seal(buf);
+}
+
+void column_footer(void *buf, int format, uint64_t groups,
+		const struct column_zone *zones)
+{
+	size_t len = column_footer_size(format, groups);
+	size_t zlen = groups * tuple_columns(format) * sizeof(*zones);
+	struct column_trailer *t = (struct column_trailer *)
+		((char *)buf + len - sizeof(*t));
+
+	memset(buf, 0, len);
+	memcpy(buf, zones, zlen);
+
+	t->magic = COLUMN_MAGIC;
+	t->version = COLUMN_VERSION;
+	t->format = format;
+	t->columns = tuple_columns(format);
+	t->group_rows = COLUMN_ROWS;
+	t->groups = groups;
+	t->zone_offset = groups * t->columns * BLOCK_SIZE;
+	t->zone_crc = crc32c(0, buf, zlen);
+	t->crc = crc32c(0, t, offsetof(struct column_trailer, crc));
+}
+
+int column_open(struct column_file *c, const char *filename)
+{
+	struct column_trailer t;
+	struct stat st;
+	size_t zlen;
+	int fd;
+
+	memset(c, 0, sizeof(*c));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(t) ||
+			pread(fd, &t, sizeof(t), st.st_size - sizeof(t)) != sizeof(t) ||
+			t.magic != COLUMN_MAGIC) {
+		close(fd);
+		return 0;
+	}
+
+	if (t.crc != crc32c(0, &t, offsetof(struct column_trailer, crc)) ||
+			t.version != COLUMN_VERSION ||
+			(t.format != TUPLE_OBJECT && t.format != TUPLE_LOCATION) ||
+			t.columns != (uint32_t)tuple_columns(t.format) ||
+			t.group_rows != COLUMN_ROWS || !t.groups ||
+			t.zone_offset != t.groups * t.columns * BLOCK_SIZE ||
+			t.zone_offset + column_footer_size(t.format, t.groups) >
+			(uint64_t)st.st_size) {
+		fprintf(stderr, "%s: bad columnar trailer\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	c->map_len = st.st_size - t.zone_offset;
+	c->map = mmap(NULL, c->map_len, PROT_READ, MAP_SHARED, fd, t.zone_offset);
+	close(fd);
+	if (c->map == MAP_FAILED) {
+		perror(filename);
+		return -1;
+	}
+
+	zlen = t.groups * t.columns * sizeof(struct column_zone);
+	c->zones = c->map;
+	c->trailer = (const struct column_trailer *)
+		((char *)c->map + c->map_len - sizeof(t));
+	c->format = t.format;
+	c->columns = t.columns;
+	c->groups = t.groups;
+
+	if (crc32c(0, c->zones, zlen) != t.zone_crc) {
+		fprintf(stderr, "%s: zone map checksum mismatch\n", filename);
+		column_close(c);
+		return -1;
+	}
+
+	return 1;
+}
+
+void column_close(struct column_file *c)
+{
+	if (c->map)
+		munmap(c->map, c->map_len);
+	memset(c, 0, sizeof(*c));
+}
+
+int column_zone_match(const struct column_file *c,
+		const struct tuple_query *q, uint64_t group)
+{
+	const struct column_zone *z = &c->zones[column_block(c, q->pred_col, group)];
+
+	if (q->pred_float)
+		return z->min.f < q->pred_lt;
+	return z->min.i < (int32_t)q->pred_lt;
+}
+
+int column_scan(const struct tuple_query *q, const void *pred,
+		const void *agg_col, struct tuple_agg *agg)
+{
+	const struct block_hdr *p = pred, *a = agg_col;
+
+	if (p->format != COLUMN_BLOCK(q->format, q->pred_col) ||
+			p->rows != COLUMN_ROWS)
+		return 0;
+	if (q->agg_col >= 0 &&
+			(a->format != COLUMN_BLOCK(q->format, q->agg_col) ||
+			 a->rows != COLUMN_ROWS))
+		return 0;
+
+	tuple_scan_words(q, (const uint32_t *)(p + 1),
+			q->agg_col >= 0 ? (const uint32_t *)(a + 1) : NULL,
+			COLUMN_ROWS, 1, agg);
+	return COLUMN_ROWS;
+}
@@ -0,0 +1,115 @@
+#ifndef COLUMN_H
+#define COLUMN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "block.h"
+#include "tuple.h"
+
+/*
+ * Columnar relation files (gen-data -C).
+ *
+ * Rows are cut into row groups of COLUMN_ROWS rows. Each column is stored
+ * as its own segment of stamped blocks, one block per row group, so
+ * column c of group g lives in block c * groups + g. Block headers carry
+ * COLUMN_BLOCK(table, c) as their format.
+ *
+ * After the segments comes the footer: a min/max zone map per column per
+ * row group, then a trailer that ends the file. The footer starts on a
+ * block boundary, so readers mmap it and use the zone maps in place.
+ *
+ *   | col 0: g0 g1 .. | col 1: g0 g1 .. | .. | zones[col][group] .. trailer |
+ *
+ * Object rows are generated in o_date order, as they would be appended,
+ * so zone maps on o_date let date-range scans skip most of the file. The
+ * other columns are random and their zone maps span the whole domain.
+ */
+#define COLUMN_MAGIC (0x43445452)	/* "RTDC" */
+#define COLUMN_VERSION 1
+
+#define COLUMN_ROWS ((int)(BLOCK_PAYLOAD / sizeof(uint32_t)))
+#define COLUMN_BLOCK(format, col) (0x100 | (col) << 4 | (format))
+
+union column_value {
+	int32_t i;
+	uint32_t u;
+	float f;
+};
+
+struct column_zone {
+	union column_value min;
+	union column_value max;
+};
+
+struct column_trailer {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t format;	/* table, see tuple.h */
+	uint32_t columns;
+	uint32_t group_rows;	/* COLUMN_ROWS */
+	uint64_t groups;
+	uint64_t zone_offset;	/* byte offset of the zone maps */
+	uint32_t zone_crc;	/* CRC32C of the zone maps */
+	uint32_t crc;		/* CRC32C of the trailer up to here */
+};
+
+/*
+ * Split a file of the given number of blocks into row groups and footer.
+ * Returns the number of row groups, 0 if the file is too small.
+ */
+uint64_t column_groups(int format, long long blocks);
+
+/* bytes of footer for a file of that many groups, a multiple of BLOCK_SIZE */
+size_t column_footer_size(int format, uint64_t groups);
+
+/*
+ * Fill data block 'block' of a columnar file and record its zone map in
+ * zones (indexed like the blocks).
+ */
+void column_fill(void *buf, int format, uint32_t file_id, uint64_t block,
+		uint64_t seed, uint64_t groups, struct column_zone *zones);
+
+/* lay out the footer for the zone maps in buf (column_footer_size() bytes) */
+void column_footer(void *buf, int format, uint64_t groups,
+		const struct column_zone *zones);
+
+/*
+ * A columnar file opened for reading; the footer is mapped.
+ */
+struct column_file {
+	void *map;
+	size_t map_len;
+	const struct column_trailer *trailer;
+	const struct column_zone *zones;
+	int format;
+	int columns;
+	uint64_t groups;
+};
+
+/*
+ * Returns 1 when filename is a columnar file, 0 when it is not (or does
+ * not exist) and -1 if it is a damaged one.
+ */
+int column_open(struct column_file *c, const char *filename);
+void column_close(struct column_file *c);
+
+static inline uint64_t column_block(const struct column_file *c, int col,
+		uint64_t group)
+{
+	return col * c->groups + group;
+}
+
+/* can any row of the group satisfy the query's predicate? */
+int column_zone_match(const struct column_file *c,
+		const struct tuple_query *q, uint64_t group);
+
+/*
+ * Run a query over one row group, given the blocks of its predicate and
+ * (unless it counts) aggregate column. Returns the tuples looked at, 0 if
+ * the blocks are not the query's columns.
+ */
+int column_scan(const struct tuple_query *q, const void *pred,
+		const void *agg_col, struct tuple_agg *agg);
+
+#endif
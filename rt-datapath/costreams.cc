@@ -0,0 +1,265 @@
+/*
+ * Many concurrent query streams as coroutines (coio.h).
+ *
+ * Every stream is one query written straight through: scan a run of
+ * blocks of a seq file, then probe random blocks of a rnd file, then fold
+ * both into the aggregate. All of them run on one thread and one I/O
+ * engine, sharing a fixed queue depth; the point is how many streams a
+ * core keeps going and what each costs in memory.
+ */
+#include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "coio.h"
+#include "block.h"
+#include "rng.h"
+
+#define READ_SIZE (4096)
+#define MAX_NAME 256
+
+#ifdef HAVE_LIBAIO
+#define DEFAULT_IOENGINE "aio"
+#else
+#define DEFAULT_IOENGINE "sim"
+#endif
+
+struct file {
+	int fd;
+	uint32_t file_id;
+	long long blocks;
+	char name[MAX_NAME];
+};
+
+struct run {
+	coio::scheduler *s;
+	int nodata;		/* engine reads no data: nothing to look at */
+	int verify;
+	uint64_t seed;
+	unsigned long long done;
+	unsigned long long agg;
+};
+
+static double wall(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what a query makes of a block: its first payload word's low bit */
+static unsigned take(struct run *r, const struct file *f,
+		const coio::buffer &b)
+{
+	long long block = b.offset() / READ_SIZE;
+	int err;
+
+	if (!b.ok()) {
+		fprintf(stderr, "%s: block %lld: read failed: %s\n", f->name, block,
+				strerror(b.res() < 0 ? -b.res() : EIO));
+		exit(1);
+	}
+	if (r->nodata)
+		return 0;
+	if (r->verify) {
+		err = block_check(b.data(), f->file_id, block, r->seed);
+		if (err) {
+			fprintf(stderr, "%s: block %lld: %s\n", f->name, block,
+					block_strerror(err));
+			exit(1);
+		}
+	}
+	return *(const uint64_t *)((const struct block_hdr *)b.data() + 1) & 1;
+}
+
+static coio::task<unsigned> scan(struct run *r, const struct file *f,
+		long long start, int blocks)
+{
+	unsigned n = 0;
+
+	for (int i = 0; i < blocks; i++) {
+		long long block = (start + i) % f->blocks;
+		coio::buffer b = co_await r->s->read(f->fd, block * READ_SIZE,
+				READ_SIZE);
+
+		n += take(r, f, b);
+	}
+	co_return n;
+}
+
+static coio::task<unsigned> probe(struct run *r, const struct file *f,
+		struct rng *rng, int blocks)
+{
+	unsigned n = 0;
+
+	for (int i = 0; i < blocks; i++) {
+		long long block = rng_range(rng, f->blocks);
+		coio::buffer b = co_await r->s->read(f->fd, block * READ_SIZE,
+				READ_SIZE);
+
+		n += take(r, f, b);
+	}
+	co_return n;
+}
+
+static coio::task<> query(struct run *r, const struct file *seq,
+		const struct file *rnd, uint64_t seed, int scan_blocks,
+		int probe_blocks)
+{
+	struct rng rng;
+	unsigned a = 0, b = 0;
+
+	rng_seed(&rng, seed);
+	if (seq)
+		a = co_await scan(r, seq, rng_range(&rng, seq->blocks), scan_blocks);
+	if (rnd)
+		b = co_await probe(r, rnd, &rng, probe_blocks);
+
+	r->agg += a + b;
+	r->done++;
+}
+
+static int open_files(struct io_engine *io, const char *base, const char *kind,
+		int n, std::vector<struct file> &files)
+{
+	for (int i = 0; i < n; i++) {
+		struct file f;
+		long long size;
+
+		snprintf(f.name, sizeof(f.name), "%s.%s.%d.dat", base, kind, i);
+		f.fd = ioengine_open(io, f.name, O_RDONLY, &size);
+		if (f.fd < 0)
+			return -1;
+		f.file_id = block_file_id(kind[0] == 'r', i);
+		f.blocks = size / READ_SIZE;
+		if (f.blocks < 1) {
+			fprintf(stderr, "%s: empty\n", f.name);
+			return -1;
+		}
+		files.push_back(f);
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -s <num seq files> -x <num rnd files> -b <filename base>\n"
+			"       [-n <streams>] [-k <scan blocks>] [-p <probe blocks>]\n"
+			"       [-d <queue depth>] [-e <io engine>[:options]] [-S <seed>]\n"
+			"       [-V <data seed>]\n"
+			"  every stream scans a run of a seq file, then probes a rnd file\n"
+			"  io engines:");
+	ioengine_list();
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<struct file> seq, rnd;
+	const char *ioengine = DEFAULT_IOENGINE;
+	char *filename_base = NULL;
+	int seq_files = -1, rnd_files = -1;
+	int streams = 10000, scan_blocks = 8, probe_blocks = 2, depth = 64;
+	uint64_t seed = 0;
+	struct run r = {};
+	struct rusage ru;
+	double start, virt, secs, vsecs;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "s:x:b:n:k:p:d:e:S:V:")) != -1) {
+		switch (c) {
+		case 's':
+			seq_files = atoi(optarg);
+			break;
+		case 'x':
+			rnd_files = atoi(optarg);
+			break;
+		case 'b':
+			filename_base = strdup(optarg);
+			break;
+		case 'n':
+			streams = atoi(optarg);
+			break;
+		case 'k':
+			scan_blocks = atoi(optarg);
+			break;
+		case 'p':
+			probe_blocks = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'e':
+			ioengine = strdup(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'V':
+			r.verify = 1;
+			r.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (seq_files < 0 || rnd_files < 0 || seq_files + rnd_files < 1 ||
+			!filename_base || streams < 1 || depth < 1) {
+		usage();
+		exit(1);
+	}
+
+	struct io_engine *io = ioengine_create(ioengine, depth);
+	if (!io)
+		exit(1);
+	r.nodata = io->ops->nodata;
+
+	if (open_files(io, filename_base, "seq", seq_files, seq) ||
+			open_files(io, filename_base, "rnd", rnd_files, rnd))
+		exit(1);
+
+	coio::scheduler s(io, depth, READ_SIZE);
+	r.s = &s;
+
+	start = wall();
+	virt = ioengine_now(io);
+
+	for (i = 0; i < streams; i++)
+		s.spawn(query(&r, seq.empty() ? NULL : &seq[i % seq.size()],
+				rnd.empty() ? NULL : &rnd[i % rnd.size()], seed + i,
+				scan_blocks, probe_blocks));
+
+	if (s.run()) {
+		fprintf(stderr, "io engine failed\n");
+		exit(1);
+	}
+
+	secs = wall() - start;
+	vsecs = ioengine_now(io) - virt;
+	getrusage(RUSAGE_SELF, &ru);
+
+	coio::frame_pool &fp = coio::frame_pool::get();
+	printf("%llu streams, %llu reads in %.2f s (%.2f s io time): "
+			"%.0f reads/s, %.0f streams/s, cpu %.2f us/read\n", r.done,
+			s.reads(), secs, vsecs, s.reads() / vsecs, r.done / vsecs,
+			(ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+			 ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6) * 1e6 /
+			(s.reads() ? s.reads() : 1));
+	printf("frames: peak %.1f KB, %.0f bytes/stream; buffers %.1f KB "
+			"(depth %d); %.1f reads/submit; agg %llu; max rss %.1f MB\n",
+			fp.peak_bytes / 1024.0, (double)fp.peak_bytes / streams,
+			depth * (double)READ_SIZE / 1024, depth,
+			s.submits() ? (double)s.reads() / s.submits() : 0, r.agg,
+			ru.ru_maxrss / 1024.0);
+
+	ioengine_destroy(io);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * CRC32C with hardware support where available.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#define POLY (0x82f63b78)	/* reflected Castagnoli polynomial */
+
+static uint32_t table[8][256];
+
+static void make_table(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+		table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^
+				table[0][table[j - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t w;
+
+	crc = ~crc;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+	/* little endian only, as is everything this runs on */
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		w ^= crc;
+		crc = table[7][w & 0xff] ^
+			table[6][(w >> 8) & 0xff] ^
+			table[5][(w >> 16) & 0xff] ^
+			table[4][(w >> 24) & 0xff] ^
+			table[3][(w >> 32) & 0xff] ^
+			table[2][(w >> 40) & 0xff] ^
+			table[1][(w >> 48) & 0xff] ^
+			table[0][w >> 56];
+	}
+
+	while (len--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+#define HAVE_HW_CRC 1
+#define HW_NAME "sse4.2"
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t c = ~crc, w;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c = __builtin_ia32_crc32qi(c, *p++);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		c = __builtin_ia32_crc32di(c, w);
+	}
+	while (len--)
+		c = __builtin_ia32_crc32qi(c, *p++);
+
+	return ~(uint32_t)c;
+}
+
+static int have_hw(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_HW_CRC 1
+#define HW_NAME "armv8"
+
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t w;
+
+	crc = ~crc;
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = __crc32cb(crc, *p++);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		crc = __crc32cd(crc, w);
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+
+	return ~crc;
+}
+
+static int have_hw(void)
+{
+	return 1;
+}
+#endif
+
+static uint32_t crc32c_init(uint32_t crc, const void *buf, size_t len);
+
+static uint32_t (*impl)(uint32_t, const void *, size_t) = crc32c_init;
+static const char *impl_name = "sw";
+
+/* pick an implementation on first use */
+static uint32_t crc32c_init(uint32_t crc, const void *buf, size_t len)
+{
+#ifdef HAVE_HW_CRC
+	if (have_hw()) {
+		impl_name = HW_NAME;
+		impl = crc32c_hw;
+		return impl(crc, buf, len);
+	}
+#endif
+	make_table();
+	impl = crc32c_sw;
+	return impl(crc, buf, len);
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return impl(crc, buf, len);
+}
+
+const char *crc32c_impl(void)
+{
+	if (impl == crc32c_init)
+		crc32c(0, NULL, 0);
+	return impl_name;
+}
@@ -0,0 +1,25 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC32C (Castagnoli), as used by iSCSI, ext4 and btrfs. Uses the SSE4.2
+ * or ARMv8 crc32c instructions when the CPU has them and a slice-by-8
+ * table otherwise. Pass 0 as the initial crc.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* name of the implementation in use, for reports */
+const char *crc32c_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Closed-loop reservation controller for the workload engine.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "engine.h"
+
+/* bound on accumulated error (anti-windup) */
+#define INTEGRAL_LIMIT (4.0)
+
+/* reserved streams may be given up to (1 + HEADROOM) x their reservation */
+#define HEADROOM (1.0)
+
+/* weight of the newest sample in the best-effort rate estimate */
+#define EWMA_ALPHA (0.3)
+
+static double clamp(double x, double lo, double hi)
+{
+	if (x < lo)
+		return lo;
+	if (x > hi)
+		return hi;
+	return x;
+}
+
+void ctrl_init(struct ctrl *c, double period)
+{
+	memset(c, 0, sizeof(*c));
+	c->enabled = 1;
+	c->period = period;
+	c->kp = 0.5;
+	c->ki = 0.2;
+	c->kd = 0.1;
+	c->deadband = 0.02;
+	c->throttle = 1.0;
+	c->throttle_floor = 0.05;
+	c->warn_periods = 3;
+}
+
+/*
+ * Adjust the token rate and queue depth of a reserved stream. Returns the
+ * normalized shortfall: positive when the stream is behind.
+ */
+static double update_reserved(struct ctrl *c, struct stream *s, double achieved)
+{
+	double err, out;
+
+	err = (s->reservation - achieved) / s->reservation;
+
+	s->integral = clamp(s->integral + err, -INTEGRAL_LIMIT, INTEGRAL_LIMIT);
+	out = c->kp * err + c->ki * s->integral + c->kd * (err - s->prev_err);
+	s->prev_err = err;
+
+	s->rate = s->reservation * (1.0 + clamp(out, 0.0, HEADROOM));
+
+	if (err > c->deadband && s->depth < s->max_depth)
+		s->depth++;
+	else if (err < -c->deadband && s->depth > 1)
+		s->depth--;
+
+	return err;
+}
+
+/*
+ * Scale best-effort streams by the global throttle. The unthrottled rate
+ * is only learned while a stream is running unlimited.
+ */
+static void update_best_effort(struct ctrl *c, struct stream *s, double achieved)
+{
+	if (s->rate == 0)
+		s->base_rate = s->base_rate ?
+			EWMA_ALPHA * achieved + (1 - EWMA_ALPHA) * s->base_rate :
+			achieved;
+
+	if (c->throttle < 1.0)
+		s->rate = clamp(c->throttle * s->base_rate, 1.0, s->base_rate);
+	else
+		s->rate = 0;
+}
+
+/*
+ * Warn once a reservation is missed with every actuator saturated, that is
+ * before queries depending on the stream actually miss their deadlines.
+ */
+static void check_warning(struct ctrl *c, struct stream *s, double err,
+		double achieved, int saturated, double now)
+{
+	if (err <= c->deadband) {
+		if (s->warned)
+			fprintf(stderr, "ctrl: %.1f: stream %d recovered: %.0f/%.0f blocks/s\n",
+					now, s->id, achieved, s->reservation);
+		s->behind = 0;
+		s->warned = 0;
+		return;
+	}
+
+	if (!saturated || s->depth < s->max_depth)
+		return;
+
+	if (++s->behind >= c->warn_periods && !s->warned) {
+		fprintf(stderr, "ctrl: %.1f: WARNING stream %d (%s) reservation cannot "
+				"be met: %.0f/%.0f blocks/s\n", now, s->id, s->filename,
+				achieved, s->reservation);
+		s->warned = 1;
+		c->warnings++;
+	}
+}
+
+void ctrl_update(struct engine *e, double now)
+{
+	struct ctrl *c = &e->ctrl;
+	double dt, achieved[e->num_streams], err[e->num_streams];
+	double worst = -1.0, out;
+	int i, num_reserved = 0, num_best_effort = 0, saturated;
+
+	if (!c->enabled)
+		return;
+
+	dt = now - c->last;
+	if (dt < c->period)
+		return;
+	c->last = now;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		achieved[i] = (s->completed - s->ctrl_completed) / dt;
+		s->ctrl_completed = s->completed;
+
+		if (s->reservation > 0) {
+			err[i] = update_reserved(c, s, achieved[i]);
+			if (err[i] > worst)
+				worst = err[i];
+			num_reserved++;
+		} else
+			num_best_effort++;
+	}
+
+	if (!num_reserved)
+		return;
+
+	/*
+	 * Global loop. While every reservation is met the integral leaks away
+	 * so best-effort streams get their bandwidth back over a few periods.
+	 */
+	if (worst > c->deadband)
+		c->integral = clamp(c->integral + worst, 0.0, INTEGRAL_LIMIT);
+	else
+		c->integral *= 0.8;
+	out = c->kp * worst + c->ki * c->integral + c->kd * (worst - c->prev_err);
+	c->prev_err = worst;
+	c->throttle = clamp(1.0 - out, c->throttle_floor, 1.0);
+
+	saturated = !num_best_effort || c->throttle <= c->throttle_floor;
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (s->reservation > 0)
+			check_warning(c, s, err[i], achieved[i], saturated, now);
+		else
+			update_best_effort(c, s, achieved[i]);
+
+		if (e->verbose)
+			fprintf(stderr, "ctrl: %.1f: stream %d %.0f/%.0f blocks/s "
+					"rate %.0f depth %d throttle %.2f\n", now, s->id,
+					achieved[i], s->reservation, s->rate, s->depth,
+					c->throttle);
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef CTRL_H
+#define CTRL_H
+
+struct engine;
+
+/*
+ * Closed-loop reservation controller.
+ *
+ * Every period the achieved rate of each reserved stream is compared with
+ * its reservation. Two PID loops act on the error:
+ *
+ *  - per reserved stream: its own token rate and queue depth, so timing
+ *    losses are made up without running it faster than it needs to.
+ *  - global: a throttle applied to the best-effort streams, driven by the
+ *    worst shortfall among the reserved streams.
+ *
+ * When both loops are saturated and a reservation is still missed the
+ * controller raises an early warning.
+ */
+struct ctrl {
+	int enabled;
+	double period;		/* seconds between updates */
+	double last;		/* time of last update */
+
+	/* gains, applied to the normalized shortfall (R - achieved) / R */
+	double kp;
+	double ki;
+	double kd;
+	double deadband;
+
+	/* global best-effort throttle */
+	double throttle;	/* best-effort rate multiplier in [floor, 1] */
+	double throttle_floor;
+	double integral;
+	double prev_err;
+
+	/* early warning */
+	int warn_periods;	/* saturated periods before warning */
+	unsigned long warnings;
+};
+
+void ctrl_init(struct ctrl *c, double period);
+void ctrl_update(struct engine *e, double now);
+
+#endif
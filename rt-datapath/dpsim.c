@@ -0,0 +1,693 @@
+/*
+ * Discrete-event simulator of the RT-DataPath workload.
+ *
+ * Queries arrive as a Poisson process with (blocks, deadline) drawn as in
+ * linear/WorkloadGenerator.java. An admission policy accepts or rejects
+ * each one and decides how it is served: by an index scan of its own that
+ * reads its blocks, or by attaching to the shared scan of its table, which
+ * it then rides for one full pass of the table wherever it joined. Joins
+ * run two stages, a scan of the build side table followed by a scan of the
+ * probe side.
+ *
+ * The device is the performance model. With m tables being scanned and n
+ * index scans, the m scans split iops_S[n] and every index scan gets
+ * iops_I[n] (m = 0) or iops_Is[n]. Rates only change when a query arrives
+ * or a stream finishes, so time jumps from event to event. All streams of
+ * one kind advance at the same rate, so a single progress counter per kind
+ * plus a heap of target positions is all the bookkeeping needed.
+ *
+ * Policies:
+ *   none    - admit everything
+ *   reserve - admit while the bandwidth reservations (B_T = max |T|/L per
+ *             scanned table, one per index scan) fit the operating point
+ *   predict - admit if replaying the admitted work, with no further
+ *             arrivals, meets every deadline; of scan and index the
+ *             choice leaving the most total slack (goodness) wins
+ *
+ * Utilization is the work delivered in units of what the device does on
+ * a single stream of each kind (iops_S[0], iops_I[1]); it can pass 1 when
+ * mixed streams overlap.
+ *
+ * -H keeps headroom in the admission tests and -z makes the device rates
+ * jitter by up to that fraction, to see how a policy copes with a model
+ * that is off.
+ */
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <assert.h>
+
+#include "rng.h"
+#include "pool.h"
+#include "pmodel.h"
+
+#define MAX_TABLES 64
+#define MAX_QUERIES (1 << 22)	/* in the system at once */
+#define NSEC_PER_SEC (1000000000)
+#define BLOCK_EPS (1e-6)
+#define TIME_EPS (1e-9)
+#define INF (1e30)
+
+enum { POLICY_NONE, POLICY_RESERVE, POLICY_PREDICT };
+enum { SCAN, INDEX };
+
+static const char *policy_names[] = { "none", "reserve", "predict", NULL };
+
+struct squery {
+	unsigned long long id;
+	double arrival;
+	double deadline;	/* absolute */
+	long long blocks;	/* read by an index scan */
+	int join;
+	int table;		/* probe side of a join */
+	int build_table;
+	int method;
+};
+
+/* a query waiting for its stream to reach target */
+struct hent {
+	double target;
+	struct squery *q;
+	int build;		/* in the build stage of a join */
+};
+
+struct heap {
+	struct hent *e;
+	int size;
+	int capacity;
+};
+
+/* everything a replay needs to copy */
+struct state {
+	struct heap scan;	/* targets in blocks per scanned table */
+	struct heap index;	/* targets in blocks per index scan */
+	long long table_blocks;
+	double vs;
+	double vi;
+	int refs[MAX_TABLES];	/* stages attached to each table's scan */
+	int tables;		/* tables being scanned */
+};
+
+struct stats {
+	unsigned long long arrived;
+	unsigned long long admitted;
+	unsigned long long scans;
+	unsigned long long indexes;
+	unsigned long long joins;
+	unsigned long long finished;
+	unsigned long long misses;
+	double slack;
+	double lateness;
+	double busy;
+	double scan_busy;
+	double seq_blocks;
+	double idx_blocks;
+};
+
+struct sim {
+	const struct pmodel *pm;
+	int policy;
+	int num_tables;
+	long long max_blocks;
+	int max_deadline;
+	double arrival_rate;
+	double join_frac;
+	double headroom;
+	double noise;
+	int verbose;
+
+	struct rng rng;
+	double now;
+	struct state st;
+	struct state scratch;
+	struct pool free;
+	int allocated;
+	struct stats stats;
+};
+
+static double wall_now(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec / (double)NSEC_PER_SEC;
+}
+
+/*
+ * Min-heap on target
+ */
+static void heap_reserve(struct heap *h, int capacity)
+{
+	if (capacity <= h->capacity)
+		return;
+	h->capacity = capacity > 2 * h->capacity ? capacity : 2 * h->capacity;
+	h->e = realloc(h->e, h->capacity * sizeof(*h->e));
+	assert(h->e);
+}
+
+static void heap_push(struct heap *h, struct hent ent)
+{
+	int i, parent;
+
+	heap_reserve(h, h->size + 1);
+
+	for (i = h->size++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (h->e[parent].target <= ent.target)
+			break;
+		h->e[i] = h->e[parent];
+	}
+	h->e[i] = ent;
+}
+
+static struct hent heap_pop(struct heap *h)
+{
+	struct hent top = h->e[0], last = h->e[--h->size];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < h->size) {
+		if (child + 1 < h->size && h->e[child + 1].target < h->e[child].target)
+			child++;
+		if (last.target <= h->e[child].target)
+			break;
+		h->e[i] = h->e[child];
+		i = child;
+	}
+	h->e[i] = last;
+	return top;
+}
+
+static void heap_copy(struct heap *dst, const struct heap *src)
+{
+	heap_reserve(dst, src->size + 1);
+	memcpy(dst->e, src->e, src->size * sizeof(*src->e));
+	dst->size = src->size;
+}
+
+/*
+ * Device model
+ */
+static double iops_S(const struct pmodel *pm, int n)
+{
+	return 1.0 / pmodel_t_S(pm, 1, n);
+}
+
+static double iops_idx(const struct pmodel *pm, int n, int scanning)
+{
+	return 1.0 / (scanning ? pmodel_t_Is(pm, 1, n) : pmodel_t_I(pm, 1, n));
+}
+
+/* per table scan and per index scan rates at the current operating point */
+static void rates(const struct state *st, const struct pmodel *pm,
+		double scale, double *rs, double *ri)
+{
+	int n = st->index.size;
+
+	*rs = st->tables ? scale * iops_S(pm, n) / st->tables : 0;
+	*ri = n ? scale * iops_idx(pm, n, st->tables > 0) : 0;
+}
+
+static void attach(struct state *st, struct squery *q, int build)
+{
+	struct hent ent = { 0, q, build };
+
+	if (q->method == INDEX) {
+		ent.target = st->vi + q->blocks;
+		heap_push(&st->index, ent);
+		return;
+	}
+
+	ent.target = st->vs + st->table_blocks;
+	heap_push(&st->scan, ent);
+	if (!st->refs[build ? q->build_table : q->table]++)
+		st->tables++;
+}
+
+/*
+ * A stage finished: start the probe side of a join, or return the query
+ * if it is done.
+ */
+static struct squery *finish(struct state *st, struct hent *ent)
+{
+	struct squery *q = ent->q;
+
+	if (q->method == SCAN &&
+			!--st->refs[ent->build ? q->build_table : q->table])
+		st->tables--;
+
+	if (ent->build) {
+		attach(st, q, 0);
+		return NULL;
+	}
+	return q;
+}
+
+static double time_to(double target, double v, double rate)
+{
+	if (target - v <= BLOCK_EPS)
+		return 0;
+	return (target - v) / rate;
+}
+
+/*
+ * Run the streams until `until` or until one of them reaches its target,
+ * which is popped into ent. Returns 1 in the latter case.
+ */
+static int step(struct state *st, const struct pmodel *pm, double scale,
+		double *now, double until, struct hent *ent, struct stats *stats)
+{
+	double rs, ri, ts = INF, ti = INF, dt;
+
+	if (!st->scan.size && !st->index.size && until == INF)
+		return 0;
+
+	rates(st, pm, scale, &rs, &ri);
+	if (st->scan.size)
+		ts = time_to(st->scan.e[0].target, st->vs, rs);
+	if (st->index.size)
+		ti = time_to(st->index.e[0].target, st->vi, ri);
+
+	dt = ts < ti ? ts : ti;
+	if (*now + dt > until)
+		dt = until - *now;
+
+	if (stats && (st->tables || st->index.size)) {
+		stats->busy += dt;
+		if (st->tables)
+			stats->scan_busy += dt;
+		stats->seq_blocks += rs * st->tables * dt;
+		stats->idx_blocks += ri * st->index.size * dt;
+	}
+
+	st->vs += rs * dt;
+	st->vi += ri * dt;
+
+	if (dt != ts && dt != ti) {
+		*now = until;
+		return 0;
+	}
+	*now += dt;
+
+	/* land exactly on the target so rounding cannot reorder stages */
+	if (dt == ts) {
+		*ent = heap_pop(&st->scan);
+		if (st->vs < ent->target)
+			st->vs = ent->target;
+	} else {
+		*ent = heap_pop(&st->index);
+		if (st->vi < ent->target)
+			st->vi = ent->target;
+	}
+	return 1;
+}
+
+/*
+ * Admission policies
+ */
+
+/* where the query would finish fastest on its own at the current point */
+static int cheaper_method(struct sim *s, struct squery *q)
+{
+	const struct state *st = &s->st;
+	int n = st->index.size, m = st->tables + !st->refs[q->table];
+	double t_scan = st->table_blocks * m / iops_S(s->pm, n);
+	double t_idx = q->blocks / iops_idx(s->pm, n + 1, st->tables > 0);
+
+	return t_idx < t_scan ? INDEX : SCAN;
+}
+
+static void reserve_scan(double *B, int table, double rate)
+{
+	if (rate > B[table])
+		B[table] = rate;
+}
+
+/*
+ * The paper's reservations: every scanned table needs B_T = max rem/L of
+ * the stages attached to it (a join in its build stage reserves
+ * (|T1| + |T2|)/L on both tables), every index scan needs rem/L.
+ */
+static int reserve_fits(struct sim *s, struct squery *cand)
+{
+	const struct state *st = &s->st;
+	double B[MAX_TABLES], cap = 1 - s->headroom, sum = 0, worst = 0;
+	double rem, L, r;
+	int i, m = 0, n = st->index.size + (cand->method == INDEX);
+
+	memset(B, 0, s->num_tables * sizeof(*B));
+
+	for (i = 0; i < st->scan.size; i++) {
+		const struct hent *e = &st->scan.e[i];
+
+		L = e->q->deadline - s->now;
+		if (L <= 0)
+			continue;	/* late already, nothing to reserve for */
+		rem = e->target - st->vs + (e->build ? st->table_blocks : 0);
+		reserve_scan(B, e->build ? e->q->build_table : e->q->table, rem / L);
+		if (e->build)
+			reserve_scan(B, e->q->table, rem / L);
+	}
+
+	for (i = 0; i < st->index.size; i++) {
+		const struct hent *e = &st->index.e[i];
+
+		L = e->q->deadline - s->now;
+		if (L > 0 && (e->target - st->vi) / L > worst)
+			worst = (e->target - st->vi) / L;
+	}
+
+	L = cand->deadline - s->now;
+	if (cand->method == INDEX) {
+		if (cand->blocks / L > worst)
+			worst = cand->blocks / L;
+	} else {
+		r = (cand->join ? 2 : 1) * st->table_blocks / L;
+		reserve_scan(B, cand->table, r);
+		if (cand->join)
+			reserve_scan(B, cand->build_table, r);
+	}
+
+	for (i = 0; i < s->num_tables; i++) {
+		sum += B[i];
+		m += B[i] > 0;
+	}
+
+	if (sum > cap * iops_S(s->pm, n))
+		return 0;
+	return !n || worst <= cap * iops_idx(s->pm, n, m > 0);
+}
+
+/*
+ * Replay the admitted work plus the candidate with no further arrivals.
+ * Returns the total slack, or -INF if a deadline would be missed.
+ */
+static double replay(struct sim *s, struct squery *cand)
+{
+	struct state *r = &s->scratch;
+	struct hent ent;
+	struct squery *q;
+	double now = s->now, slack = 0;
+
+	heap_copy(&r->scan, &s->st.scan);
+	heap_copy(&r->index, &s->st.index);
+	r->table_blocks = s->st.table_blocks;
+	r->vs = s->st.vs;
+	r->vi = s->st.vi;
+	memcpy(r->refs, s->st.refs, s->num_tables * sizeof(*r->refs));
+	r->tables = s->st.tables;
+
+	attach(r, cand, cand->join);
+
+	while (step(r, s->pm, 1 - s->headroom, &now, INF, &ent, NULL)) {
+		q = finish(r, &ent);
+		if (!q)
+			continue;
+		if (now > q->deadline + TIME_EPS)
+			return -INF;
+		slack += q->deadline - now;
+	}
+
+	return slack;
+}
+
+/*
+ * Decide on a new query: returns 1 and sets q->method if admitted
+ */
+static int admit(struct sim *s, struct squery *q)
+{
+	double g_scan, g_idx;
+
+	/* hash joins scan both relations */
+	if (q->join) {
+		q->method = SCAN;
+		switch (s->policy) {
+		case POLICY_RESERVE:
+			return reserve_fits(s, q);
+		case POLICY_PREDICT:
+			return replay(s, q) > -INF;
+		}
+		return 1;
+	}
+
+	switch (s->policy) {
+	case POLICY_RESERVE:
+		q->method = cheaper_method(s, q);
+		if (reserve_fits(s, q))
+			return 1;
+		q->method = q->method == SCAN ? INDEX : SCAN;
+		return reserve_fits(s, q);
+
+	case POLICY_PREDICT:
+		q->method = SCAN;
+		g_scan = replay(s, q);
+		q->method = INDEX;
+		g_idx = replay(s, q);
+		if (g_scan == -INF && g_idx == -INF)
+			return 0;
+		q->method = g_idx > g_scan ? INDEX : SCAN;
+		return 1;
+	}
+
+	q->method = cheaper_method(s, q);
+	return 1;
+}
+
+/*
+ * Workload
+ */
+
+/* as WorkloadGenerator.randRange(): uniform in [low, high] */
+static long long rand_range(struct rng *r, long long low, long long high)
+{
+	return low + (long long)rng_range(r, high - low + 1);
+}
+
+static struct squery *new_query(struct sim *s)
+{
+	struct squery *q = pool_get(&s->free);
+
+	if (!q) {
+		if (s->allocated == MAX_QUERIES) {
+			fprintf(stderr, "more than %d queries in the system\n",
+					MAX_QUERIES);
+			exit(1);
+		}
+		q = malloc(sizeof(*q));
+		assert(q);
+		s->allocated++;
+	}
+
+	q->id = s->stats.arrived++;
+	q->arrival = s->now;
+	q->blocks = rand_range(&s->rng, 1, s->max_blocks);
+	q->deadline = s->now + rand_range(&s->rng, 1, s->max_deadline);
+	q->table = rng_range(&s->rng, s->num_tables);
+	q->join = 0;
+	q->build_table = q->table;
+
+	if (s->num_tables > 1 && rng_double(&s->rng) < s->join_frac) {
+		q->join = 1;
+		q->build_table = (q->table + 1 +
+				rng_range(&s->rng, s->num_tables - 1)) % s->num_tables;
+	}
+
+	return q;
+}
+
+static void query_done(struct sim *s, struct squery *q)
+{
+	struct stats *st = &s->stats;
+
+	st->finished++;
+	if (s->now > q->deadline + TIME_EPS) {
+		st->misses++;
+		st->lateness += s->now - q->deadline;
+	} else
+		st->slack += q->deadline - s->now;
+
+	if (s->verbose)
+		printf("done %llu %s %.3f %.3f %.3f\n", q->id,
+				q->join ? "join" : q->method == SCAN ? "scan" : "index",
+				q->arrival, q->deadline, s->now);
+
+	pool_put(&s->free, q);
+}
+
+static void run(struct sim *s, unsigned long long num_queries)
+{
+	double next = 0, scale;
+	struct squery *q;
+	struct hent ent;
+
+	while (s->stats.arrived < num_queries || s->st.scan.size ||
+			s->st.index.size) {
+		scale = s->noise ? 1 + s->noise * (2 * rng_double(&s->rng) - 1) : 1;
+
+		if (step(&s->st, s->pm, scale, &s->now,
+				s->stats.arrived < num_queries ? next : INF,
+				&ent, &s->stats)) {
+			q = finish(&s->st, &ent);
+			if (q)
+				query_done(s, q);
+			continue;
+		}
+
+		q = new_query(s);
+		if (admit(s, q)) {
+			s->stats.admitted++;
+			if (q->join)
+				s->stats.joins++;
+			else if (q->method == SCAN)
+				s->stats.scans++;
+			else
+				s->stats.indexes++;
+			attach(&s->st, q, q->join);
+		} else {
+			if (s->verbose)
+				printf("reject %llu %.3f %.3f\n", q->id, q->arrival,
+						q->deadline);
+			pool_put(&s->free, q);
+		}
+
+		next = s->now - log(1 - rng_double(&s->rng)) / s->arrival_rate;
+	}
+}
+
+static void report(struct sim *s, double wall)
+{
+	struct stats *st = &s->stats;
+	double T = s->now > 0 ? s->now : 1;
+	double util = (st->seq_blocks / iops_S(s->pm, 0) +
+			st->idx_blocks / iops_idx(s->pm, 1, 0)) / T;
+
+	printf("policy %s\n", policy_names[s->policy]);
+	printf("queries %llu\n", st->arrived);
+	printf("admitted %llu (%.4f) scan %llu index %llu join %llu\n",
+			st->admitted, st->arrived ? st->admitted / (double)st->arrived : 0,
+			st->scans, st->indexes, st->joins);
+	printf("deadline misses %llu (%.4f of admitted) mean lateness %.3f s\n",
+			st->misses, st->finished ? st->misses / (double)st->finished : 0,
+			st->misses ? st->lateness / st->misses : 0);
+	printf("mean slack %.3f s\n",
+			st->finished > st->misses ?
+			st->slack / (st->finished - st->misses) : 0);
+	printf("utilization %.4f busy %.4f scanning %.4f\n", util, st->busy / T,
+			st->scan_busy / T);
+	printf("throughput seq %.1f idx %.1f blocks/s\n", st->seq_blocks / T,
+			st->idx_blocks / T);
+	printf("simulated %.1f s in %.3f s (%.0f queries/s)\n", s->now, wall,
+			wall > 0 ? st->arrived / wall : 0);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -p <pmodel.dat> [-P none|reserve|predict] [-n <queries>]\n"
+			"       [-a <arrivals/s>] [-B <max blocks>] [-D <max deadline s>]\n"
+			"       [-L <table blocks>] [-T <tables>] [-j <join fraction>] [-H <headroom>]\n"
+			"       [-z <rate noise>] [-S <seed>] [-v]\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct pmodel pm;
+	struct sim s;
+	char *pmodel = NULL;
+	unsigned long long num_queries = 1000000, seed = 0;
+	double start;
+	char c;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	s.policy = POLICY_PREDICT;
+	s.num_tables = 2;
+	s.max_blocks = 262144;
+	s.st.table_blocks = 262144;
+	s.max_deadline = 300;
+	s.arrival_rate = 1;
+	s.join_frac = 0.1;
+
+	while ((c = getopt(argc, argv, "p:P:n:a:B:L:D:T:j:H:z:S:v")) != -1) {
+		switch (c) {
+		case 'p':
+			pmodel = optarg;
+			break;
+		case 'P':
+			for (i = 0; policy_names[i]; i++)
+				if (!strcmp(policy_names[i], optarg))
+					break;
+			if (!policy_names[i]) {
+				usage();
+				exit(1);
+			}
+			s.policy = i;
+			break;
+		case 'n':
+			num_queries = strtoull(optarg, NULL, 0);
+			break;
+		case 'a':
+			s.arrival_rate = atof(optarg);
+			break;
+		case 'B':
+			s.max_blocks = atoll(optarg);
+			break;
+		case 'L':
+			s.st.table_blocks = atoll(optarg);
+			break;
+		case 'D':
+			s.max_deadline = atoi(optarg);
+			break;
+		case 'T':
+			s.num_tables = atoi(optarg);
+			break;
+		case 'j':
+			s.join_frac = atof(optarg);
+			break;
+		case 'H':
+			s.headroom = atof(optarg);
+			break;
+		case 'z':
+			s.noise = atof(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			s.verbose = 1;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (!pmodel) {
+		usage();
+		exit(1);
+	}
+
+	if (s.num_tables < 1 || s.num_tables > MAX_TABLES || s.max_blocks < 1 ||
+			s.st.table_blocks < 1 ||
+			s.max_deadline < 1 || s.arrival_rate <= 0 ||
+			s.headroom < 0 || s.headroom >= 1 || s.noise < 0 ||
+			s.noise >= 1) {
+		fprintf(stderr, "option out of range\n");
+		exit(1);
+	}
+
+	if (pmodel_load(&pm, pmodel))
+		exit(1);
+	s.pm = &pm;
+
+	rng_seed(&s.rng, seed);
+	assert(pool_init(&s.free, MAX_QUERIES) == 0);
+
+	start = wall_now();
+	run(&s, num_queries);
+	report(&s, wall_now() - start);
+
+	pmodel_free(&pm);
+	return 0;
+}
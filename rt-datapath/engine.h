@@ -0,0 +1,170 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "ctrl.h"
+#include "ioengine.h"
+#include "pool.h"
+#include "rng.h"
+#include "tuple.h"
+#include "column.h"
+#include "join.h"
+#include "share.h"
+#include "index.h"
+#include "prefetch.h"
+#include "bcache.h"
+#include "mclock.h"
+#include "slack.h"
+#include "hist.h"
+
+#define READ_SIZE (4096)
+
+/* some reasonble bounds */
+#define MAX_STREAMS 1024
+#define MAX_NAME 256
+#define MAX_DEPTH 64
+
+/*
+ * Reads of one row group of a columnar file: the predicate column block
+ * and, unless the query counts, the aggregate column block. The query runs
+ * once both are in.
+ */
+struct col_unit {
+	struct io_req *req[2];
+	int pending;		/* reads still in flight, 0 = slot free */
+};
+
+/*
+ * An index probe: descend from the root to the first leaf that can hold
+ * lo, then read the heap blocks of the rids found there, leaf by leaf,
+ * until the keys reach hi. One read is in flight at a time.
+ */
+struct probe {
+	struct io_req *req;	/* NULL when the slot is free */
+	int32_t lo, hi;
+	uint32_t page;		/* index page to read next, 0 for none */
+	int reading_index;	/* req reads an index page, not the heap */
+	int num_rids;
+	int next_rid;
+	uint32_t rids[INDEX_FANOUT];
+};
+
+/*
+ * A stream is one scan (sequential or index) over one relation file.
+ *
+ * Dispatch is gated by two knobs the controller can turn: a token bucket
+ * (rate, in blocks/s; 0 means unlimited) and a queue depth (max reads the
+ * stream may have in flight).
+ */
+struct stream {
+	int id;
+	char filename[MAX_NAME];
+	int fd;
+	int random_workload;
+	long long num_blocks;
+	long long next_block;	/* sequential cursor */
+	uint32_t file_id;	/* expected in block stamps */
+	struct rng rng;		/* index scan offsets */
+
+	/*
+	 * Columnar file (column.h). Sequential streams running the query
+	 * over it read row groups rather than blocks: the groups listed here,
+	 * which are all of them or those the zone maps let through.
+	 */
+	struct column_file col;
+	uint64_t *groups;
+	uint64_t num_groups;
+	uint64_t next_group;
+	struct col_unit units[MAX_DEPTH];
+
+	int stage;		/* join stage it feeds, -1 for none */
+
+	/*
+	 * B+tree of an index scan (-I). Without the shared buffer cache (-B)
+	 * inner pages are kept once read, as a buffer pool would, and leaves
+	 * and heap blocks are read every time. With it all three go through
+	 * the cache.
+	 */
+	struct probe *probes;	/* max_depth of them */
+	int index_fd;
+	struct index_meta index;
+	void **inner;		/* by page - leaves - 1 */
+	unsigned long long probes_done, rows_found;	/* during observation */
+	unsigned long long inner_hits, inner_reads, leaf_reads, heap_reads;
+	unsigned long long leaf_hits, heap_hits;
+
+	/* dispatch */
+	int depth;		/* current queue depth */
+	int max_depth;
+	int inflight;
+	struct prefetch pf;	/* sequential scans, with -P */
+	double tokens;		/* dispatch tokens */
+	double rate;		/* token refill rate (blocks/s), 0 = unlimited */
+	double reservation;	/* reserved blocks/s, 0 = best effort */
+
+	/* accounting */
+	unsigned long long blocks_read;	/* during observation */
+	unsigned long long completed;	/* since start */
+	unsigned long long ctrl_completed; /* completed at last controller tick */
+	struct hist lat;	/* read latency, usecs, during observation */
+	double start;
+	double finish;
+
+	/* controller state, see ctrl.c */
+	double integral;
+	double prev_err;
+	double base_rate;	/* unthrottled rate estimate (best effort) */
+	int behind;		/* consecutive periods short of reservation */
+	int warned;
+};
+
+struct engine {
+	struct io_engine *io;
+	int num_streams;
+	struct stream *streams;
+
+	int iodepth;		/* capacity of the io engine */
+	int inflight;
+	struct pool reqs;	/* free struct io_req, data points to the stream */
+	int alignment;
+
+	int observing;		/* counting blocks towards the output? */
+	int verbose;
+	int verify;		/* check block stamps, see block.h */
+	uint64_t seed;		/* data set seed to verify against */
+
+	/* tuple consumer: query run over every block read, see tuple.h */
+	const struct tuple_query *query;
+	struct tuple_agg agg;
+	unsigned long long scan_cycles;
+	int zone_skip;		/* skip row groups using zone maps */
+
+	/* size the queue of sequential scans by prefetch.h, not just depth */
+	int prefetch;
+
+	/* buffer cache shared by the index scans, NULL for none */
+	struct bcache *cache;
+
+	/* mClock picks whose reads go next, NULL for the token buckets */
+	struct mclock *mclock;
+
+	/* background reads or writes in the reservations' slack, NULL for none */
+	struct slack *slack;
+
+	/* keys per index probe, 1 for point lookups, 0 for plain random reads */
+	int index_range;
+
+	/* many queries evaluated together over every block, see share.h */
+	struct share *share;
+
+	/* Q3 join, see join.h: stage 0 builds, stage 1 probes */
+	struct join *join;
+	int stage;
+	unsigned long long join_cycles[2];	/* consuming blocks */
+	unsigned long long table_cycles;	/* building the hash tables */
+
+	struct ctrl ctrl;
+};
+
+double engine_now(struct engine *e);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Parallel relation file generator.
+ *
+ * Writes the $BASE.seq.N.dat and $BASE.rnd.N.dat files the drivers read,
+ * with every block stamped as described in block.h. Files are cut into
+ * large chunks which a pool of threads fills and writes with O_DIRECT, so
+ * generation runs at device speed rather than at the speed of one dd.
+ *
+ * The payload is pseudo-random by default; -f object or -f location fills
+ * it with rows of the paper's relations instead (tuple.h). With -C those
+ * are stored column by column with zone maps in a footer (column.h).
+ * A list such as -f location,object hands the formats to the files in
+ * turn, seq files first, the last one repeating.
+ *
+ * File systems that refuse O_DIRECT (tmpfs) are written through the page
+ * cache instead.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "block.h"
+#include "tuple.h"
+#include "column.h"
+
+#define MAX_FILES 1024
+#define MAX_THREADS 256
+#define MAX_NAME 256
+
+#define MB (1024 * 1024LL)
+#define USEC_PER_SEC (1000000)
+
+struct gen_file {
+	char filename[MAX_NAME];
+	uint32_t file_id;
+	int format;
+	int fd;
+	long long blocks;	/* written by the threads */
+	long long first_chunk;	/* global chunk number of block 0 */
+
+	/* columnar files */
+	uint64_t groups;
+	struct column_zone *zones;
+	size_t footer;		/* bytes after the blocks */
+};
+
+static struct gen_file files[MAX_FILES];
+static int num_files;
+
+static long long chunk_blocks;
+static long long num_chunks;
+static long long next_chunk;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t seed;
+static int formats[MAX_FILES];
+static int num_formats;
+static int columnar;
+
+static long long take_chunk(void)
+{
+	long long c;
+
+	pthread_mutex_lock(&chunk_lock);
+	c = next_chunk < num_chunks ? next_chunk++ : -1;
+	pthread_mutex_unlock(&chunk_lock);
+
+	return c;
+}
+
+/*
+ * Fill and write chunks until there are none left. Chunks are handed out
+ * in file order so the threads stay close together on the device.
+ */
+static void *writer(void *arg)
+{
+	long long c, b, n, j;
+	struct gen_file *f;
+	char *buf;
+	ssize_t ret;
+	int i = 0;
+
+	assert(posix_memalign((void **)&buf, BLOCK_SIZE,
+				chunk_blocks * BLOCK_SIZE) == 0);
+
+	while ((c = take_chunk()) >= 0) {
+		while (i + 1 < num_files && files[i + 1].first_chunk <= c)
+			i++;
+		f = &files[i];
+
+		b = (c - f->first_chunk) * chunk_blocks;
+		n = f->blocks - b < chunk_blocks ? f->blocks - b : chunk_blocks;
+
+		for (j = 0; j < n; j++)
+			if (columnar)
+				column_fill(buf + j * BLOCK_SIZE, f->format, f->file_id,
+						b + j, seed, f->groups, f->zones);
+			else
+				tuple_fill(buf + j * BLOCK_SIZE, f->format, f->file_id,
+						b + j, seed);
+
+		ret = pwrite(f->fd, buf, n * BLOCK_SIZE, b * BLOCK_SIZE);
+		if (ret != n * BLOCK_SIZE) {
+			fprintf(stderr, "%s: write failed: %s\n", f->filename,
+					ret < 0 ? strerror(errno) : "short write");
+			exit(1);
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int open_file(struct gen_file *f)
+{
+	f->fd = open(f->filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (f->fd < 0 && errno == EINVAL)
+		f->fd = open(f->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (f->fd < 0) {
+		perror(f->filename);
+		return -1;
+	}
+
+	/* ask for the whole file up front so it is laid out contiguously */
+	errno = posix_fallocate(f->fd, 0, f->blocks * BLOCK_SIZE + f->footer);
+	if (errno && errno != EOPNOTSUPP && errno != EINVAL) {
+		perror(f->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the zone maps the threads collected behind the column segments
+ */
+static int write_footer(struct gen_file *f)
+{
+	void *buf;
+	ssize_t ret;
+
+	assert(posix_memalign(&buf, BLOCK_SIZE, f->footer) == 0);
+	column_footer(buf, f->format, f->groups, f->zones);
+
+	ret = pwrite(f->fd, buf, f->footer, f->blocks * BLOCK_SIZE);
+	free(buf);
+	if (ret != (ssize_t)f->footer) {
+		fprintf(stderr, "%s: write failed: %s\n", f->filename,
+				ret < 0 ? strerror(errno) : "short write");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void add_file(const char *base, int random, int idx, long long blocks)
+{
+	struct gen_file *f = &files[num_files++];
+
+	snprintf(f->filename, sizeof(f->filename), "%s.%s.%d.dat", base,
+			random ? "rnd" : "seq", idx);
+	f->file_id = block_file_id(random, idx);
+	f->format = !num_formats ? BLOCK_RANDOM :
+		formats[num_files - 1 < num_formats ? num_files - 1 :
+			num_formats - 1];
+	f->blocks = blocks;
+
+	if (columnar) {
+		f->groups = column_groups(f->format, blocks);
+		f->blocks = f->groups * tuple_columns(f->format);
+		f->footer = column_footer_size(f->format, f->groups);
+		f->zones = calloc(f->blocks, sizeof(*f->zones));
+		assert(f->zones);
+	}
+
+	f->first_chunk = num_chunks;
+	num_chunks += (f->blocks + chunk_blocks - 1) / chunk_blocks;
+}
+
+static double tv_sec(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / (double)USEC_PER_SEC;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -s <num seq files> -x <num rnd files> -b <filename base>\n"
+			"       [-L <seq file MB>] [-l <rnd file MB>] [-c <chunk KB>]\n"
+			"       [-j <threads>] [-S <seed>] [-f <format>[,<format>..]] [-C]\n"
+			"  formats are random, object and location, handed to the files in turn\n"
+			"  -C stores object and location files column by column\n");
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[MAX_THREADS];
+	struct timeval start, finish;
+	char *filename_base = NULL;
+	int seq_files = -1, rnd_files = -1;
+	long long seq_mb = 8192, rnd_mb = 1024, chunk_kb = 4096;
+	int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long long total = 0;
+	double secs;
+	char c, *p;
+	int i;
+
+	while ((c = getopt(argc, argv, "s:x:b:L:l:c:j:S:f:C")) != -1) {
+		switch (c) {
+		case 's':
+			seq_files = atoi(optarg);
+			break;
+		case 'x':
+			rnd_files = atoi(optarg);
+			break;
+		case 'b':
+			filename_base = strdup(optarg);
+			break;
+		case 'L':
+			seq_mb = atoll(optarg);
+			break;
+		case 'l':
+			rnd_mb = atoll(optarg);
+			break;
+		case 'c':
+			chunk_kb = atoll(optarg);
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			for (p = strtok(optarg, ","); p; p = strtok(NULL, ",")) {
+				if (num_formats == MAX_FILES ||
+						(formats[num_formats++] = tuple_format(p)) < 0) {
+					usage();
+					exit(1);
+				}
+			}
+			break;
+		case 'C':
+			columnar = 1;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (seq_files < 0 || rnd_files < 0 || !filename_base) {
+		usage();
+		exit(1);
+	}
+
+	if (seq_files + rnd_files > MAX_FILES) {
+		fprintf(stderr, "Too many files! MAX_FILES=%d\n", MAX_FILES);
+		exit(1);
+	}
+
+	if (num_threads < 1 || num_threads > MAX_THREADS || seq_mb < 1 ||
+			rnd_mb < 1 || chunk_kb < BLOCK_SIZE / 1024 ||
+			chunk_kb % (BLOCK_SIZE / 1024)) {
+		fprintf(stderr, "option out of range\n");
+		exit(1);
+	}
+
+	chunk_blocks = chunk_kb * 1024 / BLOCK_SIZE;
+
+	for (i = 0; i < seq_files; i++)
+		add_file(filename_base, 0, i, seq_mb * MB / BLOCK_SIZE);
+	for (i = 0; i < rnd_files; i++)
+		add_file(filename_base, 1, i, rnd_mb * MB / BLOCK_SIZE);
+
+	for (i = 0; i < num_files; i++) {
+		if (columnar && files[i].format == BLOCK_RANDOM) {
+			fprintf(stderr, "-C needs a table format (-f)\n");
+			exit(1);
+		}
+		if (open_file(&files[i]))
+			exit(1);
+		total += files[i].blocks * BLOCK_SIZE + files[i].footer;
+	}
+
+	/* pick the crc32c implementation before the threads race to */
+	crc32c_impl();
+
+	assert(gettimeofday(&start, NULL) == 0);
+
+	for (i = 0; i < num_threads; i++)
+		assert(pthread_create(threads + i, NULL, writer, NULL) == 0);
+	for (i = 0; i < num_threads; i++)
+		assert(pthread_join(threads[i], NULL) == 0);
+
+	for (i = 0; i < num_files; i++) {
+		if (columnar && write_footer(&files[i]))
+			exit(1);
+		if (fsync(files[i].fd)) {
+			perror(files[i].filename);
+			exit(1);
+		}
+		close(files[i].fd);
+	}
+
+	assert(gettimeofday(&finish, NULL) == 0);
+
+	secs = tv_sec(&finish) - tv_sec(&start);
+	fprintf(stderr, "%d files, %lld MB in %.2f s (%.1f MB/s)\n", num_files,
+			total / MB, secs, secs > 0 ? total / MB / secs : 0);
+
+	return 0;
+}
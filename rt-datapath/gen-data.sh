@@ -3,26 +3,21 @@
 set -e
 set -x
 
-IF=/dev/zero
-DD=dd
-BS=4K
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
 
 BASE=$1
 NUM_SEQ=$2
 NUM_RND=$3
 
-do_gen_zeros() {
-    local OF="$BASE.$1.$2.dat"
-    $DD if=$IF of=$OF bs=$BS count=$3
-}
+# 8 GB seq files for plenty of growing room in doing scans, 1 GB rnd
+# files for random io. Every block is stamped, see block.h.
+$DIR/gen-data -b $BASE -s $NUM_SEQ -x $NUM_RND -L 8192 -l 1024
 
-# generate 8 GB files for plently of
-# growing room in doing scans
-for (( i = 0; i < $NUM_SEQ; i++)); do
-    do_gen_zeros seq $i 2M
-done
-
-# generate 1 GB files for random io
-for (( i = 0; i < $NUM_RND; i++)); do
-    do_gen_zeros rnd $i 256K
-done
+# The same files column by column (Object seq, Location rnd), at the
+# default sizes, for the -q/-z column scans.
+if [ "$4" == "columnar" ]; then
+	FORMATS=
+	for i in $(seq $NUM_SEQ); do FORMATS+=object,; done
+	FORMATS+=location
+	$DIR/gen-data -b $BASE.col -s $NUM_SEQ -x $NUM_RND -f $FORMATS -C
+fi
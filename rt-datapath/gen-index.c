@@ -0,0 +1,333 @@
+/*
+ * B+tree index builder.
+ *
+ * Reads the $BASE.rnd.N.dat relation files gen-data wrote (-f object or
+ * location), sorts (key, rid) pairs of one integer column and bulk loads
+ * a full B+tree into $BASE.rnd.N.idx, as described in index.h. The index
+ * scans of async-workload -I probe it.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "index.h"
+
+#define MAX_NAME 256
+#define CHUNK_BLOCKS (256)
+#define USEC_PER_SEC (1000000)
+
+static const struct {
+	const char *name;
+	int format;
+	int col;
+} keys[] = {
+	/* the first of a table is its default */
+	{ "o_lid", TUPLE_OBJECT, 1 },
+	{ "o_oid", TUPLE_OBJECT, 0 },
+	{ "o_date", TUPLE_OBJECT, 2 },
+	{ "l_lid", TUPLE_LOCATION, 0 },
+	{ NULL },
+};
+
+/* sort keys as unsigned: flip the sign bit */
+static inline uint64_t pack(int32_t key, uint32_t rid)
+{
+	return (uint64_t)((uint32_t)key ^ 0x80000000u) << 32 | rid;
+}
+
+static inline int32_t unpack_key(uint64_t v)
+{
+	return (int32_t)((uint32_t)(v >> 32) ^ 0x80000000u);
+}
+
+/*
+ * LSD radix sort, 16 bits a pass
+ */
+static void radix_sort(uint64_t *v, uint64_t *tmp, size_t n)
+{
+	static size_t count[1 << 16];
+	uint64_t *src = v, *dst = tmp, *t;
+	size_t i, sum, c;
+	int shift;
+
+	for (shift = 0; shift < 64; shift += 16) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			count[(src[i] >> shift) & 0xffff]++;
+		for (i = sum = 0; i < 1 << 16; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++)
+			dst[count[(src[i] >> shift) & 0xffff]++] = src[i];
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	/* four passes: the result is back in v */
+}
+
+/*
+ * Collect (key, rid) of every row of the relation
+ */
+static uint64_t *read_relation(const char *filename, int format, int col,
+		uint32_t *file_id, size_t *num)
+{
+	int words = tuple_columns(format);
+	uint64_t *v = NULL;
+	size_t n = 0, cap = 0;
+	long long block = 0;
+	char *buf;
+	ssize_t ret;
+	int fd, i, j;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror(filename);
+		return NULL;
+	}
+	assert(posix_memalign((void **)&buf, BLOCK_SIZE,
+				CHUNK_BLOCKS * BLOCK_SIZE) == 0);
+
+	while ((ret = pread(fd, buf, CHUNK_BLOCKS * BLOCK_SIZE,
+					block * BLOCK_SIZE)) > 0) {
+		for (i = 0; i < ret / BLOCK_SIZE; i++, block++) {
+			const struct block_hdr *h = (void *)(buf + i * BLOCK_SIZE);
+			const uint32_t *w = (const uint32_t *)(h + 1);
+
+			if (block >= 1LL << 24) {
+				fprintf(stderr, "%s: too large for 32-bit rids\n",
+						filename);
+				goto fail;
+			}
+			if (h->magic != BLOCK_MAGIC || h->format != format ||
+					h->rows >= INDEX_SLOTS) {
+				fprintf(stderr, "%s: block %lld is not %s rows\n",
+						filename, block, tuple_format_name(format));
+				goto fail;
+			}
+			*file_id = h->file_id;
+
+			if (n + h->rows > cap) {
+				cap = cap ? 2 * cap : 1 << 20;
+				v = realloc(v, cap * sizeof(*v));
+				assert(v);
+			}
+			for (j = 0; j < h->rows; j++)
+				v[n++] = pack(w[j * words + col],
+						block * INDEX_SLOTS + j);
+		}
+	}
+	if (ret < 0) {
+		perror(filename);
+		goto fail;
+	}
+
+	free(buf);
+	close(fd);
+	*num = n;
+	return v;
+
+fail:
+	free(buf);
+	free(v);
+	close(fd);
+	return NULL;
+}
+
+static int write_page(int fd, void *page, uint32_t num)
+{
+	if (pwrite(fd, page, INDEX_PAGE, (off_t)num * INDEX_PAGE) != INDEX_PAGE)
+		return -1;
+	return 0;
+}
+
+/*
+ * Write one level of pages from sorted entries, leaving the separators of
+ * the level above in place of the entries.
+ */
+static int write_level(int fd, struct index_entry *e, size_t *n, int level,
+		uint32_t *next_page)
+{
+	char page[INDEX_PAGE];
+	struct index_page *p = (struct index_page *)page;
+	size_t i, k, parents = 0;
+
+	for (i = 0; i < *n; i += INDEX_FANOUT) {
+		k = *n - i < (size_t)INDEX_FANOUT ? *n - i : INDEX_FANOUT;
+
+		memset(page, 0, sizeof(page));
+		p->magic = INDEX_MAGIC;
+		p->page = *next_page;
+		p->level = level;
+		p->n = k;
+		memcpy(index_entries(page), e + i, k * sizeof(*e));
+		if (write_page(fd, page, p->page))
+			return -1;
+
+		/* parents are written behind, so this never overtakes i */
+		e[parents].key = e[i].key;
+		e[parents].val = p->page;
+		parents++;
+		(*next_page)++;
+	}
+
+	*n = parents;
+	return 0;
+}
+
+static int build_index(const char *filename, const char *key)
+{
+	char name[MAX_NAME];
+	struct index_meta m;
+	struct index_entry *e;
+	struct timeval start, finish;
+	uint64_t *v, *tmp;
+	uint32_t file_id = 0, next_page = 1;
+	size_t n, i;
+	const char *kname = NULL;
+	int format, col = -1, fd, level;
+	char page[INDEX_PAGE];
+
+	assert(gettimeofday(&start, NULL) == 0);
+
+	format = tuple_file_format(filename);
+	for (i = 0; keys[i].name; i++)
+		if (keys[i].format == format && !kname &&
+				(!key || !strcmp(keys[i].name, key))) {
+			kname = keys[i].name;
+			col = keys[i].col;
+		}
+	if (col < 0) {
+		fprintf(stderr, "%s: no %s column to index in %s rows\n", filename,
+				key ? key : "integer",
+				format < 0 ? "unknown" : tuple_format_name(format));
+		return -1;
+	}
+
+	v = read_relation(filename, format, col, &file_id, &n);
+	if (!v || !n)
+		return -1;
+
+	tmp = malloc(n * sizeof(*tmp));
+	assert(tmp);
+	radix_sort(v, tmp, n);
+	free(tmp);
+
+	/* in place: entries are the same size as the packed pairs */
+	e = (struct index_entry *)v;
+	memset(&m, 0, sizeof(m));
+	m.min_key = unpack_key(v[0]);
+	m.max_key = unpack_key(v[n - 1]);
+	for (i = 0; i < n; i++) {
+		uint64_t x = v[i];
+
+		e[i].key = unpack_key(x);
+		e[i].val = (uint32_t)x;
+	}
+
+	index_name(name, sizeof(name), filename);
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(name);
+		free(v);
+		return -1;
+	}
+
+	m.entries = n;
+	for (level = 0; level == 0 || n > 1; level++) {
+		if (write_level(fd, e, &n, level, &next_page))
+			goto fail;
+		if (!level)
+			m.leaves = next_page - 1;
+	}
+
+	m.magic = INDEX_MAGIC;
+	m.version = INDEX_VERSION;
+	m.format = format;
+	m.key_col = col;
+	m.file_id = file_id;
+	m.pages = next_page;
+	m.root = next_page - 1;
+	m.height = level;
+	m.crc = crc32c(0, &m, offsetof(struct index_meta, crc));
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, &m, sizeof(m));
+	if (write_page(fd, page, 0) || fsync(fd))
+		goto fail;
+	close(fd);
+	free(v);
+
+	assert(gettimeofday(&finish, NULL) == 0);
+	fprintf(stderr, "%s: %llu entries on %s, %u leaves, %u levels, "
+			"%.1f MB in %.2f s\n", name, (unsigned long long)m.entries,
+			kname, m.leaves, m.height, m.pages * (double)INDEX_PAGE / (1024 * 1024),
+			finish.tv_sec - start.tv_sec +
+			(finish.tv_usec - start.tv_usec) / (double)USEC_PER_SEC);
+	return 0;
+
+fail:
+	perror(name);
+	close(fd);
+	free(v);
+	return -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -x <num rnd files> -b <filename base> [-k <column>]\n"
+			"  columns: o_oid, o_lid (default for Object), o_date,\n"
+			"           l_lid (default for Location)\n");
+}
+
+int main(int argc, char **argv)
+{
+	char filename[MAX_NAME];
+	char *filename_base = NULL, *key = NULL;
+	int rnd_files = -1;
+	char c;
+	int i;
+
+	while ((c = getopt(argc, argv, "x:b:k:")) != -1) {
+		switch (c) {
+		case 'x':
+			rnd_files = atoi(optarg);
+			break;
+		case 'b':
+			filename_base = strdup(optarg);
+			break;
+		case 'k':
+			key = strdup(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (rnd_files < 0 || !filename_base) {
+		usage();
+		exit(1);
+	}
+
+	for (i = 0; i < rnd_files; i++) {
+		snprintf(filename, sizeof(filename), "%s.rnd.%d.dat",
+				filename_base, i);
+		if (build_index(filename, key))
+			exit(1);
+	}
+
+	return 0;
+}
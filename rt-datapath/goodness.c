@@ -0,0 +1,139 @@
+/*
+ * Workload goodness: choosing seq-scan vs idx-scan for each query.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "goodness.h"
+
+double goodness_eval(const struct pmodel *pm, const struct query *q, int n,
+		const unsigned char *qi)
+{
+	int i, num_qi = 0, num_qs;
+	double g = 0;
+
+	for (i = 0; i < n; i++)
+		num_qi += !!qi[i];
+	num_qs = n - num_qi;
+
+	for (i = 0; i < n; i++) {
+		if (!qi[i])
+			g += q[i].deadline - pmodel_t_S(pm, q[i].blocks, num_qi);
+		else if (num_qs)
+			g += q[i].deadline - pmodel_t_Is(pm, q[i].blocks, num_qi);
+		else
+			g += q[i].deadline - pmodel_t_I(pm, q[i].blocks, num_qi);
+	}
+
+	return g;
+}
+
+double goodness_exhaustive(const struct pmodel *pm, const struct query *q,
+		int n, unsigned char *qi)
+{
+	unsigned char cur[GOODNESS_MAX_EXHAUSTIVE];
+	unsigned long mask, best_mask = 0;
+	double g, best = 0;
+	int i;
+
+	assert(n <= GOODNESS_MAX_EXHAUSTIVE);
+
+	for (mask = 0; mask < (1UL << n); mask++) {
+		for (i = 0; i < n; i++)
+			cur[i] = (mask >> i) & 1;
+		g = goodness_eval(pm, q, n, cur);
+		if (!mask || g > best) {
+			best = g;
+			best_mask = mask;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		qi[i] = (best_mask >> i) & 1;
+
+	return best;
+}
+
+struct gain {
+	double delta;	/* goodness gained by moving to the idx-scan set */
+	int query;
+};
+
+static int gain_cmp(const void *a, const void *b)
+{
+	const struct gain *x = a, *y = b;
+
+	if (x->delta > y->delta)
+		return -1;
+	if (x->delta < y->delta)
+		return 1;
+	return x->query - y->query;
+}
+
+/*
+ * Rank queries by their gain from an index scan at |QI| = k (0 < k < n,
+ * so the seq-scan set is never empty). Returns the seq-only goodness.
+ */
+static double rank_gains(const struct pmodel *pm, const struct query *q,
+		int n, int k, struct gain *gains)
+{
+	double base = 0, s, i_s;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		s = q[i].deadline - pmodel_t_S(pm, q[i].blocks, k);
+		i_s = q[i].deadline - pmodel_t_Is(pm, q[i].blocks, k);
+		base += s;
+		gains[i].delta = i_s - s;
+		gains[i].query = i;
+	}
+
+	qsort(gains, n, sizeof(*gains), gain_cmp);
+	return base;
+}
+
+double goodness_solve(const struct pmodel *pm, const struct query *q, int n,
+		unsigned char *qi)
+{
+	struct gain *gains;
+	double g, best;
+	int i, k, best_k = 0;
+
+	gains = malloc((n ? n : 1) * sizeof(*gains));
+	assert(gains);
+
+	/* k = 0: everything shares the scan */
+	memset(qi, 0, n);
+	best = goodness_eval(pm, q, n, qi);
+
+	/* k = n: no scan, every query uses its own index scan */
+	if (n) {
+		memset(qi, 1, n);
+		g = goodness_eval(pm, q, n, qi);
+		if (g > best) {
+			best = g;
+			best_k = n;
+		}
+	}
+
+	for (k = 1; k < n; k++) {
+		g = rank_gains(pm, q, n, k, gains);
+		for (i = 0; i < k; i++)
+			g += gains[i].delta;
+		if (g > best) {
+			best = g;
+			best_k = k;
+		}
+	}
+
+	memset(qi, best_k == n, n);
+	if (best_k > 0 && best_k < n) {
+		rank_gains(pm, q, n, best_k, gains);
+		for (i = 0; i < best_k; i++)
+			qi[gains[i].query] = 1;
+	}
+
+	free(gains);
+	return best;
+}
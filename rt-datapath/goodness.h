@@ -0,0 +1,38 @@
+#ifndef GOODNESS_H
+#define GOODNESS_H
+
+#include "pmodel.h"
+
+/*
+ * Information about a query (as in linear/Query.java)
+ */
+struct query {
+	long long blocks;	/* 4K blocks */
+	double deadline;	/* seconds */
+};
+
+/* largest workload goodness_exhaustive() will enumerate */
+#define GOODNESS_MAX_EXHAUSTIVE 30
+
+/*
+ * Average-case goodness of a partition of the workload into a seq-scan set
+ * and an idx-scan set (qi[i] != 0). The operating point is
+ * (min(1, |QS|), |QI|), as in exhaustive/goodness.py.
+ */
+double goodness_eval(const struct pmodel *pm, const struct query *q, int n,
+		const unsigned char *qi);
+
+/*
+ * Find the partition with maximum goodness. Both return the goodness and
+ * store the chosen partition in qi.
+ *
+ *  - exhaustive: enumerates all 2^n partitions (the Python reference).
+ *  - solve: for each |QI| = k picks the k queries gaining the most from
+ *    an index scan, O(n^2 log n) and exact for the same objective.
+ */
+double goodness_exhaustive(const struct pmodel *pm, const struct query *q,
+		int n, unsigned char *qi);
+double goodness_solve(const struct pmodel *pm, const struct query *q, int n,
+		unsigned char *qi);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Latency histogram with log-linear buckets: 16 per power of two, so any
+ * percentile is within about 6% of the true value, in a few KB and with
+ * O(1) inserts. Values are unsigned integers in whatever unit the caller
+ * picks (usecs or nsecs).
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	unsigned long long count[HIST_BUCKETS];
+	unsigned long long n;
+	unsigned long long max;
+	double sum;
+};
+
+static inline void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+static inline int hist_bucket(uint64_t v)
+{
+	int e;
+
+	if (v < HIST_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+	return e * HIST_SUB + ((v >> (e - 1)) & (HIST_SUB - 1));
+}
+
+/* smallest value of a bucket */
+static inline uint64_t hist_value(int b)
+{
+	int e = b / HIST_SUB;
+
+	if (!e)
+		return b;
+	return (uint64_t)(HIST_SUB + b % HIST_SUB) << (e - 1);
+}
+
+static inline void hist_add(struct hist *h, uint64_t v)
+{
+	h->count[hist_bucket(v)]++;
+	h->n++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+static inline void hist_merge(struct hist *h, const struct hist *o)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		h->count[i] += o->count[i];
+	h->n += o->n;
+	h->sum += o->sum;
+	if (o->max > h->max)
+		h->max = o->max;
+}
+
+static inline double hist_mean(const struct hist *h)
+{
+	return h->n ? h->sum / h->n : 0;
+}
+
+/* value below which a fraction p (0..1) of the samples fall */
+static inline uint64_t hist_pct(const struct hist *h, double p)
+{
+	unsigned long long want = p * h->n, seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen > want)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * B+tree index pages: meta data and searches (index.h).
+ */
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "index.h"
+
+void index_name(char *out, size_t len, const char *relation)
+{
+	size_t n = strlen(relation);
+
+	if (n > 4 && !strcmp(relation + n - 4, ".dat"))
+		n -= 4;
+	snprintf(out, len, "%.*s.idx", (int)n, relation);
+}
+
+int index_read_meta(const char *filename, struct index_meta *m)
+{
+	int fd, ret = -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (pread(fd, m, sizeof(*m), 0) == sizeof(*m) &&
+			m->magic == INDEX_MAGIC && m->version == INDEX_VERSION &&
+			m->crc == crc32c(0, m, offsetof(struct index_meta, crc)) &&
+			m->leaves && m->root < m->pages)
+		ret = 0;
+	close(fd);
+
+	return ret;
+}
+
+int index_check_page(const void *buf, uint32_t page)
+{
+	const struct index_page *p = buf;
+
+	if (p->magic != INDEX_MAGIC || p->page != page ||
+			p->n > INDEX_FANOUT)
+		return -1;
+	return 0;
+}
+
+uint32_t index_child(const void *page, int32_t lo)
+{
+	const struct index_page *p = page;
+	const struct index_entry *e = index_entries(page);
+	int l = 0, h = p->n;
+
+	/* first entry with key >= lo */
+	while (l < h) {
+		int m = (l + h) / 2;
+
+		if (e[m].key < lo)
+			l = m + 1;
+		else
+			h = m;
+	}
+
+	return e[l ? l - 1 : 0].val;
+}
+
+int index_collect(const void *page, int32_t lo, int32_t hi, uint32_t *rids,
+		int *more)
+{
+	const struct index_page *p = page;
+	const struct index_entry *e = index_entries(page);
+	int l = 0, h = p->n, n = 0;
+
+	while (l < h) {
+		int m = (l + h) / 2;
+
+		if (e[m].key < lo)
+			l = m + 1;
+		else
+			h = m;
+	}
+
+	for (; l < p->n && e[l].key < hi; l++)
+		rids[n++] = e[l].val;
+
+	*more = l == p->n;
+	return n;
+}
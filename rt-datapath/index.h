@@ -0,0 +1,92 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+
+#include "block.h"
+#include "tuple.h"
+
+/*
+ * B+tree index over one integer column of a generated relation file
+ * (gen-index), stored next to it as "$BASE.rnd.N.idx".
+ *
+ * Page 0 holds the meta data. The leaves follow in key order from page 1,
+ * so a range scan moves from leaf to leaf by page number, and the inner
+ * levels are written bottom up after them, the root last. Leaf entries
+ * are (key, rid) sorted on both, with rid = block * INDEX_SLOTS + row;
+ * inner entries are (first key of the child, child page).
+ */
+#define INDEX_MAGIC (0x49445452)	/* "RTDI" */
+#define INDEX_VERSION 1
+#define INDEX_PAGE (BLOCK_SIZE)
+#define INDEX_SLOTS (256)		/* > rows in any block */
+
+struct index_meta {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t format;	/* table of the relation */
+	uint32_t key_col;	/* 32-bit word of the row */
+	uint32_t file_id;	/* of the relation */
+	uint32_t leaves;
+	uint32_t pages;		/* all of them, meta included */
+	uint32_t root;
+	uint32_t height;	/* levels, the leaves included */
+	uint64_t entries;
+	int32_t min_key;
+	int32_t max_key;
+	uint32_t crc;		/* CRC32C of the above */
+};
+
+struct index_page {
+	uint32_t magic;
+	uint32_t page;		/* its own page number */
+	uint16_t level;		/* 0 for leaves */
+	uint16_t n;
+	uint32_t pad;
+};
+
+struct index_entry {
+	int32_t key;
+	uint32_t val;		/* rid in leaves, child page in inner pages */
+};
+
+#define INDEX_FANOUT ((int)((INDEX_PAGE - sizeof(struct index_page)) / \
+			sizeof(struct index_entry)))
+
+static inline struct index_entry *index_entries(const void *page)
+{
+	return (struct index_entry *)((struct index_page *)page + 1);
+}
+
+/* "$BASE.rnd.N.dat" -> "$BASE.rnd.N.idx" */
+void index_name(char *out, size_t len, const char *relation);
+
+/* read and check the meta page; -1 if there is no usable index */
+int index_read_meta(const char *filename, struct index_meta *m);
+
+/* 0 when buf is page 'page' of an index */
+int index_check_page(const void *buf, uint32_t page);
+
+/*
+ * Child of an inner page to descend to for keys >= lo: the last whose
+ * first key is below lo, as equal keys may start in the child before.
+ */
+uint32_t index_child(const void *page, int32_t lo);
+
+/*
+ * Collect the rids of a leaf's entries with lo <= key < hi. Returns how
+ * many; *more is set when the range may go on in the next leaf.
+ */
+int index_collect(const void *page, int32_t lo, int32_t hi, uint32_t *rids,
+		int *more);
+
+/* key of row 'row' in a heap block of the indexed relation */
+static inline int32_t index_row_key(const struct index_meta *m,
+		const void *block, int row)
+{
+	const uint32_t *w = (const uint32_t *)((struct block_hdr *)block + 1);
+
+	return (int32_t)w[row * tuple_columns(m->format) + m->key_col];
+}
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * libaio I/O engine: O_DIRECT reads and writes on real files/devices
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <libaio.h>
+
+#include "ioengine.h"
+
+#define NSEC_PER_SEC (1000000000)
+
+struct aio_data {
+	io_context_t ctx;
+	struct io_event *events;
+};
+
+static struct iocb *req_iocb(struct io_req *req)
+{
+	return (struct iocb *)req->priv;
+}
+
+static int aio_init(struct io_engine *io, const char *opts)
+{
+	struct aio_data *ad;
+	int ret;
+
+	assert(sizeof(struct iocb) <= sizeof(((struct io_req *)0)->priv));
+
+	ad = calloc(1, sizeof(*ad));
+	if (!ad) {
+		perror("calloc");
+		return -1;
+	}
+
+	ad->events = malloc(io->depth * sizeof(*ad->events));
+	if (!ad->events) {
+		perror("malloc");
+		free(ad);
+		return -1;
+	}
+
+	ret = io_queue_init(io->depth, &ad->ctx);
+	if (ret) {
+		fprintf(stderr, "io_queue_init: %s\n", strerror(-ret));
+		free(ad->events);
+		free(ad);
+		return -1;
+	}
+
+	io->priv = ad;
+	return 0;
+}
+
+static int aio_open(struct io_engine *io, const char *filename, int flags,
+		long long *size)
+{
+	int fd;
+
+	fd = open(filename, flags | O_DIRECT, 0644);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+
+	/* works for regular files and block devices alike */
+	*size = lseek(fd, 0, SEEK_END);
+	if (*size < 0) {
+		perror(filename);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void aio_close(struct io_engine *io, int fd)
+{
+	close(fd);
+}
+
+static int aio_submit(struct io_engine *io, struct io_req **reqs, int n)
+{
+	struct aio_data *ad = io->priv;
+	struct iocb *ioq[n];
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		struct io_req *req = reqs[i];
+		struct iocb *iocb = req_iocb(req);
+
+		if (req->op == IO_WRITE)
+			io_prep_pwrite(iocb, req->fd, req->buf, req->len, req->offset);
+		else
+			io_prep_pread(iocb, req->fd, req->buf, req->len, req->offset);
+		iocb->data = req;
+		ioq[i] = iocb;
+	}
+
+	/* io_submit() may take fewer than asked: the rest still go */
+	i = 0;
+	while (i < n) {
+		ret = io_submit(ad->ctx, n - i, ioq + i);
+		if (ret < 0) {
+			if (ret == -EINTR)
+				continue;
+			fprintf(stderr, "io_submit: %s\n", strerror(-ret));
+			return -1;
+		}
+		i += ret;
+	}
+
+	return 0;
+}
+
+static int aio_getevents(struct io_engine *io, int min, int max,
+		struct io_req **done, double timeout)
+{
+	struct aio_data *ad = io->priv;
+	struct timespec ts, *tsp = NULL;
+	int ret, i;
+
+	if (timeout >= 0) {
+		ts.tv_sec = (time_t)timeout;
+		ts.tv_nsec = (long)((timeout - ts.tv_sec) * NSEC_PER_SEC);
+		tsp = &ts;
+	}
+
+	/* nothing in flight: just let time pass */
+	if (!min) {
+		if (tsp)
+			nanosleep(tsp, NULL);
+		return 0;
+	}
+
+	ret = io_getevents(ad->ctx, min, max, ad->events, tsp);
+	if (ret < 0) {
+		fprintf(stderr, "io_getevents: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	for (i = 0; i < ret; i++) {
+		done[i] = ad->events[i].data;
+		done[i]->res = ad->events[i].res2 ? (long)ad->events[i].res2 :
+			(long)ad->events[i].res;
+	}
+
+	return ret;
+}
+
+static double aio_now(struct io_engine *io)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec / (double)NSEC_PER_SEC;
+}
+
+static void aio_exit(struct io_engine *io)
+{
+	struct aio_data *ad = io->priv;
+
+	io_destroy(ad->ctx);
+	free(ad->events);
+	free(ad);
+}
+
+const struct io_engine_ops ioengine_aio_ops = {
+	.name = "aio",
+	.init = aio_init,
+	.open = aio_open,
+	.close = aio_close,
+	.submit = aio_submit,
+	.getevents = aio_getevents,
+	.now = aio_now,
+	.exit = aio_exit,
+};
@@ -0,0 +1,284 @@
+/*
+ * io_uring I/O engine: O_DIRECT reads and writes on real files/devices,
+ * through the raw system calls (no liburing). "uring:buffered" leaves the
+ * page cache in the path.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "ioengine.h"
+
+#define NSEC_PER_SEC (1000000000)
+
+struct uring_data {
+	int fd;
+	unsigned features;
+	int buffered;
+
+	/* submission ring */
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/* completion ring */
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+			arg, argsz);
+}
+
+static int uring_init(struct io_engine *io, const char *opts)
+{
+	struct io_uring_params p;
+	struct uring_data *ud;
+
+	ud = calloc(1, sizeof(*ud));
+	if (!ud) {
+		perror("calloc");
+		return -1;
+	}
+
+	if (!strcmp(opts, "buffered"))
+		ud->buffered = 1;
+	else if (*opts) {
+		fprintf(stderr, "uring: unknown option '%s'\n", opts);
+		free(ud);
+		return -1;
+	}
+
+	memset(&p, 0, sizeof(p));
+	ud->fd = syscall(__NR_io_uring_setup, io->depth, &p);
+	if (ud->fd < 0) {
+		perror("io_uring_setup");
+		free(ud);
+		return -1;
+	}
+	ud->features = p.features;
+
+	ud->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ud->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ud->cq_len > ud->sq_len)
+			ud->sq_len = ud->cq_len;
+		ud->cq_len = ud->sq_len;
+	}
+
+	ud->sq_map = mmap(NULL, ud->sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ud->fd, IORING_OFF_SQ_RING);
+	if (ud->sq_map == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ud->cq_map = ud->sq_map;
+	else {
+		ud->cq_map = mmap(NULL, ud->cq_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ud->fd, IORING_OFF_CQ_RING);
+		if (ud->cq_map == MAP_FAILED)
+			goto fail;
+	}
+	ud->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ud->sqes = mmap(NULL, ud->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ud->fd, IORING_OFF_SQES);
+	if (ud->sqes == MAP_FAILED)
+		goto fail;
+
+	ud->sq_head = (unsigned *)((char *)ud->sq_map + p.sq_off.head);
+	ud->sq_tail = (unsigned *)((char *)ud->sq_map + p.sq_off.tail);
+	ud->sq_mask = (unsigned *)((char *)ud->sq_map + p.sq_off.ring_mask);
+	ud->sq_array = (unsigned *)((char *)ud->sq_map + p.sq_off.array);
+	ud->cq_head = (unsigned *)((char *)ud->cq_map + p.cq_off.head);
+	ud->cq_tail = (unsigned *)((char *)ud->cq_map + p.cq_off.tail);
+	ud->cq_mask = (unsigned *)((char *)ud->cq_map + p.cq_off.ring_mask);
+	ud->cqes = (struct io_uring_cqe *)((char *)ud->cq_map + p.cq_off.cqes);
+
+	io->priv = ud;
+	return 0;
+
+fail:
+	perror("mmap");
+	close(ud->fd);
+	free(ud);
+	return -1;
+}
+
+static int uring_open(struct io_engine *io, const char *filename, int flags,
+		long long *size)
+{
+	struct uring_data *ud = io->priv;
+	int fd;
+
+	fd = open(filename, flags | (ud->buffered ? 0 : O_DIRECT), 0644);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+
+	/* works for regular files and block devices alike */
+	*size = lseek(fd, 0, SEEK_END);
+	if (*size < 0) {
+		perror(filename);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void uring_close(struct io_engine *io, int fd)
+{
+	close(fd);
+}
+
+/*
+ * Callers keep at most io->depth requests in flight, and the kernel takes
+ * every entry we queue on io_uring_enter(), so the ring never fills.
+ */
+static int uring_submit(struct io_engine *io, struct io_req **reqs, int n)
+{
+	struct uring_data *ud = io->priv;
+	unsigned tail = *ud->sq_tail;
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		struct io_req *req = reqs[i];
+		unsigned slot = tail & *ud->sq_mask;
+		struct io_uring_sqe *sqe = &ud->sqes[slot];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = req->op == IO_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = req->fd;
+		sqe->addr = (unsigned long)req->buf;
+		sqe->len = req->len;
+		sqe->off = req->offset;
+		sqe->user_data = (unsigned long)req;
+		ud->sq_array[slot] = slot;
+		tail++;
+	}
+	__atomic_store_n(ud->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (n > 0) {
+		ret = uring_enter(ud->fd, n, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter");
+			return -1;
+		}
+		n -= ret;
+	}
+
+	return 0;
+}
+
+static int uring_reap(struct uring_data *ud, int max, struct io_req **done)
+{
+	unsigned head = *ud->cq_head;
+	unsigned tail = __atomic_load_n(ud->cq_tail, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	while (head != tail && n < max) {
+		struct io_uring_cqe *cqe = &ud->cqes[head & *ud->cq_mask];
+
+		done[n] = (struct io_req *)(unsigned long)cqe->user_data;
+		done[n]->res = cqe->res;
+		n++;
+		head++;
+	}
+	__atomic_store_n(ud->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static int uring_getevents(struct io_engine *io, int min, int max,
+		struct io_req **done, double timeout)
+{
+	struct uring_data *ud = io->priv;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec kts;
+	struct timespec ts;
+	int n, ret;
+
+	/* nothing in flight: just let time pass */
+	if (!min) {
+		if (timeout >= 0) {
+			ts.tv_sec = (time_t)timeout;
+			ts.tv_nsec = (long)((timeout - ts.tv_sec) * NSEC_PER_SEC);
+			nanosleep(&ts, NULL);
+		}
+		return 0;
+	}
+
+	n = uring_reap(ud, max, done);
+	while (n < min) {
+		/* kernels without EXT_ARG cannot time out the wait */
+		if (timeout >= 0 && (ud->features & IORING_FEAT_EXT_ARG)) {
+			kts.tv_sec = (long long)timeout;
+			kts.tv_nsec = (long long)((timeout - kts.tv_sec) * NSEC_PER_SEC);
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (unsigned long)&kts;
+			ret = uring_enter(ud->fd, 0, min - n,
+					IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+					&arg, sizeof(arg));
+		} else
+			ret = uring_enter(ud->fd, 0, min - n,
+					IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR && errno != ETIME) {
+			perror("io_uring_enter");
+			return -1;
+		}
+		n += uring_reap(ud, max - n, done + n);
+		if (ret < 0 && errno == ETIME)
+			break;
+	}
+
+	return n;
+}
+
+static double uring_now(struct io_engine *io)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec / (double)NSEC_PER_SEC;
+}
+
+static void uring_exit(struct io_engine *io)
+{
+	struct uring_data *ud = io->priv;
+
+	munmap(ud->sqes, ud->sqes_len);
+	if (ud->cq_map != ud->sq_map)
+		munmap(ud->cq_map, ud->cq_len);
+	munmap(ud->sq_map, ud->sq_len);
+	close(ud->fd);
+	free(ud);
+}
+
+const struct io_engine_ops ioengine_uring_ops = {
+	.name = "uring",
+	.init = uring_init,
+	.open = uring_open,
+	.close = uring_close,
+	.submit = uring_submit,
+	.getevents = uring_getevents,
+	.now = uring_now,
+	.exit = uring_exit,
+};
@@ -0,0 +1,71 @@
+/*
+ * I/O engine registry
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ioengine.h"
+
+static const struct io_engine_ops *engines[] = {
+#ifdef HAVE_LIBAIO
+	&ioengine_aio_ops,
+#endif
+#ifdef HAVE_URING
+	&ioengine_uring_ops,
+#endif
+	&ioengine_sim_ops,
+	NULL,
+};
+
+void ioengine_list(void)
+{
+	int i;
+
+	for (i = 0; engines[i]; i++)
+		fprintf(stderr, " %s", engines[i]->name);
+	fprintf(stderr, "\n");
+}
+
+/*
+ * Create an engine from "name[:options]"
+ */
+struct io_engine *ioengine_create(const char *spec, int depth)
+{
+	const char *opts = strchr(spec, ':');
+	size_t len = opts ? (size_t)(opts - spec) : strlen(spec);
+	struct io_engine *io;
+	int i;
+
+	for (i = 0; engines[i]; i++)
+		if (strlen(engines[i]->name) == len &&
+				!strncmp(engines[i]->name, spec, len))
+			break;
+
+	if (!engines[i]) {
+		fprintf(stderr, "unknown io engine '%s', available:", spec);
+		ioengine_list();
+		return NULL;
+	}
+
+	io = calloc(1, sizeof(*io));
+	if (!io) {
+		perror("calloc");
+		return NULL;
+	}
+
+	io->ops = engines[i];
+	io->depth = depth;
+	if (io->ops->init(io, opts ? opts + 1 : "")) {
+		free(io);
+		return NULL;
+	}
+
+	return io;
+}
+
+void ioengine_destroy(struct io_engine *io)
+{
+	io->ops->exit(io);
+	free(io);
+}
@@ -0,0 +1,119 @@
+#ifndef IOENGINE_H
+#define IOENGINE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * I/O engine interface.
+ *
+ * The workload engine talks to storage only through this interface, so the
+ * same driver runs against real devices (libaio) or against a simulated
+ * disk in virtual time. Engines are selected by a spec string,
+ * "name[:options]", e.g. "aio" or "sim:hdd,rpm=7200".
+ *
+ * Time is owned by the I/O engine as well: drivers must use
+ * ioengine_now() for every timestamp so that simulated runs are
+ * deterministic.
+ */
+
+#define IO_READ 0
+#define IO_WRITE 1
+
+struct io_req {
+	int fd;
+	int op;			/* IO_READ or IO_WRITE */
+	void *buf;
+	size_t len;
+	long long offset;
+	long res;		/* bytes transferred, or -errno */
+	void *data;		/* owner context */
+	double issued;		/* ioengine_now() at submit, kept by the owner */
+
+	/* backend private state, e.g. the aio iocb */
+	unsigned long long priv[8];
+};
+
+struct io_engine;
+
+struct io_engine_ops {
+	const char *name;
+	int nodata;		/* reads complete without filling buffers */
+	int (*init)(struct io_engine *io, const char *opts);
+	/* flags are O_RDONLY etc; the size of the file/device is returned */
+	int (*open)(struct io_engine *io, const char *filename, int flags,
+			long long *size);
+	void (*close)(struct io_engine *io, int fd);
+	int (*submit)(struct io_engine *io, struct io_req **reqs, int n);
+	/*
+	 * Reap between min and max completions, waiting at most timeout
+	 * seconds (< 0 waits forever). Returns the number reaped.
+	 */
+	int (*getevents)(struct io_engine *io, int min, int max,
+			struct io_req **done, double timeout);
+	double (*now)(struct io_engine *io);
+	void (*exit)(struct io_engine *io);
+};
+
+struct io_engine {
+	const struct io_engine_ops *ops;
+	int depth;		/* max requests in flight */
+	void *priv;
+};
+
+struct io_engine *ioengine_create(const char *spec, int depth);
+void ioengine_destroy(struct io_engine *io);
+void ioengine_list(void);
+
+static inline int ioengine_open(struct io_engine *io, const char *filename,
+		int flags, long long *size)
+{
+	return io->ops->open(io, filename, flags, size);
+}
+
+static inline void ioengine_close(struct io_engine *io, int fd)
+{
+	io->ops->close(io, fd);
+}
+
+static inline int ioengine_submit(struct io_engine *io, struct io_req **reqs,
+		int n)
+{
+	return io->ops->submit(io, reqs, n);
+}
+
+static inline int ioengine_getevents(struct io_engine *io, int min, int max,
+		struct io_req **done, double timeout)
+{
+	return io->ops->getevents(io, min, max, done, timeout);
+}
+
+static inline double ioengine_now(struct io_engine *io)
+{
+	return io->ops->now(io);
+}
+
+static inline void io_req_prep(struct io_req *req, int op, int fd, void *buf,
+		size_t len, long long offset)
+{
+	req->op = op;
+	req->fd = fd;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->res = 0;
+}
+
+/* backends */
+extern const struct io_engine_ops ioengine_aio_ops;
+extern const struct io_engine_ops ioengine_uring_ops;
+extern const struct io_engine_ops ioengine_sim_ops;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+import os
+import sys
+
+#
+# Compare runs of the same stream mixes in two directories of logs in the
+# experiments/ layout (see run-ioprio.sh): S-X.log holds bandwidth lines,
+#
+#   num-seq num-rnd [blk-count millisecond]*
+#
+# and S-X.lat latency lines laid out the same way, p50 and p99 read
+# latency in usecs per stream. Lines of a mix are averaged.
+#
+
+BLOCK_SIZE = 4096
+
+def parse(filename):
+	rows = []
+	if not os.path.exists(filename):
+		return rows
+	with open(filename) as f:
+		for line in f:
+			v = [int(x) for x in line.split()]
+			if len(v) >= 2:
+				rows.append((v[0], v[1], list(zip(v[2::2], v[3::2]))))
+	return rows
+
+def mean(xs):
+	return sum(xs) / len(xs) if xs else 0.0
+
+def summarize(d, mix):
+	bw = parse(os.path.join(d, mix + '.log'))
+	lat = parse(os.path.join(d, mix + '.lat'))
+	seq_mbs, rnd_iops, seq_p99, rnd_p99 = [], [], [], []
+	for s, x, streams in bw:
+		seq_mbs.append(sum(b * BLOCK_SIZE / 1000.0 / ms
+			for b, ms in streams[:s] if ms))
+		rnd_iops.append(sum(b * 1000.0 / ms for b, ms in streams[s:] if ms))
+	for s, x, streams in lat:
+		seq_p99 += [p99 for p50, p99 in streams[:s]]
+		rnd_p99 += [p99 for p50, p99 in streams[s:]]
+	return mean(seq_mbs), mean(rnd_iops), mean(seq_p99), mean(rnd_p99)
+
+def mix_key(mix):
+	return tuple(int(x) for x in mix.split('-'))
+
+def main():
+	if len(sys.argv) != 3:
+		print('usage: %s <log dir> <log dir>' % sys.argv[0])
+		sys.exit(1)
+	a, b = sys.argv[1], sys.argv[2]
+	mixes = set(f[:-4] for d in (a, b) for f in os.listdir(d)
+			if f.endswith('.log'))
+	na, nb = os.path.basename(a.rstrip('/')), os.path.basename(b.rstrip('/'))
+
+	print('%-6s %20s %20s %20s %20s' % ('mix', 'seq MB/s', 'rnd IOPS',
+		'seq p99 us', 'rnd p99 us'))
+	print('%-6s %20s %20s %20s %20s' % ('', *(['%9s %10s' % (na, nb)] * 4)))
+	for mix in sorted(mixes, key=mix_key):
+		x, y = summarize(a, mix), summarize(b, mix)
+		print('%-6s %9.1f %10.1f %9.0f %10.0f %9.0f %10.0f %9.0f %10.0f' %
+			(mix, x[0], y[0], x[1], y[1], x[2], y[2], x[3], y[3]))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,218 @@
+/*
+ * Radix partitioned hash join for Q3 (join.h).
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "join.h"
+
+#define EMPTY (0xffffffffu)	/* no l_lid gets this large */
+#define BATCH (256)		/* probe rows per partition batch */
+#define MIN_SLOTS (16)
+
+/* the Location predicate of Q3: l_elevation < 10 */
+#define ELEVATION_LT (10.0f)
+
+static inline uint64_t hash(uint32_t key)
+{
+	return key * 0x9e3779b97f4a7c15ull;
+}
+
+/* partitions take the top bits of the hash, table slots lower ones */
+static inline int part_of(const struct join *j, uint64_t h)
+{
+	return j->bits ? h >> (64 - j->bits) : 0;
+}
+
+static inline uint32_t slot_of(uint64_t h)
+{
+	return h >> 8;
+}
+
+static void account(struct join *j, size_t add, size_t sub)
+{
+	j->live_bytes += add;
+	j->live_bytes -= sub;
+	if (j->live_bytes > j->peak_bytes)
+		j->peak_bytes = j->live_bytes;
+}
+
+int join_init(struct join *j, int bits)
+{
+	int i;
+
+	memset(j, 0, sizeof(*j));
+	j->bits = bits;
+	j->parts = 1 << bits;
+	j->part = calloc(j->parts, sizeof(*j->part));
+	if (!j->part)
+		return -1;
+
+	for (i = 0; i < j->parts; i++) {
+		j->part[i].batch = malloc(BATCH * sizeof(struct join_entry));
+		if (!j->part[i].batch)
+			return -1;
+	}
+	j->batch_bytes = j->parts * BATCH * sizeof(struct join_entry);
+	account(j, j->batch_bytes, 0);
+
+	return 0;
+}
+
+void join_free(struct join *j)
+{
+	int i;
+
+	for (i = 0; i < j->parts; i++) {
+		free(j->part[i].rows);
+		free(j->part[i].batch);
+	}
+	free(j->part);
+	memset(j, 0, sizeof(*j));
+}
+
+static int append(struct join *j, struct join_part *p, uint32_t key, float val)
+{
+	struct join_entry *rows;
+
+	if (p->n == p->cap) {
+		uint32_t cap = p->cap ? 2 * p->cap : 64;
+
+		rows = realloc(p->rows, cap * sizeof(*rows));
+		if (!rows)
+			return -1;
+		j->build_bytes += (cap - p->cap) * sizeof(*rows);
+		account(j, (cap - p->cap) * sizeof(*rows), 0);
+		p->rows = rows;
+		p->cap = cap;
+	}
+
+	p->rows[p->n].key = key;
+	p->rows[p->n].val = val;
+	p->n++;
+	return 0;
+}
+
+static int build_block(struct join *j, const struct location_row *l, int rows)
+{
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		if (!(l[i].l_elevation < ELEVATION_LT))
+			continue;
+		if (append(j, &j->part[part_of(j, hash(l[i].l_lid))], l[i].l_lid,
+					l[i].l_elevation))
+			return -1;
+		j->build_rows++;
+	}
+
+	return 0;
+}
+
+/*
+ * Probe a partition's batch against its table
+ */
+static void probe_batch(struct join *j, struct join_part *p)
+{
+	const struct join_entry *t = p->rows, *b = p->batch;
+	unsigned long long matches = 0;
+	double sum_probe = 0, sum_build = 0;
+	uint32_t i, s;
+
+	for (i = 0; i < p->batched; i++) {
+		for (s = slot_of(hash(b[i].key)) & p->mask; t[s].key != EMPTY;
+				s = (s + 1) & p->mask) {
+			if (t[s].key == b[i].key) {
+				matches++;
+				sum_probe += b[i].val;
+				sum_build += t[s].val;
+			}
+		}
+	}
+
+	j->matches += matches;
+	j->sum_probe += sum_probe;
+	j->sum_build += sum_build;
+	p->batched = 0;
+}
+
+static void probe_block(struct join *j, const struct object_row *o, int rows)
+{
+	struct join_part *p;
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		p = &j->part[part_of(j, hash(o[i].o_lid))];
+		p->batch[p->batched].key = o[i].o_lid;
+		p->batch[p->batched].val = o[i].o_temperature;
+		if (++p->batched == BATCH)
+			probe_batch(j, p);
+	}
+}
+
+int join_block(struct join *j, const void *buf)
+{
+	const struct block_hdr *h = buf;
+
+	if (h->format == TUPLE_LOCATION && h->rows <= LOCATION_ROWS &&
+			!j->built) {
+		if (build_block(j, (const void *)(h + 1), h->rows))
+			return -1;
+		j->build_tuples += h->rows;
+		return h->rows;
+	}
+
+	if (h->format == TUPLE_OBJECT && h->rows <= OBJECT_ROWS && j->built) {
+		probe_block(j, (const void *)(h + 1), h->rows);
+		j->probe_tuples += h->rows;
+		return h->rows;
+	}
+
+	return 0;
+}
+
+int join_build(struct join *j)
+{
+	struct join_entry *t;
+	uint32_t slots, i, s;
+	int k;
+
+	for (k = 0; k < j->parts; k++) {
+		struct join_part *p = &j->part[k];
+
+		/* at most half full */
+		for (slots = MIN_SLOTS; slots < 2 * p->n; slots *= 2)
+			;
+		t = malloc(slots * sizeof(*t));
+		if (!t)
+			return -1;
+		memset(t, 0xff, slots * sizeof(*t));
+		account(j, slots * sizeof(*t), 0);
+
+		for (i = 0; i < p->n; i++) {
+			for (s = slot_of(hash(p->rows[i].key)) & (slots - 1);
+					t[s].key != EMPTY; s = (s + 1) & (slots - 1))
+				;
+			t[s] = p->rows[i];
+		}
+
+		free(p->rows);
+		account(j, 0, p->cap * sizeof(*t));
+		p->rows = t;
+		p->cap = slots;
+		p->mask = slots - 1;
+		j->table_bytes += slots * sizeof(*t);
+	}
+
+	j->built = 1;
+	return 0;
+}
+
+void join_finish(struct join *j)
+{
+	int k;
+
+	for (k = 0; k < j->parts; k++)
+		probe_batch(j, &j->part[k]);
+}
@@ -0,0 +1,80 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tuple.h"
+
+/*
+ * Q3, a build-on-Location, probe-with-Object hash join:
+ *
+ *   SELECT AVG(o_temperature), AVG(l_elevation) FROM Object, Location
+ *   WHERE o_lid = l_lid AND l_elevation < 10
+ *
+ * The build side is radix partitioned on the hash of l_lid as blocks
+ * arrive. When the build input is done every partition gets its own open
+ * addressing table, small enough to stay in cache. Probe rows are
+ * partitioned the same way into short batches, and a full batch is probed
+ * against its partition's table in one go, so probes do not miss in cache
+ * on every row. l_lid is only unique within a Location file, so the build
+ * side is one file.
+ */
+struct join_entry {
+	uint32_t key;
+	float val;
+};
+
+struct join_part {
+	struct join_entry *rows;	/* build rows, then the hash table */
+	uint32_t n, cap;
+	uint32_t mask;			/* table slots - 1 */
+	struct join_entry *batch;	/* probe rows waiting */
+	uint32_t batched;
+};
+
+struct join {
+	int bits;
+	int parts;
+	struct join_part *part;
+	int built;
+
+	/* progress */
+	unsigned long long build_rows;	/* build rows passing the predicate */
+	unsigned long long build_tuples;	/* build rows looked at */
+	unsigned long long probe_tuples;
+	unsigned long long matches;
+	double sum_probe;		/* o_temperature of matches */
+	double sum_build;		/* l_elevation of matches */
+
+	size_t build_bytes;		/* partition buffers, at their largest */
+	size_t table_bytes;		/* hash tables */
+	size_t batch_bytes;		/* probe batches */
+	size_t live_bytes;		/* all of the above allocated now */
+	size_t peak_bytes;
+};
+
+/* 2^bits partitions */
+int join_init(struct join *j, int bits);
+void join_free(struct join *j);
+
+/*
+ * Feed a block to the join. Location blocks go to the build side and
+ * Object blocks to the probe side, which needs join_build() to have run.
+ * Returns the tuples looked at, 0 for blocks of neither.
+ */
+int join_block(struct join *j, const void *buf);
+
+/* build the partitions' hash tables once all build input is in */
+int join_build(struct join *j);
+
+/* probe what is still batched, once all probe input is in */
+void join_finish(struct join *j);
+
+/* the most memory the join held at once */
+static inline size_t join_memory(const struct join *j)
+{
+	return j->peak_bytes;
+}
+
+#endif
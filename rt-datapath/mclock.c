@@ -0,0 +1,250 @@
+/*
+ * mClock scheduler for the workload engine (mclock.h).
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mclock.h"
+
+#define HEAP_R 0
+#define HEAP_P 1
+#define HEAP_L 2
+
+/* reservation compliance is checked over windows of this many seconds */
+#define MCLOCK_WINDOW (0.1)
+
+/* and met in one when this much of it was served, give or take a read */
+#define MCLOCK_MET (0.95)
+
+int mclock_init(struct mclock *m, int n, int depth)
+{
+	int i, h;
+
+	memset(m, 0, sizeof(*m));
+	m->n = n;
+	m->depth = depth;
+	m->burst = depth;
+	m->window = MCLOCK_WINDOW;
+	m->c = calloc(n, sizeof(*m->c));
+	if (!m->c)
+		return -1;
+	for (h = 0; h < 3; h++) {
+		m->heap[h] = malloc(n * sizeof(*m->heap[h]));
+		if (!m->heap[h])
+			return -1;
+	}
+	for (i = 0; i < n; i++) {
+		m->c[i].weight = 1;
+		m->c[i].pos[HEAP_R] = m->c[i].pos[HEAP_P] = m->c[i].pos[HEAP_L] = -1;
+	}
+	return 0;
+}
+
+void mclock_set(struct mclock *m, int i, double resv, double limit,
+		double weight)
+{
+	m->c[i].resv = resv;
+	m->c[i].limit = limit;
+	m->c[i].weight = weight;
+}
+
+/*
+ * Heaps of clients, one by each tag
+ */
+static double tag(const struct mclock *m, int h, int i)
+{
+	const struct mclock_client *c = &m->c[i];
+
+	return h == HEAP_R ? c->R : h == HEAP_P ? c->P : c->L;
+}
+
+static int before(const struct mclock *m, int h, int a, int b)
+{
+	return tag(m, h, m->heap[h][a]) < tag(m, h, m->heap[h][b]);
+}
+
+static void swap(struct mclock *m, int h, int a, int b)
+{
+	int t = m->heap[h][a];
+
+	m->heap[h][a] = m->heap[h][b];
+	m->heap[h][b] = t;
+	m->c[m->heap[h][a]].pos[h] = a;
+	m->c[m->heap[h][b]].pos[h] = b;
+}
+
+static void sift(struct mclock *m, int h, int i)
+{
+	int c;
+
+	while (i > 0 && before(m, h, i, (i - 1) / 2)) {
+		swap(m, h, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	while ((c = 2 * i + 1) < m->len[h]) {
+		if (c + 1 < m->len[h] && before(m, h, c + 1, c))
+			c++;
+		if (!before(m, h, c, i))
+			break;
+		swap(m, h, i, c);
+		i = c;
+	}
+}
+
+static void push(struct mclock *m, int h, int i)
+{
+	m->c[i].pos[h] = m->len[h];
+	m->heap[h][m->len[h]++] = i;
+	sift(m, h, m->c[i].pos[h]);
+}
+
+static void remove_at(struct mclock *m, int h, int i)
+{
+	int pos = m->c[i].pos[h];
+
+	if (pos < 0)
+		return;
+	m->len[h]--;
+	if (pos != m->len[h]) {
+		swap(m, h, pos, m->len[h]);
+		sift(m, h, pos);
+	}
+	m->c[i].pos[h] = -1;
+}
+
+/* over its limit, it waits in the L heap; else it shares by P */
+static void place(struct mclock *m, int i, double now)
+{
+	struct mclock_client *c = &m->c[i];
+	int h = c->limit > 0 && c->L > now ? HEAP_L : HEAP_P;
+
+	if (c->pos[h] >= 0) {
+		sift(m, h, c->pos[h]);
+		return;
+	}
+	remove_at(m, h == HEAP_L ? HEAP_P : HEAP_L, i);
+	push(m, h, i);
+}
+
+void mclock_wake(struct mclock *m, int i, double now)
+{
+	struct mclock_client *c = &m->c[i];
+
+	if (c->active)
+		return;
+	c->active = 1;
+
+	if (c->R < now)
+		c->R = now;
+	if (c->L < now)
+		c->L = now;
+	if (c->P < m->vt)
+		c->P = m->vt;
+
+	if (c->resv > 0)
+		push(m, HEAP_R, i);
+	place(m, i, now);
+}
+
+void mclock_sleep(struct mclock *m, int i)
+{
+	int h;
+
+	if (!m->c[i].active)
+		return;
+	m->c[i].active = 0;
+	for (h = 0; h < 3; h++)
+		remove_at(m, h, i);
+}
+
+int mclock_pick(struct mclock *m, double now, int *phase)
+{
+	int i;
+
+	/* clients whose limit tag has come round share again */
+	while (m->len[HEAP_L] && m->c[m->heap[HEAP_L][0]].L <= now) {
+		i = m->heap[HEAP_L][0];
+		remove_at(m, HEAP_L, i);
+		push(m, HEAP_P, i);
+	}
+
+	if (m->len[HEAP_R] && m->c[m->heap[HEAP_R][0]].R <= now) {
+		*phase = MCLOCK_RESV;
+		return m->heap[HEAP_R][0];
+	}
+	if (m->len[HEAP_P]) {
+		*phase = MCLOCK_WEIGHT;
+		return m->heap[HEAP_P][0];
+	}
+	return -1;
+}
+
+void mclock_charge(struct mclock *m, int i, int blocks, int phase,
+		double now)
+{
+	struct mclock_client *c = &m->c[i];
+
+	c->phase = phase;
+	c->blocks[phase] += blocks;
+	c->win_blocks += blocks;
+
+	if (phase == MCLOCK_RESV && c->resv > 0)
+		c->R += blocks / c->resv;
+	if (phase == MCLOCK_WEIGHT) {
+		m->vt = c->P;
+		c->P += blocks / c->weight;
+	}
+
+	/*
+	 * A client that went without reads keeps up to a queue's worth of
+	 * limit credit, so the limit holds at the engine's dispatch
+	 * granularity without letting it burst past
+	 */
+	if (c->limit > 0) {
+		if (c->L < now - m->burst / c->limit)
+			c->L = now - m->burst / c->limit;
+		c->L += blocks / c->limit;
+	}
+
+	if (!c->active)
+		return;
+	if (c->pos[HEAP_R] >= 0)
+		sift(m, HEAP_R, c->pos[HEAP_R]);
+	place(m, i, now);
+}
+
+void mclock_reset(struct mclock *m, double now)
+{
+	int i;
+
+	for (i = 0; i < m->n; i++) {
+		struct mclock_client *c = &m->c[i];
+
+		c->blocks[0] = c->blocks[1] = 0;
+		c->win_blocks = 0;
+		c->windows = c->windows_met = 0;
+	}
+	m->start = m->win_start = now;
+}
+
+void mclock_tick(struct mclock *m, double now)
+{
+	double dt = now - m->win_start;
+	int i;
+
+	if (dt < m->window)
+		return;
+
+	for (i = 0; i < m->n; i++) {
+		struct mclock_client *c = &m->c[i];
+
+		if (c->resv > 0) {
+			c->windows++;
+			if (c->win_blocks + 1 >= MCLOCK_MET * c->resv * dt)
+				c->windows_met++;
+		}
+		c->win_blocks = 0;
+	}
+	m->win_start = now;
+}
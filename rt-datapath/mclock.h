@@ -0,0 +1,82 @@
+#ifndef MCLOCK_H
+#define MCLOCK_H
+
+/*
+ * Reservation, limit and proportional-share scheduler, after mClock
+ * (Gulati et al., OSDI '10).
+ *
+ * Each client (stream) has a reservation r and a limit l in blocks/s (0
+ * for none) and a weight w, and three tags a request apart by 1/r, 1/l and
+ * 1/w. Whenever the device has room for another read:
+ *
+ *  - reservation phase: the client with the smallest R tag not after now
+ *    is served, and its R tag advances;
+ *  - otherwise, weight phase: of the clients whose L tag is not after now,
+ *    the one with the smallest P tag is served, and its P tag advances.
+ *
+ * Every read served advances the L tag. Reads served by weight do not
+ * count against the reservation, so a client gets r plus its weight's
+ * share of what the reservations leave, capped at l: reserved scans get
+ * their B_T, capped index scans stay under their cap, and the rest goes
+ * by weight.
+ *
+ * Only clients with work are in the heaps (by R; by P if under their
+ * limit, by L if over it), so a dispatch is O(log n). A client leaves when
+ * it runs out of queue depth and comes back when a read completes; its tags
+ * then start over from now (R and L) and from the weight phase's virtual
+ * time (P), so an idle client neither hoards nor loses credit.
+ */
+#define MCLOCK_RESV 0
+#define MCLOCK_WEIGHT 1
+
+struct mclock_client {
+	double resv, limit, weight;
+	double R, L, P;		/* tags: seconds, P in virtual seconds */
+	int pos[3];		/* in the R, P and L heaps, -1 when out */
+	int active;
+	int phase;		/* of the last read served */
+
+	/* during observation */
+	unsigned long long blocks[2];	/* served in each phase */
+	unsigned long long win_blocks;
+	int windows, windows_met;	/* reservation compliance */
+};
+
+struct mclock {
+	int n;
+	struct mclock_client *c;
+	int *heap[3];
+	int len[3];
+	int depth;		/* reads the device is kept busy with */
+	double vt;		/* P tag of the last weight phase read */
+	double burst;		/* limit credit an idle client may keep, reads */
+
+	/* during observation */
+	double window;		/* compliance window, seconds */
+	double win_start;
+	double start;
+};
+
+int mclock_init(struct mclock *m, int n, int depth);
+void mclock_set(struct mclock *m, int i, double resv, double limit,
+		double weight);
+
+/* the client has work again, or has none */
+void mclock_wake(struct mclock *m, int i, double now);
+void mclock_sleep(struct mclock *m, int i);
+
+/*
+ * The client to serve next and the phase serving it, or -1 when every
+ * client with work is over its limit
+ */
+int mclock_pick(struct mclock *m, double now, int *phase);
+
+/* 'blocks' reads were issued for client i in 'phase' */
+void mclock_charge(struct mclock *m, int i, int blocks, int phase,
+		double now);
+
+/* start observing; close compliance windows as they pass */
+void mclock_reset(struct mclock *m, double now);
+void mclock_tick(struct mclock *m, double now);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef OFFSET_H
+#define OFFSET_H
+
+#include "rng.h"
+
+/*
+ * Offset generators for the scan types. Both return byte offsets of
+ * blksize-aligned blocks within a file of num_blocks blocks.
+ */
+
+/* sequential scan, wrapping at the end of the relation */
+static inline long long offset_seq(long long *cursor, long long num_blocks,
+		int blksize)
+{
+	long long block = (*cursor)++;
+
+	if (*cursor >= num_blocks)
+		*cursor = 0;
+	return block * blksize;
+}
+
+/* uniform random block, as issued by the index scans */
+static inline long long offset_rnd(struct rng *r, long long num_blocks,
+		int blksize)
+{
+	return (long long)rng_range(r, num_blocks) * blksize;
+}
+
+#endif
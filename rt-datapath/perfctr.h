@@ -0,0 +1,174 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+/*
+ * Hardware counters over the I/O paths (perf_event_open(2)).
+ *
+ * A perfctr is one group of counters for the calling thread: cycles,
+ * instructions, cache misses and context switches, and the CPU time the
+ * kernel accounts (there even where the PMU is not). It counts only between
+ * perfctr_start() and perfctr_stop(), so wrapping a submit or a reap loop
+ * in them charges that loop and nothing else; the two ioctls a window
+ * costs are small next to an io_submit(). Kernel work is counted too when
+ * perf_event_paranoid allows it, else user space only (noted in the
+ * report). Counters the machine does not have (VMs, often) read as n/a.
+ */
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PERFCTR_CYCLES 0
+#define PERFCTR_INSNS 1
+#define PERFCTR_MISSES 2
+#define PERFCTR_CSW 3
+#define PERFCTR_NSEC 4
+#define PERFCTR_NUM 5
+
+static const char *perfctr_names[PERFCTR_NUM] = {
+	"cycles", "insns", "cache misses", "ctx switches", "cpu ns",
+};
+
+struct perfctr {
+	int fd[PERFCTR_NUM];	/* -1 when the counter is not there */
+	int leader;		/* group leader fd, -1 when none opened */
+	int user_only;
+	double val[PERFCTR_NUM];	/* after perfctr_read() */
+};
+
+static inline int perfctr_open_one(struct perfctr *p, int i, int user_only)
+{
+	static const struct { uint32_t type; uint64_t config; } ev[PERFCTR_NUM] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	};
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = ev[i].type;
+	attr.config = ev[i].config;
+	attr.disabled = p->leader < 0;	/* members follow the leader */
+	attr.exclude_kernel = user_only;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	/* this thread, any cpu */
+	return syscall(SYS_perf_event_open, &attr, 0, -1, p->leader, 0);
+}
+
+/*
+ * Open the counters for the calling thread. Returns 0, or -1 (with the
+ * reason on stderr) when none of them could be opened.
+ */
+static inline int perfctr_open(struct perfctr *p)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->leader = -1;
+	for (i = 0; i < PERFCTR_NUM; i++) {
+		p->fd[i] = perfctr_open_one(p, i, p->user_only);
+		if (p->fd[i] < 0 && (errno == EACCES || errno == EPERM) &&
+				p->leader < 0 && !p->user_only) {
+			/* perf_event_paranoid: try again without the kernel */
+			p->user_only = 1;
+			p->fd[i] = perfctr_open_one(p, i, 1);
+		}
+		if (p->fd[i] >= 0 && p->leader < 0)
+			p->leader = p->fd[i];
+	}
+	if (p->leader < 0) {
+		perror("perf_event_open");
+		return -1;
+	}
+	return 0;
+}
+
+static inline void perfctr_start(struct perfctr *p)
+{
+	if (p->leader >= 0)
+		ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void perfctr_stop(struct perfctr *p)
+{
+	if (p->leader >= 0)
+		ioctl(p->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * Read the totals into p->val, scaled up if the counters were multiplexed
+ * with other users of the PMU
+ */
+static inline void perfctr_read(struct perfctr *p)
+{
+	uint64_t v[3];
+	int i;
+
+	for (i = 0; i < PERFCTR_NUM; i++) {
+		p->val[i] = -1;
+		if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v))
+			continue;
+		p->val[i] = v[2] ? (double)v[0] * v[1] / v[2] : 0;
+	}
+}
+
+/* add up the counters of several threads; n/a stays n/a */
+static inline void perfctr_add(struct perfctr *sum, const struct perfctr *p)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_NUM; i++)
+		if (sum->val[i] >= 0)
+			sum->val[i] = p->val[i] < 0 ? -1 : sum->val[i] + p->val[i];
+	sum->user_only |= p->user_only;
+}
+
+static inline void perfctr_close(struct perfctr *p)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_NUM; i++)
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+	p->leader = -1;
+}
+
+/*
+ * One line of counters per I/O and per KB of data read, and IPC:
+ *   submit: 1850 cycles/io 462.500 /KB, 1200 insns/io 300.000 /KB, ..., ipc 0.65
+ */
+static inline void perfctr_report(FILE *out, const char *what,
+		const struct perfctr *p, unsigned long long ios,
+		unsigned long long bytes)
+{
+	int i;
+
+	fprintf(out, "%s%s:", what, p->user_only ? " (user only)" : "");
+	for (i = 0; i < PERFCTR_NUM; i++) {
+		if (p->val[i] < 0)
+			fprintf(out, " %s n/a%s", perfctr_names[i],
+					i < PERFCTR_NUM - 1 ? "," : "");
+		else
+			fprintf(out, " %.*f %s/io %.3f /KB%s",
+					i == PERFCTR_CSW ? 3 : 0,
+					ios ? p->val[i] / ios : 0, perfctr_names[i],
+					bytes ? p->val[i] * 1024 / bytes : 0,
+					i < PERFCTR_NUM - 1 ? "," : "");
+	}
+	if (p->val[PERFCTR_CYCLES] > 0 && p->val[PERFCTR_INSNS] >= 0)
+		fprintf(out, ", ipc %.2f", p->val[PERFCTR_INSNS] /
+				p->val[PERFCTR_CYCLES]);
+	fprintf(out, "\n");
+}
+
+#endif
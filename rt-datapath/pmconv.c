@@ -0,0 +1,621 @@
+/*
+ * Convert performance models to the binary format of pmfile.h.
+ *
+ * Inputs, any number and mix of them:
+ *
+ *   .npy      graph.py's table: [seq 0..1][rnd 0..N][seq min/avg/max iops,
+ *             rnd min/avg/max iops]
+ *   text      pmodel.dat, as written by linear/serialize_pmodel.py
+ *   directory experiment logs, <seq>-<rnd>.log ("s r [blocks ms]*") and
+ *             optionally <seq>-<rnd>.lat ("s r [p50 p99]*", see
+ *             experiments/README)
+ *   .pmf      a binary model, all of it, under its own names and sizes
+ *
+ * -d, -z and -w set the device, I/O size and direction of the inputs that
+ * follow them. A later input overwrites the metrics it has of an earlier
+ * one for the same device, direction and size.
+ *
+ * -i describes a binary model; -x writes its read model of a device back
+ * out as pmodel.dat text (e.g. for PerfModel.java).
+ */
+#include <sys/stat.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmfile.h"
+#include "pmodel.h"
+
+#define MAX_LINE (1 << 16)
+#define MAX_DEVICES 256
+#define MAX_IO_SIZES 32
+#define NPY_MAGIC "\x93NUMPY"
+
+/* one device, direction and I/O size of the model */
+struct slice {
+	char device[PMF_NAME];
+	uint32_t io_size;
+	int rw;
+	int num_seq, num_rnd;
+	double *m[PMF_NUM_METRICS];	/* [seq][rnd], NULL if not measured */
+	struct slice *next;
+};
+
+static const char *metric_names[PMF_NUM_METRICS] = {
+	"seq_min", "seq_avg", "seq_max", "rnd_min", "rnd_avg", "rnd_max",
+	"seq_p50", "seq_p99", "rnd_p50", "rnd_p99",
+};
+
+static struct slice *slices, **slices_tail = &slices;
+
+static struct slice *new_slice(const char *device, uint32_t io_size, int rw,
+		int num_seq, int num_rnd)
+{
+	struct slice *s = calloc(1, sizeof(*s));
+
+	if (!s) {
+		perror("calloc");
+		exit(1);
+	}
+	snprintf(s->device, sizeof(s->device), "%s", device);
+	s->io_size = io_size;
+	s->rw = rw;
+	s->num_seq = num_seq;
+	s->num_rnd = num_rnd;
+	*slices_tail = s;
+	slices_tail = &s->next;
+	return s;
+}
+
+static double *metric(struct slice *s, int m)
+{
+	if (!s->m[m]) {
+		s->m[m] = calloc(s->num_seq * s->num_rnd, sizeof(double));
+		if (!s->m[m]) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+	return s->m[m];
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	struct stat st;
+	FILE *f;
+	char *buf;
+
+	f = fopen(path, "r");
+	if (!f || fstat(fileno(f), &st)) {
+		perror(path);
+		exit(1);
+	}
+	buf = malloc(st.st_size + 1);
+	if (!buf || fread(buf, 1, st.st_size, f) != (size_t)st.st_size) {
+		perror(path);
+		exit(1);
+	}
+	buf[st.st_size] = 0;
+	fclose(f);
+	*len = st.st_size;
+	return buf;
+}
+
+/*
+ * numpy's .npy: little endian doubles in C order, as np.save writes them
+ */
+static void read_npy(const char *path, const char *device, uint32_t io_size,
+		int rw)
+{
+	int shape[3], seq, rnd, c;
+	size_t len, hlen, off;
+	struct slice *s;
+	const double *d;
+	char *buf, *p;
+
+	buf = read_file(path, &len);
+	if (len < 10 || memcmp(buf, NPY_MAGIC, 6))
+		goto bad;
+	if (buf[6] == 1) {
+		hlen = (unsigned char)buf[8] | (unsigned char)buf[9] << 8;
+		off = 10;
+	} else {
+		if (len < 12)
+			goto bad;
+		hlen = (unsigned char)buf[8] | (unsigned char)buf[9] << 8 |
+			(unsigned char)buf[10] << 16 | (size_t)(unsigned char)buf[11] << 24;
+		off = 12;
+	}
+	if (off + hlen > len)
+		goto bad;
+	buf[off + hlen - 1] = 0;
+
+	if (!strstr(buf + off, "'descr': '<f8'") ||
+			!strstr(buf + off, "'fortran_order': False")) {
+		fprintf(stderr, "%s: want little endian doubles in C order\n", path);
+		exit(1);
+	}
+	p = strstr(buf + off, "'shape': (");
+	if (!p || sscanf(p, "'shape': (%d, %d, %d)", &shape[0], &shape[1],
+				&shape[2]) != 3 || shape[0] < 1 || shape[1] < 1 ||
+			shape[2] != 6) {
+		fprintf(stderr, "%s: want shape (seq, rnd, 6)\n", path);
+		exit(1);
+	}
+	off += hlen;
+	if (len - off != sizeof(double) * shape[0] * shape[1] * shape[2])
+		goto bad;
+
+	d = (const double *)(buf + off);
+	s = new_slice(device, io_size, rw, shape[0], shape[1]);
+	for (seq = 0; seq < shape[0]; seq++)
+		for (rnd = 0; rnd < shape[1]; rnd++)
+			for (c = 0; c < 6; c++)
+				metric(s, c)[seq * shape[1] + rnd] =
+					d[(seq * shape[1] + rnd) * 6 + c];
+	free(buf);
+	return;
+
+bad:
+	fprintf(stderr, "%s: not a .npy file\n", path);
+	exit(1);
+}
+
+/*
+ * pmodel.dat: mean seq iops with 1 seq stream, mean rnd iops with 0 and 1
+ */
+static void read_text(const char *path, const char *device, uint32_t io_size,
+		int rw)
+{
+	struct pmodel pm;
+	struct slice *s;
+	int i;
+
+	if (pmodel_load(&pm, path))
+		exit(1);
+	s = new_slice(device, io_size, rw, 2, pm.size);
+	for (i = 0; i < pm.size; i++) {
+		metric(s, PMF_M_SEQ_AVG)[pm.size + i] = pm.iops_S[i];
+		metric(s, PMF_M_RND_AVG)[i] = pm.iops_I[i];
+		metric(s, PMF_M_RND_AVG)[pm.size + i] = pm.iops_Is[i];
+	}
+	pmodel_free(&pm);
+}
+
+/* a log line's numbers; returns how many */
+static int parse_line(char *line, double *vals, int max)
+{
+	char *tok, *save, *end;
+	int n = 0;
+
+	for (tok = strtok_r(line, " \n", &save); tok && n < max;
+			tok = strtok_r(NULL, " \n", &save)) {
+		vals[n] = strtod(tok, &end);
+		if (end == tok)
+			return -1;
+		n++;
+	}
+	return n;
+}
+
+/* min, mean and max of a run's per stream values */
+struct agg {
+	double min, sum, max;
+	long n;
+};
+
+static void agg_add(struct agg *a, double v)
+{
+	if (!a->n || v < a->min)
+		a->min = v;
+	if (!a->n || v > a->max)
+		a->max = v;
+	a->sum += v;
+	a->n++;
+}
+
+/*
+ * One <seq>-<rnd>.log or .lat file, into cell (ns, nr); as graph.py, iops
+ * are per stream per run, and each file's min/mean/max are over both
+ */
+static void read_log(const char *path, struct slice *s, int ns, int nr,
+		int lat)
+{
+	static char line[MAX_LINE];
+	static double vals[MAX_LINE / 2];
+	struct agg a[4];
+	int cell = ns * s->num_rnd + nr, n, i, k;
+	FILE *f;
+
+	memset(a, 0, sizeof(a));
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		n = parse_line(line, vals, sizeof(vals) / sizeof(vals[0]));
+		if (!n)
+			continue;
+		if (n != 2 + 2 * (ns + nr) || vals[0] != ns || vals[1] != nr) {
+			fprintf(stderr, "%s: bad line\n", path);
+			exit(1);
+		}
+		/* a[0..1]: seq, rnd iops; or seq p50, p99, rnd p50, p99 */
+		for (i = 0; i < ns + nr; i++) {
+			if (lat) {
+				k = i < ns ? 0 : 2;
+				agg_add(&a[k], vals[2 + 2 * i]);
+				agg_add(&a[k + 1], vals[3 + 2 * i]);
+			} else if (vals[3 + 2 * i] > 0)
+				agg_add(&a[i < ns ? 0 : 1], vals[2 + 2 * i] /
+						(vals[3 + 2 * i] / 1000.0));
+		}
+	}
+	fclose(f);
+
+	if (lat) {
+		if (a[0].n) {
+			metric(s, PMF_M_SEQ_P50)[cell] = a[0].sum / a[0].n;
+			metric(s, PMF_M_SEQ_P99)[cell] = a[1].sum / a[1].n;
+		}
+		if (a[2].n) {
+			metric(s, PMF_M_RND_P50)[cell] = a[2].sum / a[2].n;
+			metric(s, PMF_M_RND_P99)[cell] = a[3].sum / a[3].n;
+		}
+		return;
+	}
+	for (k = 0; k < 2; k++) {
+		if (!a[k].n)
+			continue;
+		metric(s, 3 * k + 0)[cell] = a[k].min;
+		metric(s, 3 * k + 1)[cell] = a[k].sum / a[k].n;
+		metric(s, 3 * k + 2)[cell] = a[k].max;
+	}
+}
+
+static void read_logs(const char *dir, const char *device, uint32_t io_size,
+		int rw)
+{
+	char path[4096], ext[8];
+	int ns, nr, max_s = -1, max_r = -1, pass;
+	struct slice *s = NULL;
+	struct dirent *de;
+	DIR *d;
+
+	/* size the slice, then fill it */
+	for (pass = 0; pass < 2; pass++) {
+		d = opendir(dir);
+		if (!d) {
+			perror(dir);
+			exit(1);
+		}
+		while ((de = readdir(d))) {
+			if (sscanf(de->d_name, "%d-%d.%7s", &ns, &nr, ext) != 3 ||
+					ns < 0 || nr < 0 ||
+					(strcmp(ext, "log") && strcmp(ext, "lat")))
+				continue;
+			if (!pass) {
+				if (ns > max_s)
+					max_s = ns;
+				if (nr > max_r)
+					max_r = nr;
+				continue;
+			}
+			snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+			read_log(path, s, ns, nr, !strcmp(ext, "lat"));
+		}
+		closedir(d);
+
+		if (!pass) {
+			if (max_s < 0) {
+				fprintf(stderr, "%s: no <seq>-<rnd>.log files\n", dir);
+				exit(1);
+			}
+			s = new_slice(device, io_size, rw, max_s + 1, max_r + 1);
+		}
+	}
+}
+
+static void read_pmf(const char *path)
+{
+	struct pmf f;
+	struct slice *s;
+	uint32_t dev, rw, io, m, seq;
+	const double *series;
+
+	if (pmf_open(&f, path))
+		exit(1);
+	for (dev = 0; dev < f.hdr->num_devices; dev++)
+		for (rw = 0; rw < f.hdr->num_rw; rw++)
+			for (io = 0; io < f.hdr->num_io_sizes; io++) {
+				s = new_slice(pmf_device_name(&f, dev), f.io_size[io], rw,
+						f.hdr->num_seq, f.hdr->num_rnd);
+				for (m = 0; m < PMF_NUM_METRICS; m++)
+					for (seq = 0; seq < f.hdr->num_seq; seq++) {
+						series = pmf_series(&f, dev, rw, io, m, seq);
+						if (series)
+							memcpy(metric(s, m) + seq * s->num_rnd, series,
+									s->num_rnd * sizeof(double));
+					}
+			}
+	pmf_close(&f);
+}
+
+static void read_input(const char *path, const char *device, uint32_t io_size,
+		int rw)
+{
+	char head[8] = { 0 };
+	struct stat st;
+	uint32_t magic;
+	size_t n;
+	FILE *f;
+
+	if (stat(path, &st)) {
+		perror(path);
+		exit(1);
+	}
+	if (S_ISDIR(st.st_mode)) {
+		read_logs(path, device, io_size, rw);
+		return;
+	}
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	n = fread(head, 1, sizeof(head), f);
+	fclose(f);
+	memcpy(&magic, head, sizeof(magic));
+
+	/* magic numbers tell the rest apart */
+	if (n >= 6 && !memcmp(head, NPY_MAGIC, 6))
+		read_npy(path, device, io_size, rw);
+	else if (n >= 4 && magic == PMF_MAGIC)
+		read_pmf(path);
+	else
+		read_text(path, device, io_size, rw);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int write_pmf(const char *path)
+{
+	static char devices[MAX_DEVICES][PMF_NAME];
+	uint32_t io_sizes[MAX_IO_SIZES], metrics[PMF_NUM_METRICS];
+	int slot[PMF_NUM_METRICS], have[PMF_NUM_METRICS] = { 0 };
+	struct pmf_hdr h;
+	struct slice *s;
+	char tmp[4096];
+	double *data, *dst;
+	size_t stride[5];
+	uint32_t i, dev, io;
+	int m, seq, rnd;
+	FILE *f;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = PMF_MAGIC;
+	h.version = PMF_VERSION;
+	h.hdr_size = sizeof(h);
+	h.num_rw = 1;
+
+	/* the dimensions are the union of the slices' */
+	for (s = slices; s; s = s->next) {
+		for (i = 0; i < h.num_devices; i++)
+			if (!strcmp(devices[i], s->device))
+				break;
+		if (i == h.num_devices) {
+			if (h.num_devices == MAX_DEVICES) {
+				fprintf(stderr, "more than %d devices\n", MAX_DEVICES);
+				exit(1);
+			}
+			strcpy(devices[h.num_devices++], s->device);
+		}
+
+		for (i = 0; i < h.num_io_sizes; i++)
+			if (io_sizes[i] == s->io_size)
+				break;
+		if (i == h.num_io_sizes) {
+			if (h.num_io_sizes == MAX_IO_SIZES) {
+				fprintf(stderr, "more than %d I/O sizes\n", MAX_IO_SIZES);
+				exit(1);
+			}
+			io_sizes[h.num_io_sizes++] = s->io_size;
+		}
+
+		if (s->rw == PMF_WRITE)
+			h.num_rw = 2;
+		if ((uint32_t)s->num_seq > h.num_seq)
+			h.num_seq = s->num_seq;
+		if ((uint32_t)s->num_rnd > h.num_rnd)
+			h.num_rnd = s->num_rnd;
+		for (m = 0; m < PMF_NUM_METRICS; m++)
+			if (s->m[m])
+				have[m] = 1;
+	}
+	qsort(io_sizes, h.num_io_sizes, sizeof(io_sizes[0]), cmp_u32);
+	for (m = 0; m < PMF_NUM_METRICS; m++) {
+		slot[m] = have[m] ? (int)h.num_metrics : -1;
+		if (have[m])
+			metrics[h.num_metrics++] = m;
+	}
+	pmf_layout(&h);
+
+	stride[4] = h.num_rnd;
+	stride[3] = stride[4] * h.num_seq;
+	stride[2] = stride[3] * h.num_metrics;
+	stride[1] = stride[2] * h.num_io_sizes;
+	stride[0] = stride[1] * h.num_rw;
+	data = calloc(stride[0] * h.num_devices, sizeof(double));
+	if (!data) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (s = slices; s; s = s->next) {
+		for (dev = 0; strcmp(devices[dev], s->device); dev++)
+			;
+		for (io = 0; io_sizes[io] != s->io_size; io++)
+			;
+		for (m = 0; m < PMF_NUM_METRICS; m++) {
+			if (!s->m[m])
+				continue;
+			dst = data + dev * stride[0] + s->rw * stride[1] +
+				io * stride[2] + slot[m] * stride[3];
+			for (seq = 0; seq < s->num_seq; seq++)
+				for (rnd = 0; rnd < s->num_rnd; rnd++)
+					dst[seq * stride[4] + rnd] = s->m[m][seq * s->num_rnd + rnd];
+		}
+	}
+
+	/* readers may have the old one mapped: replace it, do not rewrite it */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		exit(1);
+	}
+	fwrite(&h, sizeof(h), 1, f);
+	fseek(f, h.io_size_off, SEEK_SET);
+	fwrite(io_sizes, sizeof(io_sizes[0]), h.num_io_sizes, f);
+	fseek(f, h.device_off, SEEK_SET);
+	fwrite(devices, PMF_NAME, h.num_devices, f);
+	fseek(f, h.metric_off, SEEK_SET);
+	fwrite(metrics, sizeof(metrics[0]), h.num_metrics, f);
+	fseek(f, h.data_off, SEEK_SET);
+	fwrite(data, sizeof(double), stride[0] * h.num_devices, f);
+	if (ferror(f) || fclose(f) || rename(tmp, path)) {
+		perror(path);
+		unlink(tmp);
+		exit(1);
+	}
+	free(data);
+
+	printf("%s: %u devices, %u directions, %u I/O sizes, %u metrics, "
+			"%ux%u streams, %llu bytes\n", path, h.num_devices, h.num_rw,
+			h.num_io_sizes, h.num_metrics, h.num_seq, h.num_rnd,
+			(unsigned long long)h.file_size);
+	return 0;
+}
+
+static void describe(const char *path)
+{
+	struct pmf f;
+	uint32_t i;
+
+	if (pmf_open(&f, path))
+		exit(1);
+	printf("%s: version %u, %llu bytes\n", path, f.hdr->version,
+			(unsigned long long)f.hdr->file_size);
+	printf("  streams: 0-%u seq, 0-%u rnd\n  directions: %s\n  devices:",
+			f.hdr->num_seq - 1, f.hdr->num_rnd - 1,
+			f.hdr->num_rw == 2 ? "read, write" : "read");
+	for (i = 0; i < f.hdr->num_devices; i++)
+		printf(" %s", pmf_device_name(&f, i));
+	printf("\n  I/O sizes:");
+	for (i = 0; i < f.hdr->num_io_sizes; i++)
+		printf(" %u", f.io_size[i]);
+	printf("\n  metrics:");
+	for (i = 0; i < f.hdr->num_metrics; i++)
+		printf(" %s", metric_names[f.metric[i]]);
+	printf("\n");
+	pmf_close(&f);
+}
+
+/* as linear/serialize_pmodel.py */
+static void export_text(const char *path, const char *device)
+{
+	double *arrays[3];
+	struct pmodel pm;
+	int i, j;
+
+	if (pmodel_map(&pm, path, device))
+		exit(1);
+	arrays[0] = pm.iops_S;
+	arrays[1] = pm.iops_I;
+	arrays[2] = pm.iops_Is;
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < pm.size; j++)
+			printf("%.3f%c", arrays[i][j], j + 1 < pm.size ? ' ' : '\n');
+	pmodel_free(&pm);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: -o <out.pmf> [-d <device>] [-z <io size>] [-w] <input>...\n"
+			"       -i <model.pmf>\n"
+			"       -x <model.pmf> [-d <device>]\n"
+			"  inputs: .npy, pmodel.dat text, a directory of <seq>-<rnd>.log/.lat,\n"
+			"  or .pmf; -d, -z and -w apply to the inputs after them\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *out = NULL, *info = NULL, *export = NULL;
+	const char *device = "default";
+	uint32_t io_size = 4096;
+	int rw = PMF_READ, inputs = 0, device_set = 0;
+	int c;
+
+	/* "-" keeps inputs in order with the options around them */
+	while ((c = getopt(argc, argv, "-o:d:z:wi:x:")) != -1) {
+		switch (c) {
+		case 'o':
+			out = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			device_set = 1;
+			if (strlen(device) >= PMF_NAME) {
+				fprintf(stderr, "%s: device name too long\n", device);
+				exit(1);
+			}
+			break;
+		case 'z':
+			io_size = atoi(optarg);
+			if (!io_size) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'w':
+			rw = PMF_WRITE;
+			break;
+		case 'i':
+			info = optarg;
+			break;
+		case 'x':
+			export = optarg;
+			break;
+		case 1:
+			read_input(optarg, device, io_size, rw);
+			inputs++;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (info) {
+		describe(info);
+		return 0;
+	}
+	if (export) {
+		export_text(export, device_set ? device : NULL);
+		return 0;
+	}
+	if (!out || !inputs) {
+		usage();
+		exit(1);
+	}
+	return write_pmf(out);
+}
@@ -0,0 +1,310 @@
+#ifndef PMFILE_H
+#define PMFILE_H
+
+/*
+ * Binary performance model file (.pmf).
+ *
+ * One file holds the measured model of any number of devices: for each
+ * device, direction and I/O size, every metric as a function of the number
+ * of concurrent sequential and random (index) streams. The file is
+ * mmap()ed and read in place, so opening a model of any size costs a few
+ * page faults, and a lookup is a multiply-add into the mapping.
+ *
+ * Layout, in host byte order, each section 8 byte aligned:
+ *
+ *	struct pmf_hdr
+ *	uint32_t io_size[num_io_sizes]		bytes, ascending
+ *	char     device[num_devices][PMF_NAME]	NUL padded
+ *	uint32_t metric[num_metrics]		PMF_M_* ids
+ *	double   data[device][rw][io_size][metric][seq][rnd]
+ *
+ * so a metric over the rnd stream count is contiguous, which is how
+ * pmodel.h uses it. Cells that were never measured are 0. pmconv writes
+ * these from .npy tables, experiment logs and pmodel.dat text.
+ *
+ * Header only; C and C++ (see the pmfile::model wrapper at the end).
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PMF_MAGIC (0x31464d50)	/* "PMF1" */
+#define PMF_VERSION 1
+#define PMF_NAME 32
+
+/* directions */
+#define PMF_READ 0
+#define PMF_WRITE 1
+
+/* metrics */
+#define PMF_M_SEQ_MIN 0		/* seq stream iops */
+#define PMF_M_SEQ_AVG 1
+#define PMF_M_SEQ_MAX 2
+#define PMF_M_RND_MIN 3		/* rnd stream iops */
+#define PMF_M_RND_AVG 4
+#define PMF_M_RND_MAX 5
+#define PMF_M_SEQ_P50 6		/* read latency, usecs */
+#define PMF_M_SEQ_P99 7
+#define PMF_M_RND_P50 8
+#define PMF_M_RND_P99 9
+#define PMF_NUM_METRICS 10
+
+struct pmf_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdr_size;	/* readers skip what they do not know */
+	uint32_t num_devices;
+	uint32_t num_rw;	/* 1: reads, 2: reads and writes */
+	uint32_t num_io_sizes;
+	uint32_t num_metrics;
+	uint32_t num_seq;	/* stream counts 0 .. num_seq - 1 */
+	uint32_t num_rnd;
+	uint64_t io_size_off;	/* from the start of the file */
+	uint64_t device_off;
+	uint64_t metric_off;
+	uint64_t data_off;
+	uint64_t file_size;
+};
+
+struct pmf {
+	const struct pmf_hdr *hdr;
+	const uint32_t *io_size;
+	const char *device;
+	const uint32_t *metric;
+	const double *data;
+	size_t len;
+	int slot[PMF_NUM_METRICS];	/* by metric id, -1 if absent */
+	size_t stride[5];		/* device, rw, io size, metric, seq */
+};
+
+static inline uint64_t pmf_align(uint64_t off)
+{
+	return (off + 7) & ~7ULL;
+}
+
+/*
+ * Size of a file with this header's dimensions; fills in where its
+ * sections go.
+ */
+static inline uint64_t pmf_layout(struct pmf_hdr *h)
+{
+	h->io_size_off = pmf_align(h->hdr_size);
+	h->device_off = pmf_align(h->io_size_off + 4ULL * h->num_io_sizes);
+	h->metric_off = pmf_align(h->device_off + (uint64_t)PMF_NAME * h->num_devices);
+	h->data_off = pmf_align(h->metric_off + 4ULL * h->num_metrics);
+	h->file_size = h->data_off + 8ULL * h->num_devices * h->num_rw *
+		h->num_io_sizes * h->num_metrics * h->num_seq * h->num_rnd;
+	return h->file_size;
+}
+
+static inline void pmf_close(struct pmf *f)
+{
+	if (f->hdr)
+		munmap((void *)f->hdr, f->len);
+	memset(f, 0, sizeof(*f));
+}
+
+/*
+ * Map a model. Returns 0, or -1 with the reason on stderr.
+ */
+static inline int pmf_open(struct pmf *f, const char *path)
+{
+	struct pmf_hdr h;
+	struct stat st;
+	const char *err = NULL;
+	void *map;
+	uint32_t i;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		fprintf(stderr, "%s: not a model file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	f->hdr = (const struct pmf_hdr *)map;
+	f->len = st.st_size;
+
+	/* check the dimensions against the layout they imply */
+	h = *f->hdr;
+	if (h.magic != PMF_MAGIC)
+		err = "not a model file";
+	else if (h.version != PMF_VERSION)
+		err = "unsupported version";
+	else if (h.hdr_size < sizeof(h) || !h.num_devices || !h.num_rw ||
+			h.num_rw > 2 || !h.num_io_sizes || !h.num_metrics ||
+			h.num_metrics > PMF_NUM_METRICS || !h.num_seq || !h.num_rnd)
+		err = "bad header";
+	else if (pmf_layout(&h) != f->hdr->file_size ||
+			h.io_size_off != f->hdr->io_size_off ||
+			h.device_off != f->hdr->device_off ||
+			h.metric_off != f->hdr->metric_off ||
+			h.data_off != f->hdr->data_off ||
+			h.file_size != f->len)
+		err = "truncated or bad layout";
+	if (err) {
+		fprintf(stderr, "%s: %s\n", path, err);
+		pmf_close(f);
+		return -1;
+	}
+
+	f->io_size = (const uint32_t *)((const char *)map + h.io_size_off);
+	f->device = (const char *)map + h.device_off;
+	f->metric = (const uint32_t *)((const char *)map + h.metric_off);
+	f->data = (const double *)((const char *)map + h.data_off);
+
+	for (i = 0; i < PMF_NUM_METRICS; i++)
+		f->slot[i] = -1;
+	for (i = 0; i < h.num_metrics; i++) {
+		if (f->metric[i] >= PMF_NUM_METRICS || f->slot[f->metric[i]] >= 0) {
+			fprintf(stderr, "%s: bad metric table\n", path);
+			pmf_close(f);
+			return -1;
+		}
+		f->slot[f->metric[i]] = i;
+	}
+
+	f->stride[4] = h.num_rnd;
+	f->stride[3] = f->stride[4] * h.num_seq;
+	f->stride[2] = f->stride[3] * h.num_metrics;
+	f->stride[1] = f->stride[2] * h.num_io_sizes;
+	f->stride[0] = f->stride[1] * h.num_rw;
+	return 0;
+}
+
+static inline const char *pmf_device_name(const struct pmf *f, int dev)
+{
+	return f->device + (size_t)dev * PMF_NAME;
+}
+
+/* index of a device, or -1; NULL names the first */
+static inline int pmf_device(const struct pmf *f, const char *name)
+{
+	uint32_t i;
+
+	if (!name)
+		return 0;
+	for (i = 0; i < f->hdr->num_devices; i++)
+		if (!strncmp(pmf_device_name(f, i), name, PMF_NAME))
+			return i;
+	return -1;
+}
+
+/* index of an I/O size in bytes, or -1; 0 names the smallest */
+static inline int pmf_io_size(const struct pmf *f, uint32_t bytes)
+{
+	uint32_t i;
+
+	if (!bytes)
+		return 0;
+	for (i = 0; i < f->hdr->num_io_sizes; i++)
+		if (f->io_size[i] == bytes)
+			return i;
+	return -1;
+}
+
+/*
+ * A metric over 0 .. num_rnd - 1 rnd streams, at seq sequential streams,
+ * or NULL when the file does not have it. Indices are not checked.
+ */
+static inline const double *pmf_series(const struct pmf *f, int dev, int rw,
+		int io, int metric, int seq)
+{
+	int slot = f->slot[metric];
+
+	if (slot < 0)
+		return NULL;
+	return f->data + dev * f->stride[0] + rw * f->stride[1] +
+		io * f->stride[2] + slot * f->stride[3] + seq * f->stride[4];
+}
+
+/*
+ * One cell. Stream counts past the measured ones use the last (as
+ * pmodel.h does); an absent metric reads 0.
+ */
+static inline double pmf_get(const struct pmf *f, int dev, int rw, int io,
+		int metric, uint32_t seq, uint32_t rnd)
+{
+	const double *s;
+
+	if (seq >= f->hdr->num_seq)
+		seq = f->hdr->num_seq - 1;
+	if (rnd >= f->hdr->num_rnd)
+		rnd = f->hdr->num_rnd - 1;
+	s = pmf_series(f, dev, rw, io, metric, seq);
+	return s ? s[rnd] : 0;
+}
+
+#ifdef __cplusplus
+
+namespace pmfile {
+
+enum class metric : int {
+	seq_min = PMF_M_SEQ_MIN, seq_avg = PMF_M_SEQ_AVG, seq_max = PMF_M_SEQ_MAX,
+	rnd_min = PMF_M_RND_MIN, rnd_avg = PMF_M_RND_AVG, rnd_max = PMF_M_RND_MAX,
+	seq_p50 = PMF_M_SEQ_P50, seq_p99 = PMF_M_SEQ_P99,
+	rnd_p50 = PMF_M_RND_P50, rnd_p99 = PMF_M_RND_P99,
+};
+
+enum class dir : int { read = PMF_READ, write = PMF_WRITE };
+
+/*
+ * A mapped model, unmapped when this goes out of scope
+ */
+class model {
+public:
+	model() { memset(&f_, 0, sizeof(f_)); }
+	~model() { pmf_close(&f_); }
+	model(const model &) = delete;
+	model &operator=(const model &) = delete;
+
+	bool open(const char *path) { return !pmf_open(&f_, path); }
+
+	int device(const char *name) const { return pmf_device(&f_, name); }
+	int io_size(uint32_t bytes) const { return pmf_io_size(&f_, bytes); }
+	bool has(metric m) const { return f_.slot[(int)m] >= 0; }
+
+	const double *series(int dev, dir rw, int io, metric m, int seq) const
+	{
+		return pmf_series(&f_, dev, (int)rw, io, (int)m, seq);
+	}
+
+	double operator()(int dev, dir rw, int io, metric m, uint32_t seq,
+			uint32_t rnd) const
+	{
+		return pmf_get(&f_, dev, (int)rw, io, (int)m, seq, rnd);
+	}
+
+	const pmf_hdr &header() const { return *f_.hdr; }
+	const struct pmf *c() const { return &f_; }
+
+private:
+	struct pmf f_;
+};
+
+}
+
+#endif
+
+#endif
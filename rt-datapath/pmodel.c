@@ -0,0 +1,176 @@
+/*
+ * Performance model loading and t_S, t_I, t_Is look-ups.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmodel.h"
+#include "pmfile.h"
+
+#define MAX_LINE (1 << 16)
+#define MAX_POINTS 1024
+
+/*
+ * Parse a line of space separated doubles
+ */
+static int parse_doubles(char *line, double **out)
+{
+	double vals[MAX_POINTS];
+	char *tok, *save, *end;
+	int n = 0;
+
+	for (tok = strtok_r(line, " \n", &save); tok;
+			tok = strtok_r(NULL, " \n", &save)) {
+		if (n == MAX_POINTS)
+			return -1;
+		vals[n] = strtod(tok, &end);
+		if (end == tok)
+			return -1;
+		n++;
+	}
+
+	if (!n)
+		return -1;
+
+	*out = malloc(n * sizeof(**out));
+	if (!*out)
+		return -1;
+	memcpy(*out, vals, n * sizeof(**out));
+	return n;
+}
+
+int pmodel_map(struct pmodel *pm, const char *filename, const char *device)
+{
+	struct pmf f;
+	int dev;
+
+	memset(pm, 0, sizeof(*pm));
+
+	if (pmf_open(&f, filename))
+		return -1;
+
+	dev = pmf_device(&f, device);
+	if (dev < 0) {
+		fprintf(stderr, "%s: no device %s\n", filename, device);
+		goto err;
+	}
+	if (f.hdr->num_seq < 2 || f.slot[PMF_M_SEQ_AVG] < 0 ||
+			f.slot[PMF_M_RND_AVG] < 0) {
+		fprintf(stderr, "%s: needs mean iops with 0 and 1 seq streams\n",
+				filename);
+		goto err;
+	}
+
+	/* the series are read only, in the mapping */
+	pm->size = f.hdr->num_rnd;
+	pm->iops_S = (double *)pmf_series(&f, dev, PMF_READ, 0, PMF_M_SEQ_AVG, 1);
+	pm->iops_I = (double *)pmf_series(&f, dev, PMF_READ, 0, PMF_M_RND_AVG, 0);
+	pm->iops_Is = (double *)pmf_series(&f, dev, PMF_READ, 0, PMF_M_RND_AVG, 1);
+	pm->map = (void *)f.hdr;
+	pm->map_len = f.len;
+	return 0;
+
+err:
+	pmf_close(&f);
+	return -1;
+}
+
+int pmodel_load(struct pmodel *pm, const char *filename)
+{
+	static char line[MAX_LINE];
+	double **arrays[3] = { &pm->iops_S, &pm->iops_I, &pm->iops_Is };
+	uint32_t magic;
+	FILE *f;
+	int i, n;
+
+	memset(pm, 0, sizeof(*pm));
+
+	f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return -1;
+	}
+
+	if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == PMF_MAGIC) {
+		fclose(f);
+		return pmodel_map(pm, filename, NULL);
+	}
+	rewind(f);
+
+	for (i = 0; i < 3; i++) {
+		if (!fgets(line, sizeof(line), f)) {
+			fprintf(stderr, "%s: expected 3 arrays\n", filename);
+			goto err;
+		}
+		n = parse_doubles(line, arrays[i]);
+		if (n < 0 || (i && n != pm->size)) {
+			fprintf(stderr, "%s: invalid array on line %d\n", filename, i + 1);
+			goto err;
+		}
+		pm->size = n;
+	}
+
+	if (fgets(line, sizeof(line), f)) {
+		fprintf(stderr, "%s: too many arrays found\n", filename);
+		goto err;
+	}
+
+	fclose(f);
+	return 0;
+
+err:
+	fclose(f);
+	pmodel_free(pm);
+	return -1;
+}
+
+void pmodel_free(struct pmodel *pm)
+{
+	if (pm->map) {
+		munmap(pm->map, pm->map_len);
+		memset(pm, 0, sizeof(*pm));
+		return;
+	}
+	free(pm->iops_S);
+	free(pm->iops_I);
+	free(pm->iops_Is);
+	memset(pm, 0, sizeof(*pm));
+}
+
+static double t_lookup(const struct pmodel *pm, const double *iops,
+		long long blocks, int n)
+{
+	if (n >= pm->size)
+		n = pm->size - 1;
+	if (iops[n] == 0)
+		return PMODEL_INF;
+	return blocks / iops[n];
+}
+
+/*
+ * Time to complete a query using a sequential scan with n concurrent
+ * index scans.
+ */
+double pmodel_t_S(const struct pmodel *pm, long long blocks, int n)
+{
+	return t_lookup(pm, pm->iops_S, blocks, n);
+}
+
+/*
+ * Time to complete a query using an index scan with zero concurrent
+ * sequential scans.
+ */
+double pmodel_t_I(const struct pmodel *pm, long long blocks, int n)
+{
+	return t_lookup(pm, pm->iops_I, blocks, n);
+}
+
+/*
+ * Time to complete a query using an index scan with one concurrent
+ * sequential scan.
+ */
+double pmodel_t_Is(const struct pmodel *pm, long long blocks, int n)
+{
+	return t_lookup(pm, pm->iops_Is, blocks, n);
+}
@@ -0,0 +1,43 @@
+#ifndef PMODEL_H
+#define PMODEL_H
+
+#include <stddef.h>
+
+/*
+ * Best-effort performance model, in the format written by
+ * linear/serialize_pmodel.py:
+ *
+ *   line1: iops_S  - seq stream iops, function of # idx streams
+ *   line2: iops_I  - idx stream iops, 0 seq streams, function of # idx streams
+ *   line3: iops_Is - idx stream iops, 1 seq stream, function of # idx streams
+ *
+ * Lookups past the end of the arrays use the last entry (as in
+ * PerfModelNoBounds.java).
+ */
+struct pmodel {
+	int size;
+	double *iops_S;
+	double *iops_I;
+	double *iops_Is;
+	void *map;		/* binary model the arrays point into */
+	size_t map_len;
+};
+
+/* latency reported for an operating point the device cannot serve */
+#define PMODEL_INF (1000000.0)
+
+/* text as above, or a binary model (pmfile.h): its first device */
+int pmodel_load(struct pmodel *pm, const char *filename);
+
+/*
+ * The read model of one device of a binary model file, at the smallest
+ * I/O size, in place. NULL names the first device.
+ */
+int pmodel_map(struct pmodel *pm, const char *filename, const char *device);
+void pmodel_free(struct pmodel *pm);
+
+double pmodel_t_S(const struct pmodel *pm, long long blocks, int n);
+double pmodel_t_I(const struct pmodel *pm, long long blocks, int n);
+double pmodel_t_Is(const struct pmodel *pm, long long blocks, int n);
+
+#endif
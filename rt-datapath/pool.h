@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+
+/*
+ * Fixed-size free list of preallocated objects (iocbs, buffers, ...).
+ * Callers allocate the objects once at start-up and pool_put() them; the
+ * I/O path then never touches malloc.
+ */
+struct pool {
+	void **free;
+	int count;
+	int capacity;
+};
+
+static inline int pool_init(struct pool *p, int capacity)
+{
+	p->free = malloc(capacity * sizeof(*p->free));
+	if (!p->free)
+		return -1;
+	p->count = 0;
+	p->capacity = capacity;
+	return 0;
+}
+
+static inline void *pool_get(struct pool *p)
+{
+	if (!p->count)
+		return NULL;
+	return p->free[--p->count];
+}
+
+static inline void pool_put(struct pool *p, void *obj)
+{
+	p->free[p->count++] = obj;
+}
+
+#endif
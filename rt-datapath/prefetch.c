@@ -0,0 +1,63 @@
+/*
+ * Adaptive prefetch window for sequential scans (prefetch.h).
+ */
+#include <math.h>
+#include <string.h>
+
+#include "prefetch.h"
+
+/* weight of the newest sample in the averages */
+#define PREFETCH_ALPHA (0.05)
+
+/* reads kept beyond rate x latency, for latency jitter */
+#define PREFETCH_SPARE (1)
+
+void prefetch_init(struct prefetch *p, int max_depth)
+{
+	memset(p, 0, sizeof(*p));
+	p->window = max_depth;
+}
+
+static double ewma(double avg, double x)
+{
+	return avg ? PREFETCH_ALPHA * x + (1 - PREFETCH_ALPHA) * avg : x;
+}
+
+void prefetch_done(struct prefetch *p, double issued, double now,
+		double consume)
+{
+	if (now > issued)
+		p->latency = ewma(p->latency, now - issued);
+	p->consume = ewma(p->consume, consume);
+}
+
+int prefetch_update(struct prefetch *p, double rate, int min, int max_depth)
+{
+	double r = rate;
+	int w;
+
+	/* nothing measured yet, or a consumer that takes no time */
+	if (p->consume > 0 && (!r || 1.0 / p->consume < r))
+		r = 1.0 / p->consume;
+	if (!p->latency || !r) {
+		p->window = max_depth;
+		return p->window;
+	}
+
+	w = (int)ceil(r * p->latency) + PREFETCH_SPARE;
+	if (w < min)
+		w = min;
+	if (w > max_depth)
+		w = max_depth;
+
+	p->window = w;
+	return w;
+}
+
+void prefetch_tick(struct prefetch *p, double dt)
+{
+	p->area += p->held * dt;
+	p->secs += dt;
+	if (p->held > p->peak)
+		p->peak = p->held;
+}
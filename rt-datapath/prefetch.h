@@ -0,0 +1,47 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/*
+ * Adaptive prefetch window for sequential scans.
+ *
+ * O_DIRECT reads get no kernel readahead, so a scan only stays ahead of
+ * its consumer by keeping reads in flight itself, and every read in
+ * flight pins a buffer. By Little's law a scan consuming r blocks/s from
+ * a device taking L seconds a read needs r * L of them, plus a spare to
+ * cover the jitter; more only holds memory.
+ *
+ * The window is sized that way from two averages kept per stream: the
+ * read latency, and the time the consumer (query, join or shared scan)
+ * spends on a block. r is the slower of the consumer and the stream's
+ * token rate, so a stream the controller rate-limits, to its reservation
+ * or by the best-effort throttle, shrinks its window with it.
+ */
+struct prefetch {
+	double latency;		/* seconds a read, EWMA; 0 until measured */
+	double consume;		/* seconds of consumer time a block, EWMA */
+	int window;		/* reads to keep in flight */
+
+	int held;		/* reads in flight after the last dispatch */
+
+	/* during observation */
+	double area;		/* reads in flight integrated over time */
+	double secs;
+	int peak;
+};
+
+void prefetch_init(struct prefetch *p, int max_depth);
+
+/* a read issued at 'issued' completed at 'now'; its block took 'consume' */
+void prefetch_done(struct prefetch *p, double issued, double now,
+		double consume);
+
+/*
+ * Resize the window for a token rate (blocks/s, 0 = unlimited); it stays
+ * within min..max_depth. Returns the new window.
+ */
+int prefetch_update(struct prefetch *p, double rate, int min, int max_depth);
+
+/* account for the reads held since the last dispatch, over dt seconds */
+void prefetch_tick(struct prefetch *p, double dt);
+
+#endif
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+#
+# The elevator merging requests for the same block: on a file of a few
+# blocks rnd hands out each offset many times over, and one device read
+# must serve no more requests than it has room for. Run against a build
+# with -fsanitize=address to catch an overflow.
+#
+#   rnd-check.sh <rnd binary>
+#
+
+set -e
+
+RND=${1:-./rnd}
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+# O_DIRECT: not on tmpfs
+TMP=$(mktemp -d $DIR/rnd-check.XXXXXX)
+trap "rm -rf $TMP" EXIT
+
+dd if=/dev/urandom of=$TMP/f bs=32k count=1 2>/dev/null
+
+# 64 requests over 7 offsets, up to 4 KB merged: duplicates only
+OUT=$(ASAN_OPTIONS=detect_leaks=0 $RND -s $TMP/f -m 64 -b 4096 -l 32768 \
+	-E 64 -M 4 -t 1)
+MERGED=$(echo "$OUT" | sed -n 's/.*, \([0-9.]*\) reads merged.*/\1/p')
+if [ -z "$MERGED" ] || [ "$MERGED" == "1.00" ]; then
+	echo "duplicate offsets: FAIL, $MERGED reads per device read"
+	echo "$OUT"
+	exit 1
+fi
+echo "duplicate offsets: $MERGED reads per device read"
@@ -1,5 +1,22 @@
 /*
+ * Random read workload on libaio.
  *
+ * Keeps aio_maxio random reads outstanding against one file. With -E the
+ * reads pass through a user-space elevator first: a window of pending
+ * reads is sorted by offset, reads that are adjacent or within the gap
+ * limit of each other are merged into one larger device read, and the
+ * data is copied back to each caller's buffer when it completes. With a
+ * runtime (-t) the achieved iops, latency and merge ratio are reported;
+ * -P adds the CPU cost of the submit and the reap paths from hardware
+ * counters, per request and per KB read.
+ *
+ * Every request is also stamped with the TSC (cycles.h) as it goes
+ * through: generated, queued for the elevator, handed to io_submit(),
+ * back from it, seen completed, and reaped. -T reports each stage's
+ * p50/p99/p99.9 and, for the requests in the p99 and p99.9 tails of the
+ * whole, where their time went: the scheduler (queue, submit, reap) or
+ * the device. The kernel does not say when a read completed, so "device"
+ * runs until io_getevents() returns it.
  */
 #define _GNU_SOURCE
 #include <sys/types.h>
@@ -13,8 +30,51 @@
 #include <assert.h>
 #include <libaio.h>
 
+#include "block.h"
+#include "cycles.h"
+#include "hist.h"
+#include "perfctr.h"
+
+/*
+ * Lifecycle stages of a request, each ending at a stamp
+ */
+#define STAGE_GEN 0		/* offset picked, until queued */
+#define STAGE_QUEUE 1		/* held by the elevator, made into a read */
+#define STAGE_SUBMIT 2		/* in io_submit() */
+#define STAGE_DEVICE 3		/* until io_getevents() returns it */
+#define STAGE_REAP 4		/* reaped behind the rest of its batch */
+#define NUM_STAGES 5
+
+static const char *stage_names[NUM_STAGES] = {
+	"gen", "queue", "submit", "device", "reap",
+};
+
+/*
+ * A caller's read
+ */
+struct request {
+	long long offset;
+	struct timeval queued;
+	uint64_t t_gen, t_queued;	/* cycles */
+	void *buf;		/* caller's copy, elevator only */
+};
+
 struct iocb_context {
 	struct timeval submitted;
+	uint64_t t_submit, t_submitted;	/* into and back from io_submit() */
+	int nr;
+	struct request **reqs;	/* served by this device read */
+};
+
+/*
+ * Where the time of requests went, in cycles: each stage's histogram, and
+ * by bucket of the whole latency the sum of each stage, so the make-up of
+ * any tail of the whole adds up at the end
+ */
+struct lifecycle {
+	struct hist total;
+	struct hist stage[NUM_STAGES];
+	double by_total[HIST_BUCKETS][NUM_STAGES];
 };
 
 struct workload {
@@ -32,6 +92,39 @@ struct workload {
 	int iocb_free_count;
 	int alignment;
 
+	/* check blocks against their gen-data stamps */
+	int verify;
+	uint32_t file_id;
+	uint64_t seed;
+
+	/* requests: aio_maxio of them are outstanding at all times */
+	struct request **req_free;
+	int req_free_count;
+
+	/* elevator, off when window is 0 */
+	int window;		/* requests gathered before sorting */
+	long long gap;		/* largest hole merged over, bytes */
+	long long merge_max;	/* largest device read, bytes */
+	int merge_reqs;		/* most requests one device read serves */
+	struct request **pending;
+	int num_pending;
+
+	/* stats */
+	unsigned long long reqs_done;
+	unsigned long long reads_done;	/* device reads */
+	unsigned long long bytes_read;	/* device bytes, holes included */
+	struct hist lat;		/* request latency, usecs */
+
+	/* lifecycle breakdown, with -T */
+	int trace;
+	uint64_t t_completed;		/* io_getevents() returned */
+	struct lifecycle *lc;
+
+	/* CPU cost, with -P */
+	int perf;
+	struct perfctr submit_ctr;	/* making and submitting reads */
+	struct perfctr reap_ctr;	/* io_getevents() and completions */
+
 	io_context_t ctx;
 };
 
@@ -64,8 +157,16 @@ static void free_iocb(struct workload *w, struct iocb *io)
 static int init_iocb(struct workload *w)
 {
 	int i, ret;
+	long long bufsize;
 	void *buf;
 
+	/*
+	 * a device read may serve this many requests: one per block, and
+	 * make_reads() stops there though offsets repeat
+	 */
+	w->merge_reqs = w->window ? w->merge_max / w->aio_blksize + 1 : 1;
+	bufsize = w->window ? w->merge_max : w->aio_blksize;
+
 	w->iocb_free = malloc(w->aio_maxio * sizeof(*w->iocb_free));
 	if (!w->iocb_free) {
 		perror("malloc");
@@ -78,13 +179,13 @@ static int init_iocb(struct workload *w)
 			perror("malloc");
 			return -1;
 		}
-		ret = posix_memalign(&buf, w->alignment, w->aio_blksize);
+		ret = posix_memalign(&buf, w->alignment, bufsize);
 		if (ret) {
 			fprintf(stderr, "posix_memalign: %s\n", strerror(-ret));
 			return ret;
 		}
 		/* this is just used to save a pointer to buf */
-		io_prep_pread(w->iocb_free[i], -1, buf, w->aio_blksize, 0);
+		io_prep_pread(w->iocb_free[i], -1, buf, bufsize, 0);
 
 		/* stash some context in iocb->data */
 		w->iocb_free[i]->data = malloc(sizeof(struct iocb_context));
@@ -92,14 +193,54 @@ static int init_iocb(struct workload *w)
 			perror("malloc");
 			return -1;
 		}
+		((struct iocb_context *)w->iocb_free[i]->data)->reqs =
+			malloc(w->merge_reqs * sizeof(struct request *));
+		if (!((struct iocb_context *)w->iocb_free[i]->data)->reqs) {
+			perror("malloc");
+			return -1;
+		}
 	}
 
 	w->iocb_free_count = i;
 	return 0;
 }
 
+static int init_requests(struct workload *w)
+{
+	int i, ret;
+
+	w->req_free = malloc(w->aio_maxio * sizeof(*w->req_free));
+	w->pending = malloc(w->aio_maxio * sizeof(*w->pending));
+	if (!w->req_free || !w->pending) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < w->aio_maxio; i++) {
+		w->req_free[i] = calloc(1, sizeof(**w->req_free));
+		if (!w->req_free[i]) {
+			perror("malloc");
+			return -1;
+		}
+		if (!w->window)
+			continue;
+		ret = posix_memalign(&w->req_free[i]->buf, w->alignment,
+				w->aio_blksize);
+		if (ret) {
+			fprintf(stderr, "posix_memalign: %s\n", strerror(ret));
+			return -1;
+		}
+	}
+
+	w->req_free_count = i;
+	w->num_pending = 0;
+	hist_init(&w->lat);
+	return 0;
+}
+
 static int init_workload(struct workload *w, char *filename, long long size,
-		int aio_maxio, int aio_blksize)
+		int aio_maxio, int aio_blksize, int window, long long gap,
+		long long merge_max)
 {
 	int fd, ret;
 
@@ -117,6 +258,9 @@ static int init_workload(struct workload *w, char *filename, long long size,
 	w->alignment = 512;
 	w->size = size;
 	w->blocks = (w->size - w->aio_blksize) / w->aio_blksize;
+	w->window = window;
+	w->gap = gap;
+	w->merge_max = merge_max;
 	memset(&w->ctx, 0, sizeof(w->ctx));
 
 	ret = io_queue_init(w->aio_maxio, &w->ctx);
@@ -129,7 +273,7 @@ static int init_workload(struct workload *w, char *filename, long long size,
 	if (ret)
 		return ret;
 
-	return 0;
+	return init_requests(w);
 }
 
 /*
@@ -153,24 +297,81 @@ static unsigned long long timeval_diff(struct timeval *a, struct timeval *b)
 	return timeval_to_us(a) - timeval_to_us(b);
 }
 
+static void verify_blocks(struct workload *w, struct iocb *iocb)
+{
+	long long block = iocb->u.c.offset / BLOCK_SIZE;
+	char *buf = iocb->u.c.buf;
+	int i, err;
+
+	for (i = 0; i < (int)(iocb->u.c.nbytes / BLOCK_SIZE); i++) {
+		err = block_check(buf + i * BLOCK_SIZE, w->file_id, block + i,
+				w->seed);
+		if (err) {
+			fprintf(stderr, "%s: block %lld: %s\n", w->filename,
+					block + i, block_strerror(err));
+			exit(1);
+		}
+	}
+}
+
+static void lifecycle_add(struct lifecycle *lc, const uint64_t *t)
+{
+	uint64_t total = 0;
+	int i, b;
+
+	for (i = 0; i < NUM_STAGES; i++) {
+		hist_add(&lc->stage[i], t[i]);
+		total += t[i];
+	}
+	hist_add(&lc->total, total);
+
+	b = hist_bucket(total);
+	for (i = 0; i < NUM_STAGES; i++)
+		lc->by_total[b][i] += t[i];
+}
+
 static void rd_done(struct workload *w, struct timeval *completed,
 		struct iocb *iocb, void *data, long res, long res2)
 {
 	struct iocb_context *iocb_ctx = data;
-	unsigned long long usdiff;
+	struct request *req;
+	uint64_t t[NUM_STAGES];
+	int i;
 
 	if (res2) {
 		fprintf(stderr, "rd_done: res2=%ld, %s\n", res2, strerror(-res2));
 		exit(1);
 	}
 
-	if (res != w->aio_blksize) {
+	if (res != (long)iocb->u.c.nbytes) {
 		fprintf(stderr, "read missing bytes! %s\n", strerror(-res));
 		exit(1);
 	}
 
-	usdiff = timeval_diff(completed, &iocb_ctx->submitted);
-	//printf("%llu\n", usdiff);
+	if (w->verify)
+		verify_blocks(w, iocb);
+
+	/* scatter to the callers */
+	for (i = 0; i < iocb_ctx->nr; i++) {
+		req = iocb_ctx->reqs[i];
+		if (req->buf)
+			memcpy(req->buf, (char *)iocb->u.c.buf +
+					(req->offset - iocb->u.c.offset), w->aio_blksize);
+		hist_add(&w->lat, timeval_diff(completed, &req->queued));
+		if (w->trace) {
+			t[STAGE_GEN] = req->t_queued - req->t_gen;
+			t[STAGE_QUEUE] = iocb_ctx->t_submit - req->t_queued;
+			t[STAGE_SUBMIT] = iocb_ctx->t_submitted - iocb_ctx->t_submit;
+			t[STAGE_DEVICE] = w->t_completed - iocb_ctx->t_submitted;
+			t[STAGE_REAP] = cycles() - w->t_completed;
+			lifecycle_add(w->lc, t);
+		}
+		w->req_free[w->req_free_count++] = req;
+	}
+
+	w->reqs_done += iocb_ctx->nr;
+	w->reads_done++;
+	w->bytes_read += res;
 
 	w->aio_inflight--;
 	free_iocb(w, iocb);
@@ -183,12 +384,16 @@ static int io_wait_run(struct workload *w)
 	struct timeval completed;
 	int ret, i;
 
+	if (w->perf)
+		perfctr_start(&w->reap_ctr);
+
 	ret = io_getevents(w->ctx, 1, w->aio_maxio, events, NULL);
 	if (ret < 1) {
 		fprintf(stderr, "io_getevents: %s\n", strerror(-ret));
 		return ret;
 	}
 
+	w->t_completed = cycles();
 	assert(gettimeofday(&completed, NULL) == 0);
 
 	for (i = 0; i < ret; i++) {
@@ -196,39 +401,106 @@ static int io_wait_run(struct workload *w)
 		rd_done(w, &completed, ep->obj, ep->data, ep->res, ep->res2);
 	}
 
+	if (w->perf)
+		perfctr_stop(&w->reap_ctr);
+
 	return 0;
 }
 
-static int run_workload(struct workload *w)
+static int request_cmp(const void *a, const void *b)
 {
-	int i, n, ret;
-	struct iocb *io;
+	const struct request *x = *(struct request * const *)a;
+	const struct request *y = *(struct request * const *)b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*
+ * Turn the pending requests into device reads: one each, or with the
+ * elevator sorted and merged across holes of up to w->gap bytes.
+ */
+static int make_reads(struct workload *w, struct iocb **ioq)
+{
+	struct request **p = w->pending;
 	struct iocb_context *iocb_ctx;
-	struct timeval submitted;
+	long long start, end;
+	struct iocb *io;
 	void *data;
-	long long offset = 0;
+	int i, n = 0;
+
+	if (w->window)
+		qsort(p, w->num_pending, sizeof(*p), request_cmp);
+
+	for (i = 0; i < w->num_pending; n++) {
+		io = alloc_iocb(w);
+		assert(io); /* sanity */
+		iocb_ctx = io->data;
+		iocb_ctx->nr = 0;
+
+		start = p[i]->offset;
+		end = start + w->aio_blksize;
+		iocb_ctx->reqs[iocb_ctx->nr++] = p[i++];
+
+		while (w->window && i < w->num_pending &&
+				iocb_ctx->nr < w->merge_reqs &&
+				p[i]->offset - end <= w->gap &&
+				MAX(end, p[i]->offset + w->aio_blksize) - start <=
+				w->merge_max) {
+			end = MAX(end, p[i]->offset + w->aio_blksize);
+			iocb_ctx->reqs[iocb_ctx->nr++] = p[i++];
+		}
+
+		data = io->data;
+		io_prep_pread(io, w->fd, io->u.c.buf, end - start, start);
+		io->data = data;
+		ioq[n] = io;
+	}
+
+	w->num_pending = 0;
+	return n;
+}
+
+static int run_workload(struct workload *w, double runtime)
+{
+	int i, n, ret;
+	struct iocb_context *iocb_ctx;
+	struct timeval start, now;
+	struct request *req;
+	uint64_t t_submit;
+
+	assert(gettimeofday(&start, NULL) == 0);
 
 	while (1) {
-		n = MIN(w->aio_maxio - w->aio_inflight, w->aio_maxio);
-		if (n > 0) {
-			struct iocb *ioq[n];
-			
-			for (i = 0; i < n; i++) {
-				io = alloc_iocb(w);
-				assert(io); /* sanity */
-				data = io->data;
-				io_prep_pread(io, w->fd, io->u.c.buf, w->aio_blksize, rnd_offset(w));
-				//io_prep_pread(io, w->fd, io->u.c.buf, w->aio_blksize, offset);
-				offset += 4096;
-				io->data = data;
-				ioq[i] = io;
-			}
+		assert(gettimeofday(&now, NULL) == 0);
+		if (runtime > 0 && timeval_diff(&now, &start) >= runtime * USEC_PER_SEC)
+			break;
+
+		/* every caller that is not waiting issues a new read */
+		while (w->req_free_count) {
+			req = w->req_free[--w->req_free_count];
+			req->t_gen = cycles();
+			req->offset = rnd_offset(w);
+			req->queued = now;
+			w->pending[w->num_pending++] = req;
+			req->t_queued = cycles();
+		}
+
+		/* the elevator holds reads until its window fills, or the disk idles */
+		n = 0;
+		if (w->num_pending && (w->num_pending >= w->window || !w->aio_inflight)) {
+			struct iocb *ioq[w->num_pending];
+
+			if (w->perf)
+				perfctr_start(&w->submit_ctr);
+
+			n = make_reads(w, ioq);
 
 			/* all these dudes get the same submit time */
-			assert(gettimeofday(&submitted, NULL) == 0);
+			t_submit = cycles();
 			for (i = 0; i < n; i++) {
 				iocb_ctx = ioq[i]->data;
-				iocb_ctx->submitted = submitted;
+				iocb_ctx->submitted = now;
+				iocb_ctx->t_submit = t_submit;
 			}
 
 			ret = io_submit(w->ctx, n, ioq);
@@ -237,7 +509,14 @@ static int run_workload(struct workload *w)
 				return -1;
 			}
 
+			t_submit = cycles();
+			for (i = 0; i < n; i++)
+				((struct iocb_context *)ioq[i]->data)->t_submitted = t_submit;
+
 			w->aio_inflight += n;
+
+			if (w->perf)
+				perfctr_stop(&w->submit_ctr);
 		}
 
 		ret = io_wait_run(w);
@@ -245,12 +524,92 @@ static int run_workload(struct workload *w)
 			return -1;
 	}
 
+	/* drain */
+	while (w->aio_inflight)
+		if (io_wait_run(w))
+			return -1;
+
 	return 0;
 }
 
+static void report(struct workload *w, double secs)
+{
+	printf("%llu reads in %.1f s: %.0f iops, latency avg %.0f us, p50 %llu us, "
+			"p99 %llu us, max %llu us\n", w->reqs_done, secs,
+			w->reqs_done / secs, hist_mean(&w->lat),
+			(unsigned long long)hist_pct(&w->lat, 0.5),
+			(unsigned long long)hist_pct(&w->lat, 0.99), w->lat.max);
+	printf("%llu device reads, %.2f reads merged per device read, "
+			"%.1f KB per device read\n", w->reads_done,
+			w->reads_done ? (double)w->reqs_done / w->reads_done : 0,
+			w->reads_done ? w->bytes_read / 1024.0 / w->reads_done : 0);
+
+	if (w->perf) {
+		perfctr_read(&w->submit_ctr);
+		perfctr_read(&w->reap_ctr);
+		perfctr_report(stdout, "submit", &w->submit_ctr, w->reqs_done,
+				w->bytes_read);
+		perfctr_report(stdout, "reap", &w->reap_ctr, w->reqs_done,
+				w->bytes_read);
+	}
+}
+
+/*
+ * Stage percentiles, then what the requests in the tails of the whole spent
+ * in each stage on average (usecs, and share)
+ */
+static void report_lifecycle(struct lifecycle *lc, double hz)
+{
+	static const double pcts[] = { 0.5, 0.99, 0.999 };
+	double us = 1e6 / hz, sum[NUM_STAGES], total;
+	unsigned long long n;
+	int i, j, b, from;
+
+	printf("%-12s", "stage us");
+	for (i = 0; i < NUM_STAGES; i++)
+		printf(" %8s", stage_names[i]);
+	printf(" %8s\n", "total");
+
+	for (j = 0; j < 3; j++) {
+		printf("p%-11g", pcts[j] * 100);
+		for (i = 0; i < NUM_STAGES; i++)
+			printf(" %8.1f", hist_pct(&lc->stage[i], pcts[j]) * us);
+		printf(" %8.1f\n", hist_pct(&lc->total, pcts[j]) * us);
+	}
+
+	for (j = 1; j < 3; j++) {
+		from = hist_bucket(hist_pct(&lc->total, pcts[j]));
+		memset(sum, 0, sizeof(sum));
+		for (n = 0, b = from; b < HIST_BUCKETS; b++) {
+			n += lc->total.count[b];
+			for (i = 0; i < NUM_STAGES; i++)
+				sum[i] += lc->by_total[b][i];
+		}
+		if (!n)
+			continue;
+
+		for (total = 0, i = 0; i < NUM_STAGES; i++)
+			total += sum[i];
+		printf("p%g tail, %llu reads from %.0f us:", pcts[j] * 100, n,
+				hist_value(from) * us);
+		for (i = 0; i < NUM_STAGES; i++)
+			printf(" %s %.1f (%.0f%%)", stage_names[i], sum[i] / n * us,
+					total ? 100 * sum[i] / total : 0);
+		printf("\n");
+	}
+}
+
 static void usage(void)
 {
-	fprintf(stderr, "usage: -s <source> -m <aio_maxio> -b <aio_blksize> -l <size>\n");
+	fprintf(stderr, "usage: -s <source> -m <aio_maxio> -b <aio_blksize> -l <size>\n"
+			"       [-V <data seed>]  check blocks against their gen-data stamps\n"
+			"       [-t <runtime s>]  stop and report (default: run forever)\n"
+			"       [-E <window>]     sort and merge this many reads at a time\n"
+			"       [-g <gap KB>]     merge reads up to this far apart (0)\n"
+			"       [-M <max KB>]     largest merged read (128)\n"
+			"       [-T]              break latency down by lifecycle stage\n"
+			"       [-P]              count cycles, instructions, cache misses\n"
+			"                         and context switches of submit and reap\n");
 	exit(1);
 }
 
@@ -261,10 +620,20 @@ int main(int argc, char **argv)
 	int aio_maxio = -1;
 	int aio_blksize = -1;
 	long long size = -1;
+	long long file_id = -1;
+	uint64_t seed = 0;
+	int verify = 0;
+	double runtime = 0;
+	int window = 0;
+	int perf = 0;
+	int trace = 0;
+	uint64_t start_cycles;
+	long long gap = 0, merge_max = 128 * 1024;
+	struct timeval start, finish;
 	int ret;
 	char c;
 
-	while ((c = getopt(argc, argv, "s:m:b:l:")) != -1) {
+	while ((c = getopt(argc, argv, "s:m:b:l:V:t:E:g:M:PT")) != -1) {
 		switch (c) {
 		case 's':
 			source = strdup(optarg);
@@ -278,6 +647,28 @@ int main(int argc, char **argv)
 		case 'l':
 			size = atoll(optarg);
 			break;
+		case 'V':
+			verify = 1;
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			runtime = atof(optarg);
+			break;
+		case 'E':
+			window = atoi(optarg);
+			break;
+		case 'g':
+			gap = atoll(optarg) * 1024;
+			break;
+		case 'M':
+			merge_max = atoll(optarg) * 1024;
+			break;
+		case 'P':
+			perf = 1;
+			break;
+		case 'T':
+			trace = 1;
+			break;
 		default:
 			usage();
 		}
@@ -299,13 +690,53 @@ int main(int argc, char **argv)
 	if (size < 1)
 		usage();
 
-	ret = init_workload(&w, source, size, aio_maxio, aio_blksize);
+	if (window < 0 || window > aio_maxio || gap < 0 ||
+			merge_max < aio_blksize) {
+		fprintf(stderr, "elevator window must be 0..aio_maxio and the "
+				"largest merge at least aio_blksize\n");
+		usage();
+	}
+
+	if (verify) {
+		file_id = block_file_id_from_name(source);
+		if (file_id < 0 || aio_blksize % BLOCK_SIZE) {
+			fprintf(stderr, "-V needs a gen-data file name and a block size "
+					"multiple of %d\n", BLOCK_SIZE);
+			usage();
+		}
+	}
+
+	memset(&w, 0, sizeof(w));
+	ret = init_workload(&w, source, size, aio_maxio, aio_blksize, window,
+			gap, merge_max);
 	if (ret)
 		return ret;
 
-	ret = run_workload(&w);
+	w.verify = verify;
+	w.file_id = file_id;
+	w.seed = seed;
+
+	w.perf = perf;
+	if (perf && (perfctr_open(&w.submit_ctr) || perfctr_open(&w.reap_ctr)))
+		return 1;
+
+	w.trace = trace;
+	if (trace && !(w.lc = calloc(1, sizeof(*w.lc)))) {
+		perror("calloc");
+		return 1;
+	}
+
+	assert(gettimeofday(&start, NULL) == 0);
+	start_cycles = cycles();
+	ret = run_workload(&w, runtime);
 	if (ret)
 		return ret;
+	assert(gettimeofday(&finish, NULL) == 0);
+
+	report(&w, timeval_diff(&finish, &start) / (double)USEC_PER_SEC);
+	if (trace)
+		report_lifecycle(w.lc, (cycles() - start_cycles) /
+				(timeval_diff(&finish, &start) / (double)USEC_PER_SEC));
 
 	return 0;
 }
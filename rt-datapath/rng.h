@@ -0,0 +1,44 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*
+ * Seeded PRNG (xorshift64*) so that offset streams, generated data and
+ * simulated workloads are reproducible for a given seed, independent of
+ * libc rand() and of any other thread drawing numbers.
+ */
+struct rng {
+	uint64_t s;
+};
+
+static inline void rng_seed(struct rng *r, uint64_t seed)
+{
+	/* splitmix64 step, so small seeds still give a well mixed state */
+	seed += 0x9e3779b97f4a7c15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+	r->s = (seed ^ (seed >> 31)) | 1;
+}
+
+static inline uint64_t rng_next(struct rng *r)
+{
+	r->s ^= r->s >> 12;
+	r->s ^= r->s << 25;
+	r->s ^= r->s >> 27;
+	return r->s * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in [0, 1) */
+static inline double rng_double(struct rng *r)
+{
+	return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* uniform in [0, n) */
+static inline uint64_t rng_range(struct rng *r, uint64_t n)
+{
+	return (uint64_t)(((unsigned __int128)rng_next(r) * n) >> 64);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+set -e
+set -x
+
+#
+# Run the same stream mixes under kernel I/O priorities (workload -p) and
+# under the reservation scheduler of async-workload, then compare the two.
+# Bandwidth goes to $OUT/{ioprio,sched}/S-X.log and read latency to
+# S-X.lat, both in the experiments/ layout.
+#
+# Only the mechanism differs: both sides read with O_DIRECT, one read in
+# flight per stream (a workload thread, async-workload -m 1), over the
+# same seq and idx files for the same 10 s warmup and 30 s run.
+#
+#   run-ioprio.sh <filename base> <out dir> [max idx streams]
+#
+# SEQ_PRIO and RND_PRIO are the priorities of the seq and idx streams,
+# SEQ_RES the seq reservation (blocks/s) the scheduler is given instead,
+# ENGINE the async-workload io engine (an O_DIRECT one: aio or uring).
+#
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PATH=$PATH:$DIR
+
+BASE=$1
+OUT=$2
+MAX_RND=${3:-10}
+SEQ_PRIO=${SEQ_PRIO:-rt:4}
+RND_PRIO=${RND_PRIO:-be:7}
+SEQ_RES=${SEQ_RES:-10000}
+ENGINE=${ENGINE:-aio}
+
+mkdir -p $OUT/ioprio $OUT/sched
+
+for i in $(seq 0 $MAX_RND)
+do
+	echo 1 > /proc/sys/vm/drop_caches
+	workload -s 1 -x $i -b $BASE -D -p $SEQ_PRIO,$RND_PRIO \
+		-L $OUT/ioprio/1-$i.lat >> $OUT/ioprio/1-$i.log
+
+	echo 1 > /proc/sys/vm/drop_caches
+	async-workload -s 1 -x $i -b $BASE -e $ENGINE -m 1 -r $SEQ_RES \
+		-L $OUT/sched/1-$i.lat >> $OUT/sched/1-$i.log
+done
+
+python3 $DIR/ioprio-compare.py $OUT/ioprio $OUT/sched
@@ -0,0 +1,361 @@
+/*
+ * Shared multi-query evaluation (share.h).
+ *
+ * The rank of a value among a group's thresholds is found by a branchless
+ * binary search over the padded threshold array; the AVX2 kernel does it
+ * for 8 tuples at a time with gathers, then updates their buckets one by
+ * one.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "share.h"
+#include "rng.h"
+
+static int cmp_int(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int find_group(struct share *sh, const struct tuple_query *q)
+{
+	struct share_group *g;
+	int i;
+
+	for (i = 0; i < sh->num_groups; i++) {
+		g = &sh->groups[i];
+		if (g->format == q->format && g->pred_col == q->pred_col &&
+				g->pred_float == q->pred_float)
+			return i;
+	}
+
+	g = &sh->groups[sh->num_groups];
+	g->format = q->format;
+	g->pred_col = q->pred_col;
+	g->pred_float = q->pred_float;
+	return sh->num_groups++;
+}
+
+static int find_agg(struct share_group *g, int col)
+{
+	int i;
+
+	if (col < 0)
+		return -1;
+	for (i = 0; i < g->num_aggs; i++)
+		if (g->agg_col[i] == col)
+			return i;
+	if (g->num_aggs == SHARE_MAX_AGGS)
+		return -2;
+	g->agg_col[g->num_aggs] = col;
+	return g->num_aggs++;
+}
+
+/*
+ * Sort and dedupe a group's thresholds, pad them and rank its queries
+ */
+static int init_group(struct share *sh, int k)
+{
+	struct share_group *g = &sh->groups[k];
+	int i, j, n = 0;
+
+	g->th.p = malloc(sh->num_queries * sizeof(int32_t));
+	if (!g->th.p)
+		return -1;
+
+	for (i = 0; i < sh->num_queries; i++) {
+		const struct tuple_query *q = sh->queries[i].q;
+
+		if (sh->queries[i].group != k)
+			continue;
+		if (g->pred_float)
+			g->th.f[n++] = q->pred_lt;
+		else
+			g->th.i[n++] = (int32_t)q->pred_lt;
+	}
+
+	qsort(g->th.p, n, sizeof(int32_t), g->pred_float ? cmp_float : cmp_int);
+	for (i = j = 1; i < n; i++)
+		if (memcmp(&g->th.i[i], &g->th.i[j - 1], sizeof(int32_t)))
+			g->th.i[j++] = g->th.i[i];
+	g->n = j;
+
+	for (g->size = 1; g->size < g->n; g->size *= 2)
+		;
+	g->th.p = realloc(g->th.p, g->size * sizeof(int32_t));
+	if (!g->th.p)
+		return -1;
+	for (i = g->n; i < g->size; i++) {
+		if (g->pred_float)
+			g->th.f[i] = INFINITY;
+		else
+			g->th.i[i] = INT32_MAX;
+	}
+
+	for (i = 0; i < sh->num_queries; i++) {
+		struct share_query *sq = &sh->queries[i];
+		union { int32_t i; float f; } t;
+
+		if (sq->group != k)
+			continue;
+		if (g->pred_float)
+			t.f = sq->q->pred_lt;
+		else
+			t.i = (int32_t)sq->q->pred_lt;
+		for (sq->rank = 0; memcmp(&g->th.i[sq->rank], &t, sizeof(t));
+				sq->rank++)
+			;
+	}
+
+	g->count = calloc(g->size + 1, sizeof(*g->count));
+	if (!g->count)
+		return -1;
+	for (i = 0; i < g->num_aggs; i++) {
+		g->sum[i] = calloc(g->size + 1, sizeof(double));
+		if (!g->sum[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+int share_init(struct share *sh, const struct tuple_query *qs, int n)
+{
+	int i;
+
+	memset(sh, 0, sizeof(*sh));
+	sh->num_queries = n;
+	sh->queries = calloc(n, sizeof(*sh->queries));
+	sh->groups = calloc(n, sizeof(*sh->groups));
+	if (!sh->queries || !sh->groups)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		struct share_query *sq = &sh->queries[i];
+
+		sq->q = &qs[i];
+		sq->group = find_group(sh, sq->q);
+		sq->agg = find_agg(&sh->groups[sq->group], sq->q->agg_col);
+		if (sq->agg < -1)
+			return -1;
+	}
+
+	for (i = 0; i < sh->num_groups; i++)
+		if (init_group(sh, i))
+			return -1;
+
+	return 0;
+}
+
+void share_free(struct share *sh)
+{
+	int i, j;
+
+	for (i = 0; i < sh->num_groups; i++) {
+		free(sh->groups[i].th.p);
+		free(sh->groups[i].count);
+		for (j = 0; j < sh->groups[i].num_aggs; j++)
+			free(sh->groups[i].sum[j]);
+	}
+	free(sh->groups);
+	free(sh->queries);
+	memset(sh, 0, sizeof(*sh));
+}
+
+void share_reset(struct share *sh)
+{
+	int i, j;
+
+	for (i = 0; i < sh->num_groups; i++) {
+		struct share_group *g = &sh->groups[i];
+
+		g->tuples = 0;
+		memset(g->count, 0, (g->size + 1) * sizeof(*g->count));
+		for (j = 0; j < g->num_aggs; j++)
+			memset(g->sum[j], 0, (g->size + 1) * sizeof(double));
+	}
+	sh->tuples = 0;
+}
+
+/* thresholds at or below v */
+static inline int rank(const struct share_group *g, const uint32_t *v)
+{
+	int pos = 0, step;
+
+	if (g->pred_float) {
+		float x;
+
+		memcpy(&x, v, sizeof(x));
+		for (step = g->size / 2; step; step /= 2)
+			pos += g->th.f[pos + step - 1] <= x ? step : 0;
+		return pos + (g->th.f[pos] <= x);
+	}
+
+	for (step = g->size / 2; step; step /= 2)
+		pos += g->th.i[pos + step - 1] <= (int32_t)*v ? step : 0;
+	return pos + (g->th.i[pos] <= (int32_t)*v);
+}
+
+static inline void add(struct share_group *g, const uint32_t *row, int pos)
+{
+	float v;
+	int a;
+
+	g->count[pos]++;
+	for (a = 0; a < g->num_aggs; a++) {
+		memcpy(&v, row + g->agg_col[a], sizeof(v));
+		g->sum[a][pos] += v;
+	}
+}
+
+static void scan_scalar(struct share_group *g, const uint32_t *w, int rows,
+		int stride)
+{
+	int i;
+
+	for (i = 0; i < rows; i++, w += stride)
+		add(g, w, rank(g, w + g->pred_col));
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void scan_avx2(struct share_group *g, const uint32_t *w, int rows,
+		int stride)
+{
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32(stride));
+	const __m256i one = _mm256_set1_epi32(1);
+	__m256i pos, step, gt, v;
+	int32_t lanes[8];
+	int i, l, s;
+
+	for (i = 0; i + 8 <= rows; i += 8, w += 8 * stride) {
+		v = _mm256_i32gather_epi32((const int *)w + g->pred_col, idx, 4);
+		pos = _mm256_setzero_si256();
+
+		/* step down through the powers of two, then the final compare */
+		for (s = g->size / 2; ; s /= 2) {
+			__m256i at = s ? _mm256_add_epi32(pos,
+					_mm256_set1_epi32(s - 1)) : pos;
+
+			step = s ? _mm256_set1_epi32(s) : one;
+			if (g->pred_float)
+				gt = _mm256_castps_si256(_mm256_cmp_ps(
+						_mm256_i32gather_ps(g->th.f, at, 4),
+						_mm256_castsi256_ps(v), _CMP_GT_OQ));
+			else
+				gt = _mm256_cmpgt_epi32(
+						_mm256_i32gather_epi32(g->th.i, at, 4), v);
+			pos = _mm256_add_epi32(pos, _mm256_andnot_si256(gt, step));
+			if (!s)
+				break;
+		}
+
+		_mm256_storeu_si256((__m256i *)lanes, pos);
+		for (l = 0; l < 8; l++)
+			add(g, w + l * stride, lanes[l]);
+	}
+
+	scan_scalar(g, w, rows & 7, stride);
+}
+#endif
+
+static void scan_init(struct share_group *g, const uint32_t *w, int rows,
+		int stride);
+
+static void (*scan)(struct share_group *, const uint32_t *, int, int) =
+	scan_init;
+static const char *impl_name = "scalar";
+
+/* pick a kernel on first use */
+static void scan_init(struct share_group *g, const uint32_t *w, int rows,
+		int stride)
+{
+	scan = scan_scalar;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan = scan_avx2;
+		impl_name = "avx2";
+	}
+#endif
+	scan(g, w, rows, stride);
+}
+
+int share_scan(struct share *sh, const void *buf)
+{
+	const struct block_hdr *h = buf;
+	const uint32_t *w = (const uint32_t *)(h + 1);
+	int i, max, hit = 0;
+
+	if (h->format != TUPLE_OBJECT && h->format != TUPLE_LOCATION)
+		return 0;
+	max = h->format == TUPLE_OBJECT ? OBJECT_ROWS : LOCATION_ROWS;
+	if (h->rows > max)
+		return 0;
+
+	for (i = 0; i < sh->num_groups; i++) {
+		if (sh->groups[i].format != h->format)
+			continue;
+		scan(&sh->groups[i], w, h->rows, tuple_columns(h->format));
+		sh->groups[i].tuples += h->rows;
+		hit = 1;
+	}
+
+	if (!hit)
+		return 0;
+	sh->tuples += h->rows;
+	return h->rows;
+}
+
+void share_results(struct share *sh)
+{
+	int i, p;
+
+	for (i = 0; i < sh->num_queries; i++) {
+		struct share_query *sq = &sh->queries[i];
+		struct share_group *g = &sh->groups[sq->group];
+
+		memset(&sq->result, 0, sizeof(sq->result));
+		sq->result.tuples = g->tuples;
+		for (p = 0; p <= sq->rank; p++) {
+			sq->result.matched += g->count[p];
+			if (sq->agg >= 0)
+				sq->result.sum += g->sum[sq->agg][p];
+		}
+	}
+}
+
+void share_make_queries(struct tuple_query *qs, int n, uint64_t seed)
+{
+	struct rng r;
+	int i;
+
+	rng_seed(&r, seed);
+	for (i = 0; i < n; i++) {
+		qs[i] = tuple_queries[i % 2];
+		qs[i].pred_lt = 1 + rng_range(&r, TUPLE_DAYS);
+	}
+}
+
+const char *share_impl(void)
+{
+	if (scan == scan_init)
+		scan_init(NULL, NULL, 0, 1);
+	return impl_name;
+}
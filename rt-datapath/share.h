@@ -0,0 +1,87 @@
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <stdint.h>
+
+#include "tuple.h"
+
+/*
+ * Shared evaluation of many queries attached to one scan.
+ *
+ * Queries whose predicates are on the same column of the same table form
+ * a group. A group keeps its distinct thresholds sorted, so one binary
+ * search per tuple gives the number of thresholds at or below the value,
+ * and with it the set of queries the tuple satisfies: all those with a
+ * larger threshold. The tuple is then counted, and its aggregate values
+ * summed, in a single bucket for that rank; each query's result is a
+ * prefix sum over the buckets, taken when the results are read.
+ *
+ * Per tuple that is log2(thresholds) compares plus one update per distinct
+ * aggregate column, however many queries are attached.
+ */
+#define SHARE_MAX_AGGS 8
+
+struct share_group {
+	int format;
+	int pred_col;
+	int pred_float;
+
+	/* distinct thresholds, sorted, padded with +inf to a power of two */
+	union {
+		int32_t *i;
+		float *f;
+		void *p;
+	} th;
+	int n;			/* real thresholds */
+	int size;		/* padded */
+
+	unsigned long long tuples;
+
+	/* per rank (size + 1 of them) */
+	unsigned long long *count;
+	int num_aggs;
+	int agg_col[SHARE_MAX_AGGS];
+	double *sum[SHARE_MAX_AGGS];
+};
+
+struct share_query {
+	const struct tuple_query *q;
+	int group;
+	int rank;		/* of its threshold in the group */
+	int agg;		/* index into the group's agg_col, -1 for COUNT(*) */
+	struct tuple_agg result;	/* filled in by share_results() */
+};
+
+struct share {
+	int num_queries;
+	struct share_query *queries;
+	int num_groups;
+	struct share_group *groups;
+	unsigned long long tuples;
+};
+
+int share_init(struct share *sh, const struct tuple_query *qs, int n);
+void share_free(struct share *sh);
+
+/* start counting afresh */
+void share_reset(struct share *sh);
+
+/*
+ * Run every attached query over one block. Returns the tuples looked at,
+ * 0 if no query is on the block's table.
+ */
+int share_scan(struct share *sh, const void *buf);
+
+/* fold the buckets into each query's result */
+void share_results(struct share *sh);
+
+/*
+ * n variants of Q1 and Q2 with o_date thresholds drawn over the data's
+ * date range, for attaching many queries to the same scan
+ */
+void share_make_queries(struct tuple_query *qs, int n, uint64_t seed);
+
+/* name of the kernel in use ("avx2" or "scalar") */
+const char *share_impl(void);
+
+#endif
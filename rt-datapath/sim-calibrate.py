@@ -0,0 +1,60 @@
+import sys
+import math
+import subprocess
+from optparse import OptionParser
+
+#
+# Calibrate the simulated disk against a measured performance model.
+#
+# Runs async-workload on the sim io engine for 0-1 seq x 0-N idx streams
+# (as run.sh does on real disks), reduces the output the same way the
+# experiments/*/graph.py scripts do, and prints the simulated iops next to
+# the measured iops_S, iops_I and iops_Is arrays of a pmodel.dat.
+#
+# usage: sim-calibrate.py [-e sim:hdd,...] pmodel.dat
+#
+
+def load_pmodel(filename):
+	with open(filename) as f:
+		return [[float(v) for v in line.split()] for line in f]
+
+#
+# Mean per-stream iops of each scan type for one run
+#
+def run(engine, seq, idx, warmup, runtime):
+	out = subprocess.check_output(["./async-workload", "-s", str(seq),
+		"-x", str(idx), "-b", "sim", "-e", engine, "-w", str(warmup),
+		"-t", str(runtime)]).decode()
+	vals = [float(v) for v in out.split()[2:]]
+	iops = [vals[i] / (vals[i+1] / 1000.0) for i in range(0, len(vals), 2)]
+	seq_iops, idx_iops = iops[:seq], iops[seq:]
+	mean = lambda l: sum(l) / len(l) if l else 0.0
+	return mean(seq_iops), mean(idx_iops)
+
+if __name__ == '__main__':
+	parser = OptionParser(usage="%prog [options] pmodel.dat")
+	# the experiments ran workload.c, i.e. buffered reads with read-ahead
+	parser.add_option("-e", dest="engine", default="sim:hdd,ra=256",
+			help="io engine spec (default sim:hdd,ra=256)")
+	parser.add_option("-w", dest="warmup", type="float", default=10)
+	parser.add_option("-t", dest="runtime", type="float", default=30)
+	opts, args = parser.parse_args()
+	if len(args) != 1:
+		parser.error("need a pmodel.dat")
+
+	iops_S, iops_I, iops_Is = load_pmodel(args[0])
+	errs = []
+
+	print("%3s %10s %10s %10s %10s %10s %10s" % ("idx", "S", "S sim",
+		"I", "I sim", "Is", "Is sim"))
+	for n in range(len(iops_S)):
+		_, sim_I = run(opts.engine, 0, n, opts.warmup, opts.runtime)
+		sim_S, sim_Is = run(opts.engine, 1, n, opts.warmup, opts.runtime)
+		print("%3d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f" % (n,
+			iops_S[n], sim_S, iops_I[n], sim_I, iops_Is[n], sim_Is))
+		for meas, sim in ((iops_S[n], sim_S), (iops_I[n], sim_I),
+				(iops_Is[n], sim_Is)):
+			if meas > 0 and sim > 0:
+				errs.append(math.log(sim / meas) ** 2)
+
+	print("rms log error: %.3f" % (math.sqrt(sum(errs) / len(errs)),))
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+#
+# The background class (-G, slack.h) on the simulated disk: backing off
+# a quantum behind (the default late=), every window meets its
+# reservations, and where there is slack the background must get some of
+# it. Also, w: leaves existing files alone without force.
+#
+#   slack-check.sh
+#
+
+set -e
+
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+TMP=$(mktemp -d)
+trap "rm -rf $TMP" EXIT
+
+check() {
+	OUT=$($DIR/async-workload "$@" -b $TMP/d -e sim -m 4 -w 5 -t 20 \
+		-G w:$TMP/load 2>&1 >/dev/null)
+	rm -f $TMP/load
+	MET=$(echo "$OUT" | sed -n 's/.*reservations met in \([0-9.]*\)%.*/\1/p')
+	MBS=$(echo "$OUT" | sed -n 's/.*: \([0-9.]*\) MB\/s.*/\1/p')
+	if [ "$MET" != "100.0" ] || [ "$MBS" == "0.0" ] || [ -z "$MBS" ]; then
+		echo "$*: FAIL, reservations met in $MET% of windows," \
+			"background $MBS MB/s"
+		echo "$OUT"
+		exit 1
+	fi
+	echo "$*: reservations met, background $MBS MB/s"
+}
+
+check -s 2 -x 0 -r 20
+check -s 1 -x 1 -r 20 -R 10
+check -s 2 -x 2 -r 30 -R 10
+
+echo data > $TMP/load
+if $DIR/async-workload -s 1 -x 0 -r 20 -b $TMP/d -e sim -t 1 \
+		-G w:$TMP/load >/dev/null 2>&1; then
+	echo "w: wrote over an existing file without force: FAIL"
+	exit 1
+fi
+echo "w: leaves existing files alone"
@@ -0,0 +1,359 @@
+/*
+ * Background I/O class in the reserved streams' slack (slack.h).
+ */
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "slack.h"
+
+#define SLACK_DEPTH 4
+#define SLACK_CHUNK (64 * 1024)
+#define SLACK_QUANTUM (0.01)
+#define SLACK_SIZE (1024LL * 1024 * 1024)
+
+/* the window slack is measured over, in quanta and controller periods */
+#define SLACK_SPAN 10
+#define SLACK_PERIODS 2
+
+/*
+ * Quanta on schedule before the depth grows by one, and the most that
+ * back-offs stretch that to
+ */
+#define SLACK_STEP 10
+#define SLACK_HOLD (64 * SLACK_STEP)
+
+/*
+ * A reservation is met in a window when this much of it was served, give
+ * or take a read (as mclock.c)
+ */
+#define SLACK_MET (0.95)
+
+/* O_DIRECT wants aligned buffers and sizes */
+#define SLACK_ALIGN 4096
+
+int slack_parse(struct slack *b, char *spec)
+{
+	char *tok, *save, *file = NULL;
+	long long kb = SLACK_CHUNK / 1024;
+	double ms = SLACK_QUANTUM * 1000, late_ms = -1;
+
+	memset(b, 0, sizeof(*b));
+	b->max_depth = SLACK_DEPTH;
+	b->size = 0;
+
+	for (tok = strtok_r(spec, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (!file) {
+			if ((tok[0] != 'r' && tok[0] != 'w') || tok[1] != ':' || !tok[2])
+				goto bad;
+			b->write = tok[0] == 'w';
+			file = tok + 2;
+		} else if (!strncmp(tok, "depth=", 6))
+			b->max_depth = atoi(tok + 6);
+		else if (!strncmp(tok, "kb=", 3))
+			kb = atoll(tok + 3);
+		else if (!strncmp(tok, "q=", 2))
+			ms = atof(tok + 2);
+		else if (!strncmp(tok, "late=", 5))
+			late_ms = atof(tok + 5);
+		else if (!strncmp(tok, "size=", 5))
+			b->size = atoll(tok + 5) * 1024 * 1024;
+		else if (!strcmp(tok, "force"))
+			b->force = 1;
+		else
+			goto bad;
+	}
+
+	b->chunk = kb * 1024;
+	b->quantum = ms / 1000;
+	b->late = late_ms < 0 ? b->quantum : late_ms / 1000;
+	if (!file || strlen(file) >= sizeof(b->filename) || b->max_depth < 1 ||
+			b->max_depth > MAX_DEPTH || !b->chunk ||
+			b->chunk % SLACK_ALIGN || b->quantum <= 0 || b->late <= 0 ||
+			b->size < 0)
+		goto bad;
+	strcpy(b->filename, file);
+	return 0;
+
+bad:
+	fprintf(stderr, "bad background spec\n");
+	return -1;
+}
+
+/*
+ * Note every stream's completed reads at now, dropping the oldest note
+ * once there are span + 1; restart forgets all but this one
+ */
+static void record(struct engine *e, struct slack *b, double now, int restart)
+{
+	unsigned long long *done;
+	int i;
+
+	if (restart)
+		b->done_len = 0;
+	b->done_head = (b->done_head + 1) % (b->span + 1);
+	if (b->done_len < b->span + 1)
+		b->done_len++;
+
+	done = b->done + b->done_head * e->num_streams;
+	for (i = 0; i < e->num_streams; i++)
+		done[i] = e->streams[i].completed;
+	b->done_at[b->done_head] = now;
+}
+
+int slack_init(struct engine *e, struct slack *b)
+{
+	struct io_req *req;
+	struct stat st;
+	long long size;
+	int i, n;
+
+	/* a bulk load only fills files of its own unless told otherwise */
+	if (b->write && !b->force && stat(b->filename, &st) == 0 &&
+			(st.st_size > 0 || S_ISBLK(st.st_mode))) {
+		fprintf(stderr, "%s: exists, add force to write over it\n",
+				b->filename);
+		return -1;
+	}
+
+	b->fd = ioengine_open(e->io, b->filename,
+			b->write ? O_WRONLY | O_CREAT : O_RDONLY, &size);
+	if (b->fd < 0)
+		return -1;
+
+	/* a new file is loaded up to size= */
+	if (size < (long long)b->chunk)
+		size = b->write ? (b->size ? b->size : SLACK_SIZE) : 0;
+	b->size = size / b->chunk * b->chunk;
+	if (b->size < (long long)b->chunk) {
+		fprintf(stderr, "%s: file too small\n", b->filename);
+		return -1;
+	}
+
+	b->span = SLACK_PERIODS * e->ctrl.period / b->quantum + 0.5;
+	if (b->span < SLACK_SPAN)
+		b->span = SLACK_SPAN;
+	n = e->num_streams ? e->num_streams : 1;
+	b->done = calloc((b->span + 1) * n, sizeof(*b->done));
+	b->done_at = calloc(b->span + 1, sizeof(*b->done_at));
+	b->win_completed = calloc(n, sizeof(*b->win_completed));
+	if (!b->done || !b->done_at || !b->win_completed ||
+			pool_init(&b->reqs, b->max_depth)) {
+		perror("malloc");
+		return -1;
+	}
+	for (i = 0; i < b->max_depth; i++) {
+		req = malloc(sizeof(*req));
+		if (!req || posix_memalign(&req->buf, SLACK_ALIGN, b->chunk)) {
+			perror("malloc");
+			return -1;
+		}
+		memset(req->buf, 0xb6, b->chunk);
+		pool_put(&b->reqs, req);
+	}
+
+	b->idle_since = 0;
+	b->hold = SLACK_STEP;
+	b->last = engine_now(e);
+	record(e, b, b->last, 1);
+	return 0;
+}
+
+void slack_tick(struct engine *e, struct slack *b, double now)
+{
+	double dt = now - b->last, behind, worst = -b->late;
+	unsigned long long *then;
+	int i, oldest;
+
+	if (dt < b->quantum)
+		return;
+	b->last = now;
+
+	record(e, b, now, 0);
+	oldest = (b->done_head + b->span + 2 - b->done_len) % (b->span + 1);
+	then = b->done + oldest * e->num_streams;
+	dt = now - b->done_at[oldest];
+
+	/*
+	 * How far short of its reservation each reserved stream fell over the
+	 * window, in seconds of its reservation, not counting the one block a
+	 * stream served at exactly its rate may be short between its reads
+	 */
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (s->reservation <= 0)
+			continue;
+		behind = (s->reservation * dt - (s->completed - then[i]) - 1) /
+			s->reservation;
+		if (behind > worst)
+			worst = behind;
+	}
+
+	/*
+	 * A deeper background queue shows only once its requests have been
+	 * through the device, so grow one request every SLACK_STEP quanta.
+	 * Every back-off doubles the quanta to wait before trying again, and
+	 * every step that holds halves it, so a disk with no slack to give is
+	 * probed ever more rarely.
+	 */
+	if (worst >= b->late) {
+		if (b->depth) {
+			b->backoffs += e->observing;
+			if (b->hold < SLACK_HOLD)
+				b->hold *= 2;
+		}
+		b->depth = 0;
+		b->calm = 0;
+	} else if (worst > b->late / 2)
+		b->calm = 0;
+	else if (++b->calm >= b->hold && b->depth < b->max_depth) {
+		if (b->depth && b->hold > SLACK_STEP)
+			b->hold /= 2;
+		b->depth++;
+		b->calm = 0;
+	}
+
+	if (!e->observing)
+		return;
+	b->quanta++;
+	b->quanta_behind += worst >= b->late;
+	b->quanta_active += b->inflight > 0 || b->depth > 0;
+	b->depth_sum += b->depth;
+
+	dt = now - b->win_start;
+	if (dt < b->span * b->quantum)
+		return;
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (s->reservation <= 0)
+			continue;
+		b->windows++;
+		if (s->completed - b->win_completed[i] + 1 >=
+				SLACK_MET * s->reservation * dt)
+			b->windows_met++;
+		b->win_completed[i] = s->completed;
+	}
+	b->win_start = now;
+}
+
+int slack_dispatch(struct slack *b, struct io_req **ioq, int max)
+{
+	struct io_req *req;
+	int n = 0;
+
+	while (b->inflight < b->depth && n < max) {
+		req = pool_get(&b->reqs);
+		if (!req)
+			break;
+		req->data = b;
+		io_req_prep(req, b->write ? IO_WRITE : IO_READ, b->fd, req->buf,
+				b->chunk, b->next);
+		b->next = (b->next + b->chunk) % b->size;
+		ioq[n++] = req;
+		b->inflight++;
+	}
+
+	if (b->inflight)
+		b->idle_since = -1;
+	return n;
+}
+
+void slack_done(struct engine *e, struct slack *b, struct io_req *req)
+{
+	double now = engine_now(e);
+
+	if (req->res != (long)b->chunk) {
+		fprintf(stderr, "%s: background %s at %lld: %s\n", b->filename,
+				b->write ? "write" : "read", req->offset,
+				req->res < 0 ? strerror(-req->res) : "short");
+		exit(1);
+	}
+
+	if (e->observing) {
+		b->bytes += b->chunk;
+		hist_add(&b->lat, (now - req->issued) * 1e6);
+	}
+
+	pool_put(&b->reqs, req);
+	e->inflight--;
+	if (!--b->inflight)
+		b->idle_since = now;
+}
+
+/*
+ * A reserved read that overlapped background requests: some were in
+ * flight at any time between its issue and now
+ */
+void slack_account(struct slack *b, double issued, double now)
+{
+	int with = b->idle_since < 0 || b->idle_since > issued;
+
+	hist_add(&b->resv_lat[with], (now - issued) * 1e6);
+}
+
+void slack_reset(struct engine *e, struct slack *b, double now)
+{
+	int i;
+
+	for (i = 0; i < e->num_streams; i++)
+		b->win_completed[i] = e->streams[i].completed;
+	b->windows = b->windows_met = 0;
+	b->start = b->win_start = now;
+	record(e, b, now, 1);
+	b->bytes = 0;
+	b->quanta = b->quanta_active = b->quanta_behind = b->backoffs = 0;
+	b->depth_sum = 0;
+	hist_init(&b->lat);
+	hist_init(&b->resv_lat[0]);
+	hist_init(&b->resv_lat[1]);
+}
+
+/*
+ * What the background got, and what it cost the reserved streams: the
+ * windows their reservations were met in, the quanta they spent late
+ * behind their guarantee curve (each one a back-off while the
+ * background was running), and their read latency with background
+ * requests in flight and without
+ */
+void slack_report(struct engine *e, struct slack *b)
+{
+	double secs = b->finish - b->start;
+	int i;
+
+	if (secs <= 0)
+		return;
+
+	fprintf(stderr, "slack: background %s %s: %.1f MB/s, %.0f%% of quanta "
+			"active, depth %.1f of %d, latency p50 %llu us p99 %llu us, "
+			"%llu back-offs\n", b->write ? "writes to" : "reads of",
+			b->filename, b->bytes / 1e6 / secs,
+			b->quanta ? 100.0 * b->quanta_active / b->quanta : 0,
+			b->quanta ? b->depth_sum / b->quanta : 0, b->max_depth,
+			(unsigned long long)hist_pct(&b->lat, 0.5),
+			(unsigned long long)hist_pct(&b->lat, 0.99), b->backoffs);
+
+	for (i = 0; i < e->num_streams; i++) {
+		struct stream *s = &e->streams[i];
+
+		if (s->reservation > 0 && e->verbose)
+			fprintf(stderr, "slack: stream %d %.0f/%.0f blocks/s\n", s->id,
+					s->blocks_read / (s->finish - s->start),
+					s->reservation);
+	}
+
+	fprintf(stderr, "slack: reservations met in %.1f%% of %.0f ms windows, "
+			"late (%.0f ms behind) in %llu/%llu quanta, read latency "
+			"p50/p99 %llu/%llu us with background in flight, %llu/%llu us "
+			"without\n", b->windows ? 100.0 * b->windows_met / b->windows : 100,
+			b->span * b->quantum * 1000, b->late * 1000, b->quanta_behind, b->quanta,
+			(unsigned long long)hist_pct(&b->resv_lat[1], 0.5),
+			(unsigned long long)hist_pct(&b->resv_lat[1], 0.99),
+			(unsigned long long)hist_pct(&b->resv_lat[0], 0.5),
+			(unsigned long long)hist_pct(&b->resv_lat[0], 0.99));
+}
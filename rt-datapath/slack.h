@@ -0,0 +1,101 @@
+#ifndef SLACK_H
+#define SLACK_H
+
+#include "hist.h"
+#include "ioengine.h"
+#include "pool.h"
+
+struct engine;
+
+/*
+ * Background I/O class: a bulk load (writes) or bulk scan (reads) of one
+ * file that only gets the disk time the reserved streams leave unused.
+ *
+ * Slack is measured every quantum over a window of each reserved stream's
+ * recent past, a couple of controller periods (ctrl.h) long so the
+ * controller's own swings around the reservation even out: a stream that
+ * completed fewer reads in it than its reservation asks for is owed disk
+ * time, and the slack is how far ahead the worst stream is, in seconds of
+ * its reservation, give or take the block a stream is due between its
+ * reads. Counting completions over a window forgets deficits older than
+ * it (warmup's among them), and a stream paced at its reservation
+ * completes its reservation's worth in any window however long its reads
+ * take.
+ *
+ * The background queue depth grows by one request every few quanta while
+ * every reserved stream is on schedule, and drops to zero the quantum one
+ * falls late behind (a quantum, unless late= says otherwise), so it stops
+ * issuing within a quantum of a guaranteed stream needing the disk; each
+ * back-off makes it wait longer before trying again. Requests it already
+ * has at the device finish; keep the depth and chunk small enough for
+ * those to drain in a quantum. With no reserved streams all of the disk
+ * is slack.
+ *
+ * A bulk load writes over files of its own only: an existing one needs
+ * force.
+ */
+struct slack {
+	char filename[256];
+	int write;		/* bulk load, else bulk scan */
+	int force;		/* may overwrite an existing file */
+	int fd;
+	long long size;		/* bytes, wrapped round */
+	long long next;		/* offset of the next chunk */
+	size_t chunk;		/* bytes a request */
+
+	int max_depth;
+	int depth;		/* allowed in flight now */
+	int calm;		/* quanta on schedule since the last change */
+	int hold;		/* calm quanta before the depth grows */
+	int inflight;
+	struct pool reqs;
+
+	double quantum;		/* seconds */
+	double late;		/* shortfall that backs off, seconds */
+	double last;		/* time of the last quantum */
+
+	/* completed reads of each stream at the last span + 1 quanta */
+	int span;
+	unsigned long long *done;
+	double *done_at;
+	int done_head, done_len;
+
+	unsigned long long *win_completed;	/* at the start of the window */
+	double win_start;
+	double idle_since;	/* no background reads in flight since, -1 busy */
+
+	/* during observation */
+	double start, finish;
+	unsigned long long bytes;
+	unsigned long long quanta, quanta_active, quanta_behind, backoffs;
+	unsigned long long windows, windows_met;	/* reservations, all streams */
+	double depth_sum;
+	struct hist lat;		/* background request latency, usecs */
+	struct hist resv_lat[2];	/* reserved reads without, with background */
+};
+
+/*
+ * "r:<file>" or "w:<file>", then ",depth=<n>,kb=<chunk KB>,q=<quantum ms>,
+ * late=<ms behind to back off at, default a quantum>,size=<MB written, new
+ * files>,force" (force lets w: overwrite a file)
+ */
+int slack_parse(struct slack *b, char *spec);
+
+/* open the file and set up the requests; e->io must exist */
+int slack_init(struct engine *e, struct slack *b);
+
+/* measure the slack and resize the depth, once a quantum */
+void slack_tick(struct engine *e, struct slack *b, double now);
+
+/* queue up to max background requests into the slack */
+int slack_dispatch(struct slack *b, struct io_req **ioq, int max);
+
+void slack_done(struct engine *e, struct slack *b, struct io_req *req);
+
+/* a reserved stream's read issued at 'issued' completed at 'now' */
+void slack_account(struct slack *b, double issued, double now);
+
+void slack_reset(struct engine *e, struct slack *b, double now);
+void slack_report(struct engine *e, struct slack *b);
+
+#endif
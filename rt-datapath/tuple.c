@@ -0,0 +1,266 @@
+/*
+ * Object/Location rows: generation and predicate/aggregate scan kernels.
+ *
+ * The kernels work on 8 rows at a time with AVX2 gathers (rows are 16 or
+ * 20 bytes, so one gather per column), or plain loads over the blocks of
+ * columnar files (column.h). Matches become lane masks that feed
+ * both the count and a masked sum, so the loop has no branches. Other CPUs
+ * get the scalar loop.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "tuple.h"
+
+#define WORDS(row) ((int)(sizeof(row) / sizeof(uint32_t)))
+#define COL(row, field) ((int)(offsetof(row, field) / sizeof(uint32_t)))
+
+const struct tuple_query tuple_queries[] = {
+	/* SELECT AVG(o_temperature) FROM Object WHERE o_date < '1-1-10' */
+	{ "Q1", TUPLE_OBJECT, COL(struct object_row, o_date), 0,
+		TUPLE_DATE_2010, COL(struct object_row, o_temperature) },
+	/* SELECT AVG(o_humidity) FROM Object WHERE o_date < '1-1-10' */
+	{ "Q2", TUPLE_OBJECT, COL(struct object_row, o_date), 0,
+		TUPLE_DATE_2010, COL(struct object_row, o_humidity) },
+	/* Q3 build side: SELECT COUNT(*) FROM Location WHERE l_elevation < 10 */
+	{ "Q3L", TUPLE_LOCATION, COL(struct location_row, l_elevation), 1,
+		10, -1 },
+	{ NULL },
+};
+
+static const char *format_names[] = { "random", "object", "location", NULL };
+
+int tuple_format(const char *name)
+{
+	int i;
+
+	for (i = 0; format_names[i]; i++)
+		if (!strcmp(format_names[i], name))
+			return i;
+	return -1;
+}
+
+const char *tuple_format_name(int format)
+{
+	return format_names[format];
+}
+
+int tuple_file_format(const char *filename)
+{
+	struct block_hdr h;
+	int fd, ret = -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (pread(fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == BLOCK_MAGIC)
+		ret = h.format;
+	close(fd);
+
+	return ret;
+}
+
+const struct tuple_query *tuple_query_find(const char *name)
+{
+	int i;
+
+	for (i = 0; tuple_queries[i].name; i++)
+		if (!strcmp(tuple_queries[i].name, name))
+			return &tuple_queries[i];
+	return NULL;
+}
+
+void tuple_fill(void *buf, int format, uint32_t file_id, uint64_t block,
+		uint64_t seed)
+{
+	void *payload = (struct block_hdr *)buf + 1;
+	struct rng r;
+	int i;
+
+	if (format == BLOCK_RANDOM) {
+		block_fill(buf, file_id, block, seed);
+		return;
+	}
+
+	memset(payload, 0, BLOCK_PAYLOAD);
+
+	if (format == TUPLE_OBJECT) {
+		struct object_row *o = payload;
+
+		block_stamp(buf, file_id, block, seed, format, OBJECT_ROWS, &r);
+		for (i = 0; i < OBJECT_ROWS; i++) {
+			o[i].o_oid = block * OBJECT_ROWS + i;
+			o[i].o_lid = rng_range(&r, TUPLE_LOCATIONS);
+			o[i].o_date = rng_range(&r, TUPLE_DAYS);
+			o[i].o_temperature = -20 + 60 * rng_double(&r);
+			o[i].o_humidity = 100 * rng_double(&r);
+		}
+	} else {
+		struct location_row *l = payload;
+
+		block_stamp(buf, file_id, block, seed, format, LOCATION_ROWS, &r);
+		for (i = 0; i < LOCATION_ROWS; i++) {
+			l[i].l_lid = block * LOCATION_ROWS + i;
+			l[i].l_elevation = -100 + 3100 * rng_double(&r);
+			l[i].l_lat = -90 + 180 * rng_double(&r);
+			l[i].l_lon = -180 + 360 * rng_double(&r);
+		}
+	}
+
+	block_seal(buf);
+}
+
+int tuple_columns(int format)
+{
+	return format == TUPLE_OBJECT ? WORDS(struct object_row) :
+		WORDS(struct location_row);
+}
+
+/*
+ * The kernels see the predicate and aggregate values as two arrays of
+ * 32-bit words, stride words apart: the columns of packed rows, or two
+ * column blocks (stride 1). agg is NULL for COUNT(*).
+ */
+static void scan_scalar(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out)
+{
+	int32_t ilt = (int32_t)q->pred_lt;
+	float flt = q->pred_lt, v;
+	unsigned long long matched = 0;
+	double sum = 0;
+	int i, hit;
+
+	for (i = 0; i < rows; i++) {
+		if (q->pred_float) {
+			memcpy(&v, pred + i * stride, sizeof(v));
+			hit = v < flt;
+		} else
+			hit = (int32_t)pred[i * stride] < ilt;
+
+		matched += hit;
+		if (hit && agg) {
+			memcpy(&v, agg + i * stride, sizeof(v));
+			sum += v;
+		}
+	}
+
+	out->matched += matched;
+	out->sum += sum;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline __m256i load8(const uint32_t *p, __m256i idx, int stride)
+{
+	if (stride == 1)
+		return _mm256_loadu_si256((const __m256i *)p);
+	return _mm256_i32gather_epi32((const int *)p, idx, 4);
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out)
+{
+	const __m256i idx = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32(stride));
+	const __m256i ilt = _mm256_set1_epi32((int32_t)q->pred_lt);
+	const __m256 flt = _mm256_set1_ps(q->pred_lt);
+	__m256i count = _mm256_setzero_si256(), mask, v;
+	__m256 sum = _mm256_setzero_ps();
+	float lanes[8];
+	int32_t counts[8];
+	int i;
+
+	for (i = 0; i + 8 <= rows; i += 8) {
+		v = load8(pred + i * stride, idx, stride);
+		if (q->pred_float)
+			mask = _mm256_castps_si256(_mm256_cmp_ps(
+					_mm256_castsi256_ps(v), flt, _CMP_LT_OQ));
+		else
+			mask = _mm256_cmpgt_epi32(ilt, v);
+
+		/* true lanes are -1 */
+		count = _mm256_sub_epi32(count, mask);
+
+		if (agg) {
+			v = load8(agg + i * stride, idx, stride);
+			sum = _mm256_add_ps(sum, _mm256_and_ps(
+						_mm256_castsi256_ps(v),
+						_mm256_castsi256_ps(mask)));
+		}
+	}
+
+	_mm256_storeu_ps(lanes, sum);
+	_mm256_storeu_si256((__m256i *)counts, count);
+	for (i = 0; i < 8; i++) {
+		out->sum += lanes[i];
+		out->matched += counts[i];
+	}
+
+	/* the rows that did not fill a vector */
+	i = rows & ~7;
+	scan_scalar(q, pred + i * stride, agg ? agg + i * stride : NULL,
+			rows & 7, stride, out);
+}
+#endif
+
+static void scan_init(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out);
+
+static void (*scan)(const struct tuple_query *, const uint32_t *,
+		const uint32_t *, int, int, struct tuple_agg *) = scan_init;
+static const char *impl_name = "scalar";
+
+/* pick a kernel on first use */
+static void scan_init(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out)
+{
+	scan = scan_scalar;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan = scan_avx2;
+		impl_name = "avx2";
+	}
+#endif
+	scan(q, pred, agg, rows, stride, out);
+}
+
+void tuple_scan_words(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out)
+{
+	scan(q, pred, agg, rows, stride, out);
+	out->tuples += rows;
+}
+
+int tuple_scan(const struct tuple_query *q, const void *buf,
+		struct tuple_agg *agg)
+{
+	const struct block_hdr *h = buf;
+	const uint32_t *w = (const uint32_t *)(h + 1);
+	int max = q->format == TUPLE_OBJECT ? OBJECT_ROWS : LOCATION_ROWS;
+
+	if (h->format != q->format || h->rows > max)
+		return 0;
+
+	tuple_scan_words(q, w + q->pred_col,
+			q->agg_col >= 0 ? w + q->agg_col : NULL, h->rows,
+			tuple_columns(q->format), agg);
+	return h->rows;
+}
+
+const char *tuple_impl(void)
+{
+	struct tuple_agg agg = { 0, 0, 0 };
+
+	if (scan == scan_init)
+		scan_init(&tuple_queries[0], NULL, NULL, 0, 1, &agg);
+	return impl_name;
+}
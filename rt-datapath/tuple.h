@@ -0,0 +1,102 @@
+#ifndef TUPLE_H
+#define TUPLE_H
+
+#include <stdint.h>
+
+#include "block.h"
+
+/*
+ * Fixed-width rows of the paper's example relations, packed into the
+ * payload of stamped blocks (block.h, format field):
+ *
+ *   Object(o_oid, o_lid, o_date, o_temperature, o_humidity)
+ *   Location(l_lid, l_elevation, l_lat, l_lon)
+ *
+ * Dates are days since 2000-01-01 and are spread over 2000-2019.
+ */
+#define TUPLE_OBJECT 1
+#define TUPLE_LOCATION 2
+
+struct object_row {
+	uint32_t o_oid;
+	uint32_t o_lid;
+	int32_t o_date;
+	float o_temperature;
+	float o_humidity;
+};
+
+struct location_row {
+	uint32_t l_lid;
+	float l_elevation;
+	float l_lat;
+	float l_lon;
+};
+
+#define OBJECT_ROWS ((int)(BLOCK_PAYLOAD / sizeof(struct object_row)))
+#define LOCATION_ROWS ((int)(BLOCK_PAYLOAD / sizeof(struct location_row)))
+
+/* o_lid values are drawn from [0, TUPLE_LOCATIONS) */
+#define TUPLE_LOCATIONS (1 << 20)
+
+/* o_date spans 2000-2019 */
+#define TUPLE_DAYS (7305)
+
+/* day number of '1-1-10' */
+#define TUPLE_DATE_2010 (3653)
+
+int tuple_format(const char *name);
+const char *tuple_format_name(int format);
+
+/* format of the first block of a generated file, -1 if it is not one */
+int tuple_file_format(const char *filename);
+
+/* 32-bit columns of a table's rows */
+int tuple_columns(int format);
+
+/* fill a block of rows of the given table, as gen-data does */
+void tuple_fill(void *buf, int format, uint32_t file_id, uint64_t block,
+		uint64_t seed);
+
+/*
+ * SELECT AVG(agg) | COUNT(*) FROM table WHERE pred < value
+ *
+ * Columns are given as 32-bit word offsets into the row.
+ */
+struct tuple_query {
+	const char *name;
+	int format;		/* table scanned */
+	int pred_col;
+	int pred_float;		/* predicate column is a float, else int32 */
+	double pred_lt;
+	int agg_col;		/* -1 for COUNT(*) */
+};
+
+struct tuple_agg {
+	unsigned long long tuples;
+	unsigned long long matched;
+	double sum;
+};
+
+/* Q1, Q2 and the Location side of Q3; NULL terminated */
+extern const struct tuple_query tuple_queries[];
+
+const struct tuple_query *tuple_query_find(const char *name);
+
+/*
+ * Run a query over one block. Blocks of other tables are skipped and 0
+ * returned, otherwise the number of tuples looked at.
+ */
+int tuple_scan(const struct tuple_query *q, const void *buf,
+		struct tuple_agg *agg);
+
+/*
+ * The kernel under tuple_scan(): rows predicate and aggregate values
+ * (agg NULL for COUNT(*)), each stride words apart.
+ */
+void tuple_scan_words(const struct tuple_query *q, const uint32_t *pred,
+		const uint32_t *agg, int rows, int stride, struct tuple_agg *out);
+
+/* name of the scan kernel in use ("avx2" or "scalar") */
+const char *tuple_impl(void);
+
+#endif
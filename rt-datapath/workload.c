@@ -1,6 +1,30 @@
+/*
+ * Threaded workload driver: one thread per seq/idx stream doing plain
+ * blocking reads.
+ *
+ * With -p every stream runs under a kernel I/O priority (ioprio_set(2)),
+ * to see how far the block layer's own classes get us next to the
+ * reservations of async-workload; -D reads with O_DIRECT, as
+ * async-workload does, so the two compare like for like. With -L the
+ * read latency of every stream is logged alongside, in the layout of the
+ * bandwidth output. -P adds the CPU cost of the reads (perfctr.h) per
+ * read and per KB to the seq and idx summaries on stderr.
+ *
+ * With -M the streams read through mmap() instead, copying each block out
+ * of the mapping as read() would: seq streams under MADV_SEQUENTIAL, idx
+ * streams under MADV_RANDOM, optionally MADV_WILLNEED on the whole file
+ * (-W) and MAP_POPULATE for the index files (-H), which are the hot
+ * region the probes go to. The iops, latency and page faults of the seq
+ * and idx streams go to stderr either way, so the two compare under the
+ * same mix.
+ */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -9,6 +33,16 @@
 #include <assert.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+
+#include "block.h"
+#include "hist.h"
+#include "perfctr.h"
+
+/* not in every libc: see linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_WHO_PROCESS (1)
+#define IOPRIO_VALUE(class, level) (((class) << IOPRIO_CLASS_SHIFT) | (level))
 
 #define READ_SIZE (4096)
 
@@ -21,10 +55,30 @@ static pthread_t threads[MAX_THREADS];
 static volatile int start_obs = 0;
 static volatile int stop = 0;
 
+/* check every block against its gen-data stamp */
+static int verify = 0;
+static uint64_t seed;
+
+/* count the CPU cost of the reads */
+static int perf = 0;
+
+/* bypass the page cache */
+static int direct = 0;
+
+/* read through mmap(), and its hints */
+static int use_mmap = 0;
+static int willneed = 0;
+static int populate = 0;
+
 struct thread_info {
 	char filename[MAX_NAME];
+	uint32_t file_id;
 	unsigned int blocks_read;
 	int random_workload;
+	int ioprio;		/* -1 leaves the inherited one */
+	struct hist lat;	/* read latency, nsecs: mmap hits take under a us */
+	struct perfctr ctr;	/* seek and read, with -P */
+	long minflt, majflt;	/* page faults during observation */
 	struct timeval start;
 	struct timeval finish;
 };
@@ -34,20 +88,117 @@ static struct thread_info tinfo[MAX_THREADS];
 #define USEC_PER_SEC (1000000)
 #define USEC_PER_MSEC (1000)
 
+static const char *ioprio_classes[] = { "none", "rt", "be", "idle" };
+
+/*
+ * "<class>[:<level>]" -> ioprio value, -1 if bad. Levels are 0 (highest)
+ * to 7 and default to 4; idle has none.
+ */
+static int parse_ioprio(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	int class, level = 4;
+
+	for (class = 1; class < 4; class++)
+		if (strlen(ioprio_classes[class]) == len &&
+				!strncmp(spec, ioprio_classes[class], len))
+			break;
+	if (class == 4)
+		return -1;
+
+	if (colon) {
+		level = atoi(colon + 1);
+		if (level < 0 || level > 7)
+			return -1;
+	}
+	if (class == 3)
+		level = 0;
+
+	return IOPRIO_VALUE(class, level);
+}
+
+static double now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
 /*
- * do a random seek
+ * pick a random block
  */
-static void do_random_seek(int fd, int num_blocks)
+static off_t random_block(int num_blocks)
 {
 	off_t block;
-	off_t offset;
 
 	block = 1 + (int)((float)num_blocks * (rand() / (RAND_MAX + 1.0)));
 	if (block >= num_blocks)
 		block = num_blocks - 1;
 
-	offset = block * READ_SIZE;
+	return block;
+}
+
+/*
+ * do a random seek, returns the block
+ */
+static off_t do_random_seek(int fd, int num_blocks)
+{
+	off_t block = random_block(num_blocks);
+	off_t offset = block * READ_SIZE;
+
 	assert(lseek(fd, offset, SEEK_SET) == offset);
+
+	return block;
+}
+
+/*
+ * Map a stream's file with the hints for its access pattern
+ */
+static char *map_file(struct thread_info *info, int fd, size_t len)
+{
+	int flags = MAP_SHARED;
+	char *map;
+
+	if (populate && info->random_workload)
+		flags |= MAP_POPULATE;
+
+	map = mmap(NULL, len, PROT_READ, flags, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(info->filename);
+		exit(1);
+	}
+
+	if (madvise(map, len, info->random_workload ?
+				MADV_RANDOM : MADV_SEQUENTIAL) ||
+			(willneed && madvise(map, len, MADV_WILLNEED))) {
+		perror("madvise");
+		exit(1);
+	}
+
+	return map;
+}
+
+/* faults this thread has taken */
+static void thread_faults(long *minflt, long *majflt)
+{
+	struct rusage ru;
+
+	assert(getrusage(RUSAGE_THREAD, &ru) == 0);
+	*minflt = ru.ru_minflt;
+	*majflt = ru.ru_majflt;
+}
+
+static void verify_block(struct thread_info *info, char *buf, off_t block)
+{
+	int err = block_check(buf, info->file_id, block, seed);
+
+	if (err) {
+		fprintf(stderr, "%s: block %lld: %s\n", info->filename,
+				(long long)block, block_strerror(err));
+		exit(1);
+	}
 }
 
 /*
@@ -56,12 +207,26 @@ static void do_random_seek(int fd, int num_blocks)
 static void *workload(void *arg)
 {
 	struct thread_info *info = arg;
-	char buf[READ_SIZE];
+	char *buf;
 	int fd, local_started_obs = 0;
 	struct stat st;
 	int num_blocks;
+	off_t block = 0;
+	char *map = NULL;
+	long minflt, majflt;
+	double t;
+
+	/* who 0 is the calling thread */
+	if (info->ioprio >= 0 &&
+			syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, info->ioprio)) {
+		perror("ioprio_set");
+		exit(1);
+	}
+
+	/* O_DIRECT wants an aligned buffer */
+	assert(posix_memalign((void **)&buf, READ_SIZE, READ_SIZE) == 0);
 
-	fd = open(info->filename, O_RDONLY);
+	fd = open(info->filename, O_RDONLY | (direct ? O_DIRECT : 0));
 	if (fd < 0) {
 		perror(info->filename);
 		pthread_exit(NULL);
@@ -74,6 +239,13 @@ static void *workload(void *arg)
 
 	num_blocks = st.st_size / READ_SIZE;
 
+	if (use_mmap)
+		map = map_file(info, fd, (size_t)num_blocks * READ_SIZE);
+
+	/* the counters are per thread, so each opens its own */
+	if (perf && perfctr_open(&info->ctr))
+		exit(1);
+
 	info->blocks_read = 0;
 
 	while (!stop) {
@@ -81,18 +253,54 @@ static void *workload(void *arg)
 			local_started_obs = 1;
 			assert(gettimeofday(&info->start, NULL) == 0);
 			info->blocks_read = 0;
+			hist_init(&info->lat);
+			thread_faults(&info->minflt, &info->majflt);
 		}
 
-		if (info->random_workload)
-			do_random_seek(fd, num_blocks);
+		if (perf && local_started_obs)
+			perfctr_start(&info->ctr);
 
-		assert(read(fd, buf, READ_SIZE) == READ_SIZE);
+		if (map) {
+			/* seq streams go round again at the end */
+			if (info->random_workload)
+				block = random_block(num_blocks);
+			else if (block == num_blocks)
+				block = 0;
+
+			t = now_nsec();
+			memcpy(buf, map + block * READ_SIZE, READ_SIZE);
+		} else {
+			if (info->random_workload)
+				block = do_random_seek(fd, num_blocks);
+
+			t = now_nsec();
+			assert(read(fd, buf, READ_SIZE) == READ_SIZE);
+		}
+		if (local_started_obs)
+			hist_add(&info->lat, now_nsec() - t);
+
+		if (perf && local_started_obs)
+			perfctr_stop(&info->ctr);
+		if (verify)
+			verify_block(info, buf, block);
+		block++;
 		info->blocks_read++;
 	}
 
 	assert(gettimeofday(&info->finish, NULL) == 0);
+	thread_faults(&minflt, &majflt);
+	info->minflt = minflt - info->minflt;
+	info->majflt = majflt - info->majflt;
 
+	if (perf) {
+		perfctr_read(&info->ctr);
+		perfctr_close(&info->ctr);
+	}
+
+	if (map)
+		munmap(map, (size_t)num_blocks * READ_SIZE);
 	close(fd);
+	free(buf);
 	pthread_exit(NULL);
 }
 
@@ -118,9 +326,63 @@ static unsigned long long timeval_diff(struct timeval *a, struct timeval *b)
 	return timeval_to_ms(a) - timeval_to_ms(b);
 }
 
+/*
+ * Streams [from, to), on stderr: iops, latency and page faults, and the
+ * CPU cost of their reads with -P
+ */
+static void report_streams(const char *what, int from, int to)
+{
+	struct perfctr sum;
+	struct hist lat;
+	unsigned long long reads = 0, ms;
+	double iops = 0, minflt = 0, majflt = 0, faults = 0;
+	int i;
+
+	if (from == to)
+		return;
+
+	memset(&sum, 0, sizeof(sum));
+	hist_init(&lat);
+	for (i = from; i < to; i++) {
+		ms = timeval_diff(&tinfo[i].finish, &tinfo[i].start);
+		reads += tinfo[i].blocks_read;
+		iops += ms ? tinfo[i].blocks_read * 1000.0 / ms : 0;
+		hist_merge(&lat, &tinfo[i].lat);
+		minflt += tinfo[i].minflt;
+		majflt += tinfo[i].majflt;
+		/* a rate per stream, as for iops */
+		faults += ms ? (tinfo[i].minflt + tinfo[i].majflt) * 1000.0 / ms : 0;
+		perfctr_add(&sum, &tinfo[i].ctr);
+	}
+
+	fprintf(stderr, "%s %s: %d streams, %llu reads, %.0f iops, latency "
+			"p50 %.1f us p99 %.1f us, %.3f minor %.3f major faults/read "
+			"(%.0f/s)\n", what, use_mmap ? "mmap" : "read", to - from,
+			reads, iops, hist_pct(&lat, 0.5) / 1e3,
+			hist_pct(&lat, 0.99) / 1e3,
+			reads ? minflt / reads : 0, reads ? majflt / reads : 0,
+			faults);
+	if (perf)
+		perfctr_report(stderr, what, &sum, reads,
+				reads * (unsigned long long)READ_SIZE);
+}
+
 static void usage(void)
 {
-	fprintf(stderr, "usage: -s <num seq scans> -x <num idx scans> -b <filename base>\n");
+	fprintf(stderr, "usage: -s <num seq scans> -x <num idx scans> -b <filename base>\n"
+			"       [-V <data seed>]  check blocks against their gen-data stamps\n"
+			"       [-p <class>[:<level>][,...]]  I/O priority of the streams,\n"
+			"                         handed out in turn, the last to the rest;\n"
+			"                         classes rt, be (levels 0-7) and idle\n"
+			"       [-L <latency log>]  append p50 and p99 read latency (us)\n"
+			"                         of every stream, laid out as the output\n"
+			"       [-D]              read with O_DIRECT\n"
+			"       [-P]              count cycles, instructions, cache misses\n"
+			"                         and context switches per read (stderr)\n"
+			"       [-M]              read through mmap(): MADV_SEQUENTIAL for seq,\n"
+			"                         MADV_RANDOM for idx streams; report faults\n"
+			"       [-W]              with -M, MADV_WILLNEED the whole files\n"
+			"       [-H]              with -M, MAP_POPULATE the index files\n");
 }
 
 int main(int argc, char **argv)
@@ -129,9 +391,12 @@ int main(int argc, char **argv)
 	int idx_scans = -1;
 	int seq_scans = -1;
 	char *filename_base = NULL;
+	char *ioprios = NULL, *latency_log = NULL, *tok, *save;
+	int prio[MAX_THREADS], num_prios = 0;
+	FILE *out;
 	int i;
 
-	while ((c = getopt(argc, argv, "s:x:b:")) != -1) {
+	while ((c = getopt(argc, argv, "s:x:b:V:p:L:DPMWH")) != -1) {
 		switch  (c) {
 			case 'x':
 				idx_scans = atoi(optarg);
@@ -142,6 +407,31 @@ int main(int argc, char **argv)
 			case 'b':
 				filename_base = strdup(optarg);
 				break;
+			case 'V':
+				verify = 1;
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'p':
+				ioprios = strdup(optarg);
+				break;
+			case 'L':
+				latency_log = strdup(optarg);
+				break;
+			case 'D':
+				direct = 1;
+				break;
+			case 'P':
+				perf = 1;
+				break;
+			case 'M':
+				use_mmap = 1;
+				break;
+			case 'W':
+				willneed = 1;
+				break;
+			case 'H':
+				populate = 1;
+				break;
 			default:
 				usage();
 				exit(1);
@@ -153,15 +443,45 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (direct && use_mmap) {
+		fprintf(stderr, "-D and -M do not mix\n");
+		usage();
+		exit(1);
+	}
+
+	if ((willneed || populate) && !use_mmap) {
+		fprintf(stderr, "-W and -H are hints for -M\n");
+		usage();
+		exit(1);
+	}
+
 	num_threads = seq_scans + idx_scans;
 	if (num_threads > MAX_THREADS) {
 		fprintf(stderr, "Too many threads! MAX_THREADS=%d\n", MAX_THREADS);
 		exit(1);
 	}
 
+	for (tok = ioprios ? strtok_r(ioprios, ",", &save) : NULL; tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (num_prios == MAX_THREADS ||
+				(prio[num_prios++] = parse_ioprio(tok)) < 0) {
+			fprintf(stderr, "bad I/O priority '%s'\n", tok);
+			usage();
+			exit(1);
+		}
+	}
+	for (i = 0; i < num_threads; i++)
+		tinfo[i].ioprio = num_prios ?
+			prio[i < num_prios ? i : num_prios - 1] : -1;
+
+	/* pick the crc32c implementation before the threads race to */
+	if (verify)
+		crc32c_impl();
+
 	/* start the sequential scans */
 	for (i = 0; i < seq_scans; i++) {
 		sprintf(tinfo[i].filename, "%s.seq.%d.dat", filename_base, i);
+		tinfo[i].file_id = block_file_id(0, i);
 		tinfo[i].random_workload = 0;
 		assert(pthread_create(threads+i, NULL, workload, &tinfo[i]) == 0);
 	}
@@ -169,6 +489,7 @@ int main(int argc, char **argv)
 	/* start the rest: index scans */
 	for (; i < num_threads; i++) {
 		sprintf(tinfo[i].filename, "%s.rnd.%d.dat", filename_base, i-seq_scans);
+		tinfo[i].file_id = block_file_id(1, i-seq_scans);
 		tinfo[i].random_workload = 1;
 		assert(pthread_create(threads+i, NULL, workload, &tinfo[i]) == 0);
 	}
@@ -195,5 +516,23 @@ int main(int argc, char **argv)
 	}
 	printf("\n");
 
+	report_streams("seq", 0, seq_scans);
+	report_streams("idx", seq_scans, num_threads);
+
+	if (latency_log) {
+		out = fopen(latency_log, "a");
+		if (!out) {
+			perror(latency_log);
+			exit(1);
+		}
+		fprintf(out, "%d %d", seq_scans, idx_scans);
+		for (i = 0; i < num_threads; i++)
+			fprintf(out, " %llu %llu",
+					(unsigned long long)hist_pct(&tinfo[i].lat, 0.5) / 1000,
+					(unsigned long long)hist_pct(&tinfo[i].lat, 0.99) / 1000);
+		fprintf(out, "\n");
+		fclose(out);
+	}
+
 	return 0;
 }